@@ -0,0 +1,114 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_BATCH_H
+#define FLB_BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <fluent-bit/flb_time.h>
+
+/*
+ * Columnar view of a chunk of [time, map] records: a vector with the
+ * time of every record (row) plus one typed vector per top level map key
+ * (column), so a computation over a field runs on a plain array instead
+ * of walking the records one by one.
+ *
+ * A row where the key is missing or nil is not set in the column 'valid'
+ * bitmap. Integer columns with float values become double columns, other
+ * mixes of types, maps and arrays are kept as the encoded value (RAW).
+ * Strings and RAW values point to the records buffer, the batch can't
+ * outlive it. Outputs get the one of their task with flb_task_batch().
+ */
+
+#define FLB_BATCH_NULL     0    /* nil values only             */
+#define FLB_BATCH_INT      1    /* int64_t                     */
+#define FLB_BATCH_DOUBLE   2    /* double                      */
+#define FLB_BATCH_BOOL     3    /* uint8_t                     */
+#define FLB_BATCH_STR      4    /* string or binary view       */
+#define FLB_BATCH_RAW      5    /* encoded MessagePack value   */
+
+struct flb_batch_view {
+    const char *ptr;
+    size_t len;
+};
+
+struct flb_batch_col {
+    const char *name;           /* key, points to the records */
+    size_t name_len;
+    int type;                   /* FLB_BATCH_ value           */
+    int promoted;               /* has int values as double   */
+    union {
+        int64_t *i64;
+        double *f64;
+        uint8_t *b;
+        struct flb_batch_view *view;
+    } v;
+    uint8_t *valid;             /* bitmap, one bit per row    */
+};
+
+struct flb_batch {
+    int rows;                   /* number of records          */
+    struct flb_time *time;      /* record times               */
+    size_t *sizes;              /* encoded size of records    */
+    int n_cols;
+    int cols_size;              /* allocated columns          */
+    struct flb_batch_col *cols;
+};
+
+/* Aggregation of a numeric column */
+struct flb_batch_stats {
+    int count;                  /* valid rows */
+    double sum;
+    double min;
+    double max;
+};
+
+struct flb_batch *flb_batch_create(char *buf, size_t size);
+void flb_batch_destroy(struct flb_batch *batch);
+struct flb_batch_col *flb_batch_col_get(struct flb_batch *batch,
+                                        const char *name, size_t len);
+
+/* Kernels, 'sel' is an optional bitmap of the rows to consider */
+int flb_batch_time_select(struct flb_batch *batch,
+                          struct flb_time *from, struct flb_time *to,
+                          uint8_t *sel);
+int flb_batch_col_stats(struct flb_batch *batch, struct flb_batch_col *col,
+                        uint8_t *sel, struct flb_batch_stats *stats);
+
+static inline int flb_batch_bit(uint8_t *bitmap, int row)
+{
+    return (bitmap[row >> 3] >> (row & 7)) & 1;
+}
+
+static inline int flb_batch_valid(struct flb_batch_col *col, int row)
+{
+    return flb_batch_bit(col->valid, row);
+}
+
+/* Value of a numeric column as a double */
+static inline double flb_batch_double(struct flb_batch_col *col, int row)
+{
+    if (col->type == FLB_BATCH_INT) {
+        return (double) col->v.i64[row];
+    }
+    return col->v.f64[row];
+}
+
+#endif
@@ -37,6 +37,24 @@
 /* Macros to handle events into Buffering event loops */
 #define FLB_BUFFER_EV_QCHUNK_PUSH  1
 #define FLB_BUFFER_EV_QCHUNK_POP   2
+#define FLB_BUFFER_EV_PAUSE        3
+#define FLB_BUFFER_EV_RESUME       4
+
+/* Policies when the buffer path reach Buffer_Max_Size */
+#define FLB_BUFFER_POLICY_PAUSE        0  /* pause inputs (backpressure) */
+#define FLB_BUFFER_POLICY_DROP_OLDEST  1  /* evict oldest chunks         */
+#define FLB_BUFFER_POLICY_DROP_NEWEST  2  /* do not store new chunks     */
+
+/* Buffer_Mode: how tasks are stored in the buffer path */
+#define FLB_BUFFER_MODE_DISK           0  /* every task is stored        */
+#define FLB_BUFFER_MODE_HYBRID         1  /* store only under pressure   */
+
+/* Hybrid mode defaults */
+#define FLB_BUFFER_MEM_LIMIT     (16 * 1024 * 1024)  /* 16MB  */
+#define FLB_BUFFER_SPILL_AGE     5                   /* seconds */
+
+/* Number of evicted chunk hashes remembered by the quota */
+#define FLB_BUFFER_EVICTED_MAX   1024
 
 /*
  * Each event is an unsigned 32 bit number where it have 3 sections:
@@ -94,10 +112,42 @@ struct flb_buffer {
     char *path;
     int workers_n;             /* total number of workers */
     int worker_lru;            /* Last-Recent-Used worker */
+    int compress;              /* codec for buffer chunks */
     void *qworker;             /* queue chunk nodes  */
     struct flb_config *config; /* Fluent Bit context */
     struct mk_list workers;    /* List of flb_buffer_worker nodes  */
 
+    /*
+     * Disk usage: the counters are updated by the buffer workers every
+     * time a chunk is stored or removed, so the buffer path is never
+     * re-scanned to know it size. The 'chunks' list keeps the stored
+     * chunks in creation order, it's used to evict the oldest ones.
+     * Evicted chunks are moved to 'evicted' (the last ones only), so a
+     * later delete or move of their file is not reported as a failure.
+     */
+    size_t usage;              /* bytes stored in the buffer path  */
+    size_t max_size;           /* Buffer_Max_Size, 0 = no limit    */
+    int policy;                /* Buffer_Max_Policy                */
+    int paused;                /* inputs paused by the buffer ?    */
+    uint64_t evictions;        /* number of chunks dropped         */
+    pthread_mutex_t chunks_mutex;
+    struct mk_list chunks;     /* flb_buffer_entry nodes           */
+    int evicted_n;             /* entries in the 'evicted' list    */
+    struct mk_list evicted;    /* flb_buffer_entry nodes           */
+
+    /*
+     * Hybrid mode: tasks are kept in memory and they are only stored
+     * (spilled) in the buffer path when they are retried, when they get
+     * older than 'spill_age' or when the memory used by not stored tasks
+     * is above 'mem_limit'. The counters are only used from the engine
+     * thread.
+     */
+    int mode;                  /* Buffer_Mode                      */
+    int spill_age;             /* Buffer_Spill_Age (seconds)       */
+    size_t mem_limit;          /* Buffer_Mem_Limit                 */
+    size_t mem_usage;          /* memory of tasks not stored yet   */
+    uint64_t spills;           /* number of tasks stored late      */
+
     /*
      * When the buffering interface through the queue-worker system load
      * some 'buffers' for processing, it needs to instruct the Engine about
@@ -107,6 +157,13 @@ struct flb_buffer {
     struct flb_input_instance *i_ins;
 };
 
+/* Reference to a chunk stored in the buffer path */
+struct flb_buffer_entry {
+    char hash_str[41];      /* chunk hash                  */
+    char *name;             /* chunk filename when created */
+    struct mk_list _head;   /* Link to flb_buffer->chunks  */
+};
+
 /* */
 struct flb_buffer_request {
     int type;
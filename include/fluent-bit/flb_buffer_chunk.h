@@ -32,6 +32,41 @@
 #define FLB_BUFFER_CHUNK_OUTGOING 1
 #define FLB_BUFFER_CHUNK_DEFERRED 3
 
+/*
+ * Compressed buffer chunks: when Buffer_Compress is enabled, the chunk
+ * file starts with a fixed size header followed by the compressed
+ * content. The header is identified by the 0xc1 byte which is never
+ * used by MessagePack, so raw chunks are still loaded as-is:
+ *
+ *   +------+-----+---------+-------+----------------------+
+ *   | 0xc1 | FBC | version | codec | reserved | orig size |
+ *   +------+-----+---------+-------+----------------------+
+ *    1 byte  3 B    1 byte  1 byte   2 bytes   8 bytes (BE)
+ *
+ * Version 2 appends the chunk metadata (struct flb_chunk_meta), so the
+ * content does not need to be scanned when it's loaded back:
+ *
+ *   +---------+----------+---------+--------+-------+-------+
+ *   | records | reserved | t_first | t_last | t_min | t_max |
+ *   +---------+----------+---------+--------+-------+-------+
+ *     4 bytes   4 bytes    8 bytes each, signed (BE)
+ *
+ * Raw chunks have no header: they are sent to outputs straight from the
+ * file, their metadata is rebuilt when they are loaded.
+ *
+ * The 'dict' codec stores the records with their map keys interned (see
+ * flb_dict.h), 'orig size' is the size of the plain records. A chunk with
+ * no repeated keys is stored raw.
+ */
+#define FLB_BUFFER_CHUNK_HDR_SIZE    56
+#define FLB_BUFFER_CHUNK_HDR_V1_SIZE 16
+#define FLB_BUFFER_CHUNK_HDR_VERSION  2
+
+/* Codecs */
+#define FLB_BUFFER_CODEC_NONE  0
+#define FLB_BUFFER_CODEC_ZLIB  1
+#define FLB_BUFFER_CODEC_DICT  2   /* interned map keys, see flb_dict.h */
+
 /* Return values */
 #define FLB_BUFFER_OK            0
 #define FLB_BUFFER_ERROR        -1
@@ -45,6 +80,7 @@ struct flb_buffer_chunk {
     int buf_worker;
     char tmp[128];          /* temporal ref: Tag/output_instance */
     char hash_hex[42];
+    struct flb_chunk_meta meta;
 };
 
 int flb_buffer_chunk_add(struct flb_buffer_worker *worker,
@@ -56,11 +92,17 @@ int flb_buffer_chunk_delete_ref(struct flb_buffer_worker *worker,
 
 int flb_buffer_chunk_push(struct flb_buffer *ctx, void *data,
                           size_t size, char *tag, uint64_t routes,
-                          char *hash_hex);
+                          char *hash_hex, struct flb_chunk_meta *meta);
 
 int flb_buffer_chunk_pop(struct flb_buffer *ctx, int thread_id,
                          struct flb_task *task);
 
+void flb_buffer_chunk_hold(struct flb_buffer *ctx, struct flb_task *task);
+void flb_buffer_chunk_release(struct flb_buffer *ctx, struct flb_task *task);
+int flb_buffer_chunk_spill(struct flb_buffer *ctx, struct flb_task *task);
+void flb_buffer_chunk_spill_check(struct flb_buffer *ctx);
+int flb_buffer_chunk_evicted(struct flb_buffer *ctx, char *hash);
+
 int flb_buffer_chunk_mov(int type, char *name, uint64_t routes,
                          struct flb_buffer_worker *worker);
 
@@ -68,6 +110,13 @@ int flb_buffer_chunk_real_move(struct flb_buffer_worker *worker,
                                struct mk_event *event);
 int flb_buffer_chunk_scan(struct flb_buffer *ctx);
 
+int flb_buffer_chunk_codec(char *name);
+void flb_buffer_chunk_hdr_set(char *buf, int codec, uint64_t size,
+                              struct flb_chunk_meta *meta);
+int flb_buffer_chunk_hdr_get(char *buf, size_t len,
+                             int *codec, uint64_t *size,
+                             size_t *hdr_size, struct flb_chunk_meta *meta);
+
 #endif
 
 #endif /* !FLB_HAVE_BUFFERING */
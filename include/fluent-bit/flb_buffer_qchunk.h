@@ -32,6 +32,14 @@
 #define FLB_BUFFER_QC_PUSH_REQUEST   2  /* external request to push a qchunk */
 #define FLB_BUFFER_QC_POP_REQUEST    3  /* external request to pop a qchunk  */
 #define FLB_BUFFER_QC_PUSH           4  /* qchunk ready, push done           */
+#define FLB_BUFFER_QC_EVICT          5  /* drop queued qchunks evicted       */
+
+/* qchunk IDs: 14 bits, zero is reserved for 'not loaded' */
+#define FLB_BUFFER_QC_ID_MAX     ((1 << 14) - 1)
+#define FLB_BUFFER_QC_MAP_WORDS  ((FLB_BUFFER_QC_ID_MAX + 1) / 64)
+
+/* Default limit of qchunk bytes mapped in memory at the same time */
+#define FLB_BUFFER_QC_MMAP_LIMIT (64 * 1024 * 1024)
 
 /*
  * A queue chunk (qchunk) represents a buffer chunk that resides in the
@@ -41,11 +49,15 @@
  */
 struct flb_buffer_qchunk {
     uint16_t id;               /* qchunk id (max = (1<<14) - 1         */
+    int fd;                    /* open file while loaded (no codec)    */
     char *file_path;           /* Absolute path to source buffer chunk */
     char *tag;                 /* Tag (offset of file_path position)   */
     uint64_t routes;           /* All pending destinations             */
-    char *data;                /* chunk data, after mmap(2)            */
+    char *data;                /* chunk data, mmap(2) or uncompressed  */
     size_t size;               /* data size                            */
+    int codec;                 /* chunk codec, FLB_BUFFER_CODEC_*      */
+    size_t hdr_size;           /* compressed chunk header size         */
+    struct flb_chunk_meta meta;/* records summary, set once loaded     */
     char hash_str[41];         /* buffer hash (taken from filename     */
     struct mk_list _head;      /* Link to buffer head at ctx->queue    */
 };
@@ -57,6 +69,19 @@ struct flb_buffer_qworker {
     int ch_manager[2];         /* channel to signal worker */
     struct mk_event_loop *evl; /* event loop               */
     struct mk_list queue;      /* chunks queue             */
+
+    /*
+     * Loaded qchunks: every qchunk pushed to the engine holds an ID and
+     * a mmap(2) of its content (or the uncompressed copy) until it's
+     * popped. IDs are allocated from a bitmap and resolved through a
+     * direct lookup table, the amount of loaded bytes is bounded by
+     * 'mmap_limit'.
+     */
+    size_t mmap_size;          /* bytes currently mapped   */
+    size_t mmap_limit;         /* max bytes to be mapped   */
+    int id_hint;               /* first bitmap word to check */
+    uint64_t id_map[FLB_BUFFER_QC_MAP_WORDS];
+    struct flb_buffer_qchunk *id_table[FLB_BUFFER_QC_ID_MAX + 1];
 };
 
 int flb_buffer_qchunk_signal(uint64_t type, uint64_t val,
@@ -65,7 +90,8 @@ int flb_buffer_qchunk_signal(uint64_t type, uint64_t val,
 struct flb_buffer_qchunk *flb_buffer_qchunk_add(struct flb_buffer_qworker *qw,
                                                 char *path, uint64_t routes,
                                                 char *tag, char *hash_str);
-int flb_buffer_qchunk_delete(struct flb_buffer_qchunk *qchunk);
+int flb_buffer_qchunk_delete(struct flb_buffer_qworker *qw,
+                             struct flb_buffer_qchunk *qchunk);
 
 int flb_buffer_qchunk_create(struct flb_buffer *ctx);
 void flb_buffer_qchunk_destroy(struct flb_buffer *ctx);
@@ -74,6 +100,7 @@ int flb_buffer_qchunk_start(struct flb_buffer *ctx);
 int flb_buffer_qchunk_stop(struct flb_buffer *ctx);
 
 int flb_buffer_qchunk_push(struct flb_buffer *ctx, int id);
+int flb_buffer_qchunk_fd(struct flb_buffer *ctx, int id, int *fd);
 
 #endif
 #endif
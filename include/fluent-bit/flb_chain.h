@@ -0,0 +1,73 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_CHAIN_H
+#define FLB_CHAIN_H
+
+#include <sys/uio.h>
+#include <mk_core.h>
+#include <msgpack.h>
+
+/*
+ * Chained buffer: the data is appended to a list of blocks instead of a
+ * single area that grows with realloc(3), so appending never moves what
+ * is already stored. The first block of a chain is small and every new
+ * one doubles the size of the previous one up to FLB_CHAIN_BLOCK_MAX, a
+ * chain holding a few records does not pin a large block. Released blocks
+ * go back to a process wide pool, one list per block size, to be reused
+ * by the next writer.
+ *
+ * It can be the target of a msgpack_packer (flb_chain_packer_init()), it's
+ * read as an iovec list or copied once into a contiguous buffer when the
+ * consumer needs one (flb_chain_flatten()).
+ */
+
+#define FLB_CHAIN_BLOCK_MIN    4096    /* data bytes of a first block  */
+#define FLB_CHAIN_BLOCK_MAX    65536   /* data bytes of a large block  */
+#define FLB_CHAIN_POOL_MAX     32      /* free blocks kept per size    */
+
+struct flb_chain_block {
+    size_t len;                        /* bytes used      */
+    size_t size;                       /* bytes available */
+    struct mk_list _head;
+    char data[];
+};
+
+struct flb_chain {
+    size_t size;                       /* total bytes          */
+    size_t mem;                        /* bytes of the blocks  */
+    int count;                         /* number of blocks     */
+    struct mk_list blocks;
+};
+
+void flb_chain_init(struct flb_chain *chain);
+int flb_chain_write(void *data, const char *buf, size_t len);
+void flb_chain_move(struct flb_chain *dst, struct flb_chain *src);
+int flb_chain_iov(struct flb_chain *chain, struct iovec *iov, int n);
+char *flb_chain_flatten(struct flb_chain *chain);
+void flb_chain_reset(struct flb_chain *chain);
+void flb_chain_pool_exit();
+
+static inline void flb_chain_packer_init(msgpack_packer *pck,
+                                         struct flb_chain *chain)
+{
+    msgpack_packer_init(pck, chain, flb_chain_write);
+}
+
+#endif
@@ -39,6 +39,14 @@
 #define FLB_CONFIG_HTTP_PORT    "2020"
 #define FLB_CONFIG_DEFAULT_TAG  "fluent_bit"
 
+/* Upstream keepalive defaults */
+#define FLB_CONFIG_KA_IDLE_TIMEOUT  30  /* seconds */
+#define FLB_CONFIG_KA_MAX_REQUESTS  0   /* unlimited */
+#define FLB_CONFIG_KA_POOL_SIZE     8   /* idle connections per upstream */
+
+/* Max seconds for a network operation (connect, write, read) */
+#define FLB_CONFIG_NET_IO_TIMEOUT   30
+
 /* Property configuration: key/value for an input/output instance */
 struct flb_config_prop {
     char *key;
@@ -108,6 +116,25 @@ struct flb_config {
     /* Workers: threads spawn using flb_worker_create() */
     struct mk_list workers;
 
+    /* Upstream connections keepalive */
+    int net_keepalive;              /* reuse upstream connections ?  */
+    int net_keepalive_idle_timeout; /* max idle seconds in the pool  */
+    int net_keepalive_max_requests; /* max uses of a connection      */
+    int net_keepalive_pool_size;    /* max idle connections per upstream */
+
+    /* Upstream network operations timeout */
+    int net_io_timeout;             /* seconds, 0 = no timeout       */
+    int net_timer_fd;               /* timer to check the deadlines  */
+    struct mk_event event_net_timer;
+    struct mk_list upstreams;       /* list of flb_upstream          */
+
+    /* DNS resolver for upstream host names */
+    struct flb_dns *dns;
+    char *dns_server;               /* 'ip[:port]', else resolv.conf */
+    int dns_timeout;                /* seconds to resolve a name     */
+    int dns_max_ttl;                /* max seconds to cache a record */
+    int dns_negative_ttl;           /* seconds to cache a miss       */
+
     /* HTTP Server */
 #ifdef FLB_HAVE_HTTP
     int http_server;
@@ -119,6 +146,13 @@ struct flb_config {
     struct flb_buffer *buffer_ctx;
     int buffer_workers;
     char *buffer_path;
+    char *buffer_mmap_limit;  /* max bytes of qchunks mapped in memory */
+    char *buffer_compress;    /* codec used to store buffer chunks     */
+    char *buffer_max_size;    /* max bytes stored in the buffer path   */
+    char *buffer_max_policy;  /* what to do when max size is reached   */
+    char *buffer_mode;        /* 'disk' or 'hybrid' chunk storage      */
+    char *buffer_mem_limit;   /* hybrid: max bytes kept only in memory */
+    int buffer_spill_age;     /* hybrid: seconds before a task spills  */
 #endif
 
     /*
@@ -153,6 +187,15 @@ enum conf_type {
 #define FLB_CONF_STR_DAEMON   "Daemon"
 #define FLB_CONF_STR_LOGFILE  "Logfile"
 #define FLB_CONF_STR_LOGLEVEL "Log_Level"
+#define FLB_CONF_STR_NET_KA              "Net_Keepalive"
+#define FLB_CONF_STR_NET_KA_IDLE_TIMEOUT "Net_Keepalive_Idle_Timeout"
+#define FLB_CONF_STR_NET_KA_MAX_REQUESTS "Net_Keepalive_Max_Requests"
+#define FLB_CONF_STR_NET_KA_POOL_SIZE    "Net_Keepalive_Pool_Size"
+#define FLB_CONF_STR_NET_IO_TIMEOUT      "Net_IO_Timeout"
+#define FLB_CONF_STR_DNS_SERVER          "DNS_Server"
+#define FLB_CONF_STR_DNS_TIMEOUT         "DNS_Timeout"
+#define FLB_CONF_STR_DNS_MAX_TTL         "DNS_Max_TTL"
+#define FLB_CONF_STR_DNS_NEGATIVE_TTL    "DNS_Negative_TTL"
 #ifdef FLB_HAVE_HTTP
 #define FLB_CONF_STR_HTTP_MONITOR "HTTP_Monitor"
 #define FLB_CONF_STR_HTTP_PORT    "HTTP_Port"
@@ -160,6 +203,13 @@ enum conf_type {
 #ifdef FLB_HAVE_BUFFERING
 #define FLB_CONF_STR_BUF_PATH     "Buffer_Path"
 #define FLB_CONF_STR_BUF_WORKERS  "Buffer_Workers"
+#define FLB_CONF_STR_BUF_MMAP_LIMIT "Buffer_Mmap_Limit"
+#define FLB_CONF_STR_BUF_COMPRESS   "Buffer_Compress"
+#define FLB_CONF_STR_BUF_MAX_SIZE   "Buffer_Max_Size"
+#define FLB_CONF_STR_BUF_MAX_POLICY "Buffer_Max_Policy"
+#define FLB_CONF_STR_BUF_MODE       "Buffer_Mode"
+#define FLB_CONF_STR_BUF_MEM_LIMIT  "Buffer_Mem_Limit"
+#define FLB_CONF_STR_BUF_SPILL_AGE  "Buffer_Spill_Age"
 #endif /*FLB_HAVE_BUFFERING*/
 
 
@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_DICT_H
+#define FLB_DICT_H
+
+#include <stddef.h>
+
+/*
+ * Dictionary encoded chunks: records with the same schema repeat the same
+ * map keys over and over (e.g: 'cpu0.p_cpu' on every in_cpu sample). The
+ * encoder interns the keys found more than once in a chunk and writes
+ * them just once, in a table at the beginning, the maps refer to them by
+ * index:
+ *
+ *   ext(FLB_DICT_EXT_TABLE, [key, key, ...]) record record ...
+ *
+ * where every interned map key is replaced by ext(FLB_DICT_EXT_KEY, index),
+ * an index of 1 or 2 bytes (big endian). The rest of the records content
+ * is not modified.
+ *
+ * Encoded chunks are an internal format, flb_dict_decode() expands them
+ * back to plain MessagePack before they reach the plugins.
+ */
+
+#define FLB_DICT_EXT_TABLE    1       /* keys table, first object    */
+#define FLB_DICT_EXT_KEY      2       /* reference to a table entry  */
+
+#define FLB_DICT_KEY_MIN      4       /* shorter keys are not worth  */
+#define FLB_DICT_MAX      65535       /* max entries in a table      */
+
+int flb_dict_encode(char *buf, size_t size, char **out_buf, size_t *out_size);
+int flb_dict_decode(char *buf, size_t size, char **out_buf, size_t *out_size);
+
+#endif
@@ -0,0 +1,100 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_DNS_H
+#define FLB_DNS_H
+
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include <mk_core.h>
+#include <fluent-bit/flb_info.h>
+
+#define FLB_DNS_PORT           53
+#define FLB_DNS_TIMEOUT        5     /* seconds to resolve a name          */
+#define FLB_DNS_MAX_TTL        300   /* max seconds a record is cached     */
+#define FLB_DNS_NEGATIVE_TTL   10    /* seconds a missing name is cached   */
+#define FLB_DNS_MAX_SEARCH     6     /* 'search' domains from resolv.conf  */
+#define FLB_DNS_PACKET_SIZE    512   /* max UDP message size (RFC 1035)    */
+
+/* Lookup results */
+#define FLB_DNS_OK             0
+#define FLB_DNS_NOTFOUND       1
+
+struct flb_thread;
+struct flb_config;
+struct flb_upstream_conn;
+
+/* Cached result for a host name */
+struct flb_dns_entry {
+    char *name;
+    int status;               /* FLB_DNS_OK or FLB_DNS_NOTFOUND */
+    struct in_addr addr;
+    time_t expire;
+    struct mk_list _head;
+};
+
+/*
+ * A query waiting for an answer inside a co-routine. The engine timer
+ * retransmits it every second and resumes the co-routine once the
+ * deadline is reached.
+ */
+struct flb_dns_query {
+    int fd;
+    int expired;
+    time_t ts_retry;
+    time_t deadline;
+    size_t size;
+    unsigned char packet[FLB_DNS_PACKET_SIZE];
+    struct flb_upstream_conn *u_conn;
+    struct mk_list _head;
+};
+
+struct flb_dns {
+    struct sockaddr_in server;
+    int timeout;
+    int max_ttl;
+    int negative_ttl;
+
+    /* resolv.conf: search domains and the 'ndots' option */
+    int ndots;
+    int n_search;
+    char *search[FLB_DNS_MAX_SEARCH];
+
+    int rand_fd;              /* /dev/urandom, query IDs      */
+    uint64_t hits;
+    uint64_t misses;
+
+    struct mk_list entries;   /* cache, list of flb_dns_entry  */
+    struct mk_list queries;   /* pending co-routine queries    */
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_t mutex;
+#endif
+};
+
+struct flb_dns *flb_dns_create(struct flb_config *config);
+void flb_dns_destroy(struct flb_dns *dns);
+int flb_dns_resolve(struct flb_dns *dns, struct flb_upstream_conn *u_conn,
+                    struct flb_thread *th, char *host, struct in_addr *addr);
+int flb_dns_timeouts(struct flb_dns *dns);
+
+#endif
@@ -34,5 +34,6 @@ int flb_engine_dispatch_direct(uint64_t id,
                                char *buf, size_t size,
                                char *tag, uint64_t routes,
                                char *hash_str,
+                               struct flb_chunk_meta *meta,
                                struct flb_config *config);
 #endif
@@ -24,7 +24,12 @@
 #include <fluent-bit/flb_upstream.h>
 
 /* Buffer size */
-#define FLB_HTTP_BUF_SIZE 2048
+#define FLB_HTTP_BUF_SIZE       2048
+#define FLB_HTTP_DATA_SIZE      4096           /* initial response buffer */
+#define FLB_HTTP_DATA_SIZE_MAX  (64 * 1024)    /* larger bodies are dropped */
+
+/* Max number of requests waiting for a response on a connection */
+#define FLB_HTTP_PIPELINE_MAX   16
 
 /* HTTP Methods */
 #define FLB_HTTP_GET         0
@@ -37,11 +42,42 @@
 #define FLB_HTTP_PROXY_HTTP       1
 #define FLB_HTTP_PROXY_HTTPS      2
 
+/* Response parser states */
+#define FLB_HTTP_RESP_STATUS      0   /* status line                    */
+#define FLB_HTTP_RESP_HEADERS     1   /* header lines                   */
+#define FLB_HTTP_RESP_BODY        2   /* body with a Content-Length     */
+#define FLB_HTTP_RESP_CHUNK_SIZE  3   /* chunked: size line             */
+#define FLB_HTTP_RESP_CHUNK_DATA  4   /* chunked: data                  */
+#define FLB_HTTP_RESP_CHUNK_END   5   /* chunked: CRLF after the data   */
+#define FLB_HTTP_RESP_TRAILER     6   /* chunked: trailer headers       */
+#define FLB_HTTP_RESP_EOF         7   /* body ends when the peer closes */
+#define FLB_HTTP_RESP_DONE        8
+
+/*
+ * The response is parsed incrementally as data arrives. Bytes that follow
+ * a complete response belong to the next pipelined request and are kept
+ * in the buffer until that response is read.
+ */
 struct flb_http_response {
     int status;
-    int content_length;
-    char  data[1024 * 4];   /* 4 KB */
+    int64_t content_length; /* -1 if not set */
+    int chunked;
+    int keepalive;          /* connection can be reused after it */
+    int truncated;          /* body did not fit, the tail was dropped */
+
+    /* raw data read from the connection */
+    char *data;
     size_t data_len;
+    size_t data_size;
+
+    /* response body, chunked bodies are decoded in place */
+    char *payload;
+    size_t payload_size;
+
+    /* parser state */
+    int state;
+    size_t pos;             /* offset of the first unparsed byte */
+    size_t left;            /* body or chunk bytes still expected */
 };
 
 /* It hold information about a possible HTTP proxy set by the caller */
@@ -51,7 +87,21 @@ struct flb_http_proxy {
     char *host;             /* Proxy Host */
 };
 
-/* Set a request type */
+/*
+ * Headers that are the same on every request of an output instance, they
+ * are formatted once when the plugin starts and copied as a block.
+ */
+struct flb_http_headers {
+    int len;
+    int size;
+    char *buf;
+};
+
+/*
+ * A client is bound to an upstream connection: it's created on the first
+ * request and reused by the next ones while the connection lives, its
+ * buffers are released when the connection is destroyed.
+ */
 struct flb_http_client {
     /* Upstream connection */
     struct flb_upstream_conn *u_conn;
@@ -65,6 +115,19 @@ struct flb_http_client {
     int body_len;
     char *body_buf;
 
+    /* Target of the request, used when going through a proxy */
+    char *host;
+    int port;
+
+    /* 'Host' and 'Connection' headers of the connection, formatted once */
+    int host_len;
+    char *host_buf;
+
+    /* Pipelining: methods of the requests waiting for a response */
+    int pending;
+    int p_head;
+    int pipeline[FLB_HTTP_PIPELINE_MAX];
+
     /* Proxy */
     struct flb_http_proxy proxy;
 
@@ -77,11 +140,25 @@ struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
                                         char *body, size_t body_len,
                                         char *host, int port,
                                         char *proxy);
+int flb_http_request(struct flb_http_client *c, int method, char *uri,
+                     char *body, size_t body_len);
 
 int flb_http_add_header(struct flb_http_client *c,
                         char *key, size_t key_len,
                         char *val, size_t val_len);
+int flb_http_add_headers(struct flb_http_client *c,
+                         struct flb_http_headers *h);
+
+int flb_http_send(struct flb_http_client *c, size_t *bytes);
+int flb_http_response(struct flb_http_client *c);
 int flb_http_do(struct flb_http_client *c, size_t *bytes);
 void flb_http_client_destroy(struct flb_http_client *c);
+void flb_http_client_free(struct flb_http_client *c);
+
+struct flb_http_headers *flb_http_headers_create();
+int flb_http_headers_add(struct flb_http_headers *h,
+                         char *key, size_t key_len,
+                         char *val, size_t val_len);
+void flb_http_headers_destroy(struct flb_http_headers *h);
 
 #endif
@@ -27,6 +27,9 @@
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_str.h>
 #include <fluent-bit/flb_bits.h>
+#include <fluent-bit/flb_record.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_chain.h>
 #include <msgpack.h>
 
 #include <inttypes.h>
@@ -75,6 +78,13 @@ struct flb_input_plugin {
     /* Flush a buffer type (raw data) */
     void *(*cb_flush_buf) (void *, size_t *);
 
+    /*
+     * Flush a chained buffer: the plugin moves its blocks to the chain
+     * given by the engine (flb_chain_move()), no copy is involved. It's
+     * used instead of cb_flush_buf when set.
+     */
+    void (*cb_flush_chain) (void *, struct flb_chain *);
+
     /* Notify that a flush have completed on the collector (buf + iov) */
     void (*cb_flush_end) (void *);
 
@@ -106,8 +116,9 @@ struct flb_input_dyntag {
     char *tag;
 
     /* MessagePack */
-    struct msgpack_sbuffer mp_sbuf; /* msgpack sbuffer */
+    struct flb_chain chain;         /* packed records  */
     struct msgpack_packer mp_pck;   /* msgpack packer  */
+    struct flb_chunk_meta meta;     /* buffer summary  */
 
     /* Link to parent list on flb_input_instance */
     struct mk_list _head;
@@ -126,6 +137,7 @@ struct flb_input_instance {
     int id;                              /* instance id                  */
     int channel[2];                      /* pipe(2) channel              */
     int threaded;                        /* bool / Threaded instance ?   */
+    int intern_keys;                     /* dict encode idle tasks ?     */
     char name[16];                       /* numbered name (cpu -> cpu.0) */
     void *context;                       /* plugin configuration context */
     struct flb_input_plugin *p;          /* original plugin              */
@@ -162,6 +174,14 @@ struct flb_input_instance {
     int stats_fd;
 #endif
 
+    /*
+     * Summary of the records in the plugin buffer: plugins that track it
+     * call flb_chunk_meta_add() on every record they append, the engine
+     * takes it with the buffer on flush. Otherwise it's built with a scan
+     * when the task is created.
+     */
+    struct flb_chunk_meta meta;
+
     struct mk_list _head;                /* link to config->inputs     */
     struct mk_list routes;               /* flb_router_path's list     */
     struct mk_list dyntags;              /* dyntag nodes               */
@@ -178,6 +198,7 @@ struct flb_input_instance {
 
 struct flb_input_collector {
     int type;                            /* collector type             */
+    int paused;                          /* removed from the event loop */
 
     /* FLB_COLLECT_FD_EVENT */
     int fd_event;                        /* fd being watched           */
@@ -189,6 +210,7 @@ struct flb_input_collector {
 
     /* Callback */
     int (*cb_collect) (struct flb_config *, void *);
+    void *context;                       /* callback data (optional)   */
 
     struct mk_event event;
 
@@ -197,6 +219,19 @@ struct flb_input_collector {
     struct mk_list _head;                /* link to list of collectors */
 };
 
+/*
+ * Data given to the collector callback: its own context if it was set with
+ * flb_input_set_collector_context(), the instance context otherwise.
+ */
+static FLB_INLINE
+void *flb_input_collector_context(struct flb_input_collector *coll)
+{
+    if (coll->context) {
+        return coll->context;
+    }
+    return coll->instance->context;
+}
+
 struct flb_input_thread {
     int id;                      /* ID obtained from config->in_table_id */
     time_t start_time;           /* start time  */
@@ -309,7 +344,7 @@ struct flb_thread *flb_input_thread_collect(struct flb_input_collector *coll,
     makecontext(&th->callee, (void (*)()) coll->cb_collect,
                 2,                          /* number of arguments */
                 config,
-                coll->instance->context);
+                flb_input_collector_context(coll));
 
     return th;
 
@@ -344,7 +379,7 @@ static void input_pre_cb_collect()
     struct flb_thread *th     = libco_in_param.th;
 
     co_switch(th->caller);
-    coll->cb_collect(config, coll->instance->context);
+    coll->cb_collect(config, flb_input_collector_context(coll));
 }
 
 static FLB_INLINE
@@ -369,7 +404,7 @@ struct flb_thread *flb_input_thread_collect(struct flb_input_collector *coll,
 #endif
 
     /* Set parameters */
-    input_params_set(th, coll, config, coll->instance->context);
+    input_params_set(th, coll, config, flb_input_collector_context(coll));
     return th;
 }
 
@@ -441,6 +476,9 @@ int flb_input_set_collector_socket(struct flb_input_instance *in,
                                    int (*cb_new_connection) (struct flb_config *, void*),
                                    int fd,
                                    struct flb_config *config);
+int flb_input_set_collector_context(struct flb_input_instance *in,
+                                    int fd, void *context,
+                                    struct flb_config *config);
 void flb_input_initialize_all(struct flb_config *config);
 void flb_input_pre_run_all(struct flb_config *config);
 void flb_input_exit_all(struct flb_config *config);
@@ -452,10 +490,14 @@ int flb_input_dyntag_destroy(struct flb_input_dyntag *dt);
 int flb_input_dyntag_append(struct flb_input_instance *in,
                             char *tag, size_t tag_len,
                             msgpack_object data);
-void *flb_input_dyntag_flush(struct flb_input_dyntag *dt, size_t *size);
+void flb_input_dyntag_flush(struct flb_input_dyntag *dt,
+                            struct flb_chain *chain,
+                            struct flb_chunk_meta *meta);
 void flb_input_dyntag_exit(struct flb_input_instance *in);
 
 int flb_input_collector_fd(int fd, struct flb_config *config);
+void flb_input_pause_all(struct flb_config *config);
+void flb_input_resume_all(struct flb_config *config);
 
 /* input thread */
 //int flb_input_thread_get_id(struct flb_config *config);
@@ -49,15 +49,41 @@ struct flb_tls_session {
     struct mbedtls_ssl_config conf;
 };
 
+/* Handshake counters, times in microseconds */
+struct flb_tls_stats {
+    uint64_t full;
+    uint64_t resumed;
+    uint64_t failed;
+    uint64_t usec_full;
+    uint64_t usec_resumed;
+};
+
+/*
+ * Session saved by an upstream after a handshake, the next connections
+ * offer it (session ticket or ID) to do an abbreviated handshake.
+ */
+struct flb_tls_resume {
+    int set;                       /* 'session' is valid             */
+    mbedtls_ssl_session session;
+    struct flb_tls_stats stats;
+};
+
 /* TLS instance, library context + active sessions */
 struct flb_tls {
     struct flb_tls_context *context;
+    int session_resume;            /* resume sessions (default: true) */
 };
 
-struct flb_tls_context *flb_tls_context_new();
+struct flb_upstream;
+
+struct flb_tls_context *flb_tls_context_new(int verify,
+                                            char *ca_file, char *crt_file,
+                                            char *key_file, char *key_passwd);
 void flb_tls_context_destroy(struct flb_tls_context *ctx);
 int flb_tls_session_destroy(struct flb_tls_session *session);
 int net_io_tls_handshake(void *u_conn, void *th);
+void flb_tls_resume_destroy(struct flb_tls_resume *resume);
+void flb_tls_stats_get(struct flb_upstream *u, struct flb_tls_stats *stats);
 
 #endif /* FLB_HAVE_TLS */
 #endif
@@ -34,10 +34,50 @@ struct flb_net_host {
     struct flb_uri *uri;   /* Extra URI parameters */
 };
 
+/*
+ * Client side socket tuning, set from the output 'net.*' properties and
+ * applied to every upstream connection before connect(2).
+ */
+#define FLB_NET_CONGESTION_SIZE  16   /* TCP_CA_NAME_MAX */
+
+struct flb_net_setup {
+    int tcp_fastopen;      /* TCP Fast Open on connect                */
+    int sndbuf;            /* SO_SNDBUF bytes, 0 = system default     */
+    int rcvbuf;            /* SO_RCVBUF bytes, 0 = system default     */
+    int keepalive;         /* SO_KEEPALIVE                            */
+    int keepalive_time;    /* TCP_KEEPIDLE seconds, 0 = default       */
+    int keepalive_interval;/* TCP_KEEPINTVL seconds, 0 = default      */
+    int keepalive_probes;  /* TCP_KEEPCNT, 0 = default                */
+    int linger;            /* SO_LINGER seconds, -1 = disabled        */
+    char congestion[FLB_NET_CONGESTION_SIZE]; /* TCP_CONGESTION name  */
+    size_t zerocopy;       /* MSG_ZEROCOPY for writes >= bytes, 0 = off */
+};
+
+/* Default 'net.zerocopy' threshold, smaller writes are cheaper to copy */
+#define FLB_NET_ZEROCOPY_MIN     65536
+
+/*
+ * Max number of SO_REUSEPORT listeners per input instance. They are all
+ * served by the engine event loop: more than one splits the accept queue,
+ * it does not accept connections in parallel.
+ */
+#define FLB_NET_LISTENERS_MAX   16
+
+/* Max connections accepted per listener on each wakeup */
+#define FLB_NET_ACCEPT_BATCH    64
+
 #ifndef TCP_FASTOPEN
 #define TCP_FASTOPEN  23
 #endif
 
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT  30
+#endif
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY  60
+#endif
+
 /* Generic functions */
 int flb_net_host_set(char *plugin_name, struct flb_net_host *host, char *address);
 
@@ -46,15 +86,31 @@ int flb_net_socket_reset(int sockfd);
 int flb_net_socket_tcp_nodelay(int sockfd);
 int flb_net_socket_nonblocking(int sockfd);
 int flb_net_socket_tcp_fastopen(int sockfd);
+int flb_net_socket_reuseport(int sockfd);
+int flb_net_socket_tcp_fastopen_connect(int sockfd);
+int flb_net_socket_zerocopy(int sockfd);
+void flb_net_setup_init(struct flb_net_setup *net);
+int flb_net_socket_setup(int sockfd, struct flb_net_setup *net);
+
+/*
+ * A listening socket and the input context it belongs to, the collector
+ * context of the socket: its callback drains only this accept queue.
+ */
+struct flb_net_listener {
+    int fd;
+    void *ctx;
+};
 
 /* Socket handling */
 int flb_net_socket_create(int family, int nonblock);
 int flb_net_tcp_connect(char *host, unsigned long port);
 int flb_net_tcp_fd_connect(int fd, char *host, unsigned long port);
 int flb_net_server(char *port, char *listen_addr);
+int flb_net_server_listeners(char *port, char *listen_addr, int *fds, int n);
 int flb_net_bind(int socket_fd, const struct sockaddr *addr,
                  socklen_t addrlen, int backlog);
 int flb_net_accept(int server_fd);
+int flb_net_accept_batch(int server_fd, int *fds, int size);
 int flb_net_socket_ip_str(int socket_fd, char **buf, int size, unsigned long *len);
 
 #endif
@@ -39,6 +39,7 @@
 
 /* Output plugin masks */
 #define FLB_OUTPUT_NET          32  /* output address may set host and port */
+#define FLB_OUTPUT_IOV          64  /* takes the task chain, data is NULL   */
 #define FLB_OUTPUT_PLUGIN_CORE   0
 #define FLB_OUTPUT_PLUGIN_PROXY  1
 
@@ -83,7 +84,11 @@ struct flb_output_plugin {
     /* Pre run */
     int (*cb_pre_run) (void *, struct flb_config *);
 
-    /* Flush callback */
+    /*
+     * Flush callback: records buffer and size. A plugin registered with
+     * FLB_OUTPUT_IOV may get a NULL buffer, the records are then in the
+     * blocks of flb_output_task()->chain.
+     */
     void (*cb_flush) (void *, size_t,
                       char *, int,
                       struct flb_input_instance *,
@@ -494,6 +499,21 @@ static inline void flb_output_return_do(int x)
     flb_output_return_do(x);                                            \
     return
 
+/*
+ * Task being flushed by the calling output thread, it gives access to the
+ * encodings shared with the other routes, see flb_task_encoding().
+ */
+static inline struct flb_task *flb_output_task()
+{
+    struct flb_thread *th;
+    struct flb_output_thread *out_th;
+
+    th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+    out_th = (struct flb_output_thread *) FLB_THREAD_DATA(th);
+
+    return out_th->task;
+}
+
 struct flb_output_instance *flb_output_new(struct flb_config *config,
                                            char *output, void *data);
 
@@ -505,4 +525,8 @@ void flb_output_exit(struct flb_config *config);
 void flb_output_set_context(struct flb_output_instance *ins, void *context);
 int flb_output_init(struct flb_config *config);
 int flb_output_check(struct flb_config *config);
+int flb_output_chunk_fd(void *data, size_t bytes, int *fd, off_t *offset);
+char *flb_output_thread_tag();
+int flb_output_upstream_set(struct flb_upstream *u,
+                            struct flb_output_instance *ins);
 #endif
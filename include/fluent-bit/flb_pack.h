@@ -20,17 +20,23 @@
 #ifndef FLB_PACK_H
 #define FLB_PACK_H
 
-#include <jsmn/jsmn.h>
+#include <fluent-bit/flb_pack_json.h>
+#include <fluent-bit/flb_record.h>
+
+/* JSON output layout, see flb_msgpack_to_json() */
+#define FLB_JSON_FORMAT_ARRAY  0    /* [{...},{...}]          */
+#define FLB_JSON_FORMAT_LINES  1    /* {...}\n{...}\n         */
+
+/* JSON output flags */
+#define FLB_JSON_NODOTS        1    /* '.' in map keys becomes '_' */
 
 struct flb_pack_state {
-    int multiple;         /* support multiple jsons? */
-    int tokens_count;     /* number of parsed tokens */
-    int tokens_size;      /* array size of tokens    */
-    jsmntok_t *tokens;    /* tokens array            */
-    jsmn_parser parser;   /* parser state            */
+    int last_byte;              /* end of the last packed message */
+    struct flb_pack_json pj;    /* resumable JSON parser          */
 };
 
 int flb_pack_json(char *js, size_t len, char **buffer, int *size);
+int flb_pack_json_jsmn(char *js, size_t len, char **buffer, int *size);
 int flb_pack_state_init(struct flb_pack_state *s);
 void flb_pack_state_reset(struct flb_pack_state *s);
 
@@ -40,4 +46,16 @@ int flb_pack_json_state(char *js, size_t len,
 
 void flb_pack_print(char *data, size_t bytes);
 
+int flb_msgpack_to_json(msgpack_sbuffer *out, char *data, size_t bytes,
+                        int format, char *date_key, int flags);
+int flb_msgpack_to_json_record(msgpack_sbuffer *out, struct flb_record *rec,
+                               char *date_key, int flags);
+int flb_msgpack_to_json_fields(msgpack_sbuffer *out, struct flb_record *rec,
+                               int first, int flags);
+int flb_msgpack_to_json_value(msgpack_sbuffer *out, char *data, size_t size,
+                              int flags);
+int flb_msgpack_to_json_str(msgpack_sbuffer *out, char *str, size_t len,
+                            int flags);
+int flb_msgpack_to_json_time(msgpack_sbuffer *out, msgpack_object *o);
+
 #endif
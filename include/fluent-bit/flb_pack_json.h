@@ -0,0 +1,86 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_PACK_JSON_H
+#define FLB_PACK_JSON_H
+
+#include <stdint.h>
+#include <msgpack.h>
+
+/*
+ * JSON to MessagePack packer based on a structural index: a first pass
+ * locates the quotes and the {}[]:, characters outside of strings 64 bytes
+ * at a time (AVX2 or SSE4.2 when the CPU has them), a second pass walks
+ * that index checking the grammar and writes MessagePack straight to the
+ * caller buffer. Both passes can stop at the end of the available data and
+ * resume there when more arrives, see flb_pack_json_stream().
+ */
+
+#define FLB_PACK_JSON_DEPTH   256     /* max nesting level */
+
+/* Scanner in use, see flb_pack_json_simd() */
+#define FLB_PACK_JSON_SCALAR  0
+#define FLB_PACK_JSON_SSE42   1
+#define FLB_PACK_JSON_AVX2    2
+
+/* An open map or array */
+struct flb_pack_json_level {
+    size_t offset;                    /* header position in the output */
+    uint32_t count;                   /* entries found so far          */
+    char type;                        /* '{' or '['                    */
+};
+
+struct flb_pack_json {
+    /* offsets of the structural characters */
+    uint32_t *index;
+    size_t index_len;
+    size_t index_size;
+
+    int simd;                         /* FLB_PACK_JSON_ scanner */
+
+    /*
+     * Scanner state: bytes before 'scan_off' are indexed by 'scan_len'
+     * entries, a partial block at the end is indexed again on the next
+     * call once more data is available.
+     */
+    size_t scan_off;
+    size_t scan_len;
+    uint64_t in_string;
+    uint64_t escape;
+
+    /* Walker state, kept between flb_pack_json_stream() calls */
+    int state;
+    int depth;
+    size_t pos;                       /* next index entry to process */
+    size_t gap;                       /* first byte after last token */
+    msgpack_sbuffer out;              /* incomplete record output    */
+    struct flb_pack_json_level stack[FLB_PACK_JSON_DEPTH];
+};
+
+int flb_pack_json_init(struct flb_pack_json *pj);
+void flb_pack_json_reset(struct flb_pack_json *pj);
+void flb_pack_json_destroy(struct flb_pack_json *pj);
+int flb_pack_json_simd();
+int flb_pack_json_buffer(struct flb_pack_json *pj, char *js, size_t len,
+                         msgpack_sbuffer *sbuf, size_t *consumed,
+                         int *records);
+int flb_pack_json_stream(struct flb_pack_json *pj, char *js, size_t len,
+                         char **buffer, int *size, size_t *consumed);
+
+#endif
@@ -0,0 +1,116 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_RECORD_H
+#define FLB_RECORD_H
+
+#include <time.h>
+#include <stdint.h>
+#include <string.h>
+#include <msgpack.h>
+
+/*
+ * Read-only iterator for the [time, map] records of a MessagePack buffer.
+ * Records and map entries are decoded in place, nothing is allocated: a
+ * string or binary view points into the buffer and a nested map or array
+ * only reports its size (via.map.ptr / via.array.ptr are NULL), its
+ * encoded bytes are available to copy it as is.
+ */
+
+struct flb_record_iter {
+    char *data;
+    size_t size;
+    size_t offset;            /* next record */
+};
+
+/* A [time, map] record */
+struct flb_record {
+    msgpack_object time;      /* first array entry     */
+    uint32_t size;            /* number of map entries */
+    char *raw;                /* the encoded record    */
+    size_t raw_size;
+
+    /* map entries cursor */
+    char *kv;
+    char *end;
+    uint32_t kv_left;
+};
+
+/* A map entry */
+struct flb_record_kv {
+    msgpack_object key;
+    msgpack_object val;
+    char *key_raw;            /* encoded key   */
+    size_t key_size;
+    char *val_raw;            /* encoded value */
+    size_t val_size;
+};
+
+/*
+ * Summary of the records of a chunk. Writers keep it up to date as they
+ * append, it travels with the task (and the stored chunk) so outputs get
+ * the number of records and the time range without scanning the buffer.
+ */
+struct flb_chunk_meta {
+    uint32_t records;         /* entries in the chunk     */
+    size_t bytes;             /* encoded size             */
+    time_t t_first;           /* first and last record    */
+    time_t t_last;
+    time_t t_min;             /* time range               */
+    time_t t_max;
+};
+
+static inline void flb_chunk_meta_init(struct flb_chunk_meta *m)
+{
+    memset(m, 0, sizeof(struct flb_chunk_meta));
+}
+
+/* Account a record of 'bytes' bytes with time 't' appended to the chunk */
+static inline void flb_chunk_meta_add(struct flb_chunk_meta *m, time_t t,
+                                      size_t bytes)
+{
+    if (m->records == 0) {
+        m->t_first = t;
+        m->t_min = t;
+        m->t_max = t;
+    }
+    else if (t < m->t_min) {
+        m->t_min = t;
+    }
+    else if (t > m->t_max) {
+        m->t_max = t;
+    }
+
+    m->t_last = t;
+    m->records++;
+    m->bytes += bytes;
+}
+
+void flb_record_iter_init(struct flb_record_iter *it, void *data,
+                          size_t size);
+int flb_record_iter_next(struct flb_record_iter *it, struct flb_record *rec);
+int flb_record_kv_next(struct flb_record *rec, struct flb_record_kv *kv);
+time_t flb_record_time(struct flb_record *rec);
+int flb_record_time_get(msgpack_object *o, time_t *t);
+int flb_record_count(void *data, size_t size);
+char *flb_record_unpack(char *p, char *end, msgpack_object *o);
+char *flb_record_skip(char *p, char *end);
+void flb_chunk_meta_scan(struct flb_chunk_meta *m, void *data, size_t size);
+
+#endif
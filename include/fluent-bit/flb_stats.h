@@ -86,7 +86,7 @@ struct flb_stats_in_plugin {
     int n_data;
 
     struct flb_stats_datapoint data[FLB_STATS_SIZE];
-    struct flb_input_plugin *plugin;
+    struct flb_input_instance *plugin;
     struct mk_list _head;
 };
 
@@ -96,7 +96,7 @@ struct flb_stats_out_plugin {
     int pipe[2];
     int n_data;
     struct flb_stats_datapoint data[FLB_STATS_SIZE];
-    struct flb_output_plugin *plugin;
+    struct flb_output_instance *plugin;
     struct mk_list _head;
 };
 
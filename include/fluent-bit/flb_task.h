@@ -20,10 +20,12 @@
 #ifndef FLB_TASK_H
 #define FLB_TASK_H
 
+#include <time.h>
 #include <pthread.h>
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_buffer.h>
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_batch.h>
 
 /* Task status */
 #define FLB_TASK_NEW      0
@@ -71,6 +73,29 @@ struct flb_task_retry {
     struct mk_list _head;               /* link to parent task list     */
 };
 
+/*
+ * Encodings of the task records requested by the output plugins. They are
+ * created on first use and cached in the task, so the routes consuming the
+ * same format share a single conversion, see flb_task_encoding().
+ */
+#define FLB_TASK_ENC_MSGPACK     0      /* the records as they are     */
+#define FLB_TASK_ENC_JSON        1      /* JSON array, time as 'date'  */
+#define FLB_TASK_ENC_JSON_LINES  2      /* one JSON object per line    */
+#define FLB_TASK_ENC_GZIP     0x100     /* gzip of the above (flag)    */
+
+struct flb_task_enc {
+    int format;                         /* FLB_TASK_ENC_ value       */
+    char *buf;                          /* encoded records           */
+    size_t size;
+    struct mk_list _head;               /* link to task->encodings   */
+};
+
+#ifdef FLB_HAVE_BUFFERING
+/* Task 'worker_id' when no buffer worker owns it */
+#define FLB_TASK_WORKER_NONE  -1    /* not stored, the buffer push failed */
+#define FLB_TASK_WORKER_MEM   -2    /* hybrid mode, only held in memory   */
+#endif
+
 /* A task takes a buffer and sync input and output instances to handle it */
 struct flb_task {
     int id;                             /* task id                   */
@@ -84,9 +109,17 @@ struct flb_task {
     char *tag;                          /* original tag              */
     char *buf;                          /* buffer                    */
     size_t size;                        /* buffer data size          */
+    struct flb_chain chain;             /* records, if not in 'buf'  */
+    char *dict_buf;                     /* idle records, interned    */
+    size_t dict_size;
+    struct flb_chunk_meta meta;         /* records count, time range */
 #ifdef FLB_HAVE_BUFFERING
     int worker_id;                      /* Buffer worker that owns this task */
     int qchunk_id;                      /* qchunk id if it comes from buffer */
+    time_t created;                     /* creation time (hybrid spill)      */
+    size_t mem;                         /* bytes held in memory (hybrid)     */
+    uint64_t routes_mask;               /* routes set when created           */
+    uint64_t routes_done;               /* routes done while only in memory  */
     unsigned char hash_sha1[20];        /* SHA1(buf)                         */
     char hash_hex[41];                  /* Hex string for hash_sha1          */
 #endif
@@ -95,6 +128,8 @@ struct flb_task {
     struct mk_list threads;             /* ref flb_input_instance->tasks */
     struct mk_list routes;              /* routes to dispatch data       */
     struct mk_list retries;             /* queued in-memory retries      */
+    struct mk_list encodings;           /* cached flb_task_enc           */
+    struct flb_batch *batch;            /* columnar view, on demand      */
     struct mk_list _head;               /* link to input_instance        */
     struct flb_config *config;          /* parent flb config             */
 
@@ -106,9 +141,11 @@ struct flb_task {
 struct flb_task *flb_task_create(uint64_t ref_id,
                                  char *buf,
                                  size_t size,
+                                 struct flb_chain *chain,
                                  struct flb_input_instance *i_ins,
                                  struct flb_input_dyntag *dt,
                                  char *tag,
+                                 struct flb_chunk_meta *meta,
                                  struct flb_config *config);
 struct flb_task *flb_task_create_direct(uint64_t ref_id,
                                         char *buf,
@@ -117,6 +154,7 @@ struct flb_task *flb_task_create_direct(uint64_t ref_id,
                                         char *tag,
                                         char *hash,
                                         uint64_t routes,
+                                        struct flb_chunk_meta *meta,
                                         struct flb_config *config);
 
 void flb_task_destroy(struct flb_task *task);
@@ -126,4 +164,14 @@ struct flb_task_retry *flb_task_retry_create(struct flb_task *task,
 void flb_task_retry_destroy(struct flb_task_retry *retry);
 int flb_task_retry_clean(struct flb_task *task, void *data);
 
+int flb_task_encoding(struct flb_task *task, int format,
+                      char **out_buf, size_t *out_size);
+char *flb_task_buf(struct flb_task *task);
+struct flb_batch *flb_task_batch(struct flb_task *task);
+void flb_task_flatten(struct flb_task *task);
+#ifdef FLB_HAVE_BUFFERING
+int flb_task_buffer_prepare(struct flb_task *task);
+#endif
+int flb_task_compact(struct flb_task *task);
+
 #endif
@@ -0,0 +1,62 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_TIME_H
+#define FLB_TIME_H
+
+#include <time.h>
+#include <stdint.h>
+#include <msgpack.h>
+
+/*
+ * Record time with nanoseconds. Inputs get it from a clock cached by the
+ * engine, updated once per event loop iteration, so stamping a record is a
+ * memory read instead of a time(2) call. On the wire it's the Fluentd
+ * EventTime: a MessagePack extension of type 0 holding the seconds and the
+ * nanoseconds as two 32 bits big endian integers.
+ *
+ * Code running out of the engine thread, which may sleep while the loop is
+ * idle, reads the real clock with flb_time_get() instead.
+ */
+
+#define FLB_TIME_EVENT_EXT   0     /* EventTime extension type */
+
+struct flb_time {
+    struct timespec tm;
+};
+
+void flb_time_update();
+void flb_time_now(struct flb_time *t);
+void flb_time_get(struct flb_time *t);
+void flb_time_mono(struct flb_time *t);
+int flb_time_append_to_msgpack(struct flb_time *t, msgpack_packer *pck);
+int flb_time_pop_from_msgpack(struct flb_time *t, msgpack_object *o);
+
+static inline void flb_time_set(struct flb_time *t, time_t sec, long nsec)
+{
+    t->tm.tv_sec  = sec;
+    t->tm.tv_nsec = nsec;
+}
+
+static inline double flb_time_to_double(struct flb_time *t)
+{
+    return (double) t->tm.tv_sec + ((double) t->tm.tv_nsec / 1000000000.0);
+}
+
+#endif
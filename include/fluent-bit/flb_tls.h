@@ -22,6 +22,7 @@
 
 #ifdef FLB_HAVE_TLS
 
+#include <sys/uio.h>
 #include <fluent-bit/flb_thread.h>
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_upstream.h>
@@ -30,6 +31,8 @@ int net_io_tls_write(struct flb_thread *th, struct flb_upstream_conn *u_conn,
                      void *data, size_t len, size_t *out_len);
 int net_io_tls_read(struct flb_thread *th, struct flb_upstream_conn *u_conn,
                     void *buf, size_t len);
+int net_io_tls_writev(struct flb_thread *th, struct flb_upstream_conn *u_conn,
+                      const struct iovec *iov, int iovcnt, size_t *out_len);
 
 int flb_io_tls_connect(struct flb_upstream_conn *u_conn,
                        struct flb_thread *th);
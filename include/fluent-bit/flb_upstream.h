@@ -20,8 +20,11 @@
 #ifndef FLB_UPSTREAM_H
 #define FLB_UPSTREAM_H
 
+#include <time.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_network.h>
 
 /*
  * Upstream creation FLAGS set by Fluent Bit sub-components
@@ -34,6 +37,21 @@
  * ---
  */
 
+/* Upstream groups: node selection */
+#define FLB_UPSTREAM_LEAST_OUTSTANDING  0  /* fewest busy connections/weight */
+#define FLB_UPSTREAM_HASH_TAG           1  /* consistent hash of the tag     */
+
+#define FLB_UPSTREAM_MAX_NODES     64   /* nodes in a group                 */
+#define FLB_UPSTREAM_MAX_FAILS     3    /* failures before ejecting a node  */
+#define FLB_UPSTREAM_EJECT_TIME    10   /* seconds an ejected node is idle  */
+#define FLB_UPSTREAM_VNODES        64   /* hash ring points per weight unit */
+
+/* Point of the consistent hash ring */
+struct flb_upstream_point {
+    uint32_t hash;
+    struct flb_upstream *node;
+};
+
 /* Upstream handler */
 struct flb_upstream {
     struct mk_event_loop *evl;
@@ -43,6 +61,9 @@ struct flb_upstream {
     char *tcp_host;
 
     int n_connections;
+    int net_io_timeout;       /* max seconds for a network operation */
+    struct flb_dns *dns;      /* host name resolver, NULL = getaddrinfo */
+    struct flb_net_setup net; /* socket options for new connections  */
 
     /*
      * An upstream handler may keep open up to 'max_connections' of
@@ -65,14 +86,53 @@ struct flb_upstream {
      */
     struct mk_list busy_queue;
 
+    /*
+     * Keepalive: released connections are kept in the 'av_queue' up to
+     * 'ka_pool_size' entries. Before reusing a connection it's checked
+     * that it was not idle for more than 'ka_idle_timeout' seconds and
+     * that the remote end did not close it.
+     */
+    int ka_enabled;           /* reuse connections ?                  */
+    int ka_idle_timeout;      /* max idle seconds in 'av_queue'       */
+    int ka_max_requests;      /* max uses per connection, 0 = no limit */
+    int ka_pool_size;         /* max connections in 'av_queue'        */
+    int av_connections;       /* connections in 'av_queue'            */
+    uint64_t ka_created;      /* connections created                  */
+    uint64_t ka_reused;       /* connections taken from 'av_queue'    */
+
+    /*
+     * Upstream group: when created with a comma separated list of hosts,
+     * the upstream does not own connections. Each flb_upstream_conn_get()
+     * picks one of the 'nodes' (regular upstreams) and uses it.
+     */
+    int balance;              /* FLB_UPSTREAM_LEAST_OUTSTANDING, HASH_TAG */
+    int n_nodes;
+    int ring_size;
+    struct flb_upstream **nodes;
+    struct flb_upstream_point *ring;
+
+    /* Node of an upstream group: health tracking */
+    struct flb_upstream *parent;
+    int weight;
+    int credit;               /* smooth weighted round-robin, on ties */
+    int index;                /* position in parent->nodes            */
+    int outstanding;          /* connections in use                   */
+    int fails;                /* consecutive failures                 */
+    time_t ejected_until;     /* passive ejection, 0 = healthy        */
+
 #ifdef FLB_HAVE_TLS
     /* context with mbedTLS data to handle certificates and keys */
     struct flb_tls *tls;
+
+    /* last TLS session and handshake counters, see flb_io_tls.c */
+    struct flb_tls_resume *tls_resume;
 #endif
 
 #ifdef FLB_HAVE_FLUSH_PTHREADS
     pthread_mutex_t mutex_queue;
 #endif
+
+    struct mk_list _head;     /* link to config->upstreams */
 };
 
 /* Upstream TCP connection */
@@ -83,6 +143,24 @@ struct flb_upstream_conn {
     int fd;
     int connect_count;
 
+    /* Keepalive */
+    int requests;             /* number of times the connection was used */
+    int ka_close;             /* protocol state unknown, do not reuse it */
+    time_t ts_available;      /* time when it was put in 'av_queue'      */
+
+    /* Network I/O */
+    time_t ts_deadline;       /* current operation deadline, 0 = none    */
+    size_t write_size;        /* bytes per write(2), from SO_SNDBUF      */
+    int tfo_pending;          /* TCP Fast Open: SYN not sent yet         */
+
+    /* MSG_ZEROCOPY: sends issued and completions reported by the kernel */
+    int zerocopy;             /* SO_ZEROCOPY enabled on the socket       */
+    uint32_t zc_sent;
+    uint32_t zc_done;
+
+    /* HTTP client reused by the requests sent on this connection */
+    struct flb_http_client *http;
+
     /* Upstream parent */
     struct flb_upstream *u;
 
@@ -104,8 +182,11 @@ struct flb_upstream *flb_upstream_create(struct flb_config *config,
                                          char *host, int port, int flags,
                                          void *tls);
 int flb_upstream_destroy(struct flb_upstream *u);
+int flb_upstream_balance_set(struct flb_upstream *u, char *mode);
+void flb_upstream_net_set(struct flb_upstream *u, struct flb_net_setup *net);
 
 struct flb_upstream_conn *flb_upstream_conn_get(struct flb_upstream *u);
 int flb_upstream_conn_release(struct flb_upstream_conn *u_conn);
+int flb_upstream_conn_timeouts(struct flb_config *config);
 
 #endif
@@ -28,5 +28,6 @@ void flb_utils_warn_c(const char *msg);
 void flb_message(int type, char *file, int line, const char *fmt, ...);
 int flb_utils_set_daemon();
 void flb_utils_print_setup(struct flb_config *config);
+int64_t flb_utils_size_to_bytes(char *size);
 
 #endif
@@ -2,7 +2,7 @@
 
 /*  Fluent Bit
  *  ==========
- *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *  Copyright (C) 2015 Treasure Data Inc.
  *
  *  Licensed under the Apache License, Version 2.0 (the "License");
  *  you may not use this file except in compliance with the License.
@@ -17,23 +17,20 @@
  *  limitations under the License.
  */
 
-#ifndef FLB_OUT_ES_BULK_H
-#define FLB_OUT_ES_BULK_H
+#ifndef FLB_VERSION_H
+#define FLB_VERSION_H
 
-#include <inttypes.h>
+/* Helpers to convert/format version string */
+#define STR_HELPER(s)      #s
+#define STR(s)             STR_HELPER(s)
 
-#define ES_BULK_CHUNK      4096  /* Size of buffer chunks    */
-#define ES_BULK_HEADER      128  /* ES Bulk API prefix line  */
-#define ES_BULK_INDEX_FMT   "{\"index\":{\"_index\":\"%s\",\"_type\":\"%s\"}}\n"
-
-struct es_bulk {
-    char *ptr;
-    uint32_t len;
-    uint32_t size;
-};
-
-struct es_bulk *es_bulk_create();
-int es_bulk_append(struct es_bulk *bulk, char *index, int i_len, char *json, int j_len);
-void es_bulk_destroy(struct es_bulk *bulk);
+/* Fluent Bit Version */
+#define FLB_VERSION_MAJOR   0
+#define FLB_VERSION_MINOR   10
+#define FLB_VERSION_PATCH   0
+#define FLB_VERSION         (FLB_VERSION_MAJOR * 10000 \
+                             FLB_VERSION_MINOR * 100   \
+                             FLB_VERSION_PATCH)
+#define FLB_VERSION_STR     "0.10.0"
 
 #endif
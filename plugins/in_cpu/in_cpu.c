@@ -172,6 +172,7 @@ int in_cpu_init(struct flb_input_instance *in, struct flb_config *config, void *
     /* Gather number of processors and CPU ticks */
     ctx->n_processors = sysconf(_SC_NPROCESSORS_ONLN);
     ctx->cpu_ticks    = sysconf(_SC_CLK_TCK);
+    ctx->in           = in;
 
     /* Initialize buffers for CPU stats */
     ret = snapshots_init(ctx->n_processors, &ctx->cstats);
@@ -295,6 +296,7 @@ int in_cpu_collect(struct flb_config *config, void *in_context)
     struct flb_in_cpu_config *ctx = in_context;
     struct cpu_stats *cstats = &ctx->cstats;
     struct cpu_snapshot *s;
+    struct flb_time tm;
     (void) config;
 
     /* Get the current CPU usage */
@@ -308,8 +310,9 @@ int in_cpu_collect(struct flb_config *config, void *in_context)
     /*
      * Store the new data into the MessagePack buffer,
      */
+    flb_time_now(&tm);
     msgpack_pack_array(&ctx->mp_pck, 2);
-    msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&tm, &ctx->mp_pck);
 
     msgpack_pack_map(&ctx->mp_pck, (ctx->n_processors * 3 ) + 3);
 
@@ -340,7 +343,7 @@ int in_cpu_collect(struct flb_config *config, void *in_context)
     snapshots_switch(cstats);
     flb_trace("[in_cpu] CPU %0.2f%%", s->p_cpu);
 
-    flb_stats_update(in_cpu_plugin.stats_fd, 0, 1);
+    flb_stats_update(ctx->in->stats_fd, 0, 1);
 
     return 0;
 }
@@ -72,6 +72,7 @@ struct flb_in_cpu_config {
     int cpu_ticks;      /* CPU ticks (Kernel setting) */
 
     struct cpu_stats cstats;
+    struct flb_input_instance *in;  /* Input plugin instance */
 
     /* MessagePack buffers */
     msgpack_packer  mp_pck;
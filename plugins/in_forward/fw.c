@@ -29,26 +29,26 @@
 /*
  * For a server event, the collection event means a new client have arrived, we
  * accept the connection and create a new FW instance which will wait for
- * MessagePack records.
+ * MessagePack records. The context is the listener that became ready.
  */
 static int in_fw_collect(struct flb_config *config, void *in_context)
 {
-    int fd;
-    struct flb_in_fw_config *ctx = in_context;
+    int i;
+    int n;
+    int fds[FLB_NET_ACCEPT_BATCH];
+    struct flb_net_listener *server = in_context;
+    struct flb_in_fw_config *ctx = server->ctx;
     struct fw_conn *conn;
 
-    /* Accept the new connection */
-    fd = flb_net_accept(ctx->server_fd);
-    if (fd == -1) {
-        flb_error("[in_fw] could not accept new connection");
-        return -1;
+    n = flb_net_accept_batch(server->fd, fds, FLB_NET_ACCEPT_BATCH);
+    for (i = 0; i < n; i++) {
+        flb_trace("[in_fw] new TCP connection arrived FD=%i", fds[i]);
+        conn = fw_conn_add(fds[i], ctx);
+        if (!conn) {
+            flb_error("[in_fw] could not register connection FD=%i", fds[i]);
+        }
     }
 
-    flb_trace("[in_fw] new TCP connection arrived FD=%i", fd);
-    conn = fw_conn_add(fd, ctx);
-    if (!conn) {
-        return -1;
-    }
     return 0;
 }
 
@@ -56,6 +56,7 @@ static int in_fw_collect(struct flb_config *config, void *in_context)
 static int in_fw_init(struct flb_input_instance *in,
                       struct flb_config *config, void *data)
 {
+    int i;
     int ret;
     struct flb_in_fw_config *ctx;
     (void) data;
@@ -72,26 +73,34 @@ static int in_fw_init(struct flb_input_instance *in,
     flb_input_set_context(in, ctx);
 
     /* Create TCP server */
-    ctx->server_fd = flb_net_server(ctx->tcp_port, ctx->listen);
-    if (ctx->server_fd > 0) {
-        flb_info("[in_fw] binding %s:%s", ctx->listen, ctx->tcp_port);
+    ret = flb_net_server_listeners(ctx->tcp_port, ctx->listen,
+                                   ctx->server_fds, ctx->listeners);
+    if (ret > 0) {
+        flb_info("[in_fw] binding %s:%s listeners=%i",
+                 ctx->listen, ctx->tcp_port, ctx->listeners);
     }
     else {
         flb_error("[in_fw] could not bind address %s:%s. Aborting",
                   ctx->listen, ctx->tcp_port);
         return -1;
     }
-    flb_net_socket_nonblocking(ctx->server_fd);
 
     ctx->evl = config->evl;
 
-    /* Collect upon data available on the standard input */
-    ret = flb_input_set_collector_socket(in,
-                                        in_fw_collect,
-                                        ctx->server_fd,
-                                        config);
-    if (ret == -1) {
-        flb_utils_error_c("Could not set collector for IN_FW input plugin");
+    /* Collect upon new connections, one collector per listening socket */
+    for (i = 0; i < ctx->listeners; i++) {
+        ctx->servers[i].fd  = ctx->server_fds[i];
+        ctx->servers[i].ctx = ctx;
+        flb_net_socket_nonblocking(ctx->server_fds[i]);
+        ret = flb_input_set_collector_socket(in,
+                                            in_fw_collect,
+                                            ctx->server_fds[i],
+                                            config);
+        if (ret == -1) {
+            flb_utils_error_c("Could not set collector for IN_FW input plugin");
+        }
+        flb_input_set_collector_context(in, ctx->server_fds[i],
+                                        &ctx->servers[i], config);
     }
 
     return 0;
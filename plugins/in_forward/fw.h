@@ -22,9 +22,12 @@
 
 #include <msgpack.h>
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_network.h>
 
 struct flb_in_fw_config {
-    int server_fd;               /* TCP server file descriptor  */
+    int listeners;               /* Number of listening sockets */
+    int server_fds[FLB_NET_LISTENERS_MAX]; /* TCP server sockets  */
+    struct flb_net_listener servers[FLB_NET_LISTENERS_MAX]; /* collectors */
     size_t buffer_size;          /* Buffer size for each reader */
     size_t chunk_size;           /* Chunk allocation size       */
     char *listen;                /* Listen interface            */
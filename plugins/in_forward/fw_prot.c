@@ -181,8 +181,15 @@ int fw_prot_process(struct fw_conn *conn)
                 /* Forward format 1: [tag, [[time, map], ...]] */
                 fw_process_array(conn->in, stag, stag_len, &entry);
             }
-            else if (entry.type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
-                /* Forward format 2: [tag, time, map] */
+            else if (entry.type == MSGPACK_OBJECT_POSITIVE_INTEGER ||
+                     entry.type == MSGPACK_OBJECT_EXT) {
+                /* Forward format 2: [tag, time, map], time may be EventTime */
+                if (root.via.array.size < 3) {
+                    flb_warn("[in_fw] invalid data format, map expected");
+                    msgpack_unpacked_destroy(&result);
+                    msgpack_unpacker_free(unp);
+                    return -1;
+                }
                 map = root.via.array.ptr[2];
                 if (map.type != MSGPACK_OBJECT_MAP) {
                     flb_warn("[in_fw] invalid data format, map expected");
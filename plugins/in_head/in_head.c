@@ -39,6 +39,7 @@ static int in_head_collect(struct flb_config *config, void *in_context)
     struct flb_in_head_config *head_config = in_context;
     int fd = -1;
     int ret = -1;
+    struct flb_time tm;
 
     /* open at every collect callback */
     fd = open(head_config->filepath, O_RDONLY);
@@ -56,8 +57,9 @@ static int in_head_collect(struct flb_config *config, void *in_context)
         goto collect_fin;
     }
 
+    flb_time_now(&tm);
     msgpack_pack_array(&head_config->mp_pck, 2);
-    msgpack_pack_uint64(&head_config->mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&tm, &head_config->mp_pck);
     msgpack_pack_map(&head_config->mp_pck, 1);
 
     msgpack_pack_bin(&head_config->mp_pck, 4);
@@ -68,7 +70,7 @@ static int in_head_collect(struct flb_config *config, void *in_context)
 
     ret = 0;
     head_config->idx++;
-    flb_stats_update(in_head_plugin.stats_fd, 0, 1);
+    flb_stats_update(head_config->in->stats_fd, 0, 1);
 
  collect_fin:
     close(fd);
@@ -156,6 +158,7 @@ static int in_head_init(struct flb_input_instance *in,
     head_config->buf = NULL;
     head_config->buf_len = 0;
     head_config->idx = 0;
+    head_config->in = in;
 
     /* Initialize head config */
     ret = in_head_config_read(head_config, in);
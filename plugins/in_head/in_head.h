@@ -40,6 +40,8 @@ struct flb_in_head_config {
     int      interval_sec;
     int      interval_nsec;
 
+    struct flb_input_instance *in;  /* Input plugin instance */
+
     msgpack_packer   mp_pck;
     msgpack_sbuffer  mp_sbuf;
 };
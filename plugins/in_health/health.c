@@ -54,6 +54,7 @@ struct flb_in_health_config {
 static int in_health_collect(struct flb_config *config, void *in_context)
 {
     uint8_t alive;
+    struct flb_time tm;
     struct flb_in_health_config *ctx = in_context;
     struct flb_upstream_conn *u_conn;
 
@@ -73,8 +74,9 @@ static int in_health_collect(struct flb_config *config, void *in_context)
     /*
      * Store the new data into the MessagePack buffer,
      */
+    flb_time_now(&tm);
     msgpack_pack_array(&ctx->mp_pck, 2);
-    msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&tm, &ctx->mp_pck);
 
     msgpack_pack_map(&ctx->mp_pck, 1);
 
@@ -117,6 +119,9 @@ static int in_health_init(struct flb_input_instance *in,
         return -1;
     }
 
+    /* Every check must open a new connection */
+    ctx->u->ka_enabled = FLB_FALSE;
+
     /* interval settings */
     pval = flb_input_get_property("interval_sec", in);
     if (pval != NULL && atoi(pval) >= 0) {
@@ -134,7 +134,8 @@ static inline int process_line(char *line, struct flb_in_kmsg_config *ctx)
 {
     char priority;           /* log priority                */
     uint64_t sequence;       /* sequence number             */
-    time_t ts;               /* unix timestamp              */
+    long usec;
+    struct flb_time ts;      /* unix timestamp              */
     struct timeval tv;       /* time value                  */
     int line_len;
     uint64_t val;
@@ -178,7 +179,11 @@ static inline int process_line(char *line, struct flb_in_kmsg_config *ctx)
     tv.tv_sec  = val/1000000;
     tv.tv_usec = val - (tv.tv_sec * 1000000);
 
-    ts = ctx->boot_time.tv_sec + tv.tv_sec;
+    /* Boot time plus the record offset, keep the microseconds */
+    usec = ctx->boot_time.tv_usec + tv.tv_usec;
+    flb_time_set(&ts,
+                 ctx->boot_time.tv_sec + tv.tv_sec + (usec / 1000000),
+                 (usec % 1000000) * 1000);
 
     /* Now process the human readable message */
     p = strchr(p, ';');
@@ -196,7 +201,7 @@ static inline int process_line(char *line, struct flb_in_kmsg_config *ctx)
      * we handle this as a list of maps.
      */
     msgpack_pack_array(&ctx->mp_pck, 2);
-    msgpack_pack_uint64(&ctx->mp_pck, ts);
+    flb_time_append_to_msgpack(&ts, &ctx->mp_pck);
 
     msgpack_pack_map(&ctx->mp_pck, 5);
     msgpack_pack_bin(&ctx->mp_pck, 8);
@@ -223,7 +228,7 @@ static inline int process_line(char *line, struct flb_in_kmsg_config *ctx)
     flb_trace("[in_kmsg] pri=%i seq=%" PRIu64 " ts=%ld sec=%ld usec=%ld '%s'",
               priority,
               sequence,
-              ts,
+              (long int) ts.tm.tv_sec,
               (long int) tv.tv_sec,
               (long int) tv.tv_usec,
               (const char *) msg);
@@ -264,7 +269,7 @@ int in_kmsg_collect(struct flb_config *config, void *in_context)
     /* Process and enqueue the received line */
     process_line(line, ctx);
 
-    flb_stats_update(in_kmsg_plugin.stats_fd, bytes, 1);
+    flb_stats_update(ctx->in->stats_fd, bytes, 1);
     return 0;
 }
 
@@ -291,6 +296,7 @@ int in_kmsg_init(struct flb_input_instance *in,
         return -1;
     }
     ctx->fd = fd;
+    ctx->in = in;
 
     /* get the system boot time */
     ret = boot_time(&ctx->boot_time);
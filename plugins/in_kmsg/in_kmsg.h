@@ -47,6 +47,8 @@ struct flb_in_kmsg_config {
     /* Line processing */
     int buffer_id;
 
+    struct flb_input_instance *in;  /* Input plugin instance */
+
     /* MessagePack buffers */
     msgpack_packer  mp_pck;
     msgpack_sbuffer mp_sbuf;
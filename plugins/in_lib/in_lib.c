@@ -85,7 +85,6 @@ int in_lib_exit(void *data, struct flb_config *config)
 {
     (void) config;
     struct flb_in_lib_config *ctx = data;
-    struct flb_pack_state *s;
 
     if (ctx->buf_data) {
         flb_free(ctx->buf_data);
@@ -95,10 +94,7 @@ int in_lib_exit(void *data, struct flb_config *config)
         flb_free(ctx->msgp_data);
     }
 
-    s = &ctx->state;
-    if (s->tokens) {
-        flb_free(s->tokens);
-    }
+    flb_pack_state_reset(&ctx->state);
 
     flb_free(ctx);
     return 0;
@@ -151,13 +147,16 @@ int in_lib_collect(struct flb_config *config, void *in_context)
         flb_warn("lib data incomplete, waiting for more data...");
         return 0;
     }
-    else if (ret == FLB_ERR_JSON_INVAL) {
+    else if (ret != 0) {
         flb_warn("lib data invalid");
-        flb_pack_state_reset(&ctx->state);
-        flb_pack_state_init(&ctx->state);
+        ctx->buf_len = 0;
         return -1;
     }
-    ctx->buf_len = 0;
+
+    /* keep an incomplete message for the next read */
+    memmove(ctx->buf_data, ctx->buf_data + ctx->state.last_byte,
+            ctx->buf_len - ctx->state.last_byte);
+    ctx->buf_len -= ctx->state.last_byte;
 
     capacity = (ctx->msgp_size - ctx->msgp_len);
     if (capacity < out_size) {
@@ -167,8 +166,6 @@ int in_lib_collect(struct flb_config *config, void *in_context)
         if (!ptr) {
             perror("realloc");
             flb_free(pack);
-            flb_pack_state_reset(&ctx->state);
-            flb_pack_state_init(&ctx->state);
             return -1;
         }
         ctx->msgp_data = ptr;
@@ -179,9 +176,6 @@ int in_lib_collect(struct flb_config *config, void *in_context)
     ctx->msgp_len += out_size;
     flb_free(pack);
 
-    flb_pack_state_reset(&ctx->state);
-    flb_pack_state_init(&ctx->state);
-
     return 0;
 }
 
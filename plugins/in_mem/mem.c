@@ -38,6 +38,7 @@ struct flb_in_mem_config {
     int    idx;
     int    page_size;
     pid_t  pid;
+    struct flb_input_instance *in;  /* Input plugin instance */
     msgpack_packer  pckr;
     msgpack_sbuffer sbuf;
 };
@@ -150,6 +151,7 @@ static int in_mem_init(struct flb_input_instance *in,
     ctx->idx = 0;
     ctx->pid = 0;
     ctx->page_size = sysconf(_SC_PAGESIZE);
+    ctx->in = in;
 
     /* Check if the caller want's to trace a specific Process ID */
     tmp = flb_input_get_property("pid", in);
@@ -184,6 +186,7 @@ static int in_mem_collect(struct flb_config *config, void *in_context)
     int entries = 2;
     uint64_t total;
     uint64_t free;
+    struct flb_time tm;
     struct proc_task *task = NULL;
     struct flb_in_mem_config *ctx = in_context;
 
@@ -213,8 +216,9 @@ static int in_mem_collect(struct flb_config *config, void *in_context)
         entries += 2;
     }
 
+    flb_time_now(&tm);
     msgpack_pack_array(&ctx->pckr, 2);
-    msgpack_pack_uint64(&ctx->pckr, time(NULL));
+    flb_time_append_to_msgpack(&tm, &ctx->pckr);
     msgpack_pack_map(&ctx->pckr, entries);
 
     msgpack_pack_bin(&ctx->pckr, 5);
@@ -245,7 +249,7 @@ static int in_mem_collect(struct flb_config *config, void *in_context)
               total, free);
     ++ctx->idx;
 
-    flb_stats_update(in_mem_plugin.stats_fd, 0, 1);
+    flb_stats_update(ctx->in->stats_fd, 0, 1);
     return 0;
 }
 
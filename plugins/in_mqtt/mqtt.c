@@ -29,6 +29,7 @@
 int in_mqtt_init(struct flb_input_instance *in,
                  struct flb_config *config, void *data)
 {
+    int i;
     int ret;
     struct flb_in_mqtt_config *ctx;
     (void) data;
@@ -44,9 +45,11 @@ int in_mqtt_init(struct flb_input_instance *in,
     flb_input_set_context(in, ctx);
 
     /* Create TCP server */
-    ctx->server_fd = flb_net_server(ctx->tcp_port, ctx->listen);
-    if (ctx->server_fd > 0) {
-        flb_debug("[in_mqtt] binding %s:%s", ctx->listen, ctx->tcp_port);
+    ret = flb_net_server_listeners(ctx->tcp_port, ctx->listen,
+                                   ctx->server_fds, ctx->listeners);
+    if (ret > 0) {
+        flb_debug("[in_mqtt] binding %s:%s listeners=%i",
+                  ctx->listen, ctx->tcp_port, ctx->listeners);
     }
     else {
         flb_error("[in_mqtt] could not bind address %s:%s",
@@ -56,15 +59,21 @@ int in_mqtt_init(struct flb_input_instance *in,
     }
     ctx->evl = config->evl;
 
-    /* Collect upon data available on the standard input */
-    ret = flb_input_set_collector_event(in,
-                                        in_mqtt_collect,
-                                        ctx->server_fd,
-                                        config);
-    if (ret == -1) {
-        flb_error("[in_mqtt] Could not set collector for MQTT input plugin");
-        mqtt_config_free(ctx);
-        return -1;
+    /* Collect upon new connections, one collector per listening socket */
+    for (i = 0; i < ctx->listeners; i++) {
+        ctx->servers[i].fd  = ctx->server_fds[i];
+        ctx->servers[i].ctx = ctx;
+        ret = flb_input_set_collector_event(in,
+                                            in_mqtt_collect,
+                                            ctx->server_fds[i],
+                                            config);
+        if (ret == -1) {
+            flb_error("[in_mqtt] Could not set collector for MQTT input plugin");
+            mqtt_config_free(ctx);
+            return -1;
+        }
+        flb_input_set_collector_context(in, ctx->server_fds[i],
+                                        &ctx->servers[i], config);
     }
 
     return 0;
@@ -90,26 +99,27 @@ void *in_mqtt_flush(void *in_context, size_t *size)
 /*
  * For a server event, the collection event means a new client have arrived, we
  * accept the connection and create a new MQTT instance which will wait for
- * events/data (MQTT control packages)
+ * events/data (MQTT control packages). The context is the listener that
+ * became ready.
  */
 int in_mqtt_collect(struct flb_config *config, void *in_context)
 {
-    int fd;
-    struct flb_in_mqtt_config *ctx = in_context;
+    int i;
+    int n;
+    int fds[FLB_NET_ACCEPT_BATCH];
+    struct flb_net_listener *server = in_context;
+    struct flb_in_mqtt_config *ctx = server->ctx;
     struct mqtt_conn *conn;
 
-    /* Accept the new connection */
-    fd = flb_net_accept(ctx->server_fd);
-    if (fd == -1) {
-        flb_error("[in_mqtt] could not accept new connection");
-        return -1;
+    n = flb_net_accept_batch(server->fd, fds, FLB_NET_ACCEPT_BATCH);
+    for (i = 0; i < n; i++) {
+        flb_trace("[in_mqtt] [fd=%i] new TCP connection", fds[i]);
+        conn = mqtt_conn_add(fds[i], ctx);
+        if (!conn) {
+            flb_error("[in_mqtt] could not register connection FD=%i", fds[i]);
+        }
     }
 
-    flb_trace("[in_mqtt] [fd=%i] new TCP connection", fd);
-    conn = mqtt_conn_add(fd, ctx);
-    if (!conn) {
-        return -1;
-    }
     return 0;
 }
 
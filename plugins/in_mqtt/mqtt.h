@@ -20,10 +20,14 @@
 #ifndef FLB_IN_MQTT_H
 #define FLB_IN_MQTT_H
 
+#include <fluent-bit/flb_network.h>
+
 #define MQTT_MSGP_BUF_SIZE 8192
 
 struct flb_in_mqtt_config {
-    int server_fd;                 /* TCP server file descriptor  */
+    int listeners;                 /* Number of listening sockets */
+    int server_fds[FLB_NET_LISTENERS_MAX]; /* TCP server sockets    */
+    struct flb_net_listener servers[FLB_NET_LISTENERS_MAX]; /* collectors */
 
     char *listen;                  /* Listen interface            */
     char *tcp_port;                /* TCP Port                    */
@@ -29,6 +29,7 @@ struct flb_in_mqtt_config *mqtt_config_init(struct flb_input_instance *i_ins)
 {
     char tmp[16];
     char *listen;
+    char *listeners;
     struct flb_in_mqtt_config *config;
 
     config = flb_malloc(sizeof(struct flb_in_mqtt_config));
@@ -57,6 +58,27 @@ struct flb_in_mqtt_config *mqtt_config_init(struct flb_input_instance *i_ins)
         config->tcp_port = flb_strdup(tmp);
     }
 
+    /*
+     * Number of listening sockets, more than one uses SO_REUSEPORT. They
+     * are all served by the engine thread: it splits the accept queue, it
+     * does not add parallelism.
+     */
+    listeners = flb_input_get_property("listeners", i_ins);
+    if (!listeners) {
+        config->listeners = 1;
+    }
+    else {
+        config->listeners = atoi(listeners);
+        if (config->listeners < 1) {
+            config->listeners = 1;
+        }
+        else if (config->listeners > FLB_NET_LISTENERS_MAX) {
+            flb_warn("[in_mqtt] Listeners=%i is too high, using %i",
+                     config->listeners, FLB_NET_LISTENERS_MAX);
+            config->listeners = FLB_NET_LISTENERS_MAX;
+        }
+    }
+
     flb_debug("[in_mqtt] Listen='%s' TCP_Port=%s",
               config->listen, config->tcp_port);
 
@@ -65,8 +87,12 @@ struct flb_in_mqtt_config *mqtt_config_init(struct flb_input_instance *i_ins)
 
 void mqtt_config_free(struct flb_in_mqtt_config *config)
 {
-    if (config->server_fd > 0) {
-        close(config->server_fd);
+    int i;
+
+    for (i = 0; i < config->listeners; i++) {
+        if (config->server_fds[i] > 0) {
+            close(config->server_fds[i]);
+        }
     }
     flb_free(config->listen);
     flb_free(config->tcp_port);
@@ -124,6 +124,7 @@ static int mqtt_data_append(char *topic, size_t topic_len,
     msgpack_unpacked result;
     struct msgpack_sbuffer mp_sbuf;
     struct msgpack_packer mp_pck;
+    struct flb_time tm;
     struct flb_in_mqtt_config *ctx = in_context;
 
     /* Convert our incoming JSON to MsgPack */
@@ -150,8 +151,9 @@ static int mqtt_data_append(char *topic, size_t topic_len,
     }
     root = result.data;
 
+    flb_time_now(&tm);
     msgpack_pack_array(&mp_pck, 2);
-    msgpack_pack_int32(&mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&tm, &mp_pck);
 
     n_size = root.via.map.size;
     msgpack_pack_map(&mp_pck, n_size + 1);
@@ -52,6 +52,7 @@ static int in_random_collect(struct flb_config *config, void *in_context)
     int fd;
     int ret;
     uint64_t val;
+    struct flb_time tm;
     struct flb_in_random_config *ctx = in_context;
 
     if (ctx->samples == 0) {
@@ -76,8 +77,9 @@ static int in_random_collect(struct flb_config *config, void *in_context)
         close(fd);
     }
 
+    flb_time_now(&tm);
     msgpack_pack_array(&ctx->mp_pck, 2);
-    msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&tm, &ctx->mp_pck);
     msgpack_pack_map(&ctx->mp_pck, 1);
 
     msgpack_pack_bin(&ctx->mp_pck, 10);
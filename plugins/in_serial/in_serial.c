@@ -41,36 +41,24 @@
 #include "in_serial.h"
 #include "in_serial_config.h"
 
-void *in_serial_flush(void *in_context, size_t *size)
+void in_serial_flush(void *in_context, struct flb_chain *chain)
 {
-    char *buf;
-    msgpack_sbuffer *sbuf;
     struct flb_in_serial_config *ctx = in_context;
 
     if (ctx->buffer_id == 0)
-        return NULL;
-
-    sbuf = &ctx->mp_sbuf;
-    *size = sbuf->size;
-    buf = flb_malloc(sbuf->size);
-    if (!buf) {
-        return NULL;
-    }
-
-    /* set a new buffer and re-initialize our MessagePack context */
-    memcpy(buf, sbuf->data, sbuf->size);
-    msgpack_sbuffer_destroy(&ctx->mp_sbuf);
-    msgpack_sbuffer_init(&ctx->mp_sbuf);
-    msgpack_packer_init(&ctx->mp_pck, &ctx->mp_sbuf, msgpack_sbuffer_write);
+        return;
 
+    /* hand over the blocks, the packer keeps writing to the empty chain */
+    flb_chain_move(chain, &ctx->chain);
     ctx->buffer_id = 0;
-
-    return buf;
 }
 
 static inline int process_line(char *line, int len,
                                struct flb_in_serial_config *ctx)
 {
+    size_t size;
+    struct flb_time tm;
+
     /* Increase buffer position */
     ctx->buffer_id++;
 
@@ -78,14 +66,17 @@ static inline int process_line(char *line, int len,
      * Store the new data into the MessagePack buffer,
      * we handle this as a list of maps.
      */
+    flb_time_now(&tm);
+    size = ctx->chain.size;
     msgpack_pack_array(&ctx->mp_pck, 2);
-    msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&tm, &ctx->mp_pck);
 
     msgpack_pack_map(&ctx->mp_pck, 1);
     msgpack_pack_bin(&ctx->mp_pck, 3);
     msgpack_pack_bin_body(&ctx->mp_pck, "msg", 3);
     msgpack_pack_bin(&ctx->mp_pck, len);
     msgpack_pack_bin_body(&ctx->mp_pck, line, len);
+    flb_chunk_meta_add(&ctx->in->meta, tm.tm.tv_sec, ctx->chain.size - size);
 
     flb_debug("[in_serial] message '%s'",
               (const char *) line);
@@ -97,23 +88,30 @@ static inline int process_pack(struct flb_in_serial_config *ctx,
                                char *pack, size_t size)
 {
     size_t off = 0;
+    size_t start;
     msgpack_unpacked result;
     msgpack_object entry;
+    struct flb_time tm;
 
     ctx->buffer_id++;
+    flb_time_now(&tm);
 
     /* First pack the results, iterate concatenated messages */
     msgpack_unpacked_init(&result);
     while (msgpack_unpack_next(&result, pack, size, &off)) {
         entry = result.data;
+        start = ctx->chain.size;
 
         msgpack_pack_array(&ctx->mp_pck, 2);
-        msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+        flb_time_append_to_msgpack(&tm, &ctx->mp_pck);
 
         msgpack_pack_map(&ctx->mp_pck, 1);
         msgpack_pack_bin(&ctx->mp_pck, 3);
         msgpack_pack_bin_body(&ctx->mp_pck, "msg", 3);
         msgpack_pack_object(&ctx->mp_pck, entry);
+
+        flb_chunk_meta_add(&ctx->in->meta, tm.tm.tv_sec,
+                           ctx->chain.size - start);
     }
 
     msgpack_unpacked_destroy(&result);
@@ -136,7 +134,6 @@ int in_serial_collect(struct flb_config *config, void *in_context)
     int hits;
     char *sep;
     char *buf;
-    jsmntok_t *t;
 
     struct flb_in_serial_config *ctx = in_context;
 
@@ -178,8 +175,12 @@ int in_serial_collect(struct flb_config *config, void *in_context)
             ctx->buf_len--;
         }
 
-        /* Strip CR or LF if found at first byte */
-        if (ctx->buf_data[0] == '\r' || ctx->buf_data[0] == '\n') {
+        /*
+         * Strip CR or LF if found at first byte, the JSON parser skips
+         * them by itself and its offsets must not move.
+         */
+        if (ctx->format != FLB_SERIAL_FORMAT_JSON &&
+            (ctx->buf_data[0] == '\r' || ctx->buf_data[0] == '\n')) {
             /* Skip message with one byte with CR or LF */
             flb_trace("[in_serial] skip one byte message with ASCII code=%i",
                       ctx->buf_data[0]);
@@ -222,30 +223,25 @@ int in_serial_collect(struct flb_config *config, void *in_context)
                 flb_debug("[in_serial] JSON incomplete, waiting for more data...");
                 return 0;
             }
-            else if (ret == FLB_ERR_JSON_INVAL) {
+            else if (ret != 0) {
                 flb_debug("[in_serial] invalid JSON message, skipping");
-                flb_pack_state_reset(&ctx->pack_state);
-                flb_pack_state_init(&ctx->pack_state);
-                ctx->pack_state.multiple = FLB_TRUE;
+                ctx->buf_len = 0;
+                ctx->buf_data[0] = '\0';
 
                 return -1;
             }
 
             /*
-             * Given the Tokens used for the packaged message, append
-             * the records and then adjust buffer.
+             * Append the packed records and remove them from the buffer,
+             * an incomplete message after them is resumed on next read.
              */
             process_pack(ctx, pack, out_size);
             flb_free(pack);
 
-            t = &ctx->pack_state.tokens[0];
-            consume_bytes(ctx->buf_data, t->end, ctx->buf_len);
-            ctx->buf_len -= t->end;
+            consume_bytes(ctx->buf_data, ctx->pack_state.last_byte,
+                          ctx->buf_len);
+            ctx->buf_len -= ctx->pack_state.last_byte;
             ctx->buf_data[ctx->buf_len] = '\0';
-
-            flb_pack_state_reset(&ctx->pack_state);
-            flb_pack_state_init(&ctx->pack_state);
-            ctx->pack_state.multiple = FLB_TRUE;
         }
         else {
             /* Process and enqueue the received line */
@@ -266,6 +262,7 @@ int in_serial_exit(void *in_context, struct flb_config *config)
     tcsetattr(ctx->fd, TCSANOW, &ctx->tio_orig);
 
     flb_pack_state_reset(&ctx->pack_state);
+    flb_chain_reset(&ctx->chain);
     flb_free(ctx);
 
     return 0;
@@ -287,6 +284,7 @@ int in_serial_init(struct flb_input_instance *in,
         return -1;
     }
     ctx->format = FLB_SERIAL_FORMAT_NONE;
+    ctx->in = in;
 
     if (!serial_config_read(ctx, in)) {
         return -1;
@@ -301,8 +299,8 @@ int in_serial_init(struct flb_input_instance *in,
     flb_input_set_context(in, ctx);
 
     /* initialize MessagePack buffers */
-    msgpack_sbuffer_init(&ctx->mp_sbuf);
-    msgpack_packer_init(&ctx->mp_pck, &ctx->mp_sbuf, msgpack_sbuffer_write);
+    flb_chain_init(&ctx->chain);
+    flb_chain_packer_init(&ctx->mp_pck, &ctx->chain);
 
     /* open device */
     fd = open(ctx->file, O_RDWR | O_NOCTTY | O_NONBLOCK);
@@ -361,6 +359,6 @@ struct flb_input_plugin in_serial_plugin = {
     .cb_init      = in_serial_init,
     .cb_pre_run   = NULL,
     .cb_collect   = in_serial_collect,
-    .cb_flush_buf = in_serial_flush,
+    .cb_flush_chain = in_serial_flush,
     .cb_exit      = in_serial_exit
 };
@@ -28,6 +28,7 @@
 #include <msgpack.h>
 
 #include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_chain.h>
 
 struct flb_in_serial_config {
     int fd;           /* Socket to destination/backend */
@@ -58,9 +59,10 @@ struct flb_in_serial_config {
     /* Line processing */
     int buffer_id;
 
-    /* MessagePack buffers */
+    /* MessagePack packer writing to a chained buffer */
     msgpack_packer  mp_pck;
-    msgpack_sbuffer mp_sbuf;
+    struct flb_chain chain;
+    struct flb_input_instance *in;
 
     /*
      * If (format == FLB_SERIAL_FORMAT_JSON), we use this pack_state
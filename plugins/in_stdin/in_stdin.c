@@ -47,9 +47,11 @@ int in_stdin_init(struct flb_input_instance *in,
     }
 
     /* initialize MessagePack buffers */
-    msgpack_sbuffer_init(&ctx->mp_sbuf);
-    msgpack_packer_init(&ctx->mp_pck, &ctx->mp_sbuf, msgpack_sbuffer_write);
+    flb_chain_init(&ctx->chain);
+    flb_chain_packer_init(&ctx->mp_pck, &ctx->chain);
     ctx->buffer_id = 0;
+    ctx->buf_len = 0;
+    ctx->in = in;
 
     /* Clone the standard input file descriptor */
     fd = dup(STDIN_FILENO);
@@ -82,6 +84,10 @@ int in_stdin_collect(struct flb_config *config, void *in_context)
     char *pack;
     msgpack_unpacked result;
     size_t start = 0, off = 0;
+    size_t size;
+    time_t t;
+    struct flb_time tm;
+    msgpack_object *o;
     struct flb_in_stdin_config *ctx = in_context;
 
     bytes = read(ctx->fd,
@@ -102,17 +108,28 @@ int in_stdin_collect(struct flb_config *config, void *in_context)
     ctx->buf_len = 0;
 
     /* Queue the data with time field */
+    flb_time_now(&tm);
     msgpack_unpacked_init(&result);
 
     while (msgpack_unpack_next(&result, pack, out_size, &off)) {
-        if (result.data.type == MSGPACK_OBJECT_MAP) {
+        size = ctx->chain.size;
+        o = &result.data;
+        if (o->type == MSGPACK_OBJECT_MAP) {
             /* { map => val, map => val, map => val } */
             msgpack_pack_array(&ctx->mp_pck, 2);
-            msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+            flb_time_append_to_msgpack(&tm, &ctx->mp_pck);
             msgpack_pack_bin_body(&ctx->mp_pck, pack + start, off - start);
+            t = tm.tm.tv_sec;
         } else {
             msgpack_pack_bin_body(&ctx->mp_pck, pack + start, off - start);
+
+            /* already a record ? take it time */
+            if (o->type != MSGPACK_OBJECT_ARRAY || o->via.array.size != 2 ||
+                flb_record_time_get(&o->via.array.ptr[0], &t) != 0) {
+                t = tm.tm.tv_sec;
+            }
         }
+        flb_chunk_meta_add(&ctx->in->meta, t, ctx->chain.size - size);
         ctx->buffer_id++;
 
         start = off;
@@ -123,33 +140,16 @@ int in_stdin_collect(struct flb_config *config, void *in_context)
     return 0;
 }
 
-void *in_stdin_flush(void *in_context, size_t *size)
+void in_stdin_flush(void *in_context, struct flb_chain *chain)
 {
-    char *buf;
-    msgpack_sbuffer *sbuf;
     struct flb_in_stdin_config *ctx = in_context;
 
     if (ctx->buffer_id == 0)
-        goto fail;
-
-    sbuf = &ctx->mp_sbuf;
-    *size = sbuf->size;
-    buf = flb_malloc(sbuf->size);
-    if (!buf)
-        goto fail;
-
-    /* set a new buffer and re-initialize our MessagePack context */
-    memcpy(buf, sbuf->data, sbuf->size);
-    msgpack_sbuffer_destroy(&ctx->mp_sbuf);
-    msgpack_sbuffer_init(&ctx->mp_sbuf);
-    msgpack_packer_init(&ctx->mp_pck, &ctx->mp_sbuf, msgpack_sbuffer_write);
+        return;
 
+    /* hand over the blocks, the packer keeps writing to the empty chain */
+    flb_chain_move(chain, &ctx->chain);
     ctx->buffer_id = 0;
-
-    return buf;
-
-fail:
-    return NULL;
 }
 
 /* Cleanup serial input */
@@ -158,6 +158,7 @@ int in_stdin_exit(void *in_context, struct flb_config *config)
     struct flb_in_stdin_config *ctx = in_context;
 
     close(ctx->fd);
+    flb_chain_reset(&ctx->chain);
     flb_free(ctx);
 
     return 0;
@@ -170,6 +171,6 @@ struct flb_input_plugin in_stdin_plugin = {
     .cb_init      = in_stdin_init,
     .cb_pre_run   = NULL,
     .cb_collect   = in_stdin_collect,
-    .cb_flush_buf = in_stdin_flush,
+    .cb_flush_chain = in_stdin_flush,
     .cb_exit      = in_stdin_exit
 };
@@ -31,8 +31,9 @@ struct flb_in_stdin_config {
     char buf[8192 * 2];               /* read buffer: 16Kb max */
 
     int buffer_id;
-    struct msgpack_sbuffer mp_sbuf;  /* msgpack sbuffer        */
+    struct flb_chain chain;          /* packed records         */
     struct msgpack_packer mp_pck;    /* msgpack packer         */
+    struct flb_input_instance *in;   /* input instance         */
 };
 
 int in_stdin_collect(struct flb_config *config, void *in_context);
@@ -26,57 +26,42 @@
 #include "tcp_conn.h"
 #include "tcp_config.h"
 
-static void *in_tcp_flush(void *in_context, size_t *size)
+static void in_tcp_flush(void *in_context, struct flb_chain *chain)
 {
-    char *buf;
-    msgpack_sbuffer *sbuf;
     struct flb_in_tcp_config *ctx = in_context;
 
     if (ctx->buffer_id == 0) {
-        return NULL;
+        return;
     }
 
-    sbuf = &ctx->mp_sbuf;
-    *size = sbuf->size;
-    buf = flb_malloc(sbuf->size);
-    if (!buf) {
-        return NULL;
-    }
-
-    /* set a new buffer and re-initialize our MessagePack context */
-    memcpy(buf, sbuf->data, sbuf->size);
-    msgpack_sbuffer_destroy(&ctx->mp_sbuf);
-    msgpack_sbuffer_init(&ctx->mp_sbuf);
-    msgpack_packer_init(&ctx->mp_pck, &ctx->mp_sbuf, msgpack_sbuffer_write);
-
+    /* hand over the blocks, the packer keeps writing to the empty chain */
+    flb_chain_move(chain, &ctx->chain);
     ctx->buffer_id = 0;
-
-    return buf;
 }
 
 /*
  * For a server event, the collection event means a new client have arrived, we
  * accept the connection and create a new TCP instance which will wait for
- * JSON map messages.
+ * JSON map messages. The context is the listener that became ready.
  */
 static int in_tcp_collect(struct flb_config *config, void *in_context)
 {
-    int fd;
-    struct flb_in_tcp_config *ctx = in_context;
+    int i;
+    int n;
+    int fds[FLB_NET_ACCEPT_BATCH];
+    struct flb_net_listener *server = in_context;
+    struct flb_in_tcp_config *ctx = server->ctx;
     struct tcp_conn *conn;
 
-    /* Accept the new connection */
-    fd = flb_net_accept(ctx->server_fd);
-    if (fd == -1) {
-        flb_error("[in_tcp] could not accept new connection");
-        return -1;
+    n = flb_net_accept_batch(server->fd, fds, FLB_NET_ACCEPT_BATCH);
+    for (i = 0; i < n; i++) {
+        flb_trace("[in_tcp] new TCP connection arrived FD=%i", fds[i]);
+        conn = tcp_conn_add(fds[i], ctx);
+        if (!conn) {
+            flb_error("[in_tcp] could not register connection FD=%i", fds[i]);
+        }
     }
 
-    flb_trace("[in_tcp] new TCP connection arrived FD=%i", fd);
-    conn = tcp_conn_add(fd, ctx);
-    if (!conn) {
-        return -1;
-    }
     return 0;
 }
 
@@ -84,6 +69,7 @@ static int in_tcp_collect(struct flb_config *config, void *in_context)
 static int in_tcp_init(struct flb_input_instance *in,
                       struct flb_config *config, void *data)
 {
+    int i;
     int ret;
     struct flb_in_tcp_config *ctx;
     (void) data;
@@ -100,31 +86,39 @@ static int in_tcp_init(struct flb_input_instance *in,
     flb_input_set_context(in, ctx);
 
     /* Create TCP server */
-    ctx->server_fd = flb_net_server(ctx->tcp_port, ctx->listen);
-    if (ctx->server_fd > 0) {
-        flb_info("[in_tcp] binding %s:%s", ctx->listen, ctx->tcp_port);
+    ret = flb_net_server_listeners(ctx->tcp_port, ctx->listen,
+                                   ctx->server_fds, ctx->listeners);
+    if (ret > 0) {
+        flb_info("[in_tcp] binding %s:%s listeners=%i",
+                 ctx->listen, ctx->tcp_port, ctx->listeners);
     }
     else {
         flb_error("[in_tcp] could not bind address %s:%s. Aborting",
                   ctx->listen, ctx->tcp_port);
         return -1;
     }
-    flb_net_socket_nonblocking(ctx->server_fd);
 
     ctx->evl = config->evl;
     ctx->buffer_id = 0;
 
     /* Initialize MessagePack buffers */
-    msgpack_sbuffer_init(&ctx->mp_sbuf);
-    msgpack_packer_init(&ctx->mp_pck, &ctx->mp_sbuf, msgpack_sbuffer_write);
-
-    /* Collect upon data available on the standard input */
-    ret = flb_input_set_collector_socket(in,
-                                        in_tcp_collect,
-                                        ctx->server_fd,
-                                        config);
-    if (ret == -1) {
-        flb_utils_error_c("Could not set collector for IN_TCP input plugin");
+    flb_chain_init(&ctx->chain);
+    flb_chain_packer_init(&ctx->mp_pck, &ctx->chain);
+
+    /* Collect upon new connections, one collector per listening socket */
+    for (i = 0; i < ctx->listeners; i++) {
+        ctx->servers[i].fd  = ctx->server_fds[i];
+        ctx->servers[i].ctx = ctx;
+        flb_net_socket_nonblocking(ctx->server_fds[i]);
+        ret = flb_input_set_collector_socket(in,
+                                            in_tcp_collect,
+                                            ctx->server_fds[i],
+                                            config);
+        if (ret == -1) {
+            flb_utils_error_c("Could not set collector for IN_TCP input plugin");
+        }
+        flb_input_set_collector_context(in, ctx->server_fds[i],
+                                        &ctx->servers[i], config);
     }
 
     return 0;
@@ -143,7 +137,7 @@ static int in_tcp_exit(void *data, struct flb_config *config)
         tcp_conn_del(conn);
     }
 
-    msgpack_sbuffer_destroy(&ctx->mp_sbuf);
+    flb_chain_reset(&ctx->chain);
     tcp_config_destroy(ctx);
     return 0;
 }
@@ -155,7 +149,7 @@ struct flb_input_plugin in_tcp_plugin = {
     .cb_init      = in_tcp_init,
     .cb_pre_run   = NULL,
     .cb_collect   = in_tcp_collect,
-    .cb_flush_buf = in_tcp_flush,
+    .cb_flush_chain = in_tcp_flush,
     .cb_exit      = in_tcp_exit,
     .flags        = FLB_INPUT_NET,
 };
@@ -22,18 +22,21 @@
 
 #include <msgpack.h>
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_network.h>
 
 struct flb_in_tcp_config {
-    int server_fd;               /* TCP server file descriptor  */
+    int listeners;               /* Number of listening sockets */
+    int server_fds[FLB_NET_LISTENERS_MAX]; /* TCP server sockets  */
+    struct flb_net_listener servers[FLB_NET_LISTENERS_MAX]; /* collectors */
     int buffer_id;
     size_t buffer_size;          /* Buffer size for each reader */
     size_t chunk_size;           /* Chunk allocation size       */
     char *listen;                /* Listen interface            */
     char *tcp_port;              /* TCP Port                    */
 
-    /* MessagePack buffers */
+    /* MessagePack packer writing to a chained buffer */
     msgpack_packer  mp_pck;
-    msgpack_sbuffer mp_sbuf;
+    struct flb_chain chain;
 
     struct mk_list connections;  /* List of active connections */
     struct mk_event_loop *evl;      /* Event loop file descriptor */
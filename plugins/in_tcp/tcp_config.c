@@ -18,6 +18,7 @@
  */
 
 #include <stdlib.h>
+#include <unistd.h>
 #include <fluent-bit/flb_utils.h>
 
 #include "tcp.h"
@@ -30,6 +31,7 @@ struct flb_in_tcp_config *tcp_config_init(struct flb_input_instance *i_ins)
     char *listen;
     char *buffer_size;
     char *chunk_size;
+    char *listeners;
     struct flb_in_tcp_config *config;
 
     config = flb_malloc(sizeof(struct flb_in_tcp_config));
@@ -78,6 +80,27 @@ struct flb_in_tcp_config *tcp_config_init(struct flb_input_instance *i_ins)
         config->buffer_size  = (atoi(buffer_size) * 1024);
     }
 
+    /*
+     * Number of listening sockets, more than one uses SO_REUSEPORT. They
+     * are all served by the engine thread: it splits the accept queue, it
+     * does not add parallelism.
+     */
+    listeners = flb_input_get_property("listeners", i_ins);
+    if (!listeners) {
+        config->listeners = 1;
+    }
+    else {
+        config->listeners = atoi(listeners);
+        if (config->listeners < 1) {
+            config->listeners = 1;
+        }
+        else if (config->listeners > FLB_NET_LISTENERS_MAX) {
+            flb_warn("[in_tcp] Listeners=%i is too high, using %i",
+                     config->listeners, FLB_NET_LISTENERS_MAX);
+            config->listeners = FLB_NET_LISTENERS_MAX;
+        }
+    }
+
     flb_debug("[in_tcp] Listen='%s' TCP_Port=%s",
               config->listen, config->tcp_port);
 
@@ -86,6 +109,14 @@ struct flb_in_tcp_config *tcp_config_init(struct flb_input_instance *i_ins)
 
 int tcp_config_destroy(struct flb_in_tcp_config *config)
 {
+    int i;
+
+    for (i = 0; i < config->listeners; i++) {
+        if (config->server_fds[i] > 0) {
+            close(config->server_fds[i]);
+        }
+    }
+
     flb_free(config->tcp_port);
     flb_free(config);
 
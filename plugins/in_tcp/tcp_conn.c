@@ -36,25 +36,31 @@ static inline int process_pack(struct tcp_conn *conn,
                                char *pack, size_t size)
 {
     size_t off = 0;
+    size_t start;
+    struct flb_time tm;
     msgpack_unpacked result;
     msgpack_object entry;
     struct flb_in_tcp_config *ctx;
 
     ctx = conn->ctx;
+    flb_time_now(&tm);
 
     /* First pack the results, iterate concatenated messages */
     msgpack_unpacked_init(&result);
     while (msgpack_unpack_next(&result, pack, size, &off)) {
         entry = result.data;
+        start = ctx->chain.size;
 
         msgpack_pack_array(&ctx->mp_pck, 2);
-        msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+        flb_time_append_to_msgpack(&tm, &ctx->mp_pck);
 
         msgpack_pack_map(&ctx->mp_pck, 1);
         msgpack_pack_bin(&ctx->mp_pck, 3);
         msgpack_pack_bin_body(&ctx->mp_pck, "msg", 3);
         msgpack_pack_object(&ctx->mp_pck, entry);
 
+        flb_chunk_meta_add(&ctx->in->meta, tm.tm.tv_sec,
+                           ctx->chain.size - start);
         ctx->buffer_id++;
     }
 
@@ -74,7 +80,6 @@ int tcp_conn_event(void *data)
     struct mk_event *event;
     struct tcp_conn *conn = data;
     struct flb_in_tcp_config *ctx = conn->ctx;
-    jsmntok_t *t;
 
     event = &conn->event;
     if (event->mask & MK_EVENT_READ) {
@@ -115,16 +120,6 @@ int tcp_conn_event(void *data)
         conn->buf_len += bytes;
         conn->buf_data[conn->buf_len] = '\0';
 
-        /* Strip CR or LF if found at first byte */
-        if (conn->buf_data[0] == '\r' || conn->buf_data[0] == '\n') {
-            /* Skip message with one byte with CR or LF */
-            flb_trace("[in_tcp] skip one byte message with ASCII code=%i",
-                      conn->buf_data[0]);
-            consume_bytes(conn->buf_data, 1, conn->buf_len);
-            conn->buf_len--;
-        }
-
-
         /* JSON Format handler */
         char *pack;
         int out_size;
@@ -132,33 +127,27 @@ int tcp_conn_event(void *data)
         ret = flb_pack_json_state(conn->buf_data, conn->buf_len,
                                   &pack, &out_size, &conn->pack_state);
         if (ret == FLB_ERR_JSON_PART) {
-            flb_debug("[in_serial] JSON incomplete, waiting for more data...");
+            flb_debug("[in_tcp] JSON incomplete, waiting for more data...");
             return 0;
         }
-        else if (ret == FLB_ERR_JSON_INVAL) {
-            flb_debug("[in_serial] invalid JSON message, skipping");
-            flb_pack_state_reset(&conn->pack_state);
-            flb_pack_state_init(&conn->pack_state);
-            conn->pack_state.multiple = FLB_TRUE;
-
+        else if (ret != 0) {
+            flb_debug("[in_tcp] invalid JSON message, skipping");
+            conn->buf_len = 0;
+            conn->buf_data[0] = '\0';
             return -1;
         }
 
         /*
-         * Given the Tokens used for the packaged message, append
-         * the records and then adjust buffer.
+         * Append the packed records and remove them from the buffer, the
+         * parser resumes an incomplete message after them on next read.
          */
         process_pack(conn, pack, out_size);
 
-        t = &conn->pack_state.tokens[0];
-        consume_bytes(conn->buf_data, t->end, conn->buf_len);
-        conn->buf_len -= t->end;
+        consume_bytes(conn->buf_data, conn->pack_state.last_byte,
+                      conn->buf_len);
+        conn->buf_len -= conn->pack_state.last_byte;
         conn->buf_data[conn->buf_len] = '\0';
 
-        flb_pack_state_reset(&conn->pack_state);
-        flb_pack_state_init(&conn->pack_state);
-        conn->pack_state.multiple = FLB_TRUE;
-
         flb_free(pack);
         return bytes;
     }
@@ -215,6 +204,7 @@ struct tcp_conn *tcp_conn_add(int fd, struct flb_in_tcp_config *ctx)
     ret = mk_event_add(ctx->evl, fd, FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, conn);
     if (ret == -1) {
         flb_error("[in_tcp] could not register new connection");
+        flb_pack_state_reset(&conn->pack_state);
         close(fd);
         flb_free(conn->buf_data);
         flb_free(conn);
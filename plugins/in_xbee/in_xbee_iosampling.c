@@ -132,6 +132,7 @@ void in_xbee_iosampling_cb(struct xbee *xbee, struct xbee_con *con,
     int map_len = 0;
     unsigned int mask_din, mask_ain;
     char source_addr[8 * 2 + 1];
+    struct flb_time tm;
 
     if ((*pkt)->dataLen == 0) {
         flb_warn("xbee data length too short, skip");
@@ -161,8 +162,9 @@ void in_xbee_iosampling_cb(struct xbee *xbee, struct xbee_con *con,
     in_xbee_flush_if_needed(ctx);
     ctx->buffer_id++;
 
+    flb_time_get(&tm);
     msgpack_pack_array(&ctx->mp_pck, 2);
-    msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&tm, &ctx->mp_pck);
     msgpack_pack_map(&ctx->mp_pck, map_len);
 
     /* source address */
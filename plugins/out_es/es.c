@@ -22,70 +22,26 @@
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_network.h>
 #include <fluent-bit/flb_http_client.h>
-#include <cjson/cjson.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_record.h>
 
 #include "es.h"
-#include "es_bulk.h"
 
 struct flb_output_plugin out_es_plugin;
 
 /*
- * Convert the internal Fluent Bit data representation to the required
- * one by Elasticsearch.
- *
- * 'Sadly' this process involves to convert from Msgpack to JSON.
+ * Convert the internal Fluent Bit data representation to the Bulk API
+ * request required by Elasticsearch: every record is written as a JSON
+ * line preceded by a line with the target 'index' and 'type'.
  */
-static char *es_format(void *data, size_t bytes, int *out_size,
-                       struct flb_out_es_config *ctx)
+static int es_format(void *data, size_t bytes, msgpack_sbuffer *out,
+                     struct flb_out_es_config *ctx)
 {
-    int i;
-    int ret;
-    int n_size;
+    int records = 0;
     int index_len;
-    uint32_t psize;
-    size_t off = 0;
-    time_t atime;
-    char *buf;
-    char *ptr_key = NULL;
-    char *ptr_val = NULL;
-    char buf_key[256];
-    char buf_val[512];
-    msgpack_unpacked result;
-    msgpack_object root;
-    msgpack_object map;
-    char *j_entry;
     char j_index[ES_BULK_HEADER];
-    json_t *j_map;
-    struct es_bulk *bulk;
-
-    /* Iterate the original buffer and perform adjustments */
-    msgpack_unpacked_init(&result);
-
-    /* Perform some format validation */
-    ret = msgpack_unpack_next(&result, data, bytes, &off);
-    if (!ret) {
-        return NULL;
-    }
-
-    /* We 'should' get an array */
-    if (result.data.type != MSGPACK_OBJECT_ARRAY) {
-        /*
-         * If we got a different format, we assume the caller knows what he is
-         * doing, we just duplicate the content in a new buffer and cleanup.
-         */
-        return NULL;
-    }
-
-    root = result.data;
-    if (root.via.array.size == 0) {
-        return NULL;
-    }
-
-    /* Create the bulk composer */
-    bulk = es_bulk_create();
-    if (!bulk) {
-        return NULL;
-    }
+    struct flb_record rec;
+    struct flb_record_iter it;
 
     /* Format the JSON header required by the ES Bulk API */
     index_len = snprintf(j_index,
@@ -93,164 +49,27 @@ static char *es_format(void *data, size_t bytes, int *out_size,
                          ES_BULK_INDEX_FMT,
                          ctx->index, ctx->type);
 
-    off = 0;
-    msgpack_unpacked_destroy(&result);
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        if (result.data.type != MSGPACK_OBJECT_ARRAY) {
-            continue;
-        }
-
-        /* Each array must have two entries: time and record */
-        root = result.data;
-        if (root.via.array.size != 2) {
-            continue;
-        }
-
-        /* Create a map entry */
-        j_map = json_create_object();
-
-        atime = root.via.array.ptr[0].via.u64;
-        map   = root.via.array.ptr[1];
-
-        n_size = map.via.map.size + 1;
-
-        json_add_to_object(j_map, "date", json_create_number(atime));
-        for (i = 0; i < n_size - 1; i++) {
-            msgpack_object *k = &map.via.map.ptr[i].key;
-            msgpack_object *v = &map.via.map.ptr[i].val;
-
-            if (k->type != MSGPACK_OBJECT_BIN && k->type != MSGPACK_OBJECT_STR) {
-                continue;
-            }
-
-            /* Store key */
-            psize = k->via.bin.size;
-            if (psize <= (sizeof(buf_key) - 1)) {
-                memcpy(buf_key, k->via.bin.ptr, psize);
-                buf_key[psize] = '\0';
-                ptr_key = buf_key;
-            }
-            else {
-                /* Long JSON map keys have a performance penalty */
-                ptr_key = flb_malloc(psize + 1);
-                memcpy(ptr_key, k->via.bin.ptr, psize);
-                ptr_key[psize] = '\0';
-            }
-
-            /*
-             * Sanitize key name, Elastic Search 2.x don't allow dots
-             * in field names:
-             *
-             *   https://goo.gl/R5NMTr
-             */
-            char *p   = ptr_key;
-            char *end = ptr_key + psize;
-            while (p != end) {
-                if (*p == '.') *p = '_';
-                p++;
-            }
-
-            /* Store value */
-            if (v->type == MSGPACK_OBJECT_NIL) {
-                json_add_to_object(j_map, ptr_key, json_create_null());
-            }
-            else if (v->type == MSGPACK_OBJECT_BOOLEAN) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_bool(v->via.boolean));
-            }
-            else if (v->type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_number(v->via.u64));
-            }
-            else if (v->type == MSGPACK_OBJECT_NEGATIVE_INTEGER) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_number(v->via.i64));
-            }
-            else if (v->type == MSGPACK_OBJECT_FLOAT) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_number(v->via.f64));
-            }
-            else if (v->type == MSGPACK_OBJECT_STR) {
-                /* String value */
-                psize = v->via.str.size;
-                if (psize <= (sizeof(buf_val) - 1)) {
-                    memcpy(buf_val, v->via.str.ptr, psize);
-                    buf_val[psize] = '\0';
-                    ptr_val = buf_val;
-                }
-                else {
-                    ptr_val = flb_malloc(psize + 1);
-                    memcpy(ptr_val, k->via.str.ptr, psize);
-                    ptr_val[psize] = '\0';
-                }
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_string(ptr_val));
-            }
-            else if (v->type == MSGPACK_OBJECT_BIN) {
-                /* Bin value */
-                psize = v->via.bin.size;
-                if (psize <= (sizeof(buf_val) - 1)) {
-                    memcpy(buf_val, v->via.bin.ptr, psize);
-                    buf_val[psize] = '\0';
-                    ptr_val = buf_val;
-                }
-                else {
-                    ptr_val = flb_malloc(psize + 1);
-                    memcpy(ptr_val, k->via.bin.ptr, psize);
-                    ptr_val[psize] = '\0';
-                }
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_string(ptr_val));
-            }
-
-            if (ptr_key && ptr_key != buf_key) {
-                flb_free(ptr_key);
-            }
-            ptr_key = NULL;
-
-            if (ptr_val && ptr_val != buf_val) {
-                flb_free(ptr_val);
-            }
-            ptr_val = NULL;
-        }
+    /* Iterate the [time, map] records of the original buffer */
+    flb_record_iter_init(&it, data, bytes);
+    while (flb_record_iter_next(&it, &rec)) {
+        records++;
 
         /*
-         * At this point we have our JSON message, but in order to
-         * ingest this data into Elasticsearch we need to compose the
-         * Bulk API request, sadly it requires to prepend a JSON entry
-         * with details about the target 'index' and 'type' for EVERY
-         * message.
+         * Elastic Search 2.x don't allow dots in field names, they are
+         * replaced by underscores:
+         *
+         *   https://goo.gl/R5NMTr
          */
-        j_entry = json_print_unformatted(j_map);
-        json_delete(j_map);
-
-        ret = es_bulk_append(bulk,
-                             j_index, index_len,
-                             j_entry, strlen(j_entry));
-        flb_free(j_entry);
-        if (ret == -1) {
+        if (msgpack_sbuffer_write(out, j_index, index_len) != 0 ||
+            flb_msgpack_to_json_record(out, &rec, "date",
+                                       FLB_JSON_NODOTS) != 0 ||
+            msgpack_sbuffer_write(out, "\n", 1) != 0) {
             /* We likely ran out of memory, abort here */
-            msgpack_unpacked_destroy(&result);
-            *out_size = 0;
-            es_bulk_destroy(bulk);
-            return NULL;
+            return -1;
         }
     }
 
-    msgpack_unpacked_destroy(&result);
-
-    *out_size = bulk->len;
-    buf = bulk->ptr;
-
-    /*
-     * Note: we don't destroy the bulk as we need to keep the allocated
-     * buffer with the data. Instead we just release the bulk context and
-     * return the bulk->ptr buffer
-     */
-    flb_free(bulk);
-
-    return buf;
+    return records;
 }
 
 int cb_es_init(struct flb_output_instance *ins,
@@ -306,7 +125,11 @@ int cb_es_init(struct flb_output_instance *ins,
         flb_free(ctx);
         return -1;
     }
-
+    if (flb_output_upstream_set(upstream, ins) == -1) {
+        flb_upstream_destroy(upstream);
+        flb_free(ctx);
+        return -1;
+    }
 
     /* Set the context */
     ctx->u = upstream;
@@ -336,6 +159,20 @@ int cb_es_init(struct flb_output_instance *ins,
         }
     }
 
+    ctx->headers = flb_http_headers_create();
+    if (!ctx->headers ||
+        flb_http_headers_add(ctx->headers, "User-Agent", 10,
+                             "Fluent-Bit", 10) != 0 ||
+        flb_http_headers_add(ctx->headers, "Content-Type", 12,
+                             "application/json", 16) != 0) {
+        if (ctx->headers) {
+            flb_http_headers_destroy(ctx->headers);
+        }
+        flb_upstream_destroy(upstream);
+        flb_free(ctx);
+        return -1;
+    }
+
     flb_debug("[es] host=%s port=%i index=%s type=%s",
               ins->host.name, ins->host.port,
               ctx->index, ctx->type);
@@ -350,9 +187,8 @@ void cb_es_flush(void *data, size_t bytes,
                  struct flb_config *config)
 {
     int ret;
-    int bytes_out;
-    char *pack;
     size_t b_sent;
+    msgpack_sbuffer pack;
     struct flb_out_es_config *ctx = out_context;
     struct flb_upstream_conn *u_conn;
     struct flb_http_client *c;
@@ -361,29 +197,35 @@ void cb_es_flush(void *data, size_t bytes,
     (void) tag_len;
 
     /* Convert format */
-    pack = es_format(data, bytes, &bytes_out, ctx);
-    if (!pack) {
+    msgpack_sbuffer_init(&pack);
+    ret = es_format(data, bytes, &pack, ctx);
+    if (ret <= 0) {
+        msgpack_sbuffer_destroy(&pack);
         FLB_OUTPUT_RETURN(FLB_ERROR);
     }
 
     /* Get upstream connection */
     u_conn = flb_upstream_conn_get(ctx->u);
     if (!u_conn) {
-        flb_free(pack);
+        msgpack_sbuffer_destroy(&pack);
         FLB_OUTPUT_RETURN(FLB_RETRY);
     }
 
     /* Compose HTTP Client request */
     c = flb_http_client(u_conn, FLB_HTTP_POST, "/_bulk",
-                        pack, bytes_out, NULL, 0, NULL);
-    flb_http_add_header(c, "User-Agent", 10, "Fluent-Bit", 10);
-    flb_http_add_header(c, "Content-Type", 12, "application/json", 16);
+                        pack.data, pack.size, NULL, 0, NULL);
+    if (!c) {
+        msgpack_sbuffer_destroy(&pack);
+        flb_upstream_conn_release(u_conn);
+        FLB_OUTPUT_RETURN(FLB_RETRY);
+    }
+    flb_http_add_headers(c, ctx->headers);
 
     ret = flb_http_do(c, &b_sent);
     flb_debug("[out_es] http_do=%i", ret);
     flb_http_client_destroy(c);
 
-    flb_free(pack);
+    msgpack_sbuffer_destroy(&pack);
 
     /* Release the connection */
     flb_upstream_conn_release(u_conn);
@@ -395,6 +237,7 @@ int cb_es_exit(void *data, struct flb_config *config)
     struct flb_out_es_config *ctx = data;
 
     flb_upstream_destroy(ctx->u);
+    flb_http_headers_destroy(ctx->headers);
     flb_free(ctx);
 
     return 0;
@@ -23,11 +23,17 @@
 #define FLB_ES_DEFAULT_HOST   "127.0.0.1"
 #define FLB_ES_DEFAULT_PORT   92000
 
+#define ES_BULK_HEADER      128  /* ES Bulk API prefix line  */
+#define ES_BULK_INDEX_FMT   "{\"index\":{\"_index\":\"%s\",\"_type\":\"%s\"}}\n"
+
 struct flb_out_es_config {
     /* Elasticsearch index (database) and type (table) */
     char *index;
     char *type;
 
+    /* User-Agent and Content-Type, the same on every request */
+    struct flb_http_headers *headers;
+
     /* Upstream connection to the backend server */
     struct flb_upstream *u;
 };
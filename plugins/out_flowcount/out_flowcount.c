@@ -23,6 +23,8 @@
 
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_task.h>
+#include <fluent-bit/flb_batch.h>
 
 #include <msgpack.h>
 
@@ -83,22 +85,11 @@ static void output_fcount(FILE* f, struct flb_out_fcount_config *ctx, char* tag)
     /* TODO filtering with tag? */
 }
 
-static void count_up(msgpack_object *obj,
-                      struct flb_out_fcount_config *ctx, uint64_t size)
+static void count_up(struct flb_out_fcount_config *ctx, uint64_t size)
 {
     ctx->counts++;
     ctx->bytes += size;
-    /*TODO parse obj and count up specific data */
-}
-
-static time_t get_timestamp_from_msgpack(msgpack_object *p)
-{
-    if (p != NULL && p->via.array.size != 0) {
-        return p->via.array.ptr[0].via.u64; /* FIXME */
-    }
-    else{
-        return 0;
-    }
+    /*TODO parse rec and count up specific data */
 }
 
 static int out_fcount_init(struct flb_output_instance *ins, struct flb_config *config,
@@ -130,22 +121,27 @@ static void out_fcount_flush(void *data, size_t bytes,
                      void *out_context,
                      struct flb_config *config)
 {
-    msgpack_unpacked result;
     struct flb_out_fcount_config *ctx = out_context;
-    size_t off = 0;
+    struct flb_batch *batch;
     time_t t;
+    int i;
     int32_t diff;
-    uint64_t last_off   = 0;
     uint64_t byte_data  = 0;
 
+    (void) data;
+    (void) bytes;
     (void) i_ins;
     (void) config;
 
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        t = get_timestamp_from_msgpack(&result.data);
-        byte_data     = (uint64_t)(off - last_off);
-        last_off      = off;
+    /* only the time and size of the records are needed */
+    batch = flb_task_batch(flb_output_task());
+    if (!batch) {
+        FLB_OUTPUT_RETURN(FLB_RETRY);
+    }
+
+    for (i = 0; i < batch->rows; i++) {
+        t = batch->time[i].tm.tv_sec;
+        byte_data = batch->sizes[i];
 
         if ((diff = (int32_t)difftime(t,ctx->last_checked))< 0) {
             flb_error("[%s]time paradox?",PLUGIN_NAME);
@@ -162,10 +158,9 @@ static void out_fcount_flush(void *data, size_t bytes,
             diff -= ctx->tick;
         }
         if (diff >= 0) {
-            count_up(&result.data, ctx, byte_data);
+            count_up(ctx, byte_data);
         }
     }
-    msgpack_unpacked_destroy(&result);
 
     FLB_OUTPUT_RETURN(FLB_OK);
 }
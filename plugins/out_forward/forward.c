@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <assert.h>
 
@@ -26,6 +27,7 @@
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_record.h>
 
 #include "forward.h"
 
@@ -34,6 +36,7 @@ struct flb_output_plugin out_forward_plugin;
 int cb_forward_init(struct flb_output_instance *ins, struct flb_config *config,
                     void *data)
 {
+    char *tmp;
     struct flb_out_forward_config *ctx;
     struct flb_upstream *upstream;
     struct flb_uri_field *f_tag = NULL;
@@ -62,6 +65,11 @@ int cb_forward_init(struct flb_output_instance *ins, struct flb_config *config,
         flb_free(ctx);
         return -1;
     }
+    if (flb_output_upstream_set(upstream, ins) == -1) {
+        flb_upstream_destroy(upstream);
+        flb_free(ctx);
+        return -1;
+    }
     ctx->u = upstream;
     ctx->tag = FLB_CONFIG_DEFAULT_TAG;
     ctx->tag_len = sizeof(FLB_CONFIG_DEFAULT_TAG) - 1;
@@ -74,6 +82,12 @@ int cb_forward_init(struct flb_output_instance *ins, struct flb_config *config,
         }
     }
 
+    /* Fluentd < v0.14 only understands integer times */
+    tmp = flb_output_get_property("time_as_integer", ins);
+    if (tmp && (strcasecmp(tmp, "true") == 0 || strcasecmp(tmp, "on") == 0)) {
+        ctx->time_as_integer = FLB_TRUE;
+    }
+
     flb_output_set_context(ins, ctx);
     return 0;
 }
@@ -89,19 +103,53 @@ int cb_forward_exit(void *data, struct flb_config *config)
     return 0;
 }
 
+/*
+ * Copy the records to 'out' with their time as an integer. Entries that
+ * are not [time, map] are skipped, it returns the number of copied ones.
+ */
+static int time_to_integer(void *data, size_t bytes, msgpack_sbuffer *out)
+{
+    int n = 0;
+    msgpack_packer pck;
+    struct flb_record rec;
+    struct flb_record_iter it;
+
+    msgpack_packer_init(&pck, out, msgpack_sbuffer_write);
+
+    flb_record_iter_init(&it, data, bytes);
+    while (flb_record_iter_next(&it, &rec)) {
+        /* the map entries are copied as they are */
+        if (msgpack_pack_array(&pck, 2) != 0 ||
+            msgpack_pack_int64(&pck, flb_record_time(&rec)) != 0 ||
+            msgpack_pack_map(&pck, rec.size) != 0 ||
+            msgpack_sbuffer_write(out, rec.kv,
+                                  rec.raw + rec.raw_size - rec.kv) != 0) {
+            return -1;
+        }
+        n++;
+    }
+
+    return n;
+}
+
 void cb_forward_flush(void *data, size_t bytes,
                       char *tag, int tag_len,
                       struct flb_input_instance *i_ins, void *out_context,
                       struct flb_config *config)
 {
     int ret = -1;
+    int fd;
     int entries = 0;
-    size_t off = 0;
+    int iov_count;
+    off_t fd_offset;
     size_t total;
     size_t bytes_sent;
+    struct iovec iov_buf[2];
+    struct iovec *iov = iov_buf;
+    struct flb_task *task = flb_output_task();
     msgpack_packer   mp_pck;
     msgpack_sbuffer  mp_sbuf;
-    msgpack_unpacked result;
+    msgpack_sbuffer  body;
     struct flb_out_forward_config *ctx = out_context;
     struct flb_upstream_conn *u_conn;
     (void) i_ins;
@@ -113,14 +161,37 @@ void cb_forward_flush(void *data, size_t bytes,
     msgpack_sbuffer_init(&mp_sbuf);
     msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
 
-    /* Count number of entries, is there a better way to do this ? */
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        entries++;
+    /*
+     * The body is sent as it is unless the times must be rewritten. The
+     * task keeps the number of entries so no scan is needed.
+     */
+    entries = task->meta.records;
+    msgpack_sbuffer_init(&body);
+    if (ctx->time_as_integer == FLB_TRUE) {
+        /* records still chained, the rewrite needs them contiguous */
+        if (!data) {
+            data = flb_task_buf(task);
+        }
+        if (data) {
+            entries = time_to_integer(data, bytes, &body);
+        }
+        if (!data || entries == -1) {
+            msgpack_sbuffer_destroy(&body);
+            msgpack_sbuffer_destroy(&mp_sbuf);
+            FLB_OUTPUT_RETURN(FLB_RETRY);
+        }
+        if (entries == 0) {
+            flb_warn("[out_forward] no valid entries to flush");
+            msgpack_sbuffer_destroy(&body);
+            msgpack_sbuffer_destroy(&mp_sbuf);
+            FLB_OUTPUT_RETURN(FLB_OK);
+        }
+        data  = body.data;
+        bytes = body.size;
     }
+
     flb_debug("[out_fw] %i entries tag='%s' tag_len=%i",
               entries, tag, tag_len);
-    msgpack_unpacked_destroy(&result);
 
     /* Output: root array */
     msgpack_pack_array(&mp_pck, 2);
@@ -132,24 +203,59 @@ void cb_forward_flush(void *data, size_t bytes,
     u_conn = flb_upstream_conn_get(ctx->u);
     if (!u_conn) {
         flb_error("[out_forward] no upstream connections available");
+        msgpack_sbuffer_destroy(&body);
         msgpack_sbuffer_destroy(&mp_sbuf);
         FLB_OUTPUT_RETURN(FLB_RETRY);
     }
 
-    /* Write message header */
-    ret = flb_io_net_write(u_conn, mp_sbuf.data, mp_sbuf.size, &bytes_sent);
-    if (ret == -1) {
-        flb_error("[out_forward] could not write chunk header");
-        msgpack_sbuffer_destroy(&mp_sbuf);
-        flb_upstream_conn_release(u_conn);
-        FLB_OUTPUT_RETURN(FLB_RETRY);
+    /*
+     * If the data comes from a buffer chunk file, write the message header
+     * and let the Kernel send the body straight from the file, otherwise
+     * send header and body together in one scatter-gather write.
+     */
+    if (data && ctx->time_as_integer == FLB_FALSE &&
+        flb_output_chunk_fd(data, bytes, &fd, &fd_offset) == 0) {
+        ret = flb_io_net_write(u_conn, mp_sbuf.data, mp_sbuf.size,
+                               &bytes_sent);
+        if (ret == -1) {
+            flb_error("[out_forward] could not write chunk header");
+            msgpack_sbuffer_destroy(&mp_sbuf);
+            flb_upstream_conn_release(u_conn);
+            FLB_OUTPUT_RETURN(FLB_RETRY);
+        }
+        total = bytes_sent;
+        ret = flb_io_net_sendfile(u_conn, fd, fd_offset, bytes, &bytes_sent);
+    }
+    else {
+        /* Chained records: one entry per block after the header */
+        iov_count = 2;
+        if (!data) {
+            iov_count = task->chain.count + 1;
+            iov = flb_malloc(sizeof(struct iovec) * iov_count);
+            if (!iov) {
+                flb_errno();
+                msgpack_sbuffer_destroy(&body);
+                msgpack_sbuffer_destroy(&mp_sbuf);
+                flb_upstream_conn_release(u_conn);
+                FLB_OUTPUT_RETURN(FLB_RETRY);
+            }
+            flb_chain_iov(&task->chain, iov + 1, iov_count - 1);
+        }
+        else {
+            iov[1].iov_base = data;
+            iov[1].iov_len  = bytes;
+        }
+        iov[0].iov_base = mp_sbuf.data;
+        iov[0].iov_len  = mp_sbuf.size;
+        total = 0;
+        ret = flb_io_net_writev(u_conn, iov, iov_count, &bytes_sent);
+        if (iov != iov_buf) {
+            flb_free(iov);
+        }
     }
-
     msgpack_sbuffer_destroy(&mp_sbuf);
-    total = ret;
+    msgpack_sbuffer_destroy(&body);
 
-    /* Write body */
-    ret = flb_io_net_write(u_conn, data, bytes, &bytes_sent);
     if (ret == -1) {
         flb_error("[out_forward] error writing content body");
         flb_upstream_conn_release(u_conn);
@@ -171,5 +277,5 @@ struct flb_output_plugin out_forward_plugin = {
     .cb_pre_run   = NULL,
     .cb_flush     = cb_forward_flush,
     .cb_exit      = cb_forward_exit,
-    .flags        = FLB_OUTPUT_NET,
+    .flags        = FLB_OUTPUT_NET | FLB_OUTPUT_IOV,
 };
@@ -23,6 +23,7 @@
 struct flb_out_forward_config {
     size_t tag_len;
     char *tag;
+    int time_as_integer;    /* send seconds, not EventTime */
     struct flb_upstream *u;
 };
 
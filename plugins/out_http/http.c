@@ -24,162 +24,20 @@
 #include <errno.h>
 
 #include <msgpack.h>
-#include <cjson/cjson.h>
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_http_client.h>
+#include <fluent-bit/flb_task.h>
 #include <fluent-bit/flb_str.h>
 
 #include "http.h"
 
 struct flb_output_plugin out_http_plugin;
 
-static char *msgpack_to_json(char *data, uint64_t bytes, uint64_t *out_size)
-{
-    int i;
-    int n_size;
-    uint32_t psize;
-    size_t off = 0;
-    time_t atime;
-    char *ptr_key = NULL;
-    char *ptr_val = NULL;
-    char buf_key[256];
-    char buf_val[512];
-    char *out_json;
-    msgpack_unpacked result;
-    msgpack_object root;
-    msgpack_object map;
-    json_t *j_arr;
-    json_t *j_map;
-
-    /* Iterate the original buffer and perform adjustments */
-    msgpack_unpacked_init(&result);
-
-    j_arr = json_create_array();
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        if (result.data.type != MSGPACK_OBJECT_ARRAY) {
-            continue;
-        }
-
-        /* Each array must have two entries: time and record */
-        root = result.data;
-        if (root.via.array.size != 2) {
-            continue;
-        }
-
-        /* Create a map entry */
-        j_map = json_create_object();
-
-        atime = root.via.array.ptr[0].via.u64;
-        map   = root.via.array.ptr[1];
-
-        n_size = map.via.map.size + 1;
-
-        json_add_to_object(j_map, "date", json_create_number(atime));
-        for (i = 0; i < n_size - 1; i++) {
-            msgpack_object *k = &map.via.map.ptr[i].key;
-            msgpack_object *v = &map.via.map.ptr[i].val;
-
-            if (k->type != MSGPACK_OBJECT_BIN && k->type != MSGPACK_OBJECT_STR) {
-                continue;
-            }
-
-            /* Store key */
-            psize = k->via.str.size;
-            if (psize <= (sizeof(buf_key) - 1)) {
-                memcpy(buf_key, k->via.str.ptr, psize);
-                buf_key[psize] = '\0';
-                ptr_key = buf_key;
-            }
-            else {
-                /* Long JSON map keys have a performance penalty */
-                ptr_key = flb_malloc(psize + 1);
-                memcpy(ptr_key, k->via.str.ptr, psize);
-                ptr_key[psize] = '\0';
-            }
-
-            /* Store value */
-            if (v->type == MSGPACK_OBJECT_NIL) {
-                json_add_to_object(j_map, ptr_key, json_create_null());
-            }
-            else if (v->type == MSGPACK_OBJECT_BOOLEAN) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_bool(v->via.boolean));
-            }
-            else if (v->type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_number(v->via.u64));
-            }
-            else if (v->type == MSGPACK_OBJECT_NEGATIVE_INTEGER) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_number(v->via.i64));
-            }
-            else if (v->type == MSGPACK_OBJECT_FLOAT) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_number(v->via.f64));
-            }
-            else if (v->type == MSGPACK_OBJECT_STR) {
-                /* String value */
-                psize = v->via.str.size;
-                if (psize <= (sizeof(buf_val) - 1)) {
-                    memcpy(buf_val, v->via.str.ptr, psize);
-                    buf_val[psize] = '\0';
-                    ptr_val = buf_val;
-                }
-                else {
-                    ptr_val = flb_malloc(psize + 1);
-                    memcpy(ptr_val, v->via.str.ptr, psize);
-                    ptr_val[psize] = '\0';
-                }
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_string(ptr_val));
-            }
-            else if (v->type == MSGPACK_OBJECT_BIN) {
-                /* Bin value */
-                psize = v->via.bin.size;
-                if (psize <= (sizeof(buf_val) - 1)) {
-                    memcpy(buf_val, v->via.bin.ptr, psize);
-                    buf_val[psize] = '\0';
-                    ptr_val = buf_val;
-                }
-                else {
-                    ptr_val = flb_malloc(psize + 1);
-                    memcpy(ptr_val, v->via.bin.ptr, psize);
-                    ptr_val[psize] = '\0';
-                }
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_string(ptr_val));
-            }
-
-            if (ptr_key && ptr_key != buf_key) {
-                flb_free(ptr_key);
-            }
-            ptr_key = NULL;
-
-            if (ptr_val && ptr_val != buf_val) {
-                flb_free(ptr_val);
-            }
-            ptr_val = NULL;
-        }
-
-        /* Append the new map to the main array */
-        json_add_to_array(j_arr, j_map);
-    }
-
-    /* Release msgpack */
-    msgpack_unpacked_destroy(&result);
-
-    /* Format to JSON */
-    out_json = json_print_unformatted(j_arr);
-    json_delete(j_arr);
-    *out_size = strlen(out_json);
-
-    return out_json;
-}
-
 int cb_http_init(struct flb_output_instance *ins, struct flb_config *config,
                void *data)
 {
+    int ret;
     int ulen;
     int type;
     char *uri = NULL;
@@ -285,6 +143,11 @@ int cb_http_init(struct flb_output_instance *ins, struct flb_config *config,
         flb_free(ctx);
         return -1;
     }
+    if (flb_output_upstream_set(upstream, ins) == -1) {
+        flb_upstream_destroy(upstream);
+        flb_free(ctx);
+        return -1;
+    }
 
     if (ins->host.uri) {
         uri = flb_strdup(ins->host.uri->full);
@@ -320,11 +183,89 @@ int cb_http_init(struct flb_output_instance *ins, struct flb_config *config,
         else if (strcasecmp(tmp, "json") == 0) {
             ctx->out_format = FLB_HTTP_OUT_JSON;
         }
+        else if (strcasecmp(tmp, "json_lines") == 0) {
+            ctx->out_format = FLB_HTTP_OUT_JSON_LINES;
+        }
         else {
             flb_warn("[out_http] unrecognized 'format' option. Using 'msgpack'");
         }
     }
 
+    /* Body compression */
+    ctx->compress = FLB_FALSE;
+    tmp = flb_output_get_property("compress", ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "gzip") == 0) {
+#ifdef FLB_HAVE_ZLIB
+            ctx->compress = FLB_TRUE;
+#else
+            flb_warn("[out_http] built without zlib, 'compress' is ignored");
+#endif
+        }
+        else {
+            flb_warn("[out_http] unrecognized 'compress' option, ignoring");
+        }
+    }
+
+    /*
+     * The body is taken from the task encodings: when other routes ask for
+     * the same one the records are converted only once.
+     */
+    if (ctx->out_format == FLB_HTTP_OUT_JSON) {
+        ctx->encoding = FLB_TASK_ENC_JSON;
+    }
+    else if (ctx->out_format == FLB_HTTP_OUT_JSON_LINES) {
+        ctx->encoding = FLB_TASK_ENC_JSON_LINES;
+    }
+    else {
+        ctx->encoding = FLB_TASK_ENC_MSGPACK;
+    }
+    if (ctx->compress == FLB_TRUE) {
+        ctx->encoding |= FLB_TASK_ENC_GZIP;
+    }
+
+    ctx->headers = flb_http_headers_create();
+    if (!ctx->headers) {
+        flb_upstream_destroy(upstream);
+        flb_free(uri);
+        flb_free(ctx);
+        return -1;
+    }
+    if (ctx->out_format == FLB_HTTP_OUT_JSON) {
+        ret = flb_http_headers_add(ctx->headers,
+                                   FLB_HTTP_CONTENT_TYPE,
+                                   sizeof(FLB_HTTP_CONTENT_TYPE) - 1,
+                                   FLB_HTTP_MIME_JSON,
+                                   sizeof(FLB_HTTP_MIME_JSON) - 1);
+    }
+    else if (ctx->out_format == FLB_HTTP_OUT_JSON_LINES) {
+        ret = flb_http_headers_add(ctx->headers,
+                                   FLB_HTTP_CONTENT_TYPE,
+                                   sizeof(FLB_HTTP_CONTENT_TYPE) - 1,
+                                   FLB_HTTP_MIME_NDJSON,
+                                   sizeof(FLB_HTTP_MIME_NDJSON) - 1);
+    }
+    else {
+        ret = flb_http_headers_add(ctx->headers,
+                                   FLB_HTTP_CONTENT_TYPE,
+                                   sizeof(FLB_HTTP_CONTENT_TYPE) - 1,
+                                   FLB_HTTP_MIME_MSGPACK,
+                                   sizeof(FLB_HTTP_MIME_MSGPACK) - 1);
+    }
+    if (ret == 0 && ctx->compress == FLB_TRUE) {
+        ret = flb_http_headers_add(ctx->headers,
+                                   FLB_HTTP_CONTENT_ENC,
+                                   sizeof(FLB_HTTP_CONTENT_ENC) - 1,
+                                   "gzip", 4);
+    }
+    if (ret != 0) {
+        flb_http_headers_destroy(ctx->headers);
+        flb_upstream_destroy(upstream);
+        flb_free(uri);
+        flb_free(ctx);
+        return -1;
+    }
+
     ctx->u = upstream;
     ctx->uri  = uri;
     ctx->host = ins->host.name;
@@ -348,16 +289,17 @@ void cb_http_flush(void *data, size_t bytes,
     struct flb_upstream *u;
     struct flb_upstream_conn *u_conn;
     struct flb_http_client *c;
-    void *body;
-    uint64_t body_len;
+    char *body;
+    size_t body_len;
+    (void) data;
+    (void) bytes;
     (void) i_ins;
 
-    if (ctx->out_format == FLB_HTTP_OUT_JSON) {
-        body = msgpack_to_json(data, bytes, &body_len);
-    }
-    else {
-        body = data;
-        body_len = bytes;
+    /* The task owns the body, it's shared with any other route using it */
+    ret = flb_task_encoding(flb_output_task(), ctx->encoding,
+                            &body, &body_len);
+    if (ret == -1) {
+        FLB_OUTPUT_RETURN(FLB_ERROR);
     }
 
     /* Get upstream context and connection */
@@ -373,22 +315,13 @@ void cb_http_flush(void *data, size_t bytes,
                         body, body_len,
                         ctx->host, ctx->port,
                         ctx->proxy);
+    if (!c) {
+        flb_upstream_conn_release(u_conn);
+        FLB_OUTPUT_RETURN(FLB_RETRY);
+    }
 
     /* Append headers */
-    if (ctx->out_format == FLB_HTTP_OUT_JSON) {
-        flb_http_add_header(c,
-                            FLB_HTTP_CONTENT_TYPE,
-                            sizeof(FLB_HTTP_CONTENT_TYPE) - 1,
-                            FLB_HTTP_MIME_JSON,
-                            sizeof(FLB_HTTP_MIME_JSON) -1);
-    }
-    else {
-        flb_http_add_header(c,
-                            FLB_HTTP_CONTENT_TYPE,
-                            sizeof(FLB_HTTP_CONTENT_TYPE) - 1,
-                            FLB_HTTP_MIME_MSGPACK,
-                            sizeof(FLB_HTTP_MIME_MSGPACK) -1);
-    }
+    flb_http_add_headers(c, ctx->headers);
 
     ret = flb_http_do(c, &b_sent);
     if (ret == 0) {
@@ -420,10 +353,6 @@ void cb_http_flush(void *data, size_t bytes,
     /* Release the connection */
     flb_upstream_conn_release(u_conn);
 
-    if (ctx->out_format == FLB_HTTP_OUT_JSON) {
-        flb_free(body);
-    }
-
     FLB_OUTPUT_RETURN(out_ret);
 }
 
@@ -432,6 +361,7 @@ int cb_http_exit(void *data, struct flb_config *config)
     struct flb_out_http_config *ctx = data;
 
     flb_upstream_destroy(ctx->u);
+    flb_http_headers_destroy(ctx->headers);
 
     flb_free(ctx->proxy_host);
     flb_free(ctx->uri);
@@ -22,10 +22,14 @@
 
 #define FLB_HTTP_OUT_MSGPACK    0
 #define FLB_HTTP_OUT_JSON       1
+#define FLB_HTTP_OUT_JSON_LINES 2
 
 #define FLB_HTTP_CONTENT_TYPE   "Content-Type"
 #define FLB_HTTP_MIME_MSGPACK   "application/msgpack"
 #define FLB_HTTP_MIME_JSON      "application/json"
+#define FLB_HTTP_MIME_NDJSON    "application/x-ndjson"
+
+#define FLB_HTTP_CONTENT_ENC    "Content-Encoding"
 
 struct flb_out_http_config {
     /* Proxy */
@@ -35,12 +39,17 @@ struct flb_out_http_config {
 
     /* Output format */
     int out_format;
+    int compress;               /* gzip the request body ?          */
+    int encoding;               /* FLB_TASK_ENC_ value for the body */
 
     /* HTTP URI */
     char *uri;
     char *host;
     int  port;
 
+    /* Content-Type, the same on every request */
+    struct flb_http_headers *headers;
+
     /* Upstream connection to the backend server */
     struct flb_upstream *u;
 };
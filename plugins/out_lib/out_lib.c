@@ -21,6 +21,7 @@
 
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_record.h>
 
 #include <msgpack.h>
 
@@ -70,8 +71,8 @@ static void out_lib_flush(void *data, size_t bytes,
                           void *out_context,
                           struct flb_config *config)
 {
-    msgpack_unpacked result;
-    size_t off = 0;
+    struct flb_record rec;
+    struct flb_record_iter it;
     struct flb_out_lib_config *ctx = out_context;
     unsigned char* data_for_user   = NULL;
     (void) i_ins;
@@ -84,16 +85,19 @@ static void out_lib_flush(void *data, size_t bytes,
         FLB_OUTPUT_RETURN(FLB_ERROR);
     }
 
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        data_for_user = flb_calloc(1, bytes);
+    flb_record_iter_init(&it, data, bytes);
+    while (flb_record_iter_next(&it, &rec)) {
+        data_for_user = flb_malloc(rec.raw_size);
+        if (!data_for_user) {
+            flb_errno();
+            FLB_OUTPUT_RETURN(FLB_ERROR);
+        }
         /* FIXME: Now we return raw msgpack
                   we should return JSON format.
          */
-        memcpy(data_for_user, &result.data, bytes);
-        ctx->user_callback((void*)data_for_user, bytes);
+        memcpy(data_for_user, rec.raw, rec.raw_size);
+        ctx->user_callback((void*)data_for_user, rec.raw_size);
     }
-    msgpack_unpacked_destroy(&result);
     FLB_OUTPUT_RETURN(FLB_OK);
 }
 
@@ -20,7 +20,7 @@
 #include <stdio.h>
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_utils.h>
-#include <cjson.h>
+#include <fluent-bit/flb_pack.h>
 
 #include <msgpack.h>
 
@@ -57,6 +57,11 @@ int cb_nats_init(struct flb_output_instance *ins, struct flb_config *config,
         flb_free(ctx);
         return -1;
     }
+    if (flb_output_upstream_set(upstream, ins) == -1) {
+        flb_upstream_destroy(upstream);
+        flb_free(ctx);
+        return -1;
+    }
     ctx->u   = upstream;
     ctx->ins = ins;
     flb_output_set_context(ins, ctx);
@@ -64,134 +69,41 @@ int cb_nats_init(struct flb_output_instance *ins, struct flb_config *config,
     return 0;
 }
 
+/* Convert MsgPack records to a JSON array of [time, {"tag": ..., ...}] */
 static int msgpack_to_json(void *data, size_t bytes, char *tag,
-                           char **out_json, size_t *out_len)
+                           msgpack_sbuffer *out)
 {
-    int i;
-    int n_size;
-    size_t off = 0;
-    time_t atime;
-    char tmp_key[32];
-    char tmp_val[256];
-    char *tmp_ext;
-    json_t *j_root;
-    json_t *j_arr;
-    msgpack_object map;
-    msgpack_object root;
-    msgpack_object m_key;
-    msgpack_object m_val;
-    msgpack_packer   mp_pck;
-    msgpack_sbuffer  mp_sbuf;
-    msgpack_unpacked result;
-
-    /* Convert MsgPack to JSON */
-    msgpack_sbuffer_init(&mp_sbuf);
-    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
-    msgpack_unpacked_init(&result);
+    int n = 0;
+    struct flb_record rec;
+    struct flb_record_iter it;
 
-    j_root = json_create_array();
-
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        if (result.data.type != MSGPACK_OBJECT_ARRAY) {
-            continue;
-        }
+    if (!tag) {
+        tag = "fluentbit";
+    }
 
-        j_arr = json_create_array();
+    if (msgpack_sbuffer_write(out, "[", 1) != 0) {
+        return -1;
+    }
 
-        root = result.data;
-        if (root.via.array.size != 2) {
-            continue;
+    flb_record_iter_init(&it, data, bytes);
+    while (flb_record_iter_next(&it, &rec)) {
+        if (n++ > 0 && msgpack_sbuffer_write(out, ",", 1) != 0) {
+            return -1;
         }
 
-        atime  = root.via.array.ptr[0].via.u64;
-        map    = root.via.array.ptr[1];
-        n_size = map.via.map.size + 1;
-
-        json_add_to_array(j_arr, json_create_number(atime));
-
-        json_t *j_obj = json_create_object();
-
-        if (!tag) {
-            json_add_to_object(j_obj, "tag",
-                               json_create_string("fluentbit"));
-        }
-        else {
-            json_add_to_object(j_obj, "tag",
-                               json_create_string(tag));
+        if (msgpack_sbuffer_write(out, "[", 1) != 0 ||
+            flb_msgpack_to_json_time(out, &rec.time) != 0 ||
+            msgpack_sbuffer_write(out, ",{\"tag\":", 8) != 0 ||
+            flb_msgpack_to_json_str(out, tag, strlen(tag), 0) != 0 ||
+            flb_msgpack_to_json_fields(out, &rec, FLB_FALSE, 0) != 0 ||
+            msgpack_sbuffer_write(out, "}]", 2) != 0) {
+            return -1;
         }
-
-        for (i = 0; i < n_size - 1; i++) {
-            m_key = map.via.map.ptr[i].key;
-            m_val = map.via.map.ptr[i].val;
-
-            memcpy(tmp_key, m_key.via.bin.ptr, m_key.via.bin.size);
-            tmp_key[m_key.via.bin.size] = '\0';
-
-            if (m_val.type == MSGPACK_OBJECT_NIL) {
-                json_add_to_object(j_obj, tmp_key,
-                                   json_create_null());
-            }
-            else if (m_val.type == MSGPACK_OBJECT_BOOLEAN) {
-                json_add_to_object(j_obj, tmp_key,
-                                   json_create_bool(m_val.via.boolean));
-            }
-            else if (m_val.type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
-                json_add_to_object(j_obj, tmp_key,
-                                   json_create_number(m_val.via.u64));
-            }
-            else if (m_val.type == MSGPACK_OBJECT_NEGATIVE_INTEGER) {
-                json_add_to_object(j_obj, tmp_key,
-                                   json_create_number(m_val.via.i64));
-            }
-            else if (m_val.type == MSGPACK_OBJECT_FLOAT) {
-                json_add_to_object(j_obj, tmp_key,
-                                   json_create_number(m_val.via.f64));
-            }
-            else if (m_val.type == MSGPACK_OBJECT_STR) {
-                if (m_val.via.str.size > sizeof(tmp_val) - 1) {
-                    tmp_ext = flb_malloc(m_val.via.str.size + 1);
-                }
-                else {
-                    tmp_ext = tmp_val;
-                }
-                memcpy(tmp_ext, m_val.via.str.ptr, m_val.via.str.size);
-                tmp_ext[m_val.via.str.size] = '\0';
-
-                json_add_to_object(j_obj, tmp_key, json_create_string(tmp_ext));
-                if (tmp_ext != tmp_val) {
-                    flb_free(tmp_ext);
-                }
-            }
-            else if (m_val.type == MSGPACK_OBJECT_BIN) {
-                if (m_val.via.bin.size > sizeof(tmp_val) - 1) {
-                    tmp_ext = flb_malloc(m_val.via.bin.size + 1);
-                }
-                else {
-                    tmp_ext = tmp_val;
-                }
-                memcpy(tmp_ext, m_val.via.bin.ptr, m_val.via.bin.size);
-                tmp_ext[m_val.via.bin.size] = '\0';
-
-                json_add_to_object(j_obj, tmp_key, json_create_string(tmp_ext));
-                if (tmp_ext != tmp_val) {
-                    flb_free(tmp_ext);
-                }
-            }
-        }
-
-        json_add_to_array(j_arr, j_obj);
-        json_add_to_array(j_root, j_arr);
     }
-    msgpack_unpacked_destroy(&result);
-
-    *out_json = json_print_unformatted(j_root);
-    json_delete(j_root);
 
-    *out_len = strlen(*out_json);
-    return 0;
+    return msgpack_sbuffer_write(out, "]", 1);
 }
 
-
 void cb_nats_flush(void *data, size_t bytes,
                    char *tag, int tag_len,
                    struct flb_input_instance *i_ins,
@@ -200,10 +112,9 @@ void cb_nats_flush(void *data, size_t bytes,
 {
     int ret;
     size_t bytes_sent;
-    size_t json_len;
-    char *json_msg;
     char *request;
     int req_len;
+    msgpack_sbuffer json;
     struct flb_out_nats_config *ctx = out_context;
     struct flb_upstream_conn *u_conn;
 
@@ -226,22 +137,31 @@ void cb_nats_flush(void *data, size_t bytes,
     }
 
     /* Convert original Fluent Bit MsgPack format to JSON */
-    ret = msgpack_to_json(data, bytes, tag, &json_msg, &json_len);
+    msgpack_sbuffer_init(&json);
+    ret = msgpack_to_json(data, bytes, tag, &json);
     if (ret == -1) {
+        msgpack_sbuffer_destroy(&json);
+        flb_upstream_conn_release(u_conn);
         FLB_OUTPUT_RETURN(FLB_ERROR);
     }
 
     /* Compose the NATS Publish request */
-    request = flb_malloc(json_len + 32);
-    req_len = snprintf(request, json_len + 32, "PUB %s %zu\r\n",
-                       tag, json_len);
+    request = flb_malloc(json.size + tag_len + 32);
+    if (!request) {
+        flb_errno();
+        msgpack_sbuffer_destroy(&json);
+        flb_upstream_conn_release(u_conn);
+        FLB_OUTPUT_RETURN(FLB_RETRY);
+    }
+    req_len = snprintf(request, tag_len + 32, "PUB %s %zu\r\n",
+                       tag, json.size);
 
     /* Append JSON message and ending CRLF */
-    memcpy(request + req_len, json_msg, json_len);
-    req_len += json_len;
+    memcpy(request + req_len, json.data, json.size);
+    req_len += json.size;
     request[req_len++] = '\r';
     request[req_len++] = '\n';
-    flb_free(json_msg);
+    msgpack_sbuffer_destroy(&json);
 
     ret = flb_io_net_write(u_conn, request, req_len, &bytes_sent);
     if (ret == -1) {
@@ -24,6 +24,9 @@
 
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_record.h>
+#include <fluent-bit/flb_task.h>
+#include <fluent-bit/flb_batch.h>
 #include <msgpack.h>
 
 struct flb_plot_conf {
@@ -66,6 +69,108 @@ static int cb_plot_init(struct flb_output_instance *ins,
     return 0;
 }
 
+/*
+ * Write the data points of each record: the time and the value of the
+ * key or of the first map entry. A record without the key fails the
+ * flush, a record with a non numeric value is skipped.
+ */
+static int plot_records(struct flb_plot_conf *ctx, int fd,
+                        void *data, size_t bytes)
+{
+    time_t atime;
+    msgpack_object *val = NULL;
+    struct flb_record rec;
+    struct flb_record_kv kv;
+    struct flb_record_iter it;
+
+    flb_record_iter_init(&it, data, bytes);
+    while (flb_record_iter_next(&it, &rec)) {
+        atime = flb_record_time(&rec);
+        val = NULL;
+
+        /*
+         * Lookup key, we need to iterate the whole map as sometimes the
+         * data that gets in can set the keys in different order (e.g: forward,
+         * tcp, etc).
+         */
+        while (flb_record_kv_next(&rec, &kv)) {
+            if (!ctx->key_name) {
+                val = &kv.val;
+                break;
+            }
+
+            /* Get each key and compare, str and bin share the layout */
+            if (kv.key.type != MSGPACK_OBJECT_BIN &&
+                kv.key.type != MSGPACK_OBJECT_STR) {
+                return FLB_ERROR;
+            }
+
+            if (ctx->key_len == kv.key.via.bin.size &&
+                memcmp(kv.key.via.bin.ptr, ctx->key_name, ctx->key_len) == 0) {
+                val = &kv.val;
+                break;
+            }
+        }
+
+        if (!val) {
+            flb_error("[out_plot] unmatched key '%s'", ctx->key_name);
+            return FLB_ERROR;
+        }
+
+        if (val->type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
+            dprintf(fd, "%lu %" PRIu64 "\n", atime, val->via.u64);
+        }
+        else if (val->type == MSGPACK_OBJECT_NEGATIVE_INTEGER) {
+            dprintf(fd, "%lu %" PRId64 "\n", atime, val->via.i64);
+        }
+        else if (val->type == MSGPACK_OBJECT_FLOAT) {
+            dprintf(fd, "%lu %lf\n", atime, val->via.f64);
+        }
+        else {
+            flb_error("[out_plot] value must be integer, negative integer "
+                      "or float");
+        }
+    }
+
+    return FLB_OK;
+}
+
+/*
+ * Column of the key if every record has a value of a single numeric type
+ * for it, the common case: the data points are written straight from the
+ * time and value vectors of the task batch.
+ */
+static struct flb_batch_col *plot_column(struct flb_plot_conf *ctx,
+                                         struct flb_batch *batch)
+{
+    int i;
+    struct flb_batch_col *col;
+
+    if (!ctx->key_name || !batch) {
+        return NULL;
+    }
+
+    col = flb_batch_col_get(batch, ctx->key_name, ctx->key_len);
+    if (!col || col->promoted == FLB_TRUE ||
+        (col->type != FLB_BATCH_INT && col->type != FLB_BATCH_DOUBLE)) {
+        return NULL;
+    }
+
+    /* a value on every row, eight rows at a time */
+    for (i = 0; i < batch->rows / 8; i++) {
+        if (col->valid[i] != 0xff) {
+            return NULL;
+        }
+    }
+    for (i = batch->rows & ~7; i < batch->rows; i++) {
+        if (!flb_batch_valid(col, i)) {
+            return NULL;
+        }
+    }
+
+    return col;
+}
+
 static void cb_plot_flush(void *data, size_t bytes,
                           char *tag, int tag_len,
                           struct flb_input_instance *i_ins,
@@ -74,18 +179,20 @@ static void cb_plot_flush(void *data, size_t bytes,
 {
     int i;
     int fd;
+    int ret = FLB_OK;
     time_t atime;
-    msgpack_unpacked result;
-    size_t off = 0;
     char *out_file;
-    msgpack_object root;
-    msgpack_object map;
-    msgpack_object *key = NULL;
-    msgpack_object *val = NULL;
+    struct flb_batch *batch = NULL;
+    struct flb_batch_col *col;
     struct flb_plot_conf *ctx = out_context;
     (void) i_ins;
     (void) config;
 
+    if (ctx->key_name) {
+        batch = flb_task_batch(flb_output_task());
+    }
+    col = plot_column(ctx, batch);
+
     /* Set the right output */
     if (!ctx->out_file) {
         out_file = tag;
@@ -102,84 +209,27 @@ static void cb_plot_flush(void *data, size_t bytes,
         fd = STDOUT_FILENO;
     }
 
-    /*
-     * Upon flush, for each array, lookup the time and the first field
-     * of the map to use as a data point.
-     */
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        root = result.data;
-        atime = root.via.array.ptr[0].via.u64;
-        map   = root.via.array.ptr[1];
-
-        /*
-         * Lookup key, we need to iterate the whole map as sometimes the
-         * data that gets in can set the keys in different order (e.g: forward,
-         * tcp, etc).
-         */
-        if (ctx->key_name) {
-            for (i = 0; i < map.via.map.size; i++) {
-                /* Get each key and compare */
-                key = &map.via.map.ptr[i].key;
-                if (key->type == MSGPACK_OBJECT_BIN) {
-                    if (ctx->key_len == key->via.bin.size &&
-                        memcmp(key->via.bin.ptr, ctx->key_name, ctx->key_len) == 0) {
-                        val = &map.via.map.ptr[i].val;
-                        break;
-                    }
-                    key = NULL;
-                    val = NULL;
-                }
-                else if (key->type != MSGPACK_OBJECT_STR) {
-                    if (ctx->key_len == key->via.str.size &&
-                        memcmp(key->via.str.ptr, ctx->key_name, ctx->key_len) == 0) {
-                        val = &map.via.map.ptr[i].val;
-                        break;
-                    }
-                    key = NULL;
-                    val = NULL;
-                }
-                else {
-                    if (fd != STDOUT_FILENO) {
-                        close(fd);
-                    }
-                    FLB_OUTPUT_RETURN(FLB_ERROR);
-                }
+    if (col) {
+        for (i = 0; i < batch->rows; i++) {
+            atime = batch->time[i].tm.tv_sec;
+            if (col->type == FLB_BATCH_INT) {
+                dprintf(fd, "%lu %" PRId64 "\n", atime, col->v.i64[i]);
             }
-        }
-        else {
-            val = &map.via.map.ptr[0].val;
-        }
-
-        if (!val) {
-            flb_error("[out_plot] unmatched key '%s'", ctx->key_name);
-            if (fd != STDOUT_FILENO) {
-                close(fd);
+            else {
+                dprintf(fd, "%lu %lf\n", atime, col->v.f64[i]);
             }
-            FLB_OUTPUT_RETURN(FLB_ERROR);
-        }
-
-        if (val->type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
-            dprintf(fd, "%lu %" PRIu64 "\n", atime, val->via.u64);
-        }
-        else if (val->type == MSGPACK_OBJECT_NEGATIVE_INTEGER) {
-            dprintf(fd, "%lu %" PRId64 "\n", atime, val->via.i64);
-        }
-        else if (val->type == MSGPACK_OBJECT_FLOAT) {
-            dprintf(fd, "%lu %lf\n", atime, val->via.f64);
-        }
-        else {
-            flb_error("[out_plot] value must be integer, negative integer "
-                      "or float");
         }
     }
-    msgpack_unpacked_destroy(&result);
+    else {
+        /* no key, mixed types or missing values: record by record */
+        ret = plot_records(ctx, fd, data, bytes);
+    }
 
     if (fd != STDOUT_FILENO) {
         close(fd);
     }
 
-    FLB_OUTPUT_RETURN(FLB_OK);
+    FLB_OUTPUT_RETURN(ret);
 }
 
 static int cb_plot_exit(void *data, struct flb_config *config)
@@ -21,6 +21,8 @@
 
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_record.h>
+#include <fluent-bit/flb_time.h>
 
 #include <msgpack.h>
 
@@ -42,19 +44,41 @@ void cb_stdout_flush(void *data, size_t bytes,
                      void *out_context,
                      struct flb_config *config)
 {
-    msgpack_unpacked result;
-    size_t off = 0, cnt = 0;
+    size_t off;
+    size_t cnt = 0;
+    msgpack_zone zone;
+    msgpack_object obj;
+    struct flb_time tm;
+    struct flb_record rec;
+    struct flb_record_iter it;
     (void) i_ins;
     (void) out_context;
     (void) config;
 
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        printf("[%zd] %s: ", cnt++, tag);
-        msgpack_object_print(stdout, result.data);
-        printf("\n");
+    /* The whole record is decoded to print it, one zone is reused */
+    if (!msgpack_zone_init(&zone, MSGPACK_ZONE_CHUNK_SIZE)) {
+        FLB_OUTPUT_RETURN(FLB_RETRY);
     }
-    msgpack_unpacked_destroy(&result);
+
+    flb_record_iter_init(&it, data, bytes);
+    while (flb_record_iter_next(&it, &rec)) {
+        off = 0;
+        if (msgpack_unpack(rec.raw, rec.raw_size, &off,
+                           &zone, &obj) != MSGPACK_UNPACK_SUCCESS) {
+            continue;
+        }
+
+        /* msgpack-c can't print an EventTime, the time goes first */
+        if (flb_time_pop_from_msgpack(&tm, &rec.time) != 0) {
+            flb_time_set(&tm, 0, 0);
+        }
+        printf("[%zd] %s: [%lld.%09ld, ", cnt++, tag,
+               (long long) tm.tm.tv_sec, (long) tm.tm.tv_nsec);
+        msgpack_object_print(stdout, obj.via.array.ptr[1]);
+        printf("]\n");
+        msgpack_zone_clear(&zone);
+    }
+    msgpack_zone_destroy(&zone);
 
     FLB_OUTPUT_RETURN(FLB_OK);
 }
@@ -28,6 +28,7 @@
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_network.h>
 #include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_record.h>
 #include <fluent-bit/flb_http_client.h>
 
 #include "td.h"
@@ -45,38 +46,42 @@ struct flb_output_plugin out_td_plugin;
  */
 static char *td_format(void *data, size_t bytes, int *out_size)
 {
-    int i;
-    int ret;
-    int n_size;
-    size_t off = 0;
-    time_t atime;
+    int records = 0;
     char *buf;
     struct msgpack_sbuffer mp_sbuf;
     struct msgpack_packer mp_pck;
-    msgpack_unpacked result;
-    msgpack_object root;
-    msgpack_object map;
     msgpack_sbuffer *sbuf;
+    struct flb_record rec;
+    struct flb_record_kv kv;
+    struct flb_record_iter it;
 
     /* Initialize contexts for new output */
     msgpack_sbuffer_init(&mp_sbuf);
     msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
 
     /* Iterate the original buffer and perform adjustments */
-    msgpack_unpacked_init(&result);
+    flb_record_iter_init(&it, data, bytes);
+    while (flb_record_iter_next(&it, &rec)) {
+        records++;
 
-    /* Perform some format validation */
-    ret = msgpack_unpack_next(&result, data, bytes, &off);
-    if (!ret) {
-        return NULL;
+        msgpack_pack_map(&mp_pck, rec.size + 1);
+        msgpack_pack_bin(&mp_pck, 4);
+        msgpack_pack_bin_body(&mp_pck, "time", 4);
+        msgpack_pack_int32(&mp_pck, flb_record_time(&rec));
+
+        /* keys and values are copied as they are encoded */
+        while (flb_record_kv_next(&rec, &kv)) {
+            msgpack_sbuffer_write(&mp_sbuf, kv.key_raw, kv.key_size);
+            msgpack_sbuffer_write(&mp_sbuf, kv.val_raw, kv.val_size);
+        }
     }
 
-    /* We 'should' get an array */
-    if (result.data.type != MSGPACK_OBJECT_ARRAY) {
+    if (records == 0) {
         /*
          * If we got a different format, we assume the caller knows what he is
          * doing, we just duplicate the content in a new buffer and cleanup.
          */
+        msgpack_sbuffer_destroy(&mp_sbuf);
         buf = flb_malloc(bytes);
         if (!buf) {
             return NULL;
@@ -87,41 +92,6 @@ static char *td_format(void *data, size_t bytes, int *out_size)
         return buf;
     }
 
-    root = result.data;
-    if (root.via.array.size == 0) {
-        return NULL;
-    }
-
-    off = 0;
-    msgpack_unpacked_destroy(&result);
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        if (result.data.type != MSGPACK_OBJECT_ARRAY) {
-            continue;
-        }
-
-        /* Each array must have two entries: time and record */
-        root = result.data;
-        if (root.via.array.size != 2) {
-            continue;
-        }
-
-        atime = root.via.array.ptr[0].via.u64;
-        map   = root.via.array.ptr[1];
-
-        n_size = map.via.map.size + 1;
-        msgpack_pack_map(&mp_pck, n_size);
-        msgpack_pack_bin(&mp_pck, 4);
-        msgpack_pack_bin_body(&mp_pck, "time", 4);
-        msgpack_pack_int32(&mp_pck, atime);
-
-        for (i = 0; i < n_size - 1; i++) {
-            msgpack_pack_object(&mp_pck, map.via.map.ptr[i].key);
-            msgpack_pack_object(&mp_pck, map.via.map.ptr[i].val);
-        }
-    }
-    msgpack_unpacked_destroy(&result);
-
     /* Create new buffer */
     sbuf = &mp_sbuf;
     *out_size = sbuf->size;
@@ -161,8 +131,20 @@ int cb_td_init(struct flb_output_instance *ins, struct flb_config *config,
         flb_free(ctx);
         return -1;
     }
+    if (flb_output_upstream_set(upstream, ins) == -1) {
+        flb_upstream_destroy(upstream);
+        flb_free(ctx);
+        return -1;
+    }
     ctx->u = upstream;
 
+    ctx->headers = td_http_headers(ctx);
+    if (!ctx->headers) {
+        flb_upstream_destroy(upstream);
+        flb_free(ctx);
+        return -1;
+    }
+
     flb_output_set_context(ins, ctx);
     return 0;
 }
@@ -219,8 +201,8 @@ static void cb_td_flush(void *data, size_t bytes,
     flb_free(body);
 
     /* release */
-    flb_upstream_conn_release(u_conn);
     flb_http_client_destroy(c);
+    flb_upstream_conn_release(u_conn);
 
     FLB_OUTPUT_RETURN(FLB_OK);
 }
@@ -230,6 +212,7 @@ int cb_td_exit(void *data, struct flb_config *config)
     struct flb_out_td_config *ctx = data;
 
     flb_upstream_destroy(ctx->u);
+    flb_http_headers_destroy(ctx->headers);
     flb_free(ctx);
 
     return 0;
@@ -22,6 +22,7 @@
 
 #include <mk_core.h>
 #include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_http_client.h>
 
 struct flb_out_td_config {
     int fd;           /* Socket to destination/backend */
@@ -30,6 +31,9 @@ struct flb_out_td_config {
     char *db_name;
     char *db_table;
 
+    /* Authorization and Content-Type, the same on every request */
+    struct flb_http_headers *headers;
+
     struct flb_upstream *u;
 };
 
@@ -84,14 +84,51 @@ static void *gzip_compress(void *data, size_t len, size_t *out_len)
     return buf;
 }
 
+/* Compose the headers shared by all the requests */
+struct flb_http_headers *td_http_headers(struct flb_out_td_config *ctx)
+{
+    int pos = 0;
+    int api_len;
+    char *tmp;
+    struct flb_http_headers *h;
+
+    api_len = strlen(ctx->api);
+    tmp = flb_malloc(api_len + 4);
+    if (!tmp) {
+        return NULL;
+    }
+
+    tmp[pos++] = 'T';
+    tmp[pos++] = 'D';
+    tmp[pos++] = '1';
+    tmp[pos++] = ' ';
+    memcpy(tmp + pos, ctx->api, api_len);
+    pos += api_len;
+
+    h = flb_http_headers_create();
+    if (!h) {
+        flb_free(tmp);
+        return NULL;
+    }
+
+    if (flb_http_headers_add(h, "Authorization", 13, tmp, pos) != 0 ||
+        flb_http_headers_add(h, "Content-Type", 12,
+                             "application/gzip", 16) != 0) {
+        flb_http_headers_destroy(h);
+        flb_free(tmp);
+        return NULL;
+    }
+    flb_free(tmp);
+
+    return h;
+}
+
 struct flb_http_client *td_http_client(struct flb_upstream_conn *u_conn,
                                        void *data, size_t len,
                                        char **body,
                                        struct flb_out_td_config *ctx,
                                        struct flb_config *config)
 {
-    int pos = 0;
-    int api_len;
     size_t gz_size;
     char *gz;
     char *tmp;
@@ -116,29 +153,14 @@ struct flb_http_client *td_http_client(struct flb_upstream_conn *u_conn,
     /* Create client */
     c = flb_http_client(u_conn, FLB_HTTP_PUT, tmp,
                         gz, gz_size, NULL, 0, NULL);
+    flb_free(tmp);
     if (!c) {
-        flb_free(tmp);
         flb_free(gz);
         return NULL;
     }
 
     /* Add custom headers */
-    tmp[pos++] = 'T';
-    tmp[pos++] = 'D';
-    tmp[pos++] = '1';
-    tmp[pos++] = ' ';
-
-    api_len = strlen(ctx->api);
-    memcpy(tmp + pos, ctx->api, api_len);
-    pos += api_len;
-
-    flb_http_add_header(c,
-                        "Authorization", 13,
-                        tmp, pos);
-    flb_http_add_header(c,
-                        "Content-Type", 12,
-                        "application/gzip", 16);
-    flb_free(tmp);
+    flb_http_add_headers(c, ctx->headers);
     *body = gz;
 
     return c;
@@ -26,6 +26,7 @@
 char *td_http_request(void *data, size_t len,
                       size_t *out_len,
                       struct flb_out_td_config *ctx, struct flb_config *config);
+struct flb_http_headers *td_http_headers(struct flb_out_td_config *ctx);
 struct flb_http_client *td_http_client(struct flb_upstream_conn *u_conn,
                                        void *data, size_t len,
                                        char **body,
@@ -0,0 +1,424 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_macros.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_record.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_batch.h>
+
+/* Column type for a single value, FLB_BATCH_NULL for nil */
+static int value_type(msgpack_object *o)
+{
+    switch (o->type) {
+    case MSGPACK_OBJECT_NIL:
+        return FLB_BATCH_NULL;
+    case MSGPACK_OBJECT_BOOLEAN:
+        return FLB_BATCH_BOOL;
+    case MSGPACK_OBJECT_POSITIVE_INTEGER:
+        if (o->via.u64 > INT64_MAX) {
+            return FLB_BATCH_RAW;
+        }
+        return FLB_BATCH_INT;
+    case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+        return FLB_BATCH_INT;
+    case MSGPACK_OBJECT_FLOAT:
+        return FLB_BATCH_DOUBLE;
+    case MSGPACK_OBJECT_STR:
+    case MSGPACK_OBJECT_BIN:
+        return FLB_BATCH_STR;
+    default:
+        return FLB_BATCH_RAW;
+    }
+}
+
+/* Type of a column holding values of type 'a' and 'b' */
+static int type_merge(int a, int b)
+{
+    if (a == b || b == FLB_BATCH_NULL) {
+        return a;
+    }
+    if (a == FLB_BATCH_NULL) {
+        return b;
+    }
+    if ((a == FLB_BATCH_INT && b == FLB_BATCH_DOUBLE) ||
+        (a == FLB_BATCH_DOUBLE && b == FLB_BATCH_INT)) {
+        return FLB_BATCH_DOUBLE;
+    }
+    return FLB_BATCH_RAW;
+}
+
+static inline int col_match(struct flb_batch_col *col,
+                            const char *name, size_t len)
+{
+    return (col->name_len == len && memcmp(col->name, name, len) == 0);
+}
+
+/*
+ * Map keys may be strings or binaries (str and bin share the layout).
+ * Records of a chunk usually share the schema, so the key at position
+ * 'pos' of the map is checked against column 'pos' before searching.
+ */
+static struct flb_batch_col *col_find(struct flb_batch *batch, int pos,
+                                      const char *name, size_t len)
+{
+    int i;
+
+    if (pos < batch->n_cols && col_match(&batch->cols[pos], name, len)) {
+        return &batch->cols[pos];
+    }
+
+    for (i = 0; i < batch->n_cols; i++) {
+        if (col_match(&batch->cols[i], name, len)) {
+            return &batch->cols[i];
+        }
+    }
+
+    return NULL;
+}
+
+static struct flb_batch_col *col_add(struct flb_batch *batch,
+                                     const char *name, size_t len)
+{
+    int size;
+    struct flb_batch_col *tmp;
+    struct flb_batch_col *col;
+
+    if (batch->n_cols == batch->cols_size) {
+        size = batch->cols_size > 0 ? batch->cols_size * 2 : 8;
+        tmp = flb_realloc(batch->cols, sizeof(struct flb_batch_col) * size);
+        if (!tmp) {
+            flb_errno();
+            return NULL;
+        }
+        batch->cols = tmp;
+        batch->cols_size = size;
+    }
+
+    col = &batch->cols[batch->n_cols++];
+    memset(col, 0, sizeof(struct flb_batch_col));
+    col->name = name;
+    col->name_len = len;
+    col->type = FLB_BATCH_NULL;
+
+    return col;
+}
+
+/* Allocate the vectors of a column once its type is known */
+static int col_alloc(struct flb_batch_col *col, int rows)
+{
+    size_t size;
+
+    switch (col->type) {
+    case FLB_BATCH_INT:
+        size = sizeof(int64_t);
+        break;
+    case FLB_BATCH_DOUBLE:
+        size = sizeof(double);
+        break;
+    case FLB_BATCH_BOOL:
+        size = sizeof(uint8_t);
+        break;
+    case FLB_BATCH_STR:
+    case FLB_BATCH_RAW:
+        size = sizeof(struct flb_batch_view);
+        break;
+    default:
+        size = 0;
+    }
+
+    col->valid = flb_calloc(1, (rows + 7) / 8);
+    if (!col->valid) {
+        flb_errno();
+        return -1;
+    }
+
+    if (size > 0) {
+        /* any pointer of the union */
+        col->v.b = flb_malloc(size * rows);
+        if (!col->v.b) {
+            flb_errno();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void col_set(struct flb_batch_col *col, int row,
+                    struct flb_record_kv *kv)
+{
+    msgpack_object *o = &kv->val;
+
+    if (o->type == MSGPACK_OBJECT_NIL) {
+        return;
+    }
+
+    switch (col->type) {
+    case FLB_BATCH_INT:
+        col->v.i64[row] = o->via.i64;
+        break;
+    case FLB_BATCH_DOUBLE:
+        if (o->type == MSGPACK_OBJECT_FLOAT) {
+            col->v.f64[row] = o->via.f64;
+        }
+        else if (o->type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
+            col->v.f64[row] = (double) o->via.u64;
+        }
+        else {
+            col->v.f64[row] = (double) o->via.i64;
+        }
+        break;
+    case FLB_BATCH_BOOL:
+        col->v.b[row] = o->via.boolean;
+        break;
+    case FLB_BATCH_STR:
+        col->v.view[row].ptr = o->via.str.ptr;
+        col->v.view[row].len = o->via.str.size;
+        break;
+    case FLB_BATCH_RAW:
+        col->v.view[row].ptr = kv->val_raw;
+        col->v.view[row].len = kv->val_size;
+        break;
+    default:
+        return;
+    }
+
+    col->valid[row >> 3] |= (1 << (row & 7));
+}
+
+/*
+ * Transpose the records of 'buf' into a new batch. A first pass finds the
+ * number of rows and the columns with their types, the second one fills
+ * the vectors. It returns NULL if the memory could not be allocated.
+ */
+struct flb_batch *flb_batch_create(char *buf, size_t size)
+{
+    int i;
+    int pos;
+    int row;
+    int type;
+    struct flb_batch *batch;
+    struct flb_batch_col *col;
+    struct flb_record rec;
+    struct flb_record_kv kv;
+    struct flb_record_iter it;
+
+    batch = flb_calloc(1, sizeof(struct flb_batch));
+    if (!batch) {
+        flb_errno();
+        return NULL;
+    }
+
+    /* Schema */
+    flb_record_iter_init(&it, buf, size);
+    while (flb_record_iter_next(&it, &rec)) {
+        pos = 0;
+        while (flb_record_kv_next(&rec, &kv)) {
+            if (kv.key.type != MSGPACK_OBJECT_STR &&
+                kv.key.type != MSGPACK_OBJECT_BIN) {
+                continue;
+            }
+            col = col_find(batch, pos, kv.key.via.str.ptr,
+                           kv.key.via.str.size);
+            if (!col) {
+                col = col_add(batch, kv.key.via.str.ptr,
+                              kv.key.via.str.size);
+                if (!col) {
+                    goto error;
+                }
+            }
+            type = value_type(&kv.val);
+            if ((col->type == FLB_BATCH_INT && type == FLB_BATCH_DOUBLE) ||
+                (col->type == FLB_BATCH_DOUBLE && type == FLB_BATCH_INT)) {
+                col->promoted = FLB_TRUE;
+            }
+            col->type = type_merge(col->type, type);
+            pos++;
+        }
+        batch->rows++;
+    }
+
+    if (batch->rows == 0) {
+        return batch;
+    }
+
+    batch->time = flb_calloc(batch->rows, sizeof(struct flb_time));
+    batch->sizes = flb_malloc(sizeof(size_t) * batch->rows);
+    if (!batch->time || !batch->sizes) {
+        flb_errno();
+        goto error;
+    }
+
+    for (i = 0; i < batch->n_cols; i++) {
+        if (col_alloc(&batch->cols[i], batch->rows) == -1) {
+            goto error;
+        }
+    }
+
+    /* Values */
+    row = 0;
+    flb_record_iter_init(&it, buf, size);
+    while (flb_record_iter_next(&it, &rec) && row < batch->rows) {
+        flb_time_pop_from_msgpack(&batch->time[row], &rec.time);
+        batch->sizes[row] = rec.raw_size;
+
+        pos = 0;
+        while (flb_record_kv_next(&rec, &kv)) {
+            if (kv.key.type != MSGPACK_OBJECT_STR &&
+                kv.key.type != MSGPACK_OBJECT_BIN) {
+                continue;
+            }
+            col = col_find(batch, pos, kv.key.via.str.ptr,
+                           kv.key.via.str.size);
+            if (col) {
+                col_set(col, row, &kv);
+            }
+            pos++;
+        }
+        row++;
+    }
+
+    return batch;
+
+ error:
+    flb_batch_destroy(batch);
+    return NULL;
+}
+
+void flb_batch_destroy(struct flb_batch *batch)
+{
+    int i;
+
+    if (!batch) {
+        return;
+    }
+
+    for (i = 0; i < batch->n_cols; i++) {
+        flb_free(batch->cols[i].v.b);
+        flb_free(batch->cols[i].valid);
+    }
+    flb_free(batch->cols);
+    flb_free(batch->time);
+    flb_free(batch->sizes);
+    flb_free(batch);
+}
+
+struct flb_batch_col *flb_batch_col_get(struct flb_batch *batch,
+                                        const char *name, size_t len)
+{
+    return col_find(batch, batch->n_cols, name, len);
+}
+
+static inline int time_cmp(struct flb_time *a, struct flb_time *b)
+{
+    if (a->tm.tv_sec != b->tm.tv_sec) {
+        return a->tm.tv_sec < b->tm.tv_sec ? -1 : 1;
+    }
+    if (a->tm.tv_nsec != b->tm.tv_nsec) {
+        return a->tm.tv_nsec < b->tm.tv_nsec ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Set in 'sel' (one bit per row) the rows with a time in [from, to), a
+ * NULL limit is open. It returns the number of selected rows.
+ */
+int flb_batch_time_select(struct flb_batch *batch,
+                          struct flb_time *from, struct flb_time *to,
+                          uint8_t *sel)
+{
+    int i;
+    int n = 0;
+
+    memset(sel, 0, (batch->rows + 7) / 8);
+    for (i = 0; i < batch->rows; i++) {
+        if (from && time_cmp(&batch->time[i], from) < 0) {
+            continue;
+        }
+        if (to && time_cmp(&batch->time[i], to) >= 0) {
+            continue;
+        }
+        sel[i >> 3] |= (1 << (i & 7));
+        n++;
+    }
+
+    return n;
+}
+
+/*
+ * Count, sum, min and max of the valid rows of a numeric column, only the
+ * rows set in 'sel' if it's given. It returns -1 for other column types.
+ */
+int flb_batch_col_stats(struct flb_batch *batch, struct flb_batch_col *col,
+                        uint8_t *sel, struct flb_batch_stats *stats)
+{
+    int i;
+    int row;
+    int end;
+    uint8_t mask;
+    double v;
+
+    memset(stats, 0, sizeof(struct flb_batch_stats));
+
+    if (col->type == FLB_BATCH_NULL) {
+        return 0;
+    }
+    if (col->type != FLB_BATCH_INT && col->type != FLB_BATCH_DOUBLE) {
+        return -1;
+    }
+
+    /* eight rows per step, empty groups are skipped as a whole */
+    for (i = 0; i < (batch->rows + 7) / 8; i++) {
+        mask = col->valid[i];
+        if (sel) {
+            mask &= sel[i];
+        }
+        if (mask == 0) {
+            continue;
+        }
+
+        end = (i + 1) * 8;
+        if (end > batch->rows) {
+            end = batch->rows;
+        }
+        for (row = i * 8; row < end; row++) {
+            if (!(mask & (1 << (row & 7)))) {
+                continue;
+            }
+            v = flb_batch_double(col, row);
+            if (stats->count == 0 || v < stats->min) {
+                stats->min = v;
+            }
+            if (stats->count == 0 || v > stats->max) {
+                stats->max = v;
+            }
+            stats->sum += v;
+            stats->count++;
+        }
+    }
+
+    return 0;
+}
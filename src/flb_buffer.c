@@ -191,6 +191,7 @@ void flb_buffer_destroy(struct flb_buffer *ctx)
     struct mk_list *tmp;
     struct mk_list *head;
     struct flb_buffer_worker *worker;
+    struct flb_buffer_entry *entry;
 
     /* Destroy workers if any */
     mk_list_foreach_safe(head, tmp, &ctx->workers) {
@@ -240,8 +241,25 @@ void flb_buffer_destroy(struct flb_buffer *ctx)
         flb_free(worker);
     }
 
-    mk_list_del(&ctx->i_ins->_head);
-    flb_free(ctx->i_ins);
+    /* Chunk references used by the quota */
+    mk_list_foreach_safe(head, tmp, &ctx->chunks) {
+        entry = mk_list_entry(head, struct flb_buffer_entry, _head);
+        mk_list_del(&entry->_head);
+        flb_free(entry->name);
+        flb_free(entry);
+    }
+    mk_list_foreach_safe(head, tmp, &ctx->evicted) {
+        entry = mk_list_entry(head, struct flb_buffer_entry, _head);
+        mk_list_del(&entry->_head);
+        flb_free(entry->name);
+        flb_free(entry);
+    }
+    pthread_mutex_destroy(&ctx->chunks_mutex);
+
+    if (ctx->i_ins) {
+        mk_list_del(&ctx->i_ins->_head);
+        flb_free(ctx->i_ins);
+    }
     flb_free(ctx->path);
     flb_free(ctx);
 }
@@ -324,6 +342,86 @@ static int buffer_queue_path(char *path, struct flb_config *config)
     return 0;
 }
 
+/* Read the Buffer_Max_Size and Buffer_Max_Policy settings */
+static int buffer_quota_config(struct flb_buffer *ctx,
+                               struct flb_config *config)
+{
+    int64_t size;
+    char *policy;
+
+    if (config->buffer_max_size) {
+        size = flb_utils_size_to_bytes(config->buffer_max_size);
+        if (size < 0) {
+            flb_error("[buffer] invalid %s value '%s'",
+                      FLB_CONF_STR_BUF_MAX_SIZE, config->buffer_max_size);
+            return -1;
+        }
+        ctx->max_size = size;
+    }
+
+    policy = config->buffer_max_policy;
+    if (!policy) {
+        return 0;
+    }
+
+    if (strcasecmp(policy, "pause") == 0) {
+        ctx->policy = FLB_BUFFER_POLICY_PAUSE;
+    }
+    else if (strcasecmp(policy, "drop_oldest") == 0) {
+        ctx->policy = FLB_BUFFER_POLICY_DROP_OLDEST;
+    }
+    else if (strcasecmp(policy, "drop_newest") == 0) {
+        ctx->policy = FLB_BUFFER_POLICY_DROP_NEWEST;
+    }
+    else {
+        flb_error("[buffer] invalid %s value '%s'",
+                  FLB_CONF_STR_BUF_MAX_POLICY, policy);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int buffer_mode_config(struct flb_buffer *ctx,
+                              struct flb_config *config)
+{
+    int64_t size;
+
+    ctx->mode      = FLB_BUFFER_MODE_DISK;
+    ctx->mem_limit = FLB_BUFFER_MEM_LIMIT;
+    ctx->spill_age = FLB_BUFFER_SPILL_AGE;
+
+    if (config->buffer_mode) {
+        if (strcasecmp(config->buffer_mode, "disk") == 0) {
+            ctx->mode = FLB_BUFFER_MODE_DISK;
+        }
+        else if (strcasecmp(config->buffer_mode, "hybrid") == 0) {
+            ctx->mode = FLB_BUFFER_MODE_HYBRID;
+        }
+        else {
+            flb_error("[buffer] invalid %s value '%s'",
+                      FLB_CONF_STR_BUF_MODE, config->buffer_mode);
+            return -1;
+        }
+    }
+
+    if (config->buffer_mem_limit) {
+        size = flb_utils_size_to_bytes(config->buffer_mem_limit);
+        if (size < 0) {
+            flb_error("[buffer] invalid %s value '%s'",
+                      FLB_CONF_STR_BUF_MEM_LIMIT, config->buffer_mem_limit);
+            return -1;
+        }
+        ctx->mem_limit = size;
+    }
+
+    if (config->buffer_spill_age >= 0) {
+        ctx->spill_age = config->buffer_spill_age;
+    }
+
+    return 0;
+}
+
 /*
  * This function creates a buffer handler instance and it creates
  * a fixed number of POSIX threads which will take care of I/O
@@ -386,6 +484,48 @@ struct flb_buffer *flb_buffer_create(char *path, int workers,
     ctx->config     = config;
     mk_list_init(&ctx->workers);
 
+    /* Disk usage and quota */
+    ctx->usage     = 0;
+    ctx->max_size  = 0;
+    ctx->policy    = FLB_BUFFER_POLICY_PAUSE;
+    ctx->paused    = FLB_FALSE;
+    ctx->evictions = 0;
+    pthread_mutex_init(&ctx->chunks_mutex, NULL);
+    mk_list_init(&ctx->chunks);
+    ctx->evicted_n = 0;
+    mk_list_init(&ctx->evicted);
+
+    /* Hybrid mode counters */
+    ctx->mem_usage = 0;
+    ctx->spills    = 0;
+
+    ret = buffer_quota_config(ctx, config);
+    if (ret == -1) {
+        flb_free(ctx->path);
+        flb_free(ctx);
+        return NULL;
+    }
+
+    ret = buffer_mode_config(ctx, config);
+    if (ret == -1) {
+        flb_free(ctx->path);
+        flb_free(ctx);
+        return NULL;
+    }
+
+    /* Buffer chunks compression */
+    ctx->compress = FLB_BUFFER_CODEC_NONE;
+    if (config->buffer_compress) {
+        ctx->compress = flb_buffer_chunk_codec(config->buffer_compress);
+        if (ctx->compress == -1) {
+            flb_error("[buffer] invalid %s value '%s'",
+                      FLB_CONF_STR_BUF_COMPRESS, config->buffer_compress);
+            flb_free(ctx->path);
+            flb_free(ctx);
+            return NULL;
+        }
+    }
+
     ctx->workers_n = workers;
     if (workers <= 0) {
         ctx->workers_n = 1;
@@ -465,7 +605,13 @@ struct flb_buffer *flb_buffer_create(char *path, int workers,
     mk_list_add(&ctx->i_ins->_head, &config->inputs);
 
     /* We are done */
-    flb_debug("[buffer] new instance created; workers=%i", ctx->workers_n);
+    flb_debug("[buffer] new instance created; workers=%i compress=%s "
+              "max_size=%lu policy=%i mode=%s",
+              ctx->workers_n,
+              ctx->compress == FLB_BUFFER_CODEC_ZLIB ? "zlib" :
+              ctx->compress == FLB_BUFFER_CODEC_DICT ? "dict" : "none",
+              ctx->max_size, ctx->policy,
+              ctx->mode == FLB_BUFFER_MODE_HYBRID ? "hybrid" : "disk");
     return ctx;
 }
 
@@ -587,6 +733,14 @@ int flb_buffer_engine_event(struct flb_buffer *ctx, uint32_t event)
             return -1;
         }
     }
+    else if (type == FLB_BUFFER_EV_PAUSE) {
+        flb_warn("[buffer] max size reached (%lu/%lu bytes)",
+                 ctx->usage, ctx->max_size);
+        flb_input_pause_all(ctx->config);
+    }
+    else if (type == FLB_BUFFER_EV_RESUME) {
+        flb_input_resume_all(ctx->config);
+    }
 
     return 0;
 }
@@ -33,6 +33,7 @@
 #include <sys/file.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <zlib.h>
 
 #ifdef __linux__
 #include <linux/limits.h>
@@ -46,6 +47,9 @@
 #include <fluent-bit/flb_buffer_chunk.h>
 #include <fluent-bit/flb_buffer_qchunk.h>
 #include <fluent-bit/flb_sha1.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_bits.h>
+#include <fluent-bit/flb_dict.h>
 
 /* Local structure used to validate and obtain Chunk information */
 struct chunk_info {
@@ -166,6 +170,204 @@ int chunk_info(char *filename, struct chunk_info *info)
     return 0;
 }
 
+/* Get the codec ID given it name as set in the configuration */
+int flb_buffer_chunk_codec(char *name)
+{
+    if (strcasecmp(name, "none") == 0 || strcasecmp(name, "off") == 0) {
+        return FLB_BUFFER_CODEC_NONE;
+    }
+    else if (strcasecmp(name, "zlib") == 0 || strcasecmp(name, "on") == 0) {
+        return FLB_BUFFER_CODEC_ZLIB;
+    }
+    else if (strcasecmp(name, "dict") == 0) {
+        return FLB_BUFFER_CODEC_DICT;
+    }
+
+    return -1;
+}
+
+static inline void hdr_store64(char *p, uint64_t val)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        p[i] = (val >> (56 - (i * 8))) & 0xff;
+    }
+}
+
+static inline uint64_t hdr_load64(unsigned char *p)
+{
+    int i;
+    uint64_t val = 0;
+
+    for (i = 0; i < 8; i++) {
+        val = (val << 8) | p[i];
+    }
+    return val;
+}
+
+/* Compose a compressed chunk header into 'buf' */
+void flb_buffer_chunk_hdr_set(char *buf, int codec, uint64_t size,
+                              struct flb_chunk_meta *meta)
+{
+    buf[0] = 0xc1;
+    buf[1] = 'F';
+    buf[2] = 'B';
+    buf[3] = 'C';
+    buf[4] = FLB_BUFFER_CHUNK_HDR_VERSION;
+    buf[5] = codec;
+    buf[6] = 0;
+    buf[7] = 0;
+
+    /* Original size in big endian */
+    hdr_store64(buf + 8, size);
+
+    /* Metadata */
+    buf[16] = (meta->records >> 24) & 0xff;
+    buf[17] = (meta->records >> 16) & 0xff;
+    buf[18] = (meta->records >> 8) & 0xff;
+    buf[19] = meta->records & 0xff;
+    memset(buf + 20, '\0', 4);
+    hdr_store64(buf + 24, (int64_t) meta->t_first);
+    hdr_store64(buf + 32, (int64_t) meta->t_last);
+    hdr_store64(buf + 40, (int64_t) meta->t_min);
+    hdr_store64(buf + 48, (int64_t) meta->t_max);
+}
+
+/*
+ * Check if 'buf' starts with a compressed chunk header, if so, get the
+ * codec, original size, header size and metadata. A version 1 header has
+ * no metadata, 'meta->records' is zero then. It returns -1 for raw chunks.
+ */
+int flb_buffer_chunk_hdr_get(char *buf, size_t len,
+                             int *codec, uint64_t *size,
+                             size_t *hdr_size, struct flb_chunk_meta *meta)
+{
+    unsigned char *p = (unsigned char *) buf;
+
+    if (len < FLB_BUFFER_CHUNK_HDR_V1_SIZE) {
+        return -1;
+    }
+
+    if (p[0] != 0xc1 || p[1] != 'F' || p[2] != 'B' || p[3] != 'C') {
+        return -1;
+    }
+
+    if (p[5] != FLB_BUFFER_CODEC_ZLIB && p[5] != FLB_BUFFER_CODEC_DICT) {
+        return -1;
+    }
+
+    flb_chunk_meta_init(meta);
+    if (p[4] == 1) {
+        *hdr_size = FLB_BUFFER_CHUNK_HDR_V1_SIZE;
+    }
+    else if (p[4] == FLB_BUFFER_CHUNK_HDR_VERSION &&
+             len >= FLB_BUFFER_CHUNK_HDR_SIZE) {
+        *hdr_size = FLB_BUFFER_CHUNK_HDR_SIZE;
+        meta->records = ((uint32_t) p[16] << 24) | ((uint32_t) p[17] << 16) |
+            ((uint32_t) p[18] << 8) | p[19];
+        meta->t_first = (int64_t) hdr_load64(p + 24);
+        meta->t_last  = (int64_t) hdr_load64(p + 32);
+        meta->t_min   = (int64_t) hdr_load64(p + 40);
+        meta->t_max   = (int64_t) hdr_load64(p + 48);
+    }
+    else {
+        return -1;
+    }
+
+    *codec = p[5];
+    *size  = hdr_load64(p + 8);
+    meta->bytes = *size;
+    return 0;
+}
+
+/*
+ * Write a compressed chunk: the content is deflated in small pieces that
+ * are written to the file as soon as they are ready, so no extra copy of
+ * the whole chunk is required.
+ */
+static int chunk_write_zlib(FILE *f, struct flb_buffer_chunk *chunk)
+{
+    int ret;
+    int flush;
+    size_t w;
+    size_t len;
+    char hdr[FLB_BUFFER_CHUNK_HDR_SIZE];
+    unsigned char out[16384];
+    z_stream strm;
+
+    flb_buffer_chunk_hdr_set(hdr, FLB_BUFFER_CODEC_ZLIB, chunk->size,
+                             &chunk->meta);
+    w = fwrite(hdr, sizeof(hdr), 1, f);
+    if (!w) {
+        return -1;
+    }
+
+    strm.zalloc = Z_NULL;
+    strm.zfree  = Z_NULL;
+    strm.opaque = Z_NULL;
+    ret = deflateInit(&strm, Z_BEST_SPEED);
+    if (ret != Z_OK) {
+        return -1;
+    }
+
+    strm.next_in  = chunk->data;
+    strm.avail_in = chunk->size;
+    flush = Z_FINISH;
+
+    do {
+        strm.next_out  = out;
+        strm.avail_out = sizeof(out);
+
+        ret = deflate(&strm, flush);
+        if (ret == Z_STREAM_ERROR) {
+            deflateEnd(&strm);
+            return -1;
+        }
+
+        len = sizeof(out) - strm.avail_out;
+        if (len > 0) {
+            w = fwrite(out, len, 1, f);
+            if (!w) {
+                deflateEnd(&strm);
+                return -1;
+            }
+        }
+    } while (ret != Z_STREAM_END);
+
+    deflateEnd(&strm);
+    return 0;
+}
+
+/*
+ * Write a dictionary encoded chunk. Chunks with no repeated keys are not
+ * worth it, they are written as raw chunks.
+ */
+static int chunk_write_dict(FILE *f, struct flb_buffer_chunk *chunk)
+{
+    int ret;
+    size_t w;
+    size_t size;
+    char *buf;
+    char hdr[FLB_BUFFER_CHUNK_HDR_SIZE];
+
+    ret = flb_dict_encode(chunk->data, chunk->size, &buf, &size);
+    if (ret == -1) {
+        w = fwrite(chunk->data, chunk->size, 1, f);
+        return w ? 0 : -1;
+    }
+
+    flb_buffer_chunk_hdr_set(hdr, FLB_BUFFER_CODEC_DICT, chunk->size,
+                             &chunk->meta);
+    w = fwrite(hdr, sizeof(hdr), 1, f);
+    if (w) {
+        w = fwrite(buf, size, 1, f);
+    }
+    flb_free(buf);
+
+    return w ? 0 : -1;
+}
+
 void request_destroy(struct flb_buffer_request *req)
 {
     mk_list_del(&req->_head);
@@ -238,11 +440,327 @@ static int chunk_find(char *root_path, char *hash,
     return 0;
 }
 
+/* Notify the engine about a buffer event (pause/resume inputs) */
+static int buffer_engine_signal(struct flb_buffer *ctx, int type)
+{
+    int ret;
+    uint32_t set;
+    uint64_t val;
+
+    set = FLB_BUFFER_EV_SET(type, 0, 0);
+    val = FLB_BITS_U64_SET(FLB_ENGINE_BUFFER, set);
+    ret = write(ctx->config->ch_manager[1], &val, sizeof(val));
+    if (ret == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Account a new chunk stored in the buffer path */
+static void usage_add(struct flb_buffer *ctx, char *name, size_t size)
+{
+    struct flb_buffer_entry *entry;
+
+    __sync_add_and_fetch(&ctx->usage, size);
+
+    if (ctx->max_size == 0) {
+        return;
+    }
+
+    entry = flb_malloc(sizeof(struct flb_buffer_entry));
+    if (!entry) {
+        flb_errno();
+        return;
+    }
+    memcpy(entry->hash_str, name, 40);
+    entry->hash_str[40] = '\0';
+    entry->name = flb_strdup(name);
+
+    pthread_mutex_lock(&ctx->chunks_mutex);
+    mk_list_add(&entry->_head, &ctx->chunks);
+    pthread_mutex_unlock(&ctx->chunks_mutex);
+}
+
+/* Remove a chunk from the accounting, if the inputs were paused, resume */
+static void usage_del(struct flb_buffer *ctx, char *hash, size_t size)
+{
+    size_t low;
+    struct mk_list *head;
+    struct flb_buffer_entry *entry = NULL;
+
+    __sync_sub_and_fetch(&ctx->usage, size);
+
+    if (ctx->max_size == 0) {
+        return;
+    }
+
+    /* Chunks are usually removed in creation order, lookup from the head */
+    pthread_mutex_lock(&ctx->chunks_mutex);
+    mk_list_foreach(head, &ctx->chunks) {
+        entry = mk_list_entry(head, struct flb_buffer_entry, _head);
+        if (strncmp(entry->hash_str, hash, 40) == 0) {
+            mk_list_del(&entry->_head);
+            break;
+        }
+        entry = NULL;
+    }
+    pthread_mutex_unlock(&ctx->chunks_mutex);
+
+    if (entry) {
+        flb_free(entry->name);
+        flb_free(entry);
+    }
+
+    /* Resume once 10% of the space is available again */
+    low = ctx->max_size - (ctx->max_size / 10);
+    if (ctx->paused == FLB_TRUE && ctx->usage <= low) {
+        if (__sync_bool_compare_and_swap(&ctx->paused, FLB_TRUE, FLB_FALSE)) {
+            buffer_engine_signal(ctx, FLB_BUFFER_EV_RESUME);
+        }
+    }
+}
+
+/* Unlink a chunk file and update the buffer usage */
+static int chunk_unlink(struct flb_buffer *ctx, char *path, char *hash)
+{
+    int ret;
+    struct stat st;
+
+    ret = stat(path, &st);
+    if (ret == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    ret = unlink(path);
+    if (ret == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    usage_del(ctx, hash, st.st_size);
+    return 0;
+}
+
+/*
+ * Remember the hash of an evicted chunk, the list keeps the last
+ * FLB_BUFFER_EVICTED_MAX entries.
+ */
+static void chunk_evicted_add(struct flb_buffer *ctx,
+                              struct flb_buffer_entry *entry)
+{
+    struct flb_buffer_entry *old = NULL;
+
+    pthread_mutex_lock(&ctx->chunks_mutex);
+    mk_list_add(&entry->_head, &ctx->evicted);
+    if (ctx->evicted_n == FLB_BUFFER_EVICTED_MAX) {
+        old = mk_list_entry_first(&ctx->evicted,
+                                  struct flb_buffer_entry, _head);
+        mk_list_del(&old->_head);
+    }
+    else {
+        ctx->evicted_n++;
+    }
+    pthread_mutex_unlock(&ctx->chunks_mutex);
+
+    if (old) {
+        flb_free(old->name);
+        flb_free(old);
+    }
+}
+
+/* Forget an evicted chunk hash, the entry is released */
+static void chunk_evicted_del(struct flb_buffer *ctx,
+                              struct flb_buffer_entry *entry)
+{
+    struct mk_list *head;
+    struct flb_buffer_entry *e;
+
+    pthread_mutex_lock(&ctx->chunks_mutex);
+    mk_list_foreach(head, &ctx->evicted) {
+        e = mk_list_entry(head, struct flb_buffer_entry, _head);
+        if (e == entry) {
+            mk_list_del(&e->_head);
+            ctx->evicted_n--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ctx->chunks_mutex);
+
+    flb_free(entry->name);
+    flb_free(entry);
+}
+
+/* Check if the chunk with the given hash was evicted by the quota */
+int flb_buffer_chunk_evicted(struct flb_buffer *ctx, char *hash)
+{
+    int ret = FLB_FALSE;
+    struct mk_list *head;
+    struct flb_buffer_entry *entry;
+
+    pthread_mutex_lock(&ctx->chunks_mutex);
+    mk_list_foreach(head, &ctx->evicted) {
+        entry = mk_list_entry(head, struct flb_buffer_entry, _head);
+        if (strncmp(entry->hash_str, hash, 40) == 0) {
+            ret = FLB_TRUE;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ctx->chunks_mutex);
+
+    return ret;
+}
+
+/*
+ * Evict the oldest chunk stored in the buffer path: the chunk file and
+ * it task references are removed. Tasks that are already running in the
+ * engine are not affected, they keep their own copy of the data. The
+ * qchunk worker is notified so it drops the chunk if it's still queued.
+ */
+static int chunk_evict_oldest(struct flb_buffer_worker *worker)
+{
+    int ret;
+    char *target = NULL;
+    char *real_name = NULL;
+    char root_path[PATH_MAX];
+    char path[PATH_MAX];
+    struct stat st;
+    struct mk_list *head;
+    struct flb_buffer *ctx = worker->parent;
+    struct flb_buffer_entry *entry;
+    struct flb_output_instance *o_ins;
+
+    pthread_mutex_lock(&ctx->chunks_mutex);
+    if (mk_list_is_empty(&ctx->chunks) == 0) {
+        pthread_mutex_unlock(&ctx->chunks_mutex);
+        return -1;
+    }
+    entry = mk_list_entry_first(&ctx->chunks, struct flb_buffer_entry, _head);
+    mk_list_del(&entry->_head);
+    pthread_mutex_unlock(&ctx->chunks_mutex);
+
+    /*
+     * The chunk name might have changed if some route was removed, try
+     * the original name first and then lookup by hash.
+     */
+    snprintf(root_path, sizeof(root_path) - 1, "%soutgoing/",
+             FLB_BUFFER_PATH(worker));
+    snprintf(path, sizeof(path) - 1, "%soutgoing/%s",
+             FLB_BUFFER_PATH(worker), entry->name);
+    ret = stat(path, &st);
+    if (ret == -1) {
+        ret = chunk_find(root_path, entry->hash_str, &target, &real_name);
+        if (ret == -1) {
+            snprintf(root_path, sizeof(root_path) - 1, "%sincoming/",
+                     FLB_BUFFER_PATH(worker));
+            ret = chunk_find(root_path, entry->hash_str, &target, &real_name);
+        }
+        if (ret == -1) {
+            /* Already gone */
+            flb_free(entry->name);
+            flb_free(entry);
+            return 0;
+        }
+        snprintf(path, sizeof(path) - 1, "%s", target);
+    }
+    else {
+        real_name = flb_strdup(entry->name);
+    }
+
+    /* Task references */
+    mk_list_foreach(head, &ctx->config->outputs) {
+        o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+        snprintf(root_path, sizeof(root_path) - 1, "%stasks/%s/%s",
+                 FLB_BUFFER_PATH(worker), o_ins->name, real_name);
+        unlink(root_path);
+    }
+
+    /*
+     * The hash is recorded before the file is removed, other threads
+     * check it as soon as they miss the file.
+     */
+    ret = stat(path, &st);
+    if (ret == 0) {
+        chunk_evicted_add(ctx, entry);
+        ret = unlink(path);
+    }
+    if (ret == -1) {
+        flb_errno();
+        flb_free(target);
+        flb_free(real_name);
+        chunk_evicted_del(ctx, entry);
+        return 0;
+    }
+
+    __sync_sub_and_fetch(&ctx->usage, st.st_size);
+    __sync_add_and_fetch(&ctx->evictions, 1);
+    flb_warn("[buffer] max size reached, chunk %s evicted", real_name);
+
+    if (ctx->qworker) {
+        flb_buffer_qchunk_signal(FLB_BUFFER_QC_EVICT, 0, ctx->qworker);
+    }
+
+    flb_free(target);
+    flb_free(real_name);
+    return 0;
+}
+
+/*
+ * Check the Buffer_Max_Size quota before storing a new chunk of 'size'
+ * bytes. It returns -1 if the chunk must not be stored.
+ */
+static int chunk_quota_check(struct flb_buffer_worker *worker, size_t size)
+{
+    int ret;
+    struct flb_buffer *ctx = worker->parent;
+
+    if (ctx->max_size == 0 || ctx->usage + size <= ctx->max_size) {
+        return 0;
+    }
+
+    if (ctx->policy == FLB_BUFFER_POLICY_DROP_NEWEST) {
+        __sync_add_and_fetch(&ctx->evictions, 1);
+        flb_warn("[buffer] max size reached, new chunk dropped (%lu bytes)",
+                 size);
+        return -1;
+    }
+    else if (ctx->policy == FLB_BUFFER_POLICY_DROP_OLDEST) {
+        while (ctx->usage + size > ctx->max_size) {
+            ret = chunk_evict_oldest(worker);
+            if (ret == -1) {
+                break;
+            }
+        }
+
+        /* The chunk itself is bigger than the space we have */
+        if (ctx->usage + size > ctx->max_size) {
+            __sync_add_and_fetch(&ctx->evictions, 1);
+            flb_warn("[buffer] chunk too big for the buffer, dropped "
+                     "(%lu bytes)", size);
+            return -1;
+        }
+    }
+    else if (ctx->policy == FLB_BUFFER_POLICY_PAUSE) {
+        /*
+         * The chunk is stored anyways, the data is already in the engine.
+         * Inputs are paused until some space is released.
+         */
+        if (__sync_bool_compare_and_swap(&ctx->paused, FLB_FALSE, FLB_TRUE)) {
+            buffer_engine_signal(ctx, FLB_BUFFER_EV_PAUSE);
+        }
+    }
+
+    return 0;
+}
+
 /*
  * Remove a route from a Chunk file. This is done altering the filename,
  * specifically altering the the mask number.
  */
-static int chunk_remove_route(char *root_path, char *abs_path,
+static int chunk_remove_route(struct flb_buffer *ctx,
+                              char *root_path, char *abs_path,
                               char *hash, struct chunk_info *info,
                               uint64_t mask_id)
 {
@@ -255,9 +773,8 @@ static int chunk_remove_route(char *root_path, char *abs_path,
     routes = (info->routes & ~mask_id);
     if (routes == 0) {
         flb_debug("[buffer] delete chunk %s", abs_path);
-        ret = unlink(abs_path);
+        ret = chunk_unlink(ctx, abs_path, hash);
         if (ret == -1) {
-            flb_errno();
             return -1;
         }
         return 0;
@@ -323,7 +840,8 @@ static int chunk_miss(struct flb_buffer_worker *worker, uint64_t mask_id,
             return -1;
         }
 
-        chunk_remove_route(root_path, target, hash_hex, &info, mask_id);
+        chunk_remove_route(worker->parent, root_path, target, hash_hex,
+                           &info, mask_id);
         flb_free(real_name);
         flb_free(target);
         return 0;
@@ -343,7 +861,8 @@ static int chunk_miss(struct flb_buffer_worker *worker, uint64_t mask_id,
             flb_free(target);
             return -1;
         }
-        chunk_remove_route(root_path, target, hash_hex, &info, mask_id);
+        chunk_remove_route(worker->parent, root_path, target, hash_hex,
+                           &info, mask_id);
         flb_free(real_name);
         flb_free(target);
     }
@@ -382,6 +901,12 @@ int flb_buffer_chunk_add(struct flb_buffer_worker *worker,
         return -1;
     }
 
+    /* Make sure there is room for the new chunk */
+    ret = chunk_quota_check(worker, chunk.size);
+    if (ret == -1) {
+        return -1;
+    }
+
     /*
      * Chunk file format:
      *
@@ -431,7 +956,17 @@ int flb_buffer_chunk_add(struct flb_buffer_worker *worker,
     }
 
     /* Write data chunk */
-    w = fwrite(chunk.data, chunk.size, 1, f);
+    if (worker->parent->compress == FLB_BUFFER_CODEC_ZLIB) {
+        ret = chunk_write_zlib(f, &chunk);
+        w = (ret == 0);
+    }
+    else if (worker->parent->compress == FLB_BUFFER_CODEC_DICT) {
+        ret = chunk_write_dict(f, &chunk);
+        w = (ret == 0);
+    }
+    else {
+        w = fwrite(chunk.data, chunk.size, 1, f);
+    }
     if (!w) {
         flb_errno();
         fclose(f);
@@ -451,6 +986,7 @@ int flb_buffer_chunk_add(struct flb_buffer_worker *worker,
         flb_free(fchunk);
         return -1;
     }
+    usage_add(worker->parent, fchunk, st.st_size);
 
     *filename = fchunk;
     return chunk.routes;
@@ -485,6 +1021,11 @@ int flb_buffer_chunk_delete(struct flb_buffer_worker *worker,
              FLB_BUFFER_PATH(worker));
     ret = chunk_find(path, chunk.hash_hex, &target, &real_name);
     if (ret != 0) {
+        if (flb_buffer_chunk_evicted(worker->parent, chunk.hash_hex)) {
+            /* Removed by the Buffer_Max_Size quota */
+            flb_debug("[buffer] chunk %s was evicted", chunk.hash_hex);
+            return 0;
+        }
         flb_error("[buffer] could not match task %s/%s",
                   chunk.tmp, chunk.hash_hex);
         return -1;
@@ -526,9 +1067,8 @@ int flb_buffer_chunk_delete(struct flb_buffer_worker *worker,
         snprintf(path, sizeof(path) - 1, "%soutgoing/%s",
                  FLB_BUFFER_PATH(worker),
                  real_name);
-        ret = unlink(path);
+        ret = chunk_unlink(worker->parent, path, info.hash_str);
         if (ret == -1) {
-            flb_errno();
             flb_free(target);
             flb_free(real_name);
             return -1;
@@ -615,7 +1155,7 @@ int flb_buffer_chunk_delete_ref(struct flb_buffer_worker *worker,
  */
 int flb_buffer_chunk_push(struct flb_buffer *ctx, void *data,
                           size_t size, char *tag, uint64_t routes,
-                          char *hash_hex)
+                          char *hash_hex, struct flb_chunk_meta *meta)
 {
     int ret;
     struct flb_buffer_chunk chunk;
@@ -644,6 +1184,7 @@ int flb_buffer_chunk_push(struct flb_buffer *ctx, void *data,
     chunk.tmp[chunk.tmp_len] = '\0';
     memcpy(&chunk.hash_hex, hash_hex, 41);
     chunk.hash_hex[41] = '\0';
+    chunk.meta       = *meta;
 
     /* Lookup target worker */
     worker = get_worker(ctx, ctx->worker_lru);
@@ -675,6 +1216,27 @@ int flb_buffer_chunk_pop(struct flb_buffer *ctx, int thread_id,
     struct flb_output_instance *o_ins;
     struct flb_output_thread *out_th;
 
+    out_th = flb_output_thread_get(thread_id, task);
+    if (!out_th) {
+        return -1;
+    }
+
+    o_ins = out_th->o_ins;
+
+    /*
+     * Hybrid mode: the task was not stored, just keep track of the route
+     * so it's not stored if the task is spilled later.
+     */
+    if (task->worker_id == FLB_TASK_WORKER_MEM) {
+        task->routes_done |= o_ins->mask_id;
+        return 0;
+    }
+
+    /* The chunk push failed, there is nothing stored */
+    if (task->worker_id == FLB_TASK_WORKER_NONE) {
+        return 0;
+    }
+
     /*
      * The request must be send to the same buffer worker that originally
      * created the chunk. It must be done on this way to avoid cases
@@ -682,12 +1244,6 @@ int flb_buffer_chunk_pop(struct flb_buffer *ctx, int thread_id,
      * working (remember: buffer chunks are a backup system).
      */
     worker = get_worker(ctx, task->worker_id);
-    out_th = flb_output_thread_get(thread_id, task);
-    if (!out_th) {
-        return -1;
-    }
-
-    o_ins = out_th->o_ins;
 
     /* Compose buffer chunk instruction */
     memset(&chunk, '\0', sizeof(struct flb_buffer_chunk));
@@ -708,6 +1264,155 @@ int flb_buffer_chunk_pop(struct flb_buffer *ctx, int thread_id,
     return 0;
 }
 
+/*
+ * Hybrid mode: account a task that is only kept in memory. Chained records
+ * are counted by the blocks they pin, not by their bytes.
+ */
+void flb_buffer_chunk_hold(struct flb_buffer *ctx, struct flb_task *task)
+{
+    if (task->chain.count > 0) {
+        task->mem = task->chain.mem;
+    }
+    else {
+        task->mem = task->size;
+    }
+
+    ctx->mem_usage += task->mem;
+    if (ctx->mem_usage > ctx->mem_limit) {
+        flb_buffer_chunk_spill_check(ctx);
+    }
+}
+
+/* Hybrid mode: a task that was never stored is gone */
+void flb_buffer_chunk_release(struct flb_buffer *ctx, struct flb_task *task)
+{
+    if (ctx->mem_usage >= task->mem) {
+        ctx->mem_usage -= task->mem;
+    }
+    else {
+        ctx->mem_usage = 0;
+    }
+}
+
+/*
+ * Hybrid mode: store a task that only lives in memory, only the routes
+ * that have not finished yet are registered for the new chunk.
+ */
+int flb_buffer_chunk_spill(struct flb_buffer *ctx, struct flb_task *task)
+{
+    int worker_id;
+    uint64_t routes;
+
+    if (task->worker_id != FLB_TASK_WORKER_MEM) {
+        return 0;
+    }
+
+    routes = task->routes_mask & ~task->routes_done;
+    if (routes == 0) {
+        return 0;
+    }
+
+    if (flb_task_buffer_prepare(task) == -1) {
+        return -1;
+    }
+
+    worker_id = flb_buffer_chunk_push(ctx, task->buf, task->size, task->tag,
+                                      routes, task->hash_hex, &task->meta);
+    if (worker_id == -1) {
+        return -1;
+    }
+
+    flb_buffer_chunk_release(ctx, task);
+    task->worker_id = worker_id;
+    ctx->spills++;
+
+    flb_debug("[buffer] task %i spilled to worker=%i", task->id, worker_id);
+    return 0;
+}
+
+/* A task held in memory, 'seq' keeps the creation order within a second */
+struct spill_candidate {
+    int seq;
+    struct flb_task *task;
+};
+
+static int spill_cmp(const void *a, const void *b)
+{
+    const struct spill_candidate *c1 = a;
+    const struct spill_candidate *c2 = b;
+
+    if (c1->task->created != c2->task->created) {
+        return c1->task->created < c2->task->created ? -1 : 1;
+    }
+    return c1->seq - c2->seq;
+}
+
+/*
+ * Hybrid mode: spill the tasks that are too old and, if the memory used
+ * by not stored tasks is above the limit, the oldest ones until the
+ * usage is under control. Tasks are listed per input, they are sorted by
+ * creation time so the oldest of all inputs go first. This is invoked on
+ * every engine flush.
+ */
+void flb_buffer_chunk_spill_check(struct flb_buffer *ctx)
+{
+    int i;
+    int n = 0;
+    time_t now;
+    struct mk_list *head;
+    struct mk_list *t_head;
+    struct flb_task *task;
+    struct flb_input_instance *i_ins;
+    struct spill_candidate *list;
+
+    if (ctx->mode != FLB_BUFFER_MODE_HYBRID) {
+        return;
+    }
+
+    mk_list_foreach(head, &ctx->config->inputs) {
+        i_ins = mk_list_entry(head, struct flb_input_instance, _head);
+        n += mk_list_size(&i_ins->tasks);
+    }
+    if (n == 0) {
+        return;
+    }
+
+    list = flb_malloc(sizeof(struct spill_candidate) * n);
+    if (!list) {
+        flb_errno();
+        return;
+    }
+
+    n = 0;
+    mk_list_foreach(head, &ctx->config->inputs) {
+        i_ins = mk_list_entry(head, struct flb_input_instance, _head);
+        mk_list_foreach(t_head, &i_ins->tasks) {
+            task = mk_list_entry(t_head, struct flb_task, _head);
+            if (task->worker_id == FLB_TASK_WORKER_MEM) {
+                list[n].seq = n;
+                list[n].task = task;
+                n++;
+            }
+        }
+    }
+    qsort(list, n, sizeof(struct spill_candidate), spill_cmp);
+
+    now = time(NULL);
+    for (i = 0; i < n; i++) {
+        task = list[i].task;
+        if (ctx->mem_usage > ctx->mem_limit ||
+            now - task->created >= ctx->spill_age) {
+            flb_buffer_chunk_spill(ctx, task);
+        }
+        else {
+            /* the rest is newer */
+            break;
+        }
+    }
+
+    flb_free(list);
+}
+
 /* Enqueue a request to move a chunk */
 int flb_buffer_chunk_mov(int type, char *name, uint64_t routes,
                          struct flb_buffer_worker *worker)
@@ -819,6 +1524,11 @@ int flb_buffer_chunk_scan(struct flb_buffer *ctx)
         }
 
         if (routes > 0) {
+            ret = stat(src, &st);
+            if (ret == 0) {
+                usage_add(ctx, ent->d_name, st.st_size);
+            }
+
             qchunk = flb_buffer_qchunk_add(ctx->qworker, src, routes,
                                            info.tag, info.hash_str);
             if (!qchunk) {
@@ -864,6 +1574,11 @@ int flb_buffer_chunk_real_move(struct flb_buffer_worker *worker,
                  "%s/outgoing/%s", worker->parent->path, req.name);
         ret = rename(from, to);
         if (ret == -1) {
+            if (errno == ENOENT &&
+                flb_buffer_chunk_evicted(worker->parent, req.name)) {
+                flb_debug("[buffer] chunk %s was evicted", req.name);
+                return 0;
+            }
             flb_errno();
             return -1;
         }
@@ -21,9 +21,12 @@
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_str.h>
 #include <fluent-bit/flb_buffer.h>
+#include <fluent-bit/flb_buffer_chunk.h>
 #include <fluent-bit/flb_buffer_qchunk.h>
+#include <fluent-bit/flb_dict.h>
 #include <fluent-bit/flb_engine_dispatch.h>
 #include <fluent-bit/flb_worker.h>
+#include <fluent-bit/flb_utils.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,8 +34,10 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/mman.h>
 #include <pthread.h>
+#include <zlib.h>
 
 /* qworker thread initializator */
 static int pth_init;
@@ -65,6 +70,8 @@ struct flb_buffer_qchunk *flb_buffer_qchunk_add(struct flb_buffer_qworker *qw,
         return NULL;
     }
     qchunk->id        = 0;
+    qchunk->fd        = -1;
+    qchunk->codec     = FLB_BUFFER_CODEC_NONE;
     qchunk->file_path = flb_strdup(path);
     qchunk->routes    = routes;
     memcpy(&qchunk->hash_str, hash_str, 41);
@@ -81,10 +88,40 @@ struct flb_buffer_qchunk *flb_buffer_qchunk_add(struct flb_buffer_qworker *qw,
 }
 
 
-int flb_buffer_qchunk_delete(struct flb_buffer_qchunk *qchunk)
+/* Release the memory used by a loaded qchunk */
+static inline void qchunk_free_data(char *buf, size_t size, int codec)
+{
+    if (codec == FLB_BUFFER_CODEC_NONE) {
+        munmap(buf, size);
+    }
+    else {
+        flb_free(buf);
+    }
+}
+
+/* Release a qchunk ID so it can be used again */
+static inline void qchunk_id_release(struct flb_buffer_qworker *qw, int id)
+{
+    int word;
+
+    word = id / 64;
+    qw->id_map[word] &= ~(1ULL << (id % 64));
+    qw->id_table[id] = NULL;
+    if (word < qw->id_hint) {
+        qw->id_hint = word;
+    }
+}
+
+int flb_buffer_qchunk_delete(struct flb_buffer_qworker *qw,
+                             struct flb_buffer_qchunk *qchunk)
 {
     if (qchunk->id > 0) {
-        munmap(qchunk->data, qchunk->size);
+        qchunk_free_data(qchunk->data, qchunk->size, qchunk->codec);
+        qw->mmap_size -= qchunk->size;
+        qchunk_id_release(qw, qchunk->id);
+    }
+    if (qchunk->fd >= 0) {
+        close(qchunk->fd);
     }
     flb_free(qchunk->file_path);
     mk_list_del(&qchunk->_head);
@@ -93,8 +130,157 @@ int flb_buffer_qchunk_delete(struct flb_buffer_qchunk *qchunk)
     return 0;
 }
 
+/*
+ * Get the size that a buffer chunk will take once loaded in memory and
+ * it codec. For compressed chunks this is the original size stored in
+ * the chunk header.
+ */
+static int qchunk_get_size(struct flb_buffer_qchunk *qchunk,
+                           size_t *size, int *codec)
+{
+    int fd;
+    int ret;
+    uint64_t orig;
+    char hdr[FLB_BUFFER_CHUNK_HDR_SIZE];
+    struct stat st;
+
+    fd = open(qchunk->file_path, O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            flb_errno();
+        }
+        return -1;
+    }
+
+    ret = fstat(fd, &st);
+    if (ret == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    *codec = FLB_BUFFER_CODEC_NONE;
+    *size  = st.st_size;
+    qchunk->hdr_size = 0;
+    flb_chunk_meta_init(&qchunk->meta);
+
+    ret = read(fd, hdr, sizeof(hdr));
+    if (ret > 0 &&
+        flb_buffer_chunk_hdr_get(hdr, ret, codec, &orig,
+                                 &qchunk->hdr_size, &qchunk->meta) == 0) {
+        *size = orig;
+    }
+
+    close(fd);
+    return 0;
+}
+
+/*
+ * Decompress a zlib buffer chunk: the file is read in small pieces and
+ * inflated straight into the destination buffer.
+ */
+static char *qchunk_get_data_zlib(int fd, size_t size)
+{
+    int ret;
+    ssize_t bytes;
+    char *buf;
+    unsigned char in[16384];
+    z_stream strm;
+
+    buf = flb_malloc(size);
+    if (!buf) {
+        flb_errno();
+        return NULL;
+    }
+
+    strm.zalloc   = Z_NULL;
+    strm.zfree    = Z_NULL;
+    strm.opaque   = Z_NULL;
+    strm.next_in  = Z_NULL;
+    strm.avail_in = 0;
+    ret = inflateInit(&strm);
+    if (ret != Z_OK) {
+        flb_free(buf);
+        return NULL;
+    }
+
+    strm.next_out  = (unsigned char *) buf;
+    strm.avail_out = size;
+
+    do {
+        bytes = read(fd, in, sizeof(in));
+        if (bytes <= 0) {
+            break;
+        }
+        strm.next_in  = in;
+        strm.avail_in = bytes;
+
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            break;
+        }
+    } while (ret != Z_STREAM_END);
+
+    inflateEnd(&strm);
+
+    if (ret != Z_STREAM_END || strm.total_out != size) {
+        flb_error("[buffer qchunk] corrupted compressed chunk");
+        flb_free(buf);
+        return NULL;
+    }
+
+    return buf;
+}
+
+/*
+ * Expand a dictionary encoded buffer chunk, the encoded content is read
+ * in a temporary buffer. The expanded size is set in 'size'.
+ */
+static char *qchunk_get_data_dict(int fd, size_t len, size_t *size)
+{
+    int ret;
+    ssize_t bytes;
+    size_t total = 0;
+    size_t out_size;
+    char *buf;
+    char *out;
+
+    buf = flb_malloc(len);
+    if (!buf) {
+        flb_errno();
+        return NULL;
+    }
+
+    while (total < len) {
+        bytes = read(fd, buf + total, len - total);
+        if (bytes <= 0) {
+            break;
+        }
+        total += bytes;
+    }
+
+    ret = -1;
+    if (total == len) {
+        ret = flb_dict_decode(buf, len, &out, &out_size);
+    }
+    flb_free(buf);
+
+    if (ret == -1 || !out) {
+        flb_error("[buffer qchunk] corrupted dictionary encoded chunk");
+        return NULL;
+    }
+
+    *size = out_size;
+    return out;
+}
+
 /* Load a buffer chunk into memory */
-static char *qchunk_get_data(struct flb_buffer_qchunk *qchunk, size_t *size)
+/*
+ * Load the chunk content. For not compressed chunks the file descriptor
+ * is kept open in 'out_fd' so outputs can send the file content directly
+ * (see flb_buffer_qchunk_fd()), otherwise it's set to -1.
+ */
+static char *qchunk_get_data(struct flb_buffer_qchunk *qchunk,
+                             int codec, size_t *size, int *out_fd)
 {
     int fd;
     int ret;
@@ -118,6 +304,30 @@ static char *qchunk_get_data(struct flb_buffer_qchunk *qchunk, size_t *size)
         return NULL;
     }
 
+    /* Compressed chunk: skip the header and inflate the content */
+    if (codec == FLB_BUFFER_CODEC_ZLIB) {
+        if (lseek(fd, qchunk->hdr_size, SEEK_SET) == -1) {
+            flb_errno();
+            close(fd);
+            return NULL;
+        }
+        buf = qchunk_get_data_zlib(fd, *size);
+        close(fd);
+        *out_fd = -1;
+        return buf;
+    }
+    else if (codec == FLB_BUFFER_CODEC_DICT) {
+        if (lseek(fd, qchunk->hdr_size, SEEK_SET) == -1) {
+            flb_errno();
+            close(fd);
+            return NULL;
+        }
+        buf = qchunk_get_data_dict(fd, st.st_size - qchunk->hdr_size, size);
+        close(fd);
+        *out_fd = -1;
+        return buf;
+    }
+
     buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     if (buf == MAP_FAILED) {
         perror("mmap");
@@ -125,35 +335,33 @@ static char *qchunk_get_data(struct flb_buffer_qchunk *qchunk, size_t *size)
         return NULL;
     }
 
-    close(fd);
+    *out_fd = fd;
     *size = st.st_size;
     return buf;
 }
 
+/*
+ * Get an available qchunk ID from the bitmap. The lookup starts from the
+ * first word that may have a free bit, so in the common case this is
+ * resolved with a couple of word checks.
+ */
 static int qchunk_get_id(struct flb_buffer_qworker *qw)
 {
-    uint8_t available;
-    uint16_t id;
-    uint16_t max = (1 << 14) - 1;
-    struct mk_list *head;
-    struct flb_buffer_qchunk *qchunk;
-
-    for (id = 1; id < max; id++) {
-        available = FLB_TRUE;
+    int i;
+    int bit;
 
-        mk_list_foreach(head, &qw->queue) {
-            qchunk = mk_list_entry(head, struct flb_buffer_qchunk, _head);
-            if (qchunk->id == id) {
-                available = FLB_FALSE;
-                break;
-            }
+    for (i = qw->id_hint; i < FLB_BUFFER_QC_MAP_WORDS; i++) {
+        if (qw->id_map[i] == UINT64_MAX) {
+            continue;
         }
 
-        if (available == FLB_TRUE) {
-            return id;
-        }
+        bit = __builtin_ctzll(~qw->id_map[i]);
+        qw->id_map[i] |= (1ULL << bit);
+        qw->id_hint = i;
+        return (i * 64) + bit;
     }
 
+    qw->id_hint = FLB_BUFFER_QC_MAP_WORDS;
     return -1;
 }
 
@@ -166,6 +374,8 @@ static inline int qchunk_event_push_request(struct flb_buffer *ctx)
 {
     int id;
     int ret = 0;
+    int codec;
+    int fd;
     uint64_t val;
     uint32_t set = 0;
     size_t buf_size;
@@ -179,29 +389,64 @@ static inline int qchunk_event_push_request(struct flb_buffer *ctx)
 
     flb_trace("[buffer qchunk] event: PUSH_REQUEST received");
 
-    /* Always send the first qchunk entry from the lsit */
+    /* Always send the first qchunk entry from the list */
     mk_list_foreach_safe(head, tmp, &qw->queue) {
         qchunk = mk_list_entry(head, struct flb_buffer_qchunk, _head);
         if (qchunk->id > 0) {
             continue;
         }
 
+        /*
+         * Do not load more data than allowed, the chunk will be promoted
+         * once some loaded qchunks are popped. If nothing is loaded at
+         * all, the chunk is always accepted so a single chunk bigger
+         * than the limit cannot stall the queue.
+         */
+        ret = qchunk_get_size(qchunk, &buf_size, &codec);
+        if (ret == -1) {
+            if (flb_buffer_chunk_evicted(ctx, qchunk->hash_str)) {
+                flb_buffer_qchunk_delete(qw, qchunk);
+                continue;
+            }
+            flb_error("[buffer qchunk] could not stat %s", qchunk->file_path);
+            continue;
+        }
+        if (qw->mmap_size > 0 &&
+            qw->mmap_size + buf_size > qw->mmap_limit) {
+            flb_debug("[buffer qchunk] mmap limit reached (%lu/%lu bytes)",
+                      qw->mmap_size, qw->mmap_limit);
+            return -1;
+        }
+
         /* Load into memory */
-        buf = qchunk_get_data(qchunk, &buf_size);
+        buf = qchunk_get_data(qchunk, codec, &buf_size, &fd);
         if (!buf) {
             flb_error("[buffer qchunk] could not load %s", qchunk->file_path);
+            continue;
         }
 
         /* Obtain an ID for this qchunk */
         id = qchunk_get_id(qw);
         if (id == -1) {
-            flb_free(buf);
+            qchunk_free_data(buf, buf_size, codec);
+            if (fd >= 0) {
+                close(fd);
+            }
             flb_error("[buffer qchunk] unvailable IDs / max=(1<<14)-1");
-            continue;
+            return -1;
+        }
+        qchunk->id    = id;
+        qchunk->fd    = fd;
+        qchunk->data  = buf;
+        qchunk->size  = buf_size;
+        qchunk->codec = codec;
+
+        /* Raw and version 1 chunks carry no metadata, scan them here */
+        if (qchunk->meta.records == 0) {
+            flb_chunk_meta_scan(&qchunk->meta, buf, buf_size);
         }
-        qchunk->id   = id;
-        qchunk->data = buf;
-        qchunk->size = buf_size;
+        qw->id_table[id] = qchunk;
+        qw->mmap_size += buf_size;
 
         /*
          * Compose the event message: since we are running in a separate
@@ -221,7 +466,14 @@ static inline int qchunk_event_push_request(struct flb_buffer *ctx)
         if (ret == -1) {
             perror("write");
             flb_error("[buffer qchunk] could not notify engine");
-            flb_free(buf);
+            qchunk_free_data(buf, buf_size, codec);
+            qw->mmap_size -= buf_size;
+            qchunk_id_release(qw, id);
+            qchunk->id = 0;
+            if (fd >= 0) {
+                close(fd);
+                qchunk->fd = -1;
+            }
             continue;
         }
         return ret;
@@ -238,8 +490,6 @@ static inline int qchunk_event_push_request(struct flb_buffer *ctx)
 static inline int qchunk_event_pop_request(struct flb_buffer *ctx,
                                            uint64_t key)
 {
-    struct mk_list *tmp;
-    struct mk_list *head;
     struct flb_buffer_qchunk *qchunk;
     struct flb_buffer_qworker *qw;
 
@@ -248,15 +498,67 @@ static inline int qchunk_event_pop_request(struct flb_buffer *ctx,
     flb_debug("[buffer qchunk] event: POP_REQUEST received");
 
     /* Lookup target qchunk for removal */
+    if (key == 0 || key > FLB_BUFFER_QC_ID_MAX) {
+        return -1;
+    }
+
+    qchunk = qw->id_table[key];
+    if (!qchunk) {
+        return -1;
+    }
+
+    flb_buffer_qchunk_delete(qw, qchunk);
+    return 0;
+}
+
+/*
+ * Upon an EVICT request, remove the queued qchunks whose buffer chunk was
+ * evicted by the Buffer_Max_Size quota. Loaded qchunks keep their data
+ * until they are popped.
+ */
+static inline int qchunk_event_evict(struct flb_buffer *ctx)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_buffer_qchunk *qchunk;
+    struct flb_buffer_qworker *qw;
+
+    qw = ctx->qworker;
+
     mk_list_foreach_safe(head, tmp, &qw->queue) {
         qchunk = mk_list_entry(head, struct flb_buffer_qchunk, _head);
-        if (qchunk->id == key) {
-            flb_buffer_qchunk_delete(qchunk);
-            return 0;
+        if (qchunk->id == 0 &&
+            flb_buffer_chunk_evicted(ctx, qchunk->hash_str)) {
+            flb_debug("[buffer qchunk] evicted %s", qchunk->file_path);
+            flb_buffer_qchunk_delete(qw, qchunk);
         }
     }
 
-    return -1;
+    return 0;
+}
+
+/*
+ * Lookup the file descriptor of a loaded qchunk, it's only available for
+ * not compressed chunks where the file content is the same data handed
+ * to the outputs. It returns -1 if the qchunk is not file-backed.
+ */
+int flb_buffer_qchunk_fd(struct flb_buffer *ctx, int id, int *fd)
+{
+    struct flb_buffer_qchunk *qchunk;
+    struct flb_buffer_qworker *qw;
+
+    qw = ctx->qworker;
+    if (!qw || id <= 0 || id > FLB_BUFFER_QC_ID_MAX) {
+        return -1;
+    }
+
+    qchunk = qw->id_table[id];
+    if (!qchunk || qchunk->fd == -1) {
+        return -1;
+    }
+
+    *fd = qchunk->fd;
+    return 0;
 }
 
 /* Handle events from the event loop */
@@ -287,6 +589,9 @@ static int qchunk_handle_event(int fd, int mask, struct flb_buffer *ctx)
     else if (type == FLB_BUFFER_QC_POP_REQUEST) {
         ret = qchunk_event_pop_request(ctx, key);
     }
+    else if (type == FLB_BUFFER_QC_EVICT) {
+        ret = qchunk_event_evict(ctx);
+    }
 
     return ret;
 }
@@ -342,10 +647,11 @@ int flb_buffer_qchunk_signal(uint64_t type, uint64_t val,
 int flb_buffer_qchunk_create(struct flb_buffer *ctx)
 {
     int ret;
+    int64_t limit;
     struct flb_buffer_qworker *qw;
 
     /* Allocate context */
-    qw = flb_malloc(sizeof(struct flb_buffer_qworker));
+    qw = flb_calloc(1, sizeof(struct flb_buffer_qworker));
     if (!qw) {
         perror("malloc");
         return -1;
@@ -353,6 +659,25 @@ int flb_buffer_qchunk_create(struct flb_buffer *ctx)
     qw->tid = 0;
     mk_list_init(&qw->queue);
 
+    /* ID zero is reserved: it means the qchunk is not loaded */
+    qw->id_map[0] = 1;
+    qw->id_hint = 0;
+
+    /* Limit of bytes mapped in memory */
+    qw->mmap_size  = 0;
+    qw->mmap_limit = FLB_BUFFER_QC_MMAP_LIMIT;
+    if (ctx->config->buffer_mmap_limit) {
+        limit = flb_utils_size_to_bytes(ctx->config->buffer_mmap_limit);
+        if (limit <= 0) {
+            flb_error("[buffer qchunk] invalid %s value '%s'",
+                      FLB_CONF_STR_BUF_MMAP_LIMIT,
+                      ctx->config->buffer_mmap_limit);
+            flb_free(qw);
+            return -1;
+        }
+        qw->mmap_limit = limit;
+    }
+
     /* Create an event loop */
     qw->evl = mk_event_loop_create(16);
     if (!qw->evl) {
@@ -388,7 +713,7 @@ void flb_buffer_qchunk_destroy(struct flb_buffer *ctx)
     /* Delete the list of qchunk entries */
     mk_list_foreach_safe(head, tmp, &qw->queue) {
         qchunk = mk_list_entry(head, struct flb_buffer_qchunk, _head);
-        flb_buffer_qchunk_delete(qchunk);
+        flb_buffer_qchunk_delete(qw, qchunk);
     }
 
     mk_event_loop_destroy(qw->evl);
@@ -462,19 +787,15 @@ int flb_buffer_qchunk_stop(struct flb_buffer *ctx)
 int flb_buffer_qchunk_push(struct flb_buffer *ctx, int id)
 {
     int ret;
-    struct mk_list *head;
     struct flb_buffer_qworker *qw;
-    struct flb_buffer_qchunk *qchunk = NULL;
+    struct flb_buffer_qchunk *qchunk;
 
-    qw = ctx->qworker;
-    mk_list_foreach(head, &qw->queue) {
-        qchunk = mk_list_entry(head, struct flb_buffer_qchunk, _head);
-        if (qchunk->id == id) {
-            break;
-        }
-        qchunk = NULL;
+    if (id <= 0 || id > FLB_BUFFER_QC_ID_MAX) {
+        return -1;
     }
 
+    qw = ctx->qworker;
+    qchunk = qw->id_table[id];
     if (!qchunk) {
         return -1;
     }
@@ -486,6 +807,7 @@ int flb_buffer_qchunk_push(struct flb_buffer *ctx, int id)
                                      qchunk->tag,
                                      qchunk->routes,
                                      qchunk->hash_str,
+                                     &qchunk->meta,
                                      ctx->config);
     return ret;
 }
@@ -0,0 +1,245 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <string.h>
+#include <pthread.h>
+
+#include <mk_core.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_chain.h>
+
+/*
+ * Free blocks, shared by every chain, one list per block size. Packers may
+ * run out of the engine thread (threaded inputs) so the lists are protected
+ * by a mutex, it's only taken when a block is filled or released.
+ */
+#define POOL_CLASSES   5       /* FLB_CHAIN_BLOCK_MIN << 0..4 */
+
+static struct mk_list pool[POOL_CLASSES] = {
+    { &pool[0], &pool[0] }, { &pool[1], &pool[1] }, { &pool[2], &pool[2] },
+    { &pool[3], &pool[3] }, { &pool[4], &pool[4] }
+};
+static int pool_count[POOL_CLASSES];
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int pool_class(size_t size)
+{
+    int c = 0;
+
+    while (size > FLB_CHAIN_BLOCK_MIN && c < POOL_CLASSES - 1) {
+        size >>= 1;
+        c++;
+    }
+    return c;
+}
+
+static struct flb_chain_block *block_get(size_t size)
+{
+    int c;
+    struct flb_chain_block *block = NULL;
+
+    c = pool_class(size);
+
+    pthread_mutex_lock(&pool_mutex);
+    if (pool_count[c] > 0) {
+        block = mk_list_entry_first(&pool[c], struct flb_chain_block, _head);
+        mk_list_del(&block->_head);
+        pool_count[c]--;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (!block) {
+        block = flb_malloc(sizeof(struct flb_chain_block) + size);
+        if (!block) {
+            flb_errno();
+            return NULL;
+        }
+        block->size = size;
+    }
+
+    block->len = 0;
+    return block;
+}
+
+static void block_put(struct flb_chain_block *block)
+{
+    int c;
+
+    c = pool_class(block->size);
+
+    pthread_mutex_lock(&pool_mutex);
+    if (pool_count[c] < FLB_CHAIN_POOL_MAX) {
+        mk_list_add(&block->_head, &pool[c]);
+        pool_count[c]++;
+        block = NULL;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    flb_free(block);
+}
+
+void flb_chain_init(struct flb_chain *chain)
+{
+    chain->size  = 0;
+    chain->mem   = 0;
+    chain->count = 0;
+    mk_list_init(&chain->blocks);
+}
+
+/* Append 'len' bytes, a msgpack_packer_write callback */
+int flb_chain_write(void *data, const char *buf, size_t len)
+{
+    size_t avail;
+    size_t size = FLB_CHAIN_BLOCK_MIN;
+    struct flb_chain *chain = data;
+    struct flb_chain_block *block = NULL;
+
+    if (chain->count > 0) {
+        block = mk_list_entry_last(&chain->blocks,
+                                   struct flb_chain_block, _head);
+    }
+
+    while (len > 0) {
+        if (!block || block->len == block->size) {
+            /* every new block doubles the previous one */
+            if (block) {
+                size = block->size * 2;
+                if (size > FLB_CHAIN_BLOCK_MAX) {
+                    size = FLB_CHAIN_BLOCK_MAX;
+                }
+            }
+            block = block_get(size);
+            if (!block) {
+                return -1;
+            }
+            mk_list_add(&block->_head, &chain->blocks);
+            chain->count++;
+            chain->mem += block->size;
+        }
+
+        avail = block->size - block->len;
+        if (avail > len) {
+            avail = len;
+        }
+        memcpy(block->data + block->len, buf, avail);
+        block->len  += avail;
+        chain->size += avail;
+        buf += avail;
+        len -= avail;
+    }
+
+    return 0;
+}
+
+/* Hand the blocks of 'src' over to the end of 'dst', 'src' ends empty */
+void flb_chain_move(struct flb_chain *dst, struct flb_chain *src)
+{
+    if (src->count == 0) {
+        return;
+    }
+
+    mk_list_cat(&src->blocks, &dst->blocks);
+    dst->size  += src->size;
+    dst->mem   += src->mem;
+    dst->count += src->count;
+    flb_chain_init(src);
+}
+
+/*
+ * Fill up to 'n' iovec entries with the blocks in order, it returns the
+ * number of entries used (chain->count if 'n' is big enough).
+ */
+int flb_chain_iov(struct flb_chain *chain, struct iovec *iov, int n)
+{
+    int i = 0;
+    struct mk_list *head;
+    struct flb_chain_block *block;
+
+    mk_list_foreach(head, &chain->blocks) {
+        if (i == n) {
+            break;
+        }
+        block = mk_list_entry(head, struct flb_chain_block, _head);
+        iov[i].iov_base = block->data;
+        iov[i].iov_len  = block->len;
+        i++;
+    }
+
+    return i;
+}
+
+/* Copy the content into a new buffer of its exact size */
+char *flb_chain_flatten(struct flb_chain *chain)
+{
+    char *buf;
+    char *p;
+    struct mk_list *head;
+    struct flb_chain_block *block;
+
+    buf = flb_malloc(chain->size > 0 ? chain->size : 1);
+    if (!buf) {
+        flb_errno();
+        return NULL;
+    }
+
+    p = buf;
+    mk_list_foreach(head, &chain->blocks) {
+        block = mk_list_entry(head, struct flb_chain_block, _head);
+        memcpy(p, block->data, block->len);
+        p += block->len;
+    }
+
+    return buf;
+}
+
+/* Release the blocks, the chain can be written again */
+void flb_chain_reset(struct flb_chain *chain)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_chain_block *block;
+
+    mk_list_foreach_safe(head, tmp, &chain->blocks) {
+        block = mk_list_entry(head, struct flb_chain_block, _head);
+        mk_list_del(&block->_head);
+        block_put(block);
+    }
+    flb_chain_init(chain);
+}
+
+/* Release the pooled blocks */
+void flb_chain_pool_exit()
+{
+    int i;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_chain_block *block;
+
+    pthread_mutex_lock(&pool_mutex);
+    for (i = 0; i < POOL_CLASSES; i++) {
+        mk_list_foreach_safe(head, tmp, &pool[i]) {
+            block = mk_list_entry(head, struct flb_chain_block, _head);
+            mk_list_del(&block->_head);
+            flb_free(block);
+        }
+        pool_count[i] = 0;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
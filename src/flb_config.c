@@ -33,6 +33,7 @@
 #include <fluent-bit/flb_kernel.h>
 #include <fluent-bit/flb_worker.h>
 #include <fluent-bit/flb_scheduler.h>
+#include <fluent-bit/flb_dns.h>
 
 struct flb_service_config service_configs[] = {
     {FLB_CONF_STR_FLUSH,
@@ -51,6 +52,42 @@ struct flb_service_config service_configs[] = {
      FLB_CONF_TYPE_STR,
      offsetof(struct flb_config, log)},
 
+    {FLB_CONF_STR_NET_KA,
+     FLB_CONF_TYPE_BOOL,
+     offsetof(struct flb_config, net_keepalive)},
+
+    {FLB_CONF_STR_NET_KA_IDLE_TIMEOUT,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, net_keepalive_idle_timeout)},
+
+    {FLB_CONF_STR_NET_KA_MAX_REQUESTS,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, net_keepalive_max_requests)},
+
+    {FLB_CONF_STR_NET_KA_POOL_SIZE,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, net_keepalive_pool_size)},
+
+    {FLB_CONF_STR_NET_IO_TIMEOUT,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, net_io_timeout)},
+
+    {FLB_CONF_STR_DNS_SERVER,
+     FLB_CONF_TYPE_STR,
+     offsetof(struct flb_config, dns_server)},
+
+    {FLB_CONF_STR_DNS_TIMEOUT,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, dns_timeout)},
+
+    {FLB_CONF_STR_DNS_MAX_TTL,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, dns_max_ttl)},
+
+    {FLB_CONF_STR_DNS_NEGATIVE_TTL,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, dns_negative_ttl)},
+
 #ifdef FLB_HAVE_HTTP
     {FLB_CONF_STR_HTTP_MONITOR,
      FLB_CONF_TYPE_BOOL,
@@ -69,6 +106,34 @@ struct flb_service_config service_configs[] = {
     {FLB_CONF_STR_BUF_WORKERS,
      FLB_CONF_TYPE_INT,
      offsetof(struct flb_config, buffer_workers)},
+
+    {FLB_CONF_STR_BUF_MMAP_LIMIT,
+     FLB_CONF_TYPE_STR,
+     offsetof(struct flb_config, buffer_mmap_limit)},
+
+    {FLB_CONF_STR_BUF_COMPRESS,
+     FLB_CONF_TYPE_STR,
+     offsetof(struct flb_config, buffer_compress)},
+
+    {FLB_CONF_STR_BUF_MAX_SIZE,
+     FLB_CONF_TYPE_STR,
+     offsetof(struct flb_config, buffer_max_size)},
+
+    {FLB_CONF_STR_BUF_MAX_POLICY,
+     FLB_CONF_TYPE_STR,
+     offsetof(struct flb_config, buffer_max_policy)},
+
+    {FLB_CONF_STR_BUF_MODE,
+     FLB_CONF_TYPE_STR,
+     offsetof(struct flb_config, buffer_mode)},
+
+    {FLB_CONF_STR_BUF_MEM_LIMIT,
+     FLB_CONF_TYPE_STR,
+     offsetof(struct flb_config, buffer_mem_limit)},
+
+    {FLB_CONF_STR_BUF_SPILL_AGE,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, buffer_spill_age)},
 #endif
 
     {NULL, FLB_CONF_TYPE_OTHER, 0} /* end of array */
@@ -99,6 +164,22 @@ struct flb_config *flb_config_init()
     config->kernel       = flb_kernel_info();
     config->verbose      = 3;
 
+    /* Upstream keepalive */
+    config->net_keepalive              = FLB_TRUE;
+    config->net_keepalive_idle_timeout = FLB_CONFIG_KA_IDLE_TIMEOUT;
+    config->net_keepalive_max_requests = FLB_CONFIG_KA_MAX_REQUESTS;
+    config->net_keepalive_pool_size    = FLB_CONFIG_KA_POOL_SIZE;
+    config->net_io_timeout             = FLB_CONFIG_NET_IO_TIMEOUT;
+    config->net_timer_fd               = -1;
+    mk_list_init(&config->upstreams);
+
+    /* DNS resolver */
+    config->dns              = NULL;
+    config->dns_server       = NULL;
+    config->dns_timeout      = FLB_DNS_TIMEOUT;
+    config->dns_max_ttl      = FLB_DNS_MAX_TTL;
+    config->dns_negative_ttl = FLB_DNS_NEGATIVE_TTL;
+
 #ifdef FLB_HAVE_HTTP
     config->http_server  = FLB_FALSE;
     config->http_port    = flb_strdup(FLB_CONFIG_HTTP_PORT);
@@ -108,6 +189,13 @@ struct flb_config *flb_config_init()
     config->buffer_ctx     = NULL;
     config->buffer_path    = NULL;
     config->buffer_workers = 0;
+    config->buffer_mmap_limit = NULL;
+    config->buffer_compress   = NULL;
+    config->buffer_max_size   = NULL;
+    config->buffer_max_policy = NULL;
+    config->buffer_mode = NULL;
+    config->buffer_mem_limit = NULL;
+    config->buffer_spill_age = -1;
 #endif
 
     mk_list_init(&config->collectors);
@@ -202,6 +290,10 @@ void flb_config_exit(struct flb_config *config)
     /* Release scheduler */
     flb_sched_exit(config);
 
+    /* DNS resolver */
+    flb_dns_destroy(config->dns);
+    flb_free(config->dns_server);
+
 #ifdef FLB_HAVE_HTTP
     if (config->http_port) {
         flb_free(config->http_port);
@@ -214,6 +306,12 @@ void flb_config_exit(struct flb_config *config)
 
 #ifdef FLB_HAVE_BUFFERING
     flb_free(config->buffer_path);
+    flb_free(config->buffer_mmap_limit);
+    flb_free(config->buffer_compress);
+    flb_free(config->buffer_max_size);
+    flb_free(config->buffer_max_policy);
+    flb_free(config->buffer_mode);
+    flb_free(config->buffer_mem_limit);
 #endif
 
     mk_event_loop_destroy(config->evl);
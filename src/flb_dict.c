@@ -0,0 +1,439 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <msgpack.h>
+
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_dict.h>
+
+/* A map key seen in the chunk, it points to the chunk content */
+struct dict_key {
+    const char *ptr;
+    uint32_t len;
+    int type;                   /* MSGPACK_OBJECT_STR or _BIN */
+    int count;                  /* occurrences                */
+    int index;                  /* table index or -1          */
+};
+
+/* Open addressing hash table of keys */
+struct dict {
+    struct dict_key *slots;
+    size_t n_slots;             /* power of two */
+    size_t used;
+    int entries;                /* keys in the table */
+};
+
+static inline uint32_t key_hash(const char *p, uint32_t len, int type)
+{
+    uint32_t i;
+    uint32_t h = 2166136261u ^ type;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int dict_init(struct dict *d, size_t n_slots)
+{
+    d->slots = flb_calloc(n_slots, sizeof(struct dict_key));
+    if (!d->slots) {
+        flb_errno();
+        return -1;
+    }
+    d->n_slots = n_slots;
+    d->used = 0;
+    d->entries = 0;
+    return 0;
+}
+
+static struct dict_key *dict_slot(struct dict *d, const char *p,
+                                  uint32_t len, int type)
+{
+    size_t i;
+    struct dict_key *k;
+
+    i = key_hash(p, len, type) & (d->n_slots - 1);
+    while (1) {
+        k = &d->slots[i];
+        if (!k->ptr ||
+            (k->len == len && k->type == type && memcmp(k->ptr, p, len) == 0)) {
+            return k;
+        }
+        i = (i + 1) & (d->n_slots - 1);
+    }
+}
+
+static int dict_grow(struct dict *d)
+{
+    size_t i;
+    struct dict old = *d;
+    struct dict_key *k;
+
+    if (dict_init(d, old.n_slots * 2) == -1) {
+        *d = old;
+        return -1;
+    }
+
+    for (i = 0; i < old.n_slots; i++) {
+        if (!old.slots[i].ptr) {
+            continue;
+        }
+        k = dict_slot(d, old.slots[i].ptr, old.slots[i].len,
+                      old.slots[i].type);
+        *k = old.slots[i];
+        d->used++;
+    }
+    flb_free(old.slots);
+    return 0;
+}
+
+/* Account the map keys of 'o', it returns -1 if the chunk can't be encoded */
+static int dict_count(struct dict *d, msgpack_object *o)
+{
+    uint32_t i;
+    msgpack_object *key;
+    struct dict_key *k;
+
+    if (o->type == MSGPACK_OBJECT_ARRAY) {
+        for (i = 0; i < o->via.array.size; i++) {
+            if (dict_count(d, &o->via.array.ptr[i]) == -1) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    else if (o->type != MSGPACK_OBJECT_MAP) {
+        return 0;
+    }
+
+    for (i = 0; i < o->via.map.size; i++) {
+        key = &o->via.map.ptr[i].key;
+
+        /* a key already looking like a reference would be ambiguous */
+        if (key->type == MSGPACK_OBJECT_EXT &&
+            key->via.ext.type == FLB_DICT_EXT_KEY) {
+            return -1;
+        }
+
+        if ((key->type == MSGPACK_OBJECT_STR ||
+             key->type == MSGPACK_OBJECT_BIN) &&
+            key->via.str.size >= FLB_DICT_KEY_MIN) {
+            if ((d->used + 1) * 10 > d->n_slots * 7 && dict_grow(d) == -1) {
+                return -1;
+            }
+            k = dict_slot(d, key->via.str.ptr, key->via.str.size, key->type);
+            if (!k->ptr) {
+                k->ptr   = key->via.str.ptr;
+                k->len   = key->via.str.size;
+                k->type  = key->type;
+                k->index = -1;
+                d->used++;
+            }
+            k->count++;
+
+            /* indexes follow the order of the second appearance */
+            if (k->count == 2 && d->entries < FLB_DICT_MAX) {
+                k->index = d->entries++;
+            }
+        }
+
+        if (dict_count(d, &o->via.map.ptr[i].val) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void pack_key_ref(msgpack_packer *pck, int index)
+{
+    char buf[2];
+
+    if (index < 256) {
+        buf[0] = index;
+        msgpack_pack_ext(pck, 1, FLB_DICT_EXT_KEY);
+        msgpack_pack_ext_body(pck, buf, 1);
+    }
+    else {
+        buf[0] = (index >> 8) & 0xff;
+        buf[1] = index & 0xff;
+        msgpack_pack_ext(pck, 2, FLB_DICT_EXT_KEY);
+        msgpack_pack_ext_body(pck, buf, 2);
+    }
+}
+
+/* Pack 'o' replacing the interned map keys by their reference */
+static void dict_pack(struct dict *d, msgpack_packer *pck, msgpack_object *o)
+{
+    uint32_t i;
+    msgpack_object *key;
+    struct dict_key *k;
+
+    if (o->type == MSGPACK_OBJECT_ARRAY) {
+        msgpack_pack_array(pck, o->via.array.size);
+        for (i = 0; i < o->via.array.size; i++) {
+            dict_pack(d, pck, &o->via.array.ptr[i]);
+        }
+        return;
+    }
+    else if (o->type != MSGPACK_OBJECT_MAP) {
+        msgpack_pack_object(pck, *o);
+        return;
+    }
+
+    msgpack_pack_map(pck, o->via.map.size);
+    for (i = 0; i < o->via.map.size; i++) {
+        key = &o->via.map.ptr[i].key;
+        k = NULL;
+        if ((key->type == MSGPACK_OBJECT_STR ||
+             key->type == MSGPACK_OBJECT_BIN) &&
+            key->via.str.size >= FLB_DICT_KEY_MIN) {
+            k = dict_slot(d, key->via.str.ptr, key->via.str.size, key->type);
+        }
+
+        if (k && k->index >= 0) {
+            pack_key_ref(pck, k->index);
+        }
+        else {
+            msgpack_pack_object(pck, *key);
+        }
+        dict_pack(d, pck, &o->via.map.ptr[i].val);
+    }
+}
+
+/* Pack the keys table as the first object of the encoded chunk */
+static int dict_pack_table(struct dict *d, msgpack_packer *pck)
+{
+    size_t i;
+    msgpack_sbuffer tbuf;
+    msgpack_packer tpck;
+    struct dict_key **keys;
+
+    keys = flb_malloc(sizeof(struct dict_key *) * d->entries);
+    if (!keys) {
+        flb_errno();
+        return -1;
+    }
+    for (i = 0; i < d->n_slots; i++) {
+        if (d->slots[i].ptr && d->slots[i].index >= 0) {
+            keys[d->slots[i].index] = &d->slots[i];
+        }
+    }
+
+    msgpack_sbuffer_init(&tbuf);
+    msgpack_packer_init(&tpck, &tbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&tpck, d->entries);
+    for (i = 0; i < (size_t) d->entries; i++) {
+        if (keys[i]->type == MSGPACK_OBJECT_STR) {
+            msgpack_pack_str(&tpck, keys[i]->len);
+            msgpack_pack_str_body(&tpck, keys[i]->ptr, keys[i]->len);
+        }
+        else {
+            msgpack_pack_bin(&tpck, keys[i]->len);
+            msgpack_pack_bin_body(&tpck, keys[i]->ptr, keys[i]->len);
+        }
+    }
+    flb_free(keys);
+
+    msgpack_pack_ext(pck, tbuf.size, FLB_DICT_EXT_TABLE);
+    msgpack_pack_ext_body(pck, tbuf.data, tbuf.size);
+    msgpack_sbuffer_destroy(&tbuf);
+
+    return 0;
+}
+
+/*
+ * Encode a chunk of records. It returns -1 if there is nothing to intern
+ * or the content is not valid, the chunk should be kept as it is then.
+ */
+int flb_dict_encode(char *buf, size_t size, char **out_buf, size_t *out_size)
+{
+    int ret = 0;
+    size_t off = 0;
+    struct dict d;
+    msgpack_unpacked result;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+
+    if (dict_init(&d, 256) == -1) {
+        return -1;
+    }
+
+    /* First pass: find the repeated keys */
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, buf, size, &off)) {
+        if (dict_count(&d, &result.data) == -1) {
+            ret = -1;
+            break;
+        }
+    }
+    msgpack_unpacked_destroy(&result);
+
+    if (ret == -1 || off != size || d.entries == 0) {
+        flb_free(d.slots);
+        return -1;
+    }
+
+    /* Second pass: table and records with references */
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    if (dict_pack_table(&d, &pck) == -1) {
+        msgpack_sbuffer_destroy(&sbuf);
+        flb_free(d.slots);
+        return -1;
+    }
+
+    off = 0;
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, buf, size, &off)) {
+        dict_pack(&d, &pck, &result.data);
+    }
+    msgpack_unpacked_destroy(&result);
+    flb_free(d.slots);
+
+    if (!sbuf.data || sbuf.size >= size) {
+        /* not smaller, not worth */
+        msgpack_sbuffer_destroy(&sbuf);
+        return -1;
+    }
+
+    *out_buf  = sbuf.data;
+    *out_size = sbuf.size;
+    return 0;
+}
+
+/* Pack 'o' back with the original keys */
+static int dict_expand(msgpack_object *table, uint32_t entries,
+                       msgpack_packer *pck, msgpack_object *o)
+{
+    uint32_t i;
+    uint32_t index;
+    msgpack_object *key;
+    const unsigned char *p;
+
+    if (o->type == MSGPACK_OBJECT_ARRAY) {
+        msgpack_pack_array(pck, o->via.array.size);
+        for (i = 0; i < o->via.array.size; i++) {
+            if (dict_expand(table, entries, pck,
+                            &o->via.array.ptr[i]) == -1) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    else if (o->type != MSGPACK_OBJECT_MAP) {
+        msgpack_pack_object(pck, *o);
+        return 0;
+    }
+
+    msgpack_pack_map(pck, o->via.map.size);
+    for (i = 0; i < o->via.map.size; i++) {
+        key = &o->via.map.ptr[i].key;
+        if (key->type == MSGPACK_OBJECT_EXT &&
+            key->via.ext.type == FLB_DICT_EXT_KEY) {
+            p = (const unsigned char *) key->via.ext.ptr;
+            if (key->via.ext.size == 1) {
+                index = p[0];
+            }
+            else if (key->via.ext.size == 2) {
+                index = ((uint32_t) p[0] << 8) | p[1];
+            }
+            else {
+                return -1;
+            }
+            if (index >= entries) {
+                return -1;
+            }
+            msgpack_pack_object(pck, table[index]);
+        }
+        else {
+            msgpack_pack_object(pck, *key);
+        }
+
+        if (dict_expand(table, entries, pck, &o->via.map.ptr[i].val) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Expand an encoded chunk to plain MessagePack records */
+int flb_dict_decode(char *buf, size_t size, char **out_buf, size_t *out_size)
+{
+    int ret = 0;
+    size_t off = 0;
+    size_t t_off = 0;
+    msgpack_object *table;
+    msgpack_unpacked t_result;
+    msgpack_unpacked result;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+
+    /* keys table */
+    msgpack_unpacked_init(&t_result);
+    if (!msgpack_unpack_next(&t_result, buf, size, &off) ||
+        t_result.data.type != MSGPACK_OBJECT_EXT ||
+        t_result.data.via.ext.type != FLB_DICT_EXT_TABLE) {
+        msgpack_unpacked_destroy(&t_result);
+        return -1;
+    }
+
+    msgpack_unpacked_init(&result);
+    if (!msgpack_unpack_next(&result, t_result.data.via.ext.ptr,
+                             t_result.data.via.ext.size, &t_off) ||
+        result.data.type != MSGPACK_OBJECT_ARRAY) {
+        msgpack_unpacked_destroy(&result);
+        msgpack_unpacked_destroy(&t_result);
+        return -1;
+    }
+
+    /* 'result' keeps the table while the records are expanded */
+    table = result.data.via.array.ptr;
+    msgpack_unpacked_destroy(&t_result);
+    msgpack_unpacked_init(&t_result);
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    while (msgpack_unpack_next(&t_result, buf, size, &off)) {
+        ret = dict_expand(table, result.data.via.array.size, &pck,
+                          &t_result.data);
+        if (ret == -1) {
+            break;
+        }
+    }
+    msgpack_unpacked_destroy(&t_result);
+    msgpack_unpacked_destroy(&result);
+
+    if (ret == -1 || off != size) {
+        msgpack_sbuffer_destroy(&sbuf);
+        return -1;
+    }
+
+    *out_buf  = sbuf.data;
+    *out_size = sbuf.size;
+    return 0;
+}
@@ -0,0 +1,764 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * FLB_DNS
+ * =======
+ * Minimal stub resolver used by the upstream connections. getaddrinfo(3)
+ * blocks the caller, and since outputs connect from inside a co-routine a
+ * slow name server stalls the whole engine. This resolver instead sends
+ * an 'A' query over UDP and, when running inside a co-routine, yields
+ * until the answer arrives.
+ *
+ * Results are cached per host name using the record TTL (capped by
+ * DNS_Max_TTL); names that do not exist are cached for DNS_Negative_TTL
+ * seconds. Numeric addresses and /etc/hosts entries never hit the
+ * network.
+ *
+ * Only the first server is asked, only 'A' records are queried and
+ * truncated answers are not retried over TCP: on any failure, negative
+ * answers included, the caller falls back to getaddrinfo(3). Queries use
+ * random IDs and answers are only taken from the server address.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_str.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_thread.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_dns.h>
+
+#define FLB_DNS_RESOLV_CONF  "/etc/resolv.conf"
+#define FLB_DNS_HOSTS        "/etc/hosts"
+
+#define DNS_TYPE_A      1
+#define DNS_CLASS_IN    1
+#define DNS_RCODE_NAME  3    /* NXDOMAIN */
+#define DNS_FLAG_TC     0x02 /* truncated answer */
+
+static inline void dns_lock(struct flb_dns *dns)
+{
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&dns->mutex);
+#endif
+}
+
+static inline void dns_unlock(struct flb_dns *dns)
+{
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&dns->mutex);
+#endif
+}
+
+/* Set the name server address from a 'ip' or 'ip:port' string */
+static int dns_server_set(struct flb_dns *dns, char *str)
+{
+    int port = FLB_DNS_PORT;
+    char *p;
+    char ip[INET_ADDRSTRLEN];
+
+    p = strchr(str, ':');
+    if (p) {
+        if (p - str >= (int) sizeof(ip)) {
+            return -1;
+        }
+        memcpy(ip, str, p - str);
+        ip[p - str] = '\0';
+        port = atoi(p + 1);
+        if (port <= 0 || port > 65535) {
+            return -1;
+        }
+    }
+    else {
+        if (strlen(str) >= sizeof(ip)) {
+            return -1;
+        }
+        strcpy(ip, str);
+    }
+
+    memset(&dns->server, 0, sizeof(dns->server));
+    dns->server.sin_family = AF_INET;
+    dns->server.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &dns->server.sin_addr) != 1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Read the name server, search domains and 'ndots' from resolv.conf */
+static void dns_resolv_conf(struct flb_dns *dns, int set_server)
+{
+    int n;
+    char line[1024];
+    char *key;
+    char *val;
+    char *save;
+    FILE *f;
+
+    f = fopen(FLB_DNS_RESOLV_CONF, "r");
+    if (!f) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line) - 1, f)) {
+        key = strtok_r(line, " \t\r\n", &save);
+        if (!key || key[0] == '#' || key[0] == ';') {
+            continue;
+        }
+
+        if (strcmp(key, "nameserver") == 0 && set_server == FLB_TRUE) {
+            val = strtok_r(NULL, " \t\r\n", &save);
+            if (val && dns_server_set(dns, val) == 0) {
+                set_server = FLB_FALSE;
+            }
+        }
+        else if (strcmp(key, "search") == 0 || strcmp(key, "domain") == 0) {
+            /* the last 'search' or 'domain' line wins */
+            for (n = 0; n < dns->n_search; n++) {
+                flb_free(dns->search[n]);
+            }
+            dns->n_search = 0;
+            while ((val = strtok_r(NULL, " \t\r\n", &save)) &&
+                   dns->n_search < FLB_DNS_MAX_SEARCH) {
+                dns->search[dns->n_search++] = flb_strdup(val);
+            }
+        }
+        else if (strcmp(key, "options") == 0) {
+            while ((val = strtok_r(NULL, " \t\r\n", &save))) {
+                if (strncmp(val, "ndots:", 6) == 0) {
+                    dns->ndots = atoi(val + 6);
+                }
+            }
+        }
+    }
+
+    fclose(f);
+}
+
+/* Look up a name in /etc/hosts, only IPv4 entries are considered */
+static int dns_hosts_lookup(char *host, struct in_addr *addr)
+{
+    int ret = -1;
+    char line[1024];
+    char *p;
+    char *ip;
+    char *name;
+    char *save;
+    FILE *f;
+    struct in_addr tmp;
+
+    f = fopen(FLB_DNS_HOSTS, "r");
+    if (!f) {
+        return -1;
+    }
+
+    while (ret == -1 && fgets(line, sizeof(line) - 1, f)) {
+        p = strchr(line, '#');
+        if (p) {
+            *p = '\0';
+        }
+
+        ip = strtok_r(line, " \t\r\n", &save);
+        if (!ip || inet_pton(AF_INET, ip, &tmp) != 1) {
+            continue;
+        }
+
+        while ((name = strtok_r(NULL, " \t\r\n", &save))) {
+            if (strcasecmp(name, host) == 0) {
+                *addr = tmp;
+                ret = 0;
+                break;
+            }
+        }
+    }
+
+    fclose(f);
+    return ret;
+}
+
+/* Find a cached entry, expired entries are removed */
+static struct flb_dns_entry *dns_cache_get(struct flb_dns *dns, char *host)
+{
+    time_t now;
+    struct mk_list *head;
+    struct flb_dns_entry *entry;
+
+    now = time(NULL);
+    mk_list_foreach(head, &dns->entries) {
+        entry = mk_list_entry(head, struct flb_dns_entry, _head);
+        if (strcasecmp(entry->name, host) != 0) {
+            continue;
+        }
+
+        if (entry->expire > now) {
+            return entry;
+        }
+
+        mk_list_del(&entry->_head);
+        flb_free(entry->name);
+        flb_free(entry);
+        return NULL;
+    }
+
+    return NULL;
+}
+
+static void dns_cache_set(struct flb_dns *dns, char *host, int status,
+                          struct in_addr *addr, int ttl)
+{
+    struct flb_dns_entry *entry;
+
+    if (ttl <= 0) {
+        return;
+    }
+
+    dns_lock(dns);
+    entry = dns_cache_get(dns, host);
+    if (!entry) {
+        entry = flb_calloc(1, sizeof(struct flb_dns_entry));
+        if (!entry) {
+            flb_errno();
+            dns_unlock(dns);
+            return;
+        }
+        entry->name = flb_strdup(host);
+        mk_list_add(&entry->_head, &dns->entries);
+    }
+
+    entry->status = status;
+    if (addr) {
+        entry->addr = *addr;
+    }
+    entry->expire = time(NULL) + ttl;
+    dns_unlock(dns);
+}
+
+/* Compose a recursive query for the 'A' record of 'name' */
+static int dns_packet_query(struct flb_dns_query *q, uint16_t id, char *name)
+{
+    int len;
+    char *p;
+    char *dot;
+    unsigned char *buf = q->packet;
+    size_t off = 12;
+
+    memset(buf, '\0', 12);
+    buf[0] = id >> 8;
+    buf[1] = id & 0xff;
+    buf[2] = 0x01;            /* RD: recursion desired */
+    buf[5] = 1;               /* QDCOUNT */
+
+    p = name;
+    while (*p) {
+        dot = strchr(p, '.');
+        len = dot ? dot - p : (int) strlen(p);
+        if (len == 0 || len > 63 || off + len + 1 + 5 > sizeof(q->packet)) {
+            return -1;
+        }
+
+        buf[off++] = len;
+        memcpy(buf + off, p, len);
+        off += len;
+
+        p += len;
+        if (*p == '.') {
+            p++;
+        }
+    }
+    buf[off++] = 0;
+
+    buf[off++] = 0;
+    buf[off++] = DNS_TYPE_A;
+    buf[off++] = 0;
+    buf[off++] = DNS_CLASS_IN;
+
+    q->size = off;
+    return 0;
+}
+
+/* Skip an encoded (maybe compressed) name, returns the new offset */
+static int dns_packet_skip_name(unsigned char *buf, int size, int off)
+{
+    while (off < size) {
+        if (buf[off] == 0) {
+            return off + 1;
+        }
+        if ((buf[off] & 0xc0) == 0xc0) {
+            return off + 2;
+        }
+        off += buf[off] + 1;
+    }
+
+    return -1;
+}
+
+/* Random query ID, so answers can't be guessed by a third party */
+static uint16_t dns_query_id(struct flb_dns *dns)
+{
+    uint16_t id;
+
+    if (dns->rand_fd == -1 ||
+        read(dns->rand_fd, &id, sizeof(id)) != sizeof(id)) {
+        id = (uint16_t) random();
+    }
+
+    return id;
+}
+
+/*
+ * Check that a packet answers the query 'q': same ID and the same
+ * question, the labels are compared ignoring the case.
+ */
+static int dns_packet_match(unsigned char *buf, int size,
+                            struct flb_dns_query *q)
+{
+    int i;
+
+    if (size < (int) q->size || buf[0] != q->packet[0] ||
+        buf[1] != q->packet[1] || !(buf[2] & 0x80) ||
+        buf[4] != 0 || buf[5] != 1) {
+        return FLB_FALSE;
+    }
+
+    for (i = 12; i < (int) q->size; i++) {
+        if (tolower(buf[i]) != tolower(q->packet[i])) {
+            return FLB_FALSE;
+        }
+    }
+
+    return FLB_TRUE;
+}
+
+/*
+ * Parse an answer matching the query 'q': returns FLB_DNS_OK with the
+ * first 'A' record found, FLB_DNS_NOTFOUND if the name or the record does
+ * not exist and -1 on server errors, truncated or malformed packets.
+ */
+static int dns_packet_answer(unsigned char *buf, int size,
+                             struct flb_dns_query *q,
+                             struct in_addr *addr, int *ttl)
+{
+    int i;
+    int off;
+    int type;
+    int class;
+    int rlen;
+    int rcode;
+    int ancount;
+
+    /* the full answer needs TCP, leave it to getaddrinfo(3) */
+    if (buf[2] & DNS_FLAG_TC) {
+        return -1;
+    }
+
+    rcode = buf[3] & 0x0f;
+    if (rcode == DNS_RCODE_NAME) {
+        return FLB_DNS_NOTFOUND;
+    }
+    else if (rcode != 0) {
+        return -1;
+    }
+
+    ancount = (buf[6] << 8) | buf[7];
+    off = q->size;
+
+    for (i = 0; i < ancount; i++) {
+        off = dns_packet_skip_name(buf, size, off);
+        if (off == -1 || off + 10 > size) {
+            return -1;
+        }
+
+        type  = (buf[off] << 8) | buf[off + 1];
+        class = (buf[off + 2] << 8) | buf[off + 3];
+        rlen  = (buf[off + 8] << 8) | buf[off + 9];
+        off += 10;
+        if (off + rlen > size) {
+            return -1;
+        }
+
+        if (type == DNS_TYPE_A && class == DNS_CLASS_IN && rlen == 4) {
+            *ttl = (int) (((uint32_t) buf[off - 6] << 24) |
+                          (buf[off - 5] << 16) | (buf[off - 4] << 8) |
+                          buf[off - 3]);
+            memcpy(addr, buf + off, 4);
+            return FLB_DNS_OK;
+        }
+        off += rlen;
+    }
+
+    /* The name exists but it has no IPv4 address (NODATA) */
+    return FLB_DNS_NOTFOUND;
+}
+
+/* Wait for the query socket to become readable */
+static int dns_query_wait(struct flb_dns *dns, struct flb_dns_query *q,
+                          struct flb_thread *th)
+{
+    int ret;
+    time_t now;
+    struct pollfd pfd;
+    struct flb_upstream_conn *u_conn = q->u_conn;
+    struct flb_upstream *u = u_conn ? u_conn->u : NULL;
+
+    if (th && u && (u->flags & FLB_IO_ASYNC)) {
+        MK_EVENT_NEW(&u_conn->event);
+        u_conn->thread = th;
+        ret = mk_event_add(u->evl, q->fd, FLB_ENGINE_EV_THREAD,
+                           MK_EVENT_READ, &u_conn->event);
+        if (ret == -1) {
+            return -1;
+        }
+
+        /* flb_dns_timeouts() retransmits and wakes us up on expiration */
+        mk_list_add(&q->_head, &dns->queries);
+        flb_thread_yield(th, FLB_FALSE);
+        mk_list_del(&q->_head);
+        mk_event_del(u->evl, &u_conn->event);
+        MK_EVENT_NEW(&u_conn->event);
+
+        return q->expired == FLB_TRUE ? -1 : 0;
+    }
+
+    /* Blocking mode: retransmit every second until the deadline */
+    while (1) {
+        pfd.fd = q->fd;
+        pfd.events = POLLIN;
+        ret = poll(&pfd, 1, 1000);
+        if (ret > 0) {
+            return 0;
+        }
+        if (ret == -1 && errno != EINTR) {
+            return -1;
+        }
+
+        now = time(NULL);
+        if (now >= q->deadline) {
+            return -1;
+        }
+        send(q->fd, q->packet, q->size, 0);
+    }
+}
+
+/* Send a query for 'name' and wait for the answer */
+static int dns_query(struct flb_dns *dns, struct flb_upstream_conn *u_conn,
+                     struct flb_thread *th, char *name,
+                     struct in_addr *addr, int *ttl)
+{
+    int ret;
+    ssize_t bytes;
+    uint16_t id;
+    socklen_t peer_len;
+    unsigned char buf[FLB_DNS_PACKET_SIZE];
+    struct sockaddr_in peer;
+    struct flb_dns_query q;
+
+    id = dns_query_id(dns);
+
+    memset(&q, 0, sizeof(q));
+    ret = dns_packet_query(&q, id, name);
+    if (ret == -1) {
+        flb_error("[dns] invalid host name '%s'", name);
+        return -1;
+    }
+
+    q.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (q.fd == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    ret = connect(q.fd, (struct sockaddr *) &dns->server,
+                  sizeof(dns->server));
+    if (ret == -1 || send(q.fd, q.packet, q.size, 0) == -1) {
+        flb_errno();
+        close(q.fd);
+        return -1;
+    }
+
+    q.u_conn = u_conn;
+    q.ts_retry = time(NULL) + 1;
+    q.deadline = time(NULL) + dns->timeout;
+
+    while (1) {
+        peer_len = sizeof(peer);
+        bytes = recvfrom(q.fd, buf, sizeof(buf), 0,
+                         (struct sockaddr *) &peer, &peer_len);
+        if (bytes == -1) {
+            if (errno != EAGAIN && errno != EINTR) {
+                /* e.g: ECONNREFUSED, nobody listening */
+                ret = -1;
+                break;
+            }
+
+            if (dns_query_wait(dns, &q, th) == -1) {
+                flb_warn("[dns] query for '%s' timed out", name);
+                ret = -1;
+                break;
+            }
+            continue;
+        }
+
+        /*
+         * The socket is connected so the kernel already drops datagrams
+         * from other peers, check it anyways. Answers that don't match
+         * the query (stale or forged) are ignored.
+         */
+        if (peer_len != sizeof(peer) ||
+            peer.sin_addr.s_addr != dns->server.sin_addr.s_addr ||
+            peer.sin_port != dns->server.sin_port ||
+            dns_packet_match(buf, bytes, &q) == FLB_FALSE) {
+            continue;
+        }
+
+        ret = dns_packet_answer(buf, bytes, &q, addr, ttl);
+        break;
+    }
+
+    close(q.fd);
+    return ret;
+}
+
+/*
+ * Resolve 'host' into an IPv4 address. When called from a co-routine of an
+ * asynchronous upstream connection, the co-routine yields while the query
+ * is in flight.
+ *
+ * It returns 0 on success and -1 on failure. Negative answers are cached
+ * so the name server is not asked again for a while, but the name may
+ * still resolve through getaddrinfo(3) (NSS, IPv6 only hosts), callers
+ * fall back to it on any failure.
+ */
+int flb_dns_resolve(struct flb_dns *dns, struct flb_upstream_conn *u_conn,
+                    struct flb_thread *th, char *host, struct in_addr *addr)
+{
+    int i;
+    int ret = -1;
+    int ttl = 0;
+    int dots = 0;
+    int n_names = 0;
+    char *p;
+    char *names[FLB_DNS_MAX_SEARCH + 1];
+    char name[256];
+    struct flb_dns_entry *entry;
+
+    if (!host || *host == '\0') {
+        return -1;
+    }
+
+    /* Numeric address */
+    if (inet_pton(AF_INET, host, addr) == 1) {
+        return 0;
+    }
+
+    dns_lock(dns);
+    entry = dns_cache_get(dns, host);
+    if (entry) {
+        dns->hits++;
+        ret = entry->status;
+        *addr = entry->addr;
+        dns_unlock(dns);
+
+        if (ret == FLB_DNS_NOTFOUND) {
+            flb_debug("[dns] '%s' not found (cached)", host);
+            return -1;
+        }
+        return 0;
+    }
+    dns->misses++;
+    dns_unlock(dns);
+
+    if (dns_hosts_lookup(host, addr) == 0) {
+        dns_cache_set(dns, host, FLB_DNS_OK, addr, dns->max_ttl);
+        return 0;
+    }
+
+    /* Candidate names: try the search domains first for short names */
+    for (p = host; *p; p++) {
+        if (*p == '.') {
+            dots++;
+        }
+    }
+
+    if (dots < dns->ndots && *(p - 1) != '.') {
+        for (i = 0; i < dns->n_search; i++) {
+            names[n_names++] = dns->search[i];
+        }
+    }
+    names[n_names++] = NULL;
+
+    for (i = 0; i < n_names; i++) {
+        if (names[i]) {
+            snprintf(name, sizeof(name) - 1, "%s.%s", host, names[i]);
+        }
+        else {
+            snprintf(name, sizeof(name) - 1, "%s", host);
+        }
+
+        ret = dns_query(dns, u_conn, th, name, addr, &ttl);
+        if (ret != FLB_DNS_NOTFOUND) {
+            break;
+        }
+    }
+
+    if (ret == FLB_DNS_OK) {
+        if (ttl > dns->max_ttl) {
+            ttl = dns->max_ttl;
+        }
+        inet_ntop(AF_INET, addr, name, sizeof(name));
+        flb_debug("[dns] '%s' resolved to %s (ttl=%i)", host, name, ttl);
+        dns_cache_set(dns, host, FLB_DNS_OK, addr, ttl);
+        return 0;
+    }
+    else if (ret == FLB_DNS_NOTFOUND) {
+        flb_debug("[dns] '%s' not found", host);
+        dns_cache_set(dns, host, FLB_DNS_NOTFOUND, NULL, dns->negative_ttl);
+    }
+
+    return -1;
+}
+
+/*
+ * Called by the engine every second: retransmit pending queries and wake
+ * up the co-routines whose query reached the deadline.
+ */
+int flb_dns_timeouts(struct flb_dns *dns)
+{
+    int c = 0;
+    time_t now;
+    struct mk_list *head;
+    struct flb_dns_query *q;
+
+    now = time(NULL);
+
+ retry:
+    mk_list_foreach(head, &dns->queries) {
+        q = mk_list_entry(head, struct flb_dns_query, _head);
+        if (q->expired == FLB_TRUE) {
+            continue;
+        }
+
+        if (now >= q->deadline) {
+            /* the co-routine unlinks the query, restart the iteration */
+            q->expired = FLB_TRUE;
+            flb_thread_resume(q->u_conn->thread);
+            c++;
+            goto retry;
+        }
+
+        if (now >= q->ts_retry) {
+            send(q->fd, q->packet, q->size, 0);
+            q->ts_retry = now + 1;
+        }
+    }
+
+    return c;
+}
+
+struct flb_dns *flb_dns_create(struct flb_config *config)
+{
+    int ret;
+    char ip[INET_ADDRSTRLEN];
+    struct flb_dns *dns;
+
+    dns = flb_calloc(1, sizeof(struct flb_dns));
+    if (!dns) {
+        flb_errno();
+        return NULL;
+    }
+
+    dns->timeout      = config->dns_timeout;
+    dns->max_ttl      = config->dns_max_ttl;
+    dns->negative_ttl = config->dns_negative_ttl;
+    dns->ndots        = 1;
+    dns->rand_fd      = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    mk_list_init(&dns->entries);
+    mk_list_init(&dns->queries);
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_init(&dns->mutex, NULL);
+#endif
+
+    /* Default name server, overridden by resolv.conf and DNS_Server */
+    dns_server_set(dns, "127.0.0.1");
+    if (config->dns_server) {
+        ret = dns_server_set(dns, config->dns_server);
+        if (ret == -1) {
+            flb_error("[dns] invalid DNS_Server '%s'", config->dns_server);
+            flb_dns_destroy(dns);
+            return NULL;
+        }
+    }
+    dns_resolv_conf(dns, config->dns_server ? FLB_FALSE : FLB_TRUE);
+
+    inet_ntop(AF_INET, &dns->server.sin_addr, ip, sizeof(ip));
+    flb_debug("[dns] name server %s:%i", ip, ntohs(dns->server.sin_port));
+    return dns;
+}
+
+void flb_dns_destroy(struct flb_dns *dns)
+{
+    int i;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_dns_entry *entry;
+
+    if (!dns) {
+        return;
+    }
+
+    flb_debug("[dns] cache hits=%lu misses=%lu", dns->hits, dns->misses);
+
+    mk_list_foreach_safe(head, tmp, &dns->entries) {
+        entry = mk_list_entry(head, struct flb_dns_entry, _head);
+        mk_list_del(&entry->_head);
+        flb_free(entry->name);
+        flb_free(entry);
+    }
+
+    for (i = 0; i < dns->n_search; i++) {
+        flb_free(dns->search[i]);
+    }
+
+    if (dns->rand_fd != -1) {
+        close(dns->rand_fd);
+    }
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_destroy(&dns->mutex);
+#endif
+
+    flb_free(dns);
+}
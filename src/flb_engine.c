@@ -36,11 +36,15 @@
 #include <fluent-bit/flb_engine.h>
 #include <fluent-bit/flb_engine_dispatch.h>
 #include <fluent-bit/flb_task.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_chain.h>
 #include <fluent-bit/flb_router.h>
 #include <fluent-bit/flb_http_server.h>
 #include <fluent-bit/flb_buffer.h>
 #include <fluent-bit/flb_buffer_qchunk.h>
 #include <fluent-bit/flb_scheduler.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_dns.h>
 
 #ifdef FLB_HAVE_BUFFERING
 #include <fluent-bit/flb_buffer_chunk.h>
@@ -232,6 +236,16 @@ static inline int flb_engine_manager(int fd, struct flb_config *config)
             else {
                 flb_debug("[sched] retry=%p %i in %i seconds",
                           retry, task->id, retry_seconds);
+#ifdef FLB_HAVE_BUFFERING
+                /* Hybrid mode: a retried task must be stored */
+                if (config->buffer_ctx) {
+                    flb_buffer_chunk_spill(config->buffer_ctx, task);
+                }
+#endif
+                /* Nothing running on the task, shrink it while it waits */
+                if (task->users == 0) {
+                    flb_task_compact(task);
+                }
             }
         }
         else if (ret == FLB_ERROR) {
@@ -273,6 +287,7 @@ static FLB_INLINE int flb_engine_handle_event(int fd, int mask,
             if (config->buffer_ctx) {
                 flb_buffer_qchunk_signal(FLB_BUFFER_QC_PUSH_REQUEST, 0,
                                          config->buffer_ctx->qworker);
+                flb_buffer_chunk_spill_check(config->buffer_ctx);
             }
 #endif
             return 0;
@@ -280,6 +295,14 @@ static FLB_INLINE int flb_engine_handle_event(int fd, int mask,
         else if (config->shutdown_fd == fd) {
             return FLB_ENGINE_SHUTDOWN;
         }
+        else if (config->net_timer_fd == fd) {
+            consume_byte(fd);
+            flb_upstream_conn_timeouts(config);
+            if (config->dns) {
+                flb_dns_timeouts(config->dns);
+            }
+            return 0;
+        }
 #ifdef FLB_HAVE_STATS
         else if (config->stats_fd == fd) {
             consume_byte(fd);
@@ -356,6 +379,12 @@ int flb_engine_start(struct flb_config *config)
         exit(EXIT_FAILURE);
     }
 
+    /* DNS resolver used by upstream connections */
+    config->dns = flb_dns_create(config);
+    if (!config->dns) {
+        flb_warn("[engine] could not create DNS resolver, using getaddrinfo");
+    }
+
     /* Initialize input plugins */
     flb_input_initialize_all(config);
 
@@ -381,6 +410,20 @@ int flb_engine_start(struct flb_config *config)
         flb_utils_error(FLB_ERR_CFG_FLUSH_CREATE);
     }
 
+    /*
+     * Timer to check the deadlines of upstream network operations, it also
+     * retransmits and expires the pending DNS queries.
+     */
+    if (config->net_io_timeout > 0 || config->dns) {
+        event = &config->event_net_timer;
+        event->mask = MK_EVENT_EMPTY;
+        event->status = MK_EVENT_NONE;
+        config->net_timer_fd = mk_event_timeout_create(evl, 1, 0, event);
+        if (config->net_timer_fd == -1) {
+            flb_warn("[engine] could not create network timeouts timer");
+        }
+    }
+
     /* Initialize the stats interface (just if FLB_HAVE_STATS is defined) */
     flb_stats_init(config);
 
@@ -446,9 +489,13 @@ int flb_engine_start(struct flb_config *config)
 #endif
 
     /* Signal that we have started */
+    flb_time_update();
     flb_engine_started(config);
     while (1) {
         mk_event_wait(evl);
+
+        /* Handlers of this round stamp their records with the cached time */
+        flb_time_update();
         mk_event_foreach(event, evl) {
             if (event->type == FLB_ENGINE_EV_CORE) {
                 ret = flb_engine_handle_event(event->fd, event->mask, config);
@@ -518,5 +565,8 @@ int flb_engine_shutdown(struct flb_config *config)
 
     flb_config_exit(config);
 
+    /* free blocks kept for the chained buffers */
+    flb_chain_pool_exit();
+
     return 0;
 }
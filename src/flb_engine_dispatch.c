@@ -31,6 +31,22 @@
 void flb_task_add_thread(struct flb_thread *thread,
                                 struct flb_task *task);
 
+/* Check if every route of the task can read the records from its chain */
+static int task_routes_iov(struct flb_task *task)
+{
+    struct mk_list *head;
+    struct flb_task_route *route;
+
+    mk_list_foreach(head, &task->routes) {
+        route = mk_list_entry(head, struct flb_task_route, _head);
+        if (!(route->out->p->flags & FLB_OUTPUT_IOV)) {
+            return FLB_FALSE;
+        }
+    }
+
+    return FLB_TRUE;
+}
+
 #if defined (FLB_HAVE_FLUSH_UCONTEXT) || defined (FLB_HAVE_FLUSH_LIBCO)
 
 /* It creates a new output thread using a 'Retry' context */
@@ -44,6 +60,11 @@ int flb_engine_dispatch_retry(struct flb_task_retry *retry,
     task = retry->parent;
     i_ins = task->i_ins;
 
+    /* records compacted while the task was waiting, expand them */
+    if (task->dict_buf && !flb_task_buf(task)) {
+        return -1;
+    }
+
     th = flb_output_thread(task,
                            i_ins,
                            retry->o_ins,
@@ -81,6 +102,14 @@ static int tasks_start(struct flb_input_instance *in,
         }
         task->status = FLB_TASK_RUNNING;
 
+        /*
+         * Chained records are given as they are to the outputs handling an
+         * iovec list, the others need a contiguous buffer.
+         */
+        if (task->chain.count > 0 && task_routes_iov(task) == FLB_FALSE) {
+            flb_task_flatten(task);
+        }
+
         /* A task contain one or more routes */
         mk_list_foreach(r_head, &task->routes) {
             route = mk_list_entry(r_head, struct flb_task_route, _head);
@@ -118,14 +147,43 @@ int flb_engine_dispatch(uint64_t id, struct flb_input_instance *in,
     size_t size;
     struct flb_input_plugin *p;
     struct flb_task *task = NULL;
+    struct flb_chunk_meta meta;
+    struct flb_chain chain;
 
     p = in->p;
     if (!p) {
         return 0;
     }
 
-    if (p->cb_flush_buf) {
+    flb_chain_init(&chain);
+
+    if (p->cb_flush_chain) {
+        p->cb_flush_chain(in->context, &chain);
+
+        /* the summary kept by the plugin goes with the buffer */
+        meta = in->meta;
+        flb_chunk_meta_init(&in->meta);
+
+        if (chain.size == 0) {
+            flb_chain_reset(&chain);
+            return 0;
+        }
+
+        task = flb_task_create(id, NULL, 0, &chain, in, NULL, in->tag, &meta,
+                               config);
+        if (!task) {
+            flb_chain_reset(&chain);
+            return -1;
+        }
+        flb_trace("[engine dispatch] task #%i created %p", task->id, task);
+    }
+    else if (p->cb_flush_buf) {
         buf = p->cb_flush_buf(in->context, &size);
+
+        /* the summary kept by the plugin goes with the buffer */
+        meta = in->meta;
+        flb_chunk_meta_init(&in->meta);
+
         if (!buf || size == 0) {
             return 0;
         }
@@ -135,7 +193,8 @@ int flb_engine_dispatch(uint64_t id, struct flb_input_instance *in,
          * and the co-routines associated to the output instance plugins
          * that needs to handle the data.
          */
-        task = flb_task_create(id, buf, size, in, NULL, in->tag, config);
+        task = flb_task_create(id, buf, size, NULL, in, NULL, in->tag, &meta,
+                               config);
         if (!task) {
             flb_free(buf);
             return -1;
@@ -154,21 +213,16 @@ int flb_engine_dispatch(uint64_t id, struct flb_input_instance *in,
                 continue;
             }
 
-            /* There is a match, get the buffer */
-            buf = flb_input_dyntag_flush(dt, &size);
-            if (size == 0) {
-                if (buf) {
-                    flb_free(buf);
-                }
-                continue;
-            }
-            if (!buf) {
+            /* There is a match, take the records */
+            flb_input_dyntag_flush(dt, &chain, &meta);
+            if (chain.size == 0) {
                 continue;
             }
 
-            task = flb_task_create(id, buf, size, dt->in, dt, dt->tag, config);
+            task = flb_task_create(id, NULL, 0, &chain, dt->in, dt, dt->tag,
+                                   &meta, config);
             if (!task) {
-                flb_free(buf);
+                flb_chain_reset(&chain);
                 continue;
             }
         }
@@ -189,12 +243,13 @@ int flb_engine_dispatch_direct(uint64_t id,
                                char *buf, size_t size,
                                char *tag, uint64_t routes,
                                char *hash_str,
+                               struct flb_chunk_meta *meta,
                                struct flb_config *config)
 {
     struct flb_task *task;
 
     task = flb_task_create_direct(id, buf, size, in, tag, hash_str,
-                                  routes, config);
+                                  routes, meta, config);
     if (!task) {
         return -1;
     }
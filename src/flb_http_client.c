@@ -27,32 +27,453 @@
  * - Use upstream connections.
  * - Support 'retry' in case the HTTP server timeouts a connection.
  * - Get return Status, Headers and Body content if found.
+ * - Reuse the client and its buffers while the connection is alive.
+ * - Pipeline requests: send many of them, then read the responses.
  */
 
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
 #include <fluent-bit/flb_http_client.h>
 
-/* check if there is enough space in the client header buffer */
-static int header_available(struct flb_http_client *c, int bytes)
+static char *http_methods[] = { "GET", "POST", "PUT", "HEAD" };
+
+/* make sure the buffer has room for 'bytes' more bytes */
+static int buf_reserve(char **buf, int *len, int *size, int bytes)
 {
-    int available;
+    int new_size;
+    char *tmp;
+
+    if (*size - *len >= bytes) {
+        return 0;
+    }
+
+    if (bytes < 512) {
+        new_size = *size + 512;
+    }
+    else {
+        new_size = *size + bytes;
+    }
 
-    available = c->header_size - c->header_len;
-    if (available < bytes) {
+    tmp = flb_realloc(*buf, new_size);
+    if (!tmp) {
+        flb_errno();
         return -1;
     }
+    *buf  = tmp;
+    *size = new_size;
 
     return 0;
 }
 
-static int process_response(struct flb_http_client *c)
+static int buf_append(char **buf, int *len, int *size,
+                      char *data, int data_len)
 {
+    if (buf_reserve(buf, len, size, data_len) != 0) {
+        return -1;
+    }
+
+    memcpy(*buf + *len, data, data_len);
+    *len += data_len;
+
+    return 0;
+}
+
+static int buf_append_header(char **buf, int *len, int *size,
+                             char *key, size_t key_len,
+                             char *val, size_t val_len)
+{
+    int required;
+
+    /*
+     * The new header will need enough space in the buffer:
+     *
+     * key      : length of the key
+     * separator: ': ' (2 bytes)
+     * val      : length of the key value
+     * CRLF     : '\r\n' (2 bytes)
+     */
+    required = key_len + 2 + val_len + 2;
+    if (buf_reserve(buf, len, size, required) != 0) {
+        return -1;
+    }
+
+    memcpy(*buf + *len, key, key_len);
+    *len += key_len;
+    (*buf)[(*len)++] = ':';
+    (*buf)[(*len)++] = ' ';
+    memcpy(*buf + *len, val, val_len);
+    *len += val_len;
+    (*buf)[(*len)++] = '\r';
+    (*buf)[(*len)++] = '\n';
+
+    return 0;
+}
+
+#define header_append(c, data, len)                                     \
+    buf_append(&c->header_buf, &c->header_len, &c->header_size, data, len)
+
+/* Prepare the response for a new parse, keeping the pipelined data */
+static void response_reset(struct flb_http_response *r)
+{
+    if (r->pos > 0) {
+        memmove(r->data, r->data + r->pos, r->data_len - r->pos);
+        r->data_len -= r->pos;
+        r->data[r->data_len] = '\0';
+        r->pos = 0;
+    }
+
+    r->status         = 0;
+    r->content_length = -1;
+    r->chunked        = FLB_FALSE;
+    r->keepalive      = FLB_TRUE;
+    r->truncated      = FLB_FALSE;
+    r->payload        = NULL;
+    r->payload_size   = 0;
+    r->state          = FLB_HTTP_RESP_STATUS;
+    r->left           = 0;
+}
+
+/*
+ * Get the next complete line, 'len' is set to its length without the
+ * ending CRLF. It returns NULL if the line is not complete yet.
+ */
+static char *response_line(struct flb_http_response *r, int *len)
+{
+    char *line;
+    char *p;
+
+    line = r->data + r->pos;
+    p = memchr(line, '\n', r->data_len - r->pos);
+    if (!p) {
+        return NULL;
+    }
+
+    r->pos += (p - line) + 1;
+    if (p > line && *(p - 1) == '\r') {
+        p--;
+    }
+    *len = p - line;
+
+    return line;
+}
+
+/* If the line is the header 'name', return its value */
+static char *header_value(char *line, int len, char *name, int *val_len)
+{
+    int n;
+    char *p;
+    char *end = line + len;
+
+    n = strlen(name);
+    if (len <= n || line[n] != ':' || strncasecmp(line, name, n) != 0) {
+        return NULL;
+    }
+
+    p = line + n + 1;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    while (end > p && (*(end - 1) == ' ' || *(end - 1) == '\t')) {
+        end--;
+    }
+    *val_len = end - p;
+
+    return p;
+}
+
+/* Content-Length: digits only, a repeated header must have the same value */
+static int content_length_parse(struct flb_http_response *r,
+                                char *val, int val_len)
+{
+    unsigned long long n;
+    char *end;
+
+    if (val_len == 0 || !isdigit((unsigned char) *val)) {
+        return -1;
+    }
+
+    errno = 0;
+    n = strtoull(val, &end, 10);
+    if (errno == ERANGE || end != val + val_len || n > INT64_MAX) {
+        return -1;
+    }
+
+    if (r->content_length >= 0 && r->content_length != (int64_t) n) {
+        return -1;
+    }
+    r->content_length = n;
+
+    return 0;
+}
+
+/* It returns -1 if the header value is invalid */
+static int response_header(struct flb_http_response *r, char *line, int len)
+{
+    int val_len;
+    char *val;
+
+    val = header_value(line, len, "Content-Length", &val_len);
+    if (val) {
+        if (content_length_parse(r, val, val_len) != 0) {
+            flb_error("[http_client] invalid Content-Length: %.*s",
+                      val_len, val);
+            return -1;
+        }
+        return 0;
+    }
+
+    /* 'chunked' must be the last transfer coding */
+    val = header_value(line, len, "Transfer-Encoding", &val_len);
+    if (val) {
+        if (val_len >= 7 &&
+            strncasecmp(val + val_len - 7, "chunked", 7) == 0) {
+            r->chunked = FLB_TRUE;
+        }
+        return 0;
+    }
+
+    val = header_value(line, len, "Connection", &val_len);
+    if (val) {
+        if (val_len == 5 && strncasecmp(val, "close", 5) == 0) {
+            r->keepalive = FLB_FALSE;
+        }
+        else if (val_len == 10 && strncasecmp(val, "keep-alive", 10) == 0) {
+            r->keepalive = FLB_TRUE;
+        }
+    }
+
+    return 0;
+}
+
+/* Headers are done, find out how the body is delimited */
+static void response_body_start(struct flb_http_response *r, int method)
+{
+    r->payload = r->data + r->pos;
+
+    if (method == FLB_HTTP_HEAD || r->status < 200 ||
+        r->status == 204 || r->status == 304) {
+        r->state = FLB_HTTP_RESP_DONE;
+    }
+    else if (r->chunked == FLB_TRUE) {
+        r->state = FLB_HTTP_RESP_CHUNK_SIZE;
+    }
+    else if (r->content_length >= 0) {
+        r->left  = r->content_length;
+        r->state = FLB_HTTP_RESP_BODY;
+    }
+    else {
+        /* no length, the body ends when the server closes */
+        r->keepalive = FLB_FALSE;
+        r->state = FLB_HTTP_RESP_EOF;
+    }
+}
+
+/*
+ * Move 'n' body bytes to the end of the payload, chunked bodies are decoded
+ * in place. Once the payload is truncated the bytes are dropped.
+ */
+static void body_consume(struct flb_http_response *r, size_t n)
+{
+    char *src;
+    char *dst;
+
+    src = r->data + r->pos;
+    if (r->truncated == FLB_TRUE) {
+        memmove(src, src + n, r->data_len - r->pos - n);
+        r->data_len -= n;
+    }
+    else {
+        dst = r->payload + r->payload_size;
+        if (dst != src) {
+            memmove(dst, src, n);
+        }
+        r->payload_size += n;
+        r->pos += n;
+    }
+    r->left -= n;
+}
+
+/*
+ * Parse the data available in the response buffer. It returns 1 when the
+ * response is complete, 0 if more data is needed and -1 on error.
+ */
+static int response_parse(struct flb_http_response *r, int method)
+{
+    int len;
+    size_t n;
+    char *line;
+    char *end;
+
+    while (1) {
+        switch (r->state) {
+        case FLB_HTTP_RESP_STATUS:
+            line = response_line(r, &len);
+            if (!line) {
+                return 0;
+            }
+            /* HTTP/1.x NNN */
+            if (len < 12 || strncmp(line, "HTTP/1.", 7) != 0) {
+                return -1;
+            }
+            r->status = atoi(line + 9);
+            if (line[7] == '0') {
+                r->keepalive = FLB_FALSE;
+            }
+            r->state = FLB_HTTP_RESP_HEADERS;
+            break;
+        case FLB_HTTP_RESP_HEADERS:
+            line = response_line(r, &len);
+            if (!line) {
+                return 0;
+            }
+            if (len == 0) {
+                response_body_start(r, method);
+            }
+            else if (response_header(r, line, len) != 0) {
+                /* the body cannot be delimited, drop the response */
+                r->status = 0;
+                return -1;
+            }
+            break;
+        case FLB_HTTP_RESP_BODY:
+            n = r->data_len - r->pos;
+            if (n > r->left) {
+                n = r->left;
+            }
+            body_consume(r, n);
+            if (r->left > 0) {
+                return 0;
+            }
+            r->state = FLB_HTTP_RESP_DONE;
+            break;
+        case FLB_HTTP_RESP_CHUNK_SIZE:
+            line = response_line(r, &len);
+            if (!line) {
+                return 0;
+            }
+            n = strtoul(line, &end, 16);
+            if (end == line) {
+                return -1;
+            }
+            if (n == 0) {
+                r->state = FLB_HTTP_RESP_TRAILER;
+            }
+            else {
+                r->left  = n;
+                r->state = FLB_HTTP_RESP_CHUNK_DATA;
+            }
+            break;
+        case FLB_HTTP_RESP_CHUNK_DATA:
+            n = r->data_len - r->pos;
+            if (n > r->left) {
+                n = r->left;
+            }
+            body_consume(r, n);
+            if (r->left > 0) {
+                return 0;
+            }
+            r->state = FLB_HTTP_RESP_CHUNK_END;
+            break;
+        case FLB_HTTP_RESP_CHUNK_END:
+            line = response_line(r, &len);
+            if (!line) {
+                return 0;
+            }
+            if (len != 0) {
+                return -1;
+            }
+            r->state = FLB_HTTP_RESP_CHUNK_SIZE;
+            break;
+        case FLB_HTTP_RESP_TRAILER:
+            line = response_line(r, &len);
+            if (!line) {
+                return 0;
+            }
+            if (len == 0) {
+                r->state = FLB_HTTP_RESP_DONE;
+            }
+            break;
+        case FLB_HTTP_RESP_EOF:
+            n = r->data_len - r->pos;
+            r->left = n;
+            body_consume(r, n);
+            return 0;
+        case FLB_HTTP_RESP_DONE:
+            return 1;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Make room to read more data: reclaim the space left by decoded chunk
+ * headers, grow the buffer up to FLB_HTTP_DATA_SIZE_MAX and if the body
+ * still does not fit, keep its head and drop the rest.
+ */
+static int response_room(struct flb_http_response *r)
+{
+    size_t gap;
+    size_t cut;
+    size_t new_size;
     char *tmp;
 
-    tmp = mk_string_copy_substr(c->resp.data, 9, 12);
-    c->resp.status = atoi(tmp);
-    mk_mem_free(tmp);
+    if (r->data_len + 1 < r->data_size) {
+        return 0;
+    }
+
+    if (r->payload) {
+        gap = r->pos - ((r->payload - r->data) + r->payload_size);
+        if (gap > 0) {
+            memmove(r->data + r->pos - gap, r->data + r->pos,
+                    r->data_len - r->pos);
+            r->data_len -= gap;
+            r->pos -= gap;
+            return 0;
+        }
+    }
+
+    if (r->data_size < FLB_HTTP_DATA_SIZE_MAX) {
+        new_size = r->data_size * 2;
+        if (new_size > FLB_HTTP_DATA_SIZE_MAX) {
+            new_size = FLB_HTTP_DATA_SIZE_MAX;
+        }
+        tmp = flb_realloc(r->data, new_size);
+        if (!tmp) {
+            flb_errno();
+            return -1;
+        }
+        if (r->payload) {
+            r->payload = tmp + (r->payload - r->data);
+        }
+        r->data = tmp;
+        r->data_size = new_size;
+        return 0;
+    }
+
+    /* Headers bigger than the buffer */
+    if (!r->payload || r->payload_size == 0) {
+        return -1;
+    }
+
+    cut = r->payload_size;
+    if (cut > FLB_HTTP_DATA_SIZE) {
+        cut = FLB_HTTP_DATA_SIZE;
+    }
+    memmove(r->data + r->pos - cut, r->data + r->pos, r->data_len - r->pos);
+    r->payload_size -= cut;
+    r->pos -= cut;
+    r->data_len -= cut;
+    r->truncated = FLB_TRUE;
 
     return 0;
 }
@@ -120,237 +541,363 @@ static int proxy_parse(char *proxy, struct flb_http_client *c)
     return 0;
 }
 
-struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
-                                        int method, char *uri,
-                                        char *body, size_t body_len,
-                                        char *host, int port,
-                                        char *proxy)
+static struct flb_http_client *http_client_create(struct flb_upstream_conn *u_conn)
 {
-    int ret;
-    char *buf = NULL;
-    char *str_method = NULL;
-    char *fmt_plain =                           \
-        "%s %s HTTP/1.1\r\n"
-        "Host: %s:%i\r\n"
-        "Connection: KeepAlive\r\n"
-        "Content-Length: %i\r\n";
-    char *fmt_proxy =                           \
-        "%s http://%s:%i/%s HTTP/1.1\r\n"
-        "Host: %s:%i\r\n"
-        "Proxy-Connection: KeepAlive\r\n"
-        "Content-Length: %i\r\n";
-
+    int size;
     struct flb_http_client *c;
     struct flb_upstream *u = u_conn->u;
 
-    switch (method) {
-    case FLB_HTTP_GET:
-        str_method = "GET";
-        break;
-    case FLB_HTTP_POST:
-        str_method = "POST";
-        break;
-    case FLB_HTTP_PUT:
-        str_method = "PUT";
-        break;
-    case FLB_HTTP_HEAD:
-        str_method = "HEAD";
-        break;
-    };
-
-    buf = flb_calloc(1, FLB_HTTP_BUF_SIZE);
-    if (!buf) {
-        perror("malloc");
+    c = flb_calloc(1, sizeof(struct flb_http_client));
+    if (!c) {
+        flb_errno();
         return NULL;
     }
+    c->u_conn = u_conn;
 
-    /* FIXME: handler for HTTPS proxy */
-    if (!proxy) {
-        ret = snprintf(buf, FLB_HTTP_BUF_SIZE,
-                       fmt_plain,
-                       str_method,
-                       uri,
-                       u->tcp_host,
-                       u->tcp_port,
-                       body_len);
-    }
-    else {
-        ret = snprintf(buf, FLB_HTTP_BUF_SIZE,
-                       fmt_proxy,
-                       str_method,
-                       host,
-                       port,
-                       "",
-                       host,
-                       port,
-                       body_len);
+    c->header_buf = flb_malloc(FLB_HTTP_BUF_SIZE);
+    if (!c->header_buf) {
+        flb_errno();
+        flb_http_client_free(c);
+        return NULL;
     }
+    c->header_size = FLB_HTTP_BUF_SIZE;
 
-    if (ret == -1) {
-        perror("snprintf");
-        flb_free(buf);
+    /* Headers that only depend on the connection end-point */
+    size = strlen(u->tcp_host) + 64;
+    c->host_buf = flb_malloc(size);
+    if (!c->host_buf) {
+        flb_errno();
+        flb_http_client_free(c);
         return NULL;
     }
-
-    c = flb_calloc(1, sizeof(struct flb_http_client));
-    if (!c) {
-        flb_free(buf);
+    c->host_len = snprintf(c->host_buf, size,
+                           "Host: %s:%i\r\n"
+                           "Connection: KeepAlive\r\n",
+                           u->tcp_host, u->tcp_port);
+
+    c->resp.data = flb_malloc(FLB_HTTP_DATA_SIZE);
+    if (!c->resp.data) {
+        flb_errno();
+        flb_http_client_free(c);
         return NULL;
     }
+    c->resp.data_size = FLB_HTTP_DATA_SIZE;
+    c->resp.data[0] = '\0';
 
-    c->u_conn      = u_conn;
-    c->method      = method;
-    c->header_buf  = buf;
-    c->header_size = FLB_HTTP_BUF_SIZE;
-    c->header_len  = ret;
+    return c;
+}
+
+/* Compose the request line and the common headers */
+static int request_format(struct flb_http_client *c, int method, char *uri,
+                          char *body, size_t body_len)
+{
+    int ret;
+    int len;
+    char num[32];
+    char *str_method;
+
+    if (method < FLB_HTTP_GET || method > FLB_HTTP_HEAD) {
+        return -1;
+    }
+    str_method = http_methods[method];
+
+    c->method = method;
+    c->header_len = 0;
+
+    if (c->proxy.type == FLB_HTTP_PROXY_NONE) {
+        ret  = header_append(c, str_method, strlen(str_method));
+        ret |= header_append(c, " ", 1);
+        ret |= header_append(c, uri, strlen(uri));
+        ret |= header_append(c, " HTTP/1.1\r\n", 11);
+        ret |= header_append(c, c->host_buf, c->host_len);
+        if (ret != 0) {
+            return -1;
+        }
+    }
+    else {
+        /* FIXME: handler for HTTPS proxy */
+        len = snprintf(c->header_buf, c->header_size,
+                       "%s http://%s:%i/%s HTTP/1.1\r\n"
+                       "Host: %s:%i\r\n"
+                       "Proxy-Connection: KeepAlive\r\n",
+                       str_method, c->host, c->port, "",
+                       c->host, c->port);
+        if (len < 0 || len >= c->header_size) {
+            return -1;
+        }
+        c->header_len = len;
+    }
+
+    len = snprintf(num, sizeof(num), "%lu", (unsigned long) body_len);
+    ret  = header_append(c, "Content-Length: ", 16);
+    ret |= header_append(c, num, len);
+    ret |= header_append(c, "\r\n", 2);
+    if (ret != 0) {
+        return -1;
+    }
 
     if (body && body_len > 0) {
         c->body_buf = body;
         c->body_len = body_len;
     }
+    else {
+        c->body_buf = NULL;
+        c->body_len = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * Get the HTTP client of the connection and compose a request. The client
+ * is created on the first request, the following ones reuse it.
+ */
+struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
+                                        int method, char *uri,
+                                        char *body, size_t body_len,
+                                        char *host, int port,
+                                        char *proxy)
+{
+    int ret;
+    struct flb_http_client *c;
+
+    c = u_conn->http;
+    if (!c) {
+        c = http_client_create(u_conn);
+        if (!c) {
+            return NULL;
+        }
+        u_conn->http = c;
+    }
+    else if (c->pending > 0) {
+        flb_error("[http_client] connection has %i responses pending",
+                  c->pending);
+        return NULL;
+    }
+
+    c->host = host;
+    c->port = port;
 
-    /* Check proxy data */
-    if (proxy) {
+    /* Check proxy data, the connection always goes to the same proxy */
+    if (proxy && !c->proxy.host) {
         ret = proxy_parse(proxy, c);
         if (ret != 0) {
-            flb_free(buf);
-            flb_free(c);
             return NULL;
         }
     }
 
+    ret = request_format(c, method, uri, body, body_len);
+    if (ret != 0) {
+        return NULL;
+    }
+
     return c;
 }
 
+/*
+ * Compose a new request on the same client, used to pipeline requests
+ * once the previous one was sent.
+ */
+int flb_http_request(struct flb_http_client *c, int method, char *uri,
+                     char *body, size_t body_len)
+{
+    if (c->pending >= FLB_HTTP_PIPELINE_MAX) {
+        flb_error("[http_client] too many pipelined requests");
+        return -1;
+    }
+
+    return request_format(c, method, uri, body, body_len);
+}
+
 /* Append a custom HTTP header to the request */
 int flb_http_add_header(struct flb_http_client *c,
                         char *key, size_t key_len,
                         char *val, size_t val_len)
 {
-    int required;
-    int new_size;
-    char *tmp;
+    return buf_append_header(&c->header_buf, &c->header_len,
+                             &c->header_size,
+                             key, key_len, val, val_len);
+}
 
-    /*
-     * The new header will need enough space in the buffer:
-     *
-     * key      : length of the key
-     * separator: ': ' (2 bytes)
-     * val      : length of the key value
-     * CRLF     : '\r\n' (2 bytes)
-     */
-    required = key_len + 2 + val_len + 2;
+/* Append a set of pre-formatted headers to the request */
+int flb_http_add_headers(struct flb_http_client *c,
+                         struct flb_http_headers *h)
+{
+    return header_append(c, h->buf, h->len);
+}
 
-    if (header_available(c, required) != 0) {
-        if (required < 512) {
-            new_size = c->header_size + 512;
-        }
-        else {
-            new_size = c->header_size + required;
-        }
-        tmp = flb_realloc(c->header_buf, new_size);
-        if (!tmp) {
-            perror("realloc");
-            return -1;
-        }
-        c->header_buf  = tmp;
-        c->header_size = new_size;
+/* Write the request, the response must be read with flb_http_response() */
+int flb_http_send(struct flb_http_client *c, size_t *bytes)
+{
+    int ret;
+    size_t bytes_sent = 0;
+    struct iovec iov[2];
+
+    if (c->pending >= FLB_HTTP_PIPELINE_MAX) {
+        flb_error("[http_client] too many pipelined requests");
+        return -1;
     }
 
-    /* append the header key */
-    memcpy(c->header_buf + c->header_len,
-           key, key_len);
-    c->header_len += key_len;
+    /* Append the ending header CRLF */
+    if (header_append(c, "\r\n", 2) != 0) {
+        return -1;
+    }
 
-    /* append the separator */
-    c->header_buf[c->header_len++] = ':';
-    c->header_buf[c->header_len++] = ' ';
+    /* Until the responses are fully read, the connection cannot be reused */
+    c->u_conn->ka_close = FLB_TRUE;
 
-    /* append the header value */
-    memcpy(c->header_buf + c->header_len,
-           val, val_len);
-    c->header_len += val_len;
+    /* Write the header and the body (if any) in one call */
+    iov[0].iov_base = c->header_buf;
+    iov[0].iov_len  = c->header_len;
+    iov[1].iov_base = c->body_buf;
+    iov[1].iov_len  = c->body_len;
 
-    /* Append the ending header CRLF */
-    c->header_buf[c->header_len++] = '\r';
-    c->header_buf[c->header_len++] = '\n';
+    ret = flb_io_net_writev(c->u_conn, iov, c->body_len > 0 ? 2 : 1,
+                            &bytes_sent);
+    if (ret == -1) {
+        return -1;
+    }
+
+    /* number of sent bytes */
+    *bytes = bytes_sent;
+
+    c->pipeline[(c->p_head + c->pending) % FLB_HTTP_PIPELINE_MAX] = c->method;
+    c->pending++;
 
     return 0;
 }
 
-int flb_http_do(struct flb_http_client *c, size_t *bytes)
+/*
+ * Read the response of the oldest request sent. It returns 0 if at least
+ * the status was received, the connection is only reused if the response
+ * was complete.
+ */
+int flb_http_response(struct flb_http_client *c)
 {
     int ret;
+    int method;
     int r_bytes;
-    int available;
-    int crlf = 2;
-    int new_size;
-    size_t bytes_header = 0;
-    size_t bytes_body = 0;
-    char *tmp;
+    struct flb_http_response *r = &c->resp;
 
-    /* check enough space for the ending CRLF */
-    if (header_available(c, crlf) != 0) {
-        new_size = c->header_size + 2;
-        tmp = flb_realloc(c->header_buf, new_size);
-        if (!tmp) {
-            return -1;
-        }
-        c->header_buf = tmp;
-        c->header_len = new_size;
+    if (c->pending == 0) {
+        return -1;
     }
+    method = c->pipeline[c->p_head];
+    c->p_head = (c->p_head + 1) % FLB_HTTP_PIPELINE_MAX;
+    c->pending--;
+
+    response_reset(r);
+    while (1) {
+        ret = response_parse(r, method);
+        if (ret == 1 && r->status >= 100 && r->status < 200) {
+            /* informational, the final response follows */
+            response_reset(r);
+            continue;
+        }
+        else if (ret != 0) {
+            break;
+        }
 
-    /* Append the ending header CRLF */
-    c->header_buf[c->header_len++] = '\r';
-    c->header_buf[c->header_len++] = '\n';
+        if (response_room(r) != 0) {
+            ret = -1;
+            break;
+        }
 
-    /* Write the header */
-    ret = flb_io_net_write(c->u_conn,
-                           c->header_buf, c->header_len,
-                           &bytes_header);
-    if (ret == -1) {
-        perror("write");
-        return -1;
+        r_bytes = flb_io_net_read(c->u_conn,
+                                  r->data + r->data_len,
+                                  r->data_size - r->data_len - 1);
+        if (r_bytes <= 0) {
+            if (r->state == FLB_HTTP_RESP_EOF) {
+                r->state = FLB_HTTP_RESP_DONE;
+                ret = 1;
+            }
+            else {
+                ret = -1;
+            }
+            break;
+        }
+        r->data_len += r_bytes;
+        r->data[r->data_len] = '\0';
     }
 
-    if (c->body_len > 0) {
-        ret = flb_io_net_write(c->u_conn,
-                               c->body_buf, c->body_len,
-                               &bytes_body);
-        if (ret == -1) {
-            perror("write");
-            return -1;
+    if (ret == 1 && r->keepalive == FLB_TRUE) {
+        /* data not requested means the protocol state is unknown */
+        if (c->pending == 0 && r->pos == r->data_len) {
+            c->u_conn->ka_close = FLB_FALSE;
         }
     }
+    else {
+        /* the responses of the remaining requests will not come */
+        c->pending = 0;
+    }
 
-    /* number of sent bytes */
-    *bytes = (bytes_header + bytes_body);
+    if (ret == 1 || r->status > 0) {
+        return 0;
+    }
 
-    /* Read the server response, we need at least 19 bytes */
-    c->resp.data_len = 0;
-    while (c->resp.data_len < 19) {
-        available = ((sizeof(c->resp.data) - 1) - c->resp.data_len);
-        if (available < 1) {
-            return -1;
-        }
+    return -1;
+}
 
-        r_bytes = flb_io_net_read(c->u_conn,
-                                  c->resp.data + c->resp.data_len,
-                                  available);
-        if (r_bytes <= 0) {
-            return -1;
-        }
+int flb_http_do(struct flb_http_client *c, size_t *bytes)
+{
+    int ret;
 
-        c->resp.data_len += r_bytes;
-        c->resp.data[c->resp.data_len] = '\0';
+    ret = flb_http_send(c, bytes);
+    if (ret == -1) {
+        return -1;
     }
 
-    process_response(c);
-    return 0;
+    return flb_http_response(c);
 }
 
+/*
+ * The request is done, the client stays with the connection and it's
+ * released by flb_http_client_free() when the connection is destroyed.
+ */
 void flb_http_client_destroy(struct flb_http_client *c)
+{
+    if (c->pending > 0) {
+        c->u_conn->ka_close = FLB_TRUE;
+    }
+
+    c->body_buf = NULL;
+    c->body_len = 0;
+}
+
+void flb_http_client_free(struct flb_http_client *c)
 {
     flb_free(c->header_buf);
+    flb_free(c->host_buf);
+    flb_free(c->resp.data);
+    if (c->proxy.host) {
+        free(c->proxy.host);
+    }
     flb_free(c);
 }
+
+struct flb_http_headers *flb_http_headers_create()
+{
+    struct flb_http_headers *h;
+
+    h = flb_calloc(1, sizeof(struct flb_http_headers));
+    if (!h) {
+        flb_errno();
+        return NULL;
+    }
+
+    return h;
+}
+
+int flb_http_headers_add(struct flb_http_headers *h,
+                         char *key, size_t key_len,
+                         char *val, size_t val_len)
+{
+    return buf_append_header(&h->buf, &h->len, &h->size,
+                             key, key_len, val, val_len);
+}
+
+void flb_http_headers_destroy(struct flb_http_headers *h)
+{
+    flb_free(h->buf);
+    flb_free(h);
+}
@@ -120,6 +120,8 @@ struct flb_input_instance *flb_input_new(struct flb_config *config,
         instance->context  = NULL;
         instance->data     = data;
         instance->threaded = FLB_FALSE;
+        instance->intern_keys = FLB_FALSE;
+        flb_chunk_meta_init(&instance->meta);
 
         /* net */
         instance->host.name    = NULL;
@@ -179,6 +181,14 @@ int flb_input_set_property(struct flb_input_instance *in, char *k, char *v)
         in->tag     = flb_strdup(v);
         in->tag_len = strlen(v);
     }
+    else if (prop_key_check("intern_keys", k, len) == 0) {
+        if (strcasecmp(v, "true") == 0 || strcasecmp(v, "on") == 0) {
+            in->intern_keys = FLB_TRUE;
+        }
+        else {
+            in->intern_keys = FLB_FALSE;
+        }
+    }
     else {
         /* Append any remaining configuration key to prop list */
         prop = flb_malloc(sizeof(struct flb_config_prop));
@@ -381,12 +391,14 @@ int flb_input_set_collector_time(struct flb_input_instance *in,
 
     collector = flb_malloc(sizeof(struct flb_input_collector));
     collector->type        = FLB_COLLECT_TIME;
+    collector->paused      = FLB_FALSE;
     collector->cb_collect  = cb_collect;
     collector->fd_event    = -1;
     collector->fd_timer    = -1;
     collector->seconds     = seconds;
     collector->nanoseconds = nanoseconds;
     collector->instance    = in;
+    collector->context     = NULL;
 
     mk_list_add(&collector->_head, &config->collectors);
     return 0;
@@ -401,12 +413,14 @@ int flb_input_set_collector_event(struct flb_input_instance *in,
 
     collector = flb_malloc(sizeof(struct flb_input_collector));
     collector->type        = FLB_COLLECT_FD_EVENT;
+    collector->paused      = FLB_FALSE;
     collector->cb_collect  = cb_collect;
     collector->fd_event    = fd;
     collector->fd_timer    = -1;
     collector->seconds     = -1;
     collector->nanoseconds = -1;
     collector->instance    = in;
+    collector->context     = NULL;
     mk_list_add(&collector->_head, &config->collectors);
 
     return 0;
@@ -421,17 +435,42 @@ int flb_input_set_collector_socket(struct flb_input_instance *in,
 
     collector = flb_malloc(sizeof(struct flb_input_collector));
     collector->type        = FLB_COLLECT_FD_SERVER;
+    collector->paused      = FLB_FALSE;
     collector->cb_collect  = cb_new_connection;
     collector->fd_event    = fd;
     collector->fd_timer    = -1;
     collector->seconds     = -1;
     collector->nanoseconds = -1;
     collector->instance    = in;
+    collector->context     = NULL;
     mk_list_add(&collector->_head, &config->collectors);
 
     return 0;
 }
 
+/*
+ * Set the data given to the callback of the collector watching 'fd', a
+ * server may register one context per listening socket so the callback
+ * knows which one is ready.
+ */
+int flb_input_set_collector_context(struct flb_input_instance *in,
+                                    int fd, void *context,
+                                    struct flb_config *config)
+{
+    struct mk_list *head;
+    struct flb_input_collector *collector;
+
+    mk_list_foreach(head, &config->collectors) {
+        collector = mk_list_entry(head, struct flb_input_collector, _head);
+        if (collector->instance == in && collector->fd_event == fd) {
+            collector->context = context;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
 /* Creates a new dyntag node for the input_instance in question */
 struct flb_input_dyntag *flb_input_dyntag_create(struct flb_input_instance *in,
                                                  char *tag, int tag_len)
@@ -456,8 +495,9 @@ struct flb_input_dyntag *flb_input_dyntag_create(struct flb_input_instance *in,
     dt->tag_len = tag_len;
 
     /* Initialize MessagePack fields */
-    msgpack_sbuffer_init(&dt->mp_sbuf);
-    msgpack_packer_init(&dt->mp_pck, &dt->mp_sbuf, msgpack_sbuffer_write);
+    flb_chain_init(&dt->chain);
+    flb_chain_packer_init(&dt->mp_pck, &dt->chain);
+    flb_chunk_meta_init(&dt->meta);
 
     /* Link to the list head */
     mk_list_add(&dt->_head, &in->dyntags);
@@ -470,7 +510,7 @@ int flb_input_dyntag_destroy(struct flb_input_dyntag *dt)
     flb_debug("[dyntag %s] %p destroy (tag=%s)",
               dt->in->name, dt, dt->tag);
 
-    msgpack_sbuffer_destroy(&dt->mp_sbuf);
+    flb_chain_reset(&dt->chain);
     mk_list_del(&dt->_head);
     flb_free(dt->tag);
     flb_free(dt);
@@ -491,6 +531,24 @@ void flb_input_dyntag_exit(struct flb_input_instance *in)
 }
 
 
+/* Append a packed entry to the dyntag buffer and account it in the summary */
+static void dyntag_pack(struct flb_input_dyntag *dt, msgpack_object *data)
+{
+    time_t t;
+    size_t size = dt->chain.size;
+
+    msgpack_pack_object(&dt->mp_pck, *data);
+
+    if (data->type == MSGPACK_OBJECT_ARRAY && data->via.array.size == 2 &&
+        flb_record_time_get(&data->via.array.ptr[0], &t) == 0) {
+        flb_chunk_meta_add(&dt->meta, t, dt->chain.size - size);
+    }
+    else {
+        dt->meta.records++;
+        dt->meta.bytes += dt->chain.size - size;
+    }
+}
+
 /* Append a MessagPack Map to an active buffer in the input instance */
 int flb_input_dyntag_append(struct flb_input_instance *in,
                             char *tag, size_t tag_len,
@@ -521,7 +579,7 @@ int flb_input_dyntag_append(struct flb_input_instance *in,
 
     /* Found a dyntag node that can append the new info */
     if (dt) {
-        msgpack_pack_object(&dt->mp_pck, data);
+        dyntag_pack(dt, &data);
         goto out;
     }
 
@@ -530,41 +588,37 @@ int flb_input_dyntag_append(struct flb_input_instance *in,
     if (!dt) {
         return -1;
     }
-    msgpack_pack_object(&dt->mp_pck, data);
+    dyntag_pack(dt, &data);
 
  out:
     /* Lock buffers where size > 2MB */
-    if (dt->mp_sbuf.size > 2048000) {
+    if (dt->chain.size > 2048000) {
         dt->lock = FLB_TRUE;
     }
 
     return 0;
 }
 
-/* Retrieve a raw buffer from a dyntag node */
-void *flb_input_dyntag_flush(struct flb_input_dyntag *dt, size_t *size)
+/* Move the dyntag records and their summary to 'chain' */
+void flb_input_dyntag_flush(struct flb_input_dyntag *dt,
+                            struct flb_chain *chain,
+                            struct flb_chunk_meta *meta)
 {
-    void *buf;
-
     /*
-     * MessagePack-C internal use a raw buffer for it operations, since we
-     * already appended data we just can take out the references to avoid
-     * a new memory allocation and skip a copy operation.
+     * The blocks are handed over as they are, the packer keeps pointing
+     * to the dyntag chain which is empty now.
      */
-
-    buf   = dt->mp_sbuf.data;
-    *size = dt->mp_sbuf.size;
+    *meta = dt->meta;
+    flb_chain_move(chain, &dt->chain);
+    flb_chunk_meta_init(&dt->meta);
 
     /* Unset the lock, it means more data can be added */
     dt->lock = FLB_FALSE;
 
     /* Set it busy as it likely it's a reference for an outgoing task */
-    dt->busy = FLB_TRUE;
-
-    msgpack_sbuffer_init(&dt->mp_sbuf);
-    msgpack_packer_init(&dt->mp_pck, &dt->mp_sbuf, msgpack_sbuffer_write);
-
-    return buf;
+    if (chain->size > 0) {
+        dt->busy = FLB_TRUE;
+    }
 }
 
 int flb_input_collector_fd(int fd, struct flb_config *config)
@@ -599,8 +653,74 @@ int flb_input_collector_fd(int fd, struct flb_config *config)
         flb_thread_resume(th);
     }
     else {
-        collector->cb_collect(config, collector->instance->context);
+        collector->cb_collect(config, flb_input_collector_context(collector));
     }
 
     return 0;
 }
+
+/*
+ * Stop collecting data from the input instances: every collector event is
+ * removed from the engine event loop until flb_input_resume_all() is
+ * called. This is used as a backpressure mechanism, connections that were
+ * already accepted by server collectors are not affected.
+ */
+void flb_input_pause_all(struct flb_config *config)
+{
+    struct mk_list *head;
+    struct flb_input_collector *collector;
+
+    mk_list_foreach(head, &config->collectors) {
+        collector = mk_list_entry(head, struct flb_input_collector, _head);
+        if (collector->paused == FLB_TRUE) {
+            continue;
+        }
+
+        if (collector->type == FLB_COLLECT_TIME && collector->fd_timer == -1) {
+            continue;
+        }
+
+        mk_event_del(config->evl, &collector->event);
+        collector->paused = FLB_TRUE;
+    }
+
+    flb_warn("[input] inputs paused");
+}
+
+/* Register back into the event loop the collectors paused previously */
+void flb_input_resume_all(struct flb_config *config)
+{
+    int fd;
+    int ret;
+    struct mk_list *head;
+    struct mk_event *event;
+    struct flb_input_collector *collector;
+
+    mk_list_foreach(head, &config->collectors) {
+        collector = mk_list_entry(head, struct flb_input_collector, _head);
+        if (collector->paused == FLB_FALSE) {
+            continue;
+        }
+
+        if (collector->type == FLB_COLLECT_TIME) {
+            fd = collector->fd_timer;
+        }
+        else {
+            fd = collector->fd_event;
+        }
+
+        event = &collector->event;
+        event->mask   = MK_EVENT_EMPTY;
+        event->status = MK_EVENT_NONE;
+        ret = mk_event_add(config->evl, fd,
+                           FLB_ENGINE_EV_CORE, MK_EVENT_READ, event);
+        if (ret == -1) {
+            flb_error("[input] could not resume collector for %s",
+                      collector->instance->name);
+            continue;
+        }
+        collector->paused = FLB_FALSE;
+    }
+
+    flb_info("[input] inputs resumed");
+}
@@ -50,6 +50,17 @@
 #include <unistd.h>
 #include <limits.h>
 #include <assert.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#endif
+#include <string.h>
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_config.h>
@@ -61,61 +72,165 @@
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_macros.h>
 #include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_dns.h>
 #include <fluent-bit/flb_engine.h>
 #include <fluent-bit/flb_thread.h>
 
-FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
-                                  struct flb_thread *th)
+/*
+ * Limits for the number of bytes handed to each write(2) on async mode, the
+ * real size is taken from the socket send buffer (SO_SNDBUF).
+ */
+#define FLB_IO_WRITE_SIZE_MIN  16384
+#define FLB_IO_WRITE_SIZE_MAX  524288
+
+/*
+ * MSG_ZEROCOPY (Linux >= 4.14): wakeups without new completions tolerated
+ * while waiting on the socket error queue before giving up.
+ */
+#define FLB_IO_ZEROCOPY_IDLE   16
+
+#ifdef __linux__
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY                0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY       5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED  1
+#endif
+#endif
+
+/* Number of iovec entries handled without a dynamic allocation */
+#define FLB_IO_IOV_STATIC      8
+
+/*
+ * Network operations deadlines: every operation (connect, write or read)
+ * sets a deadline on the connection. On async mode the engine checks the
+ * deadlines every second and shutdown(2) the sockets of expired ones so
+ * the co-routine is resumed (see flb_upstream_conn_timeouts()). Sockets
+ * are non-blocking on both modes, blocking mode waits with poll(2) for
+ * the remaining time.
+ */
+static inline int net_io_deadline_set(struct flb_upstream_conn *u_conn)
+{
+    if (u_conn->ts_deadline > 0) {
+        /* Already set by the caller operation */
+        return FLB_FALSE;
+    }
+
+    if (u_conn->u->net_io_timeout > 0) {
+        u_conn->ts_deadline = time(NULL) + u_conn->u->net_io_timeout;
+    }
+    return FLB_TRUE;
+}
+
+static inline int net_io_deadline_expired(struct flb_upstream_conn *u_conn)
+{
+    if (u_conn->ts_deadline > 0 && time(NULL) >= u_conn->ts_deadline) {
+        flb_error("[io] fd=%i %s:%i operation timed out after %i seconds",
+                  u_conn->fd, u_conn->u->tcp_host, u_conn->u->tcp_port,
+                  u_conn->u->net_io_timeout);
+        return FLB_TRUE;
+    }
+    return FLB_FALSE;
+}
+
+/* Blocking mode: wait until the socket is ready or the deadline expires */
+static int net_io_wait(struct flb_upstream_conn *u_conn, int events)
 {
-    int fd;
     int ret;
-    int error = 0;
-    socklen_t len = sizeof(error);
-    struct flb_upstream *u = u_conn->u;
+    int timeout = -1;
+    time_t now;
+    struct pollfd pfd;
 
-    if (u_conn->fd > 0) {
-        close(u_conn->fd);
+    if (u_conn->ts_deadline > 0) {
+        now = time(NULL);
+        if (now >= u_conn->ts_deadline) {
+            net_io_deadline_expired(u_conn);
+            return -1;
+        }
+        timeout = (u_conn->ts_deadline - now) * 1000;
     }
 
-    /* Create the socket */
-    fd = flb_net_socket_create(AF_INET, FLB_FALSE);
-    if (fd == -1) {
-        flb_error("[io] could not create socket");
+    pfd.fd      = u_conn->fd;
+    pfd.events  = events;
+    pfd.revents = 0;
+
+    do {
+        ret = poll(&pfd, 1, timeout);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret == 0) {
+        net_io_deadline_expired(u_conn);
+        return -1;
+    }
+    else if (ret == -1) {
+        flb_errno();
         return -1;
     }
-    u_conn->fd = fd;
 
-    /*
-     * If we use co-routines flushing method, make sure socket
-     * operations are asynchronous
-     */
-    if (u->flags & FLB_IO_ASYNC) {
-        flb_net_socket_nonblocking(u_conn->fd);
+    if (pfd.revents & POLLNVAL) {
+        return -1;
     }
 
-    flb_net_socket_tcp_nodelay(fd);
+    return 0;
+}
 
-    /* Start the connection */
-    ret = flb_net_tcp_fd_connect(fd, u->tcp_host, u->tcp_port);
-    if (ret == -1) {
-        /* In blocking mode connect() fails right away */
-        if ((u->flags & FLB_IO_ASYNC) == 0) {
-            close(fd);
-            return -1;
-        }
+/* Blocking mode wait for other layers (TLS), see net_io_wait() */
+int flb_io_net_wait(struct flb_upstream_conn *u_conn, int events)
+{
+    return net_io_wait(u_conn, events);
+}
 
-        if (errno == EINPROGRESS) {
-            flb_trace("[upstream] connection in process");
-        }
-        else {
-            close(fd);
+/* Number of bytes to write per call, it follows the socket send buffer */
+static size_t net_io_write_size(struct flb_upstream_conn *u_conn)
+{
+    int ret;
+    int size;
+    socklen_t len = sizeof(size);
+
+    if (u_conn->write_size > 0) {
+        return u_conn->write_size;
+    }
+
+    ret = getsockopt(u_conn->fd, SOL_SOCKET, SO_SNDBUF, &size, &len);
+    if (ret == -1 || size <= 0) {
+        size = FLB_IO_WRITE_SIZE_MAX;
+    }
+    else if (size < FLB_IO_WRITE_SIZE_MIN) {
+        size = FLB_IO_WRITE_SIZE_MIN;
+    }
+    else if (size > FLB_IO_WRITE_SIZE_MAX) {
+        size = FLB_IO_WRITE_SIZE_MAX;
+    }
+
+    u_conn->write_size = size;
+    return size;
+}
+
+/*
+ * Wait for a non-blocking connect(2) to complete: the co-routine yields
+ * until the socket is writable, then the socket error is checked.
+ */
+static int net_io_connect_wait(struct flb_upstream_conn *u_conn,
+                               struct flb_thread *th)
+{
+    int ret;
+    int error = 0;
+    socklen_t len = sizeof(error);
+    struct flb_upstream *u = u_conn->u;
+
+    if ((u->flags & FLB_IO_ASYNC) == 0) {
+        if (net_io_wait(u_conn, POLLOUT) == -1) {
             return -1;
         }
-
+    }
+    else {
         MK_EVENT_NEW(&u_conn->event);
         u_conn->thread = th;
         ret = mk_event_add(u->evl,
-                           fd,
+                           u_conn->fd,
                            FLB_ENGINE_EV_THREAD,
                            MK_EVENT_WRITE, &u_conn->event);
         if (ret == -1) {
@@ -123,7 +238,6 @@ FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
              * If we failed here there no much that we can do, just
              * let the caller we failed
              */
-            close(fd);
             return -1;
         }
 
@@ -137,29 +251,157 @@ FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
         ret = mk_event_del(u->evl, &u_conn->event);
         assert(ret == 0);
 
-        /* Check the connection status */
-        if (u_conn->event.mask & MK_EVENT_WRITE) {
-            ret = getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
-            if (ret == -1) {
-                flb_error("[io] could not validate socket status");
-                close(fd);
-                return -1;
-            }
+        if (net_io_deadline_expired(u_conn) == FLB_TRUE) {
+            return -1;
+        }
 
-            if (error != 0) {
-                /* Connection is broken, not much to do here */
-                flb_error("[io] TCP connection failed: %s:%i",
-                          u->tcp_host, u->tcp_port);
-                close(fd);
-                return -1;
-            }
+        if ((u_conn->event.mask & MK_EVENT_WRITE) == 0) {
+            return -1;
+        }
+        MK_EVENT_NEW(&u_conn->event);
+    }
 
-            MK_EVENT_NEW(&u_conn->event);
+    /* Check the connection status */
+    ret = getsockopt(u_conn->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (ret == -1) {
+        flb_error("[io] could not validate socket status");
+        return -1;
+    }
+
+    if (error != 0) {
+        /* Connection is broken, not much to do here */
+        flb_error("[io] TCP connection failed: %s:%i",
+                  u->tcp_host, u->tcp_port);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * A TCP Fast Open connection sends its SYN with the first write. Before an
+ * operation that cannot carry it (sendfile(2) or a read), an empty send
+ * starts the handshake and we wait for it.
+ */
+static int net_io_tfo_connect(struct flb_upstream_conn *u_conn,
+                              struct flb_thread *th)
+{
+    int ret;
+
+    u_conn->tfo_pending = FLB_FALSE;
+
+    ret = send(u_conn->fd, NULL, 0, MSG_NOSIGNAL);
+    if (ret == 0) {
+        return 0;
+    }
+    if (errno != EINPROGRESS && errno != EAGAIN) {
+        flb_errno();
+        return -1;
+    }
+
+    return net_io_connect_wait(u_conn, th);
+}
+
+static int net_io_connect(struct flb_upstream_conn *u_conn,
+                          struct flb_thread *th)
+{
+    int fd;
+    int ret;
+    int tfo = FLB_FALSE;
+    int resolved = FLB_FALSE;
+    struct sockaddr_in addr;
+    struct flb_upstream *u = u_conn->u;
+
+    /*
+     * Resolve the host name first: the resolver caches the results and
+     * does not block the event loop while a query is in flight. If it
+     * fails, negative answers included, getaddrinfo(3) gets a chance when
+     * connecting.
+     */
+    if (u->dns) {
+        memset(&addr, 0, sizeof(addr));
+        ret = flb_dns_resolve(u->dns, u_conn, th, u->tcp_host, &addr.sin_addr);
+        if (ret == 0) {
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(u->tcp_port);
+            resolved = FLB_TRUE;
+        }
+        else {
+            flb_debug("[io] resolver failed for %s, using getaddrinfo",
+                      u->tcp_host);
+        }
+    }
+
+    /* Create the socket */
+    fd = flb_net_socket_create(AF_INET, FLB_FALSE);
+    if (fd == -1) {
+        flb_error("[io] could not create socket");
+        return -1;
+    }
+    u_conn->fd = fd;
+
+    /*
+     * The socket is non-blocking on both modes: co-routines yield when it's
+     * not ready, blocking mode waits with poll(2) up to the deadline.
+     */
+    flb_net_socket_nonblocking(u_conn->fd);
+
+    flb_net_socket_tcp_nodelay(fd);
+    flb_net_socket_setup(fd, &u->net);
+
+    /*
+     * TCP Fast Open: the SYN carries the first write. It's not used with
+     * TLS since the TLS layer does not handle a write that is still in
+     * progress (EINPROGRESS).
+     */
+    if (u->net.tcp_fastopen == FLB_TRUE && (u->flags & FLB_IO_TLS) == 0) {
+        if (flb_net_socket_tcp_fastopen_connect(fd) == 0) {
+            tfo = FLB_TRUE;
+        }
+        else {
+            flb_debug("[io] TCP Fast Open is not available");
+        }
+    }
+
+    /* MSG_ZEROCOPY, TLS records are written from the TLS layer buffers */
+    u_conn->zerocopy = FLB_FALSE;
+    u_conn->zc_sent  = 0;
+    u_conn->zc_done  = 0;
+#ifdef __linux__
+    if (u->net.zerocopy > 0 && (u->flags & FLB_IO_TLS) == 0) {
+        if (flb_net_socket_zerocopy(fd) == 0) {
+            u_conn->zerocopy = FLB_TRUE;
+        }
+        else {
+            flb_debug("[io] MSG_ZEROCOPY is not available");
+        }
+    }
+#endif
+
+    /* Start the connection */
+    if (resolved == FLB_TRUE) {
+        ret = connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+    }
+    else {
+        ret = flb_net_tcp_fd_connect(fd, u->tcp_host, u->tcp_port);
+    }
+    if (ret == -1) {
+        if (errno == EINPROGRESS) {
+            flb_trace("[upstream] connection in process");
         }
         else {
             close(fd);
             return -1;
         }
+
+        if (net_io_connect_wait(u_conn, th) == -1) {
+            close(fd);
+            return -1;
+        }
+    }
+    else if (tfo == FLB_TRUE) {
+        /* connect(2) was deferred, the SYN goes out with the first write */
+        u_conn->tfo_pending = FLB_TRUE;
     }
 
 #ifdef FLB_HAVE_TLS
@@ -179,11 +421,31 @@ FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
     return 0;
 }
 
+FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
+                                  struct flb_thread *th)
+{
+    int ret;
+    int deadline;
+
+    if (u_conn->fd > 0) {
+        close(u_conn->fd);
+    }
+    u_conn->write_size = 0;
+    u_conn->tfo_pending = FLB_FALSE;
+
+    deadline = net_io_deadline_set(u_conn);
+    ret = net_io_connect(u_conn, th);
+    if (deadline == FLB_TRUE) {
+        u_conn->ts_deadline = 0;
+    }
+
+    return ret;
+}
+
 static int net_io_write(struct flb_upstream_conn *u_conn,
                         void *data, size_t len, size_t *out_len)
 {
     int ret;
-    int tries = 0;
     size_t total = 0;
 
     if (u_conn->fd <= 0) {
@@ -198,22 +460,16 @@ static int net_io_write(struct flb_upstream_conn *u_conn,
     while (total < len) {
         ret = write(u_conn->fd, data + total, len - total);
         if (ret == -1) {
-            if (errno == EAGAIN) {
-                /*
-                 * FIXME: for now we are handling this in a very lazy way,
-                 * just sleep for a second and retry (for a max of 30 tries).
-                 */
-                sleep(1);
-                tries++;
-
-                if (tries == 30) {
+            /* EINPROGRESS: TCP Fast Open sent the SYN */
+            if (errno == EAGAIN || errno == EINTR || errno == EINPROGRESS) {
+                /* Wait for the socket to be writable (or the deadline) */
+                if (net_io_wait(u_conn, POLLOUT) == -1) {
                     return -1;
                 }
                 continue;
             }
             return -1;
         }
-        tries = 0;
         total += ret;
     }
 
@@ -244,10 +500,8 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
  retry:
     error = 0;
 
-    if (len - total > 524288) {
-        send = 524288;
-    }
-    else {
+    send = net_io_write_size(u_conn);
+    if (len - total < send) {
         send = (len - total);
     }
     bytes = write(u_conn->fd, data + total, send);
@@ -264,7 +518,8 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
 #endif
 
     if (bytes == -1) {
-        if (errno == EAGAIN) {
+        /* EINPROGRESS: TCP Fast Open sent the SYN, handshake in progress */
+        if (errno == EAGAIN || errno == EINPROGRESS) {
             MK_EVENT_NEW(&u_conn->event);
             u_conn->thread = th;
 
@@ -292,6 +547,10 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
                 return -1;
             }
 
+            if (net_io_deadline_expired(u_conn) == FLB_TRUE) {
+                return -1;
+            }
+
             /* Check the connection status */
             if (u_conn->event.mask & MK_EVENT_WRITE) {
                 ret = getsockopt(u_conn->fd, SOL_SOCKET, SO_ERROR, &error, &slen);
@@ -342,6 +601,9 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
             }
         }
         flb_thread_yield(th, MK_FALSE);
+        if (net_io_deadline_expired(u_conn) == FLB_TRUE) {
+            return -1;
+        }
         goto retry;
     }
 
@@ -355,45 +617,493 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
     return bytes;
 }
 
-static ssize_t net_io_read(struct flb_upstream_conn *u_conn,
-                           void *buf, size_t len)
+#ifdef __linux__
+static int net_io_sendfile(struct flb_upstream_conn *u_conn,
+                           int fd, off_t offset, size_t len, size_t *out_len)
 {
     int ret;
+    size_t total = 0;
 
-    ret = read(u_conn->fd, buf, len);
-    if (ret == -1) {
-        return -1;
+    if (u_conn->fd <= 0) {
+        struct flb_thread *th;
+        th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+        ret = flb_io_net_connect(u_conn, th);
+        if (ret == -1) {
+            return -1;
+        }
+        if (u_conn->tfo_pending == FLB_TRUE &&
+            net_io_tfo_connect(u_conn, th) == -1) {
+            return -1;
+        }
     }
 
-    return ret;
+    while (total < len) {
+        ret = sendfile(u_conn->fd, fd, &offset, len - total);
+        if (ret == -1) {
+            if (errno == EAGAIN || errno == EINTR) {
+                if (net_io_wait(u_conn, POLLOUT) == -1) {
+                    return -1;
+                }
+                continue;
+            }
+            return -1;
+        }
+        else if (ret == 0) {
+            /* File is shorter than expected */
+            return -1;
+        }
+        total += ret;
+    }
+
+    *out_len = total;
+    return total;
 }
 
-static FLB_INLINE ssize_t net_io_read_async(struct flb_thread *th,
+/*
+ * Async version of net_io_sendfile(): the file content is sent by the
+ * Kernel straight from the page cache, the co-routine yields when the
+ * socket cannot take more data.
+ */
+static FLB_INLINE int net_io_sendfile_async(struct flb_thread *th,
                                             struct flb_upstream_conn *u_conn,
-                                            void *buf, size_t len)
+                                            int fd, off_t offset, size_t len,
+                                            size_t *out_len)
 {
     int ret;
+    int error;
+    ssize_t bytes;
+    size_t total = 0;
+    size_t send;
+    socklen_t slen = sizeof(error);
     struct flb_upstream *u = u_conn->u;
 
- retry_read:
+    while (total < len) {
+        send = net_io_write_size(u_conn);
+        if (len - total < send) {
+            send = (len - total);
+        }
 
-    ret = read(u_conn->fd, buf, len);
-    if (ret == -1) {
-        if (errno == EAGAIN) {
+        bytes = sendfile(u_conn->fd, fd, &offset, send);
+        flb_trace("[io thread=%p] [fd %i] sendfile_async(2)=%d (%lu/%lu)",
+                  th, u_conn->fd, bytes, total + (bytes > 0 ? bytes : 0), len);
+
+        if (bytes == -1) {
+            if (errno != EAGAIN) {
+                return -1;
+            }
+
+            MK_EVENT_NEW(&u_conn->event);
             u_conn->thread = th;
             ret = mk_event_add(u->evl,
                                u_conn->fd,
                                FLB_ENGINE_EV_THREAD,
-                               MK_EVENT_READ, &u_conn->event);
+                               MK_EVENT_WRITE, &u_conn->event);
             if (ret == -1) {
-                /*
-                 * If we failed here there no much that we can do, just
-                 * let the caller we failed
-                 */
-                close(u_conn->fd);
                 return -1;
             }
-            flb_thread_yield(th, MK_FALSE);
+
+            /* Wait until the socket is writable again */
+            flb_thread_yield(th, FLB_FALSE);
+
+            ret = mk_event_del(u->evl, &u_conn->event);
+            if (ret == -1) {
+                return -1;
+            }
+
+            if (net_io_deadline_expired(u_conn) == FLB_TRUE) {
+                return -1;
+            }
+
+            if (!(u_conn->event.mask & MK_EVENT_WRITE)) {
+                return -1;
+            }
+
+            ret = getsockopt(u_conn->fd, SOL_SOCKET, SO_ERROR, &error, &slen);
+            if (ret == -1 || error != 0) {
+                flb_error("[io] TCP connection failed: %s:%i",
+                          u->tcp_host, u->tcp_port);
+                return -1;
+            }
+            MK_EVENT_NEW(&u_conn->event);
+            continue;
+        }
+        else if (bytes == 0) {
+            /* File is shorter than expected */
+            return -1;
+        }
+
+        total += bytes;
+    }
+
+    *out_len = total;
+    return total;
+}
+#endif
+
+/* Skip 'bytes' already written from an iovec array */
+static void net_io_iov_advance(struct iovec **iov, int *iovcnt, size_t bytes)
+{
+    while (*iovcnt > 0 && bytes >= (*iov)->iov_len) {
+        bytes -= (*iov)->iov_len;
+        (*iov)++;
+        (*iovcnt)--;
+    }
+
+    if (*iovcnt > 0 && bytes > 0) {
+        (*iov)->iov_base = (char *) (*iov)->iov_base + bytes;
+        (*iov)->iov_len -= bytes;
+    }
+}
+
+#ifdef __linux__
+/*
+ * Read the MSG_ZEROCOPY completions from the socket error queue. Each one
+ * reports a range of finished sends, the kernel numbers them in order.
+ */
+static int net_io_zerocopy_reap(struct flb_upstream_conn *u_conn)
+{
+    int ret;
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+
+    while (u_conn->zc_done != u_conn->zc_sent) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        ret = recvmsg(u_conn->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            flb_errno();
+            return -1;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+
+            serr = (struct sock_extended_err *) CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+                continue;
+            }
+
+            u_conn->zc_done += serr->ee_data - serr->ee_info + 1;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                flb_trace("[io] fd=%i zero-copy sends %u-%u were copied",
+                          u_conn->fd, serr->ee_info, serr->ee_data);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * The kernel keeps references to the pages of a MSG_ZEROCOPY send until
+ * the data is acknowledged. Wait for every completion so the caller can
+ * release its buffer.
+ */
+static int net_io_zerocopy_wait(struct flb_upstream_conn *u_conn,
+                                struct flb_thread *th)
+{
+    int ret;
+    int idle = 0;
+    uint32_t done;
+    struct flb_upstream *u = u_conn->u;
+
+    while (1) {
+        done = u_conn->zc_done;
+        if (net_io_zerocopy_reap(u_conn) == -1) {
+            return -1;
+        }
+
+        if (u_conn->zc_done == u_conn->zc_sent) {
+            return 0;
+        }
+
+        if (u_conn->zc_done == done && ++idle > FLB_IO_ZEROCOPY_IDLE) {
+            flb_error("[io] fd=%i zero-copy completions not received",
+                      u_conn->fd);
+            return -1;
+        }
+
+        /* Completions are notified as an error condition (POLLERR) */
+        if ((u->flags & FLB_IO_ASYNC) == 0) {
+            if (net_io_wait(u_conn, 0) == -1) {
+                return -1;
+            }
+            continue;
+        }
+
+        MK_EVENT_NEW(&u_conn->event);
+        u_conn->thread = th;
+        ret = mk_event_add(u->evl,
+                           u_conn->fd,
+                           FLB_ENGINE_EV_THREAD,
+                           MK_EVENT_EMPTY, &u_conn->event);
+        if (ret == -1) {
+            return -1;
+        }
+
+        flb_thread_yield(th, FLB_FALSE);
+
+        ret = mk_event_del(u->evl, &u_conn->event);
+        if (ret == -1) {
+            return -1;
+        }
+        MK_EVENT_NEW(&u_conn->event);
+
+        if (net_io_deadline_expired(u_conn) == FLB_TRUE) {
+            return -1;
+        }
+    }
+}
+
+/*
+ * On failure the kernel may still hold references to the caller buffer:
+ * reset the connection on close so no pending data is sent from memory
+ * that is about to be released.
+ */
+static void net_io_zerocopy_abort(struct flb_upstream_conn *u_conn)
+{
+    struct linger lin;
+
+    lin.l_onoff  = 1;
+    lin.l_linger = 0;
+    setsockopt(u_conn->fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+}
+#else
+/* MSG_ZEROCOPY is Linux only, connections never enable it */
+static int net_io_zerocopy_reap(struct flb_upstream_conn *u_conn)
+{
+    (void) u_conn;
+    return 0;
+}
+
+static int net_io_zerocopy_wait(struct flb_upstream_conn *u_conn,
+                                struct flb_thread *th)
+{
+    (void) u_conn;
+    (void) th;
+    return 0;
+}
+
+static void net_io_zerocopy_abort(struct flb_upstream_conn *u_conn)
+{
+    (void) u_conn;
+}
+#endif
+
+/* writev(2), or sendmsg(2) with MSG_ZEROCOPY when 'zerocopy' is set */
+static ssize_t net_io_sendv(struct flb_upstream_conn *u_conn,
+                            struct iovec *iov, int iovcnt, int zerocopy)
+{
+    ssize_t bytes;
+    struct msghdr msg;
+
+    if (zerocopy == FLB_FALSE) {
+        return writev(u_conn->fd, iov, iovcnt);
+    }
+
+#ifdef __linux__
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = iovcnt;
+
+    bytes = sendmsg(u_conn->fd, &msg, MSG_ZEROCOPY);
+    if (bytes == -1 && errno == ENOBUFS) {
+        /* No room for more notifications, copy the data this time */
+        return writev(u_conn->fd, iov, iovcnt);
+    }
+    else if (bytes >= 0) {
+        u_conn->zc_sent++;
+    }
+#else
+    (void) msg;
+    bytes = writev(u_conn->fd, iov, iovcnt);
+#endif
+
+    return bytes;
+}
+
+static int net_io_writev(struct flb_upstream_conn *u_conn,
+                         struct iovec *iov, int iovcnt,
+                         size_t len, int zerocopy, size_t *out_len)
+{
+    int ret;
+    ssize_t bytes;
+    size_t total = 0;
+
+    if (u_conn->fd <= 0) {
+        struct flb_thread *th;
+        th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+        ret = flb_io_net_connect(u_conn, th);
+        if (ret == -1) {
+            return -1;
+        }
+    }
+
+    while (total < len) {
+        bytes = net_io_sendv(u_conn, iov, iovcnt, zerocopy);
+        if (bytes == -1) {
+            if (errno == EAGAIN || errno == EINTR || errno == EINPROGRESS) {
+                if (net_io_wait(u_conn, POLLOUT) == -1) {
+                    return -1;
+                }
+                /* the wakeup may come from queued completions */
+                if (zerocopy == FLB_TRUE &&
+                    net_io_zerocopy_reap(u_conn) == -1) {
+                    return -1;
+                }
+                continue;
+            }
+            return -1;
+        }
+        total += bytes;
+        net_io_iov_advance(&iov, &iovcnt, bytes);
+    }
+
+    *out_len = total;
+    return total;
+}
+
+static FLB_INLINE int net_io_writev_async(struct flb_thread *th,
+                                          struct flb_upstream_conn *u_conn,
+                                          struct iovec *iov, int iovcnt,
+                                          size_t len, int zerocopy,
+                                          size_t *out_len)
+{
+    int ret;
+    int error;
+    ssize_t bytes;
+    size_t total = 0;
+    socklen_t slen = sizeof(error);
+    struct flb_upstream *u = u_conn->u;
+
+    while (total < len) {
+        bytes = net_io_sendv(u_conn, iov, iovcnt, zerocopy);
+        flb_trace("[io thread=%p] [fd %i] writev_async(2)=%d (%lu/%lu)",
+                  th, u_conn->fd, bytes, total + (bytes > 0 ? bytes : 0), len);
+
+        if (bytes == -1) {
+            /* EINPROGRESS: TCP Fast Open sent the SYN, handshake in progress */
+            if (errno != EAGAIN && errno != EINPROGRESS) {
+                return -1;
+            }
+
+            MK_EVENT_NEW(&u_conn->event);
+            u_conn->thread = th;
+            ret = mk_event_add(u->evl,
+                               u_conn->fd,
+                               FLB_ENGINE_EV_THREAD,
+                               MK_EVENT_WRITE, &u_conn->event);
+            if (ret == -1) {
+                return -1;
+            }
+
+            /* Wait until the socket is writable again */
+            flb_thread_yield(th, FLB_FALSE);
+
+            ret = mk_event_del(u->evl, &u_conn->event);
+            if (ret == -1) {
+                return -1;
+            }
+
+            if (net_io_deadline_expired(u_conn) == FLB_TRUE) {
+                return -1;
+            }
+
+            if (!(u_conn->event.mask & MK_EVENT_WRITE)) {
+                return -1;
+            }
+
+            ret = getsockopt(u_conn->fd, SOL_SOCKET, SO_ERROR, &error, &slen);
+            if (ret == -1 || error != 0) {
+                flb_error("[io] TCP connection failed: %s:%i",
+                          u->tcp_host, u->tcp_port);
+                return -1;
+            }
+            MK_EVENT_NEW(&u_conn->event);
+
+            /* the wakeup may come from queued completions */
+            if (zerocopy == FLB_TRUE && net_io_zerocopy_reap(u_conn) == -1) {
+                return -1;
+            }
+            continue;
+        }
+
+        total += bytes;
+        net_io_iov_advance(&iov, &iovcnt, bytes);
+    }
+
+    *out_len = total;
+    return total;
+}
+
+static ssize_t net_io_read(struct flb_upstream_conn *u_conn,
+                           void *buf, size_t len)
+{
+    int ret;
+
+    while (1) {
+        ret = read(u_conn->fd, buf, len);
+        if (ret == -1) {
+            if (errno == EAGAIN || errno == EINTR) {
+                if (net_io_wait(u_conn, POLLIN) == -1) {
+                    return -1;
+                }
+                continue;
+            }
+            return -1;
+        }
+        break;
+    }
+
+    return ret;
+}
+
+static FLB_INLINE ssize_t net_io_read_async(struct flb_thread *th,
+                                            struct flb_upstream_conn *u_conn,
+                                            void *buf, size_t len)
+{
+    int ret;
+    struct flb_upstream *u = u_conn->u;
+
+ retry_read:
+
+    ret = read(u_conn->fd, buf, len);
+    if (ret == -1) {
+        if (errno == EAGAIN) {
+            MK_EVENT_NEW(&u_conn->event);
+            u_conn->thread = th;
+            ret = mk_event_add(u->evl,
+                               u_conn->fd,
+                               FLB_ENGINE_EV_THREAD,
+                               MK_EVENT_READ, &u_conn->event);
+            if (ret == -1) {
+                /*
+                 * If we failed here there no much that we can do, just
+                 * let the caller we failed
+                 */
+                close(u_conn->fd);
+                return -1;
+            }
+            flb_thread_yield(th, MK_FALSE);
+
+            /* We got a notification, remove the event registered */
+            mk_event_del(u->evl, &u_conn->event);
+            if (net_io_deadline_expired(u_conn) == FLB_TRUE) {
+                return -1;
+            }
             goto retry_read;
         }
         return -1;
@@ -410,8 +1120,17 @@ int flb_io_net_write(struct flb_upstream_conn *u_conn, void *data,
                      size_t len, size_t *out_len)
 {
     int ret = -1;
+    int deadline;
+    struct iovec iov;
     struct flb_upstream *u = u_conn->u;
 
+    /* Large writes go through the scatter-gather path for MSG_ZEROCOPY */
+    if (u_conn->zerocopy == FLB_TRUE && len >= u->net.zerocopy) {
+        iov.iov_base = data;
+        iov.iov_len  = len;
+        return flb_io_net_writev(u_conn, &iov, 1, out_len);
+    }
+
 #if defined (FLB_HAVE_FLUSH_UCONTEXT) || defined (FLB_HAVE_FLUSH_LIBCO)
     struct flb_thread *th = pthread_getspecific(flb_thread_key);
     flb_trace("[io thread=%p] [net_write] trying %zd bytes",
@@ -420,6 +1139,8 @@ int flb_io_net_write(struct flb_upstream_conn *u_conn, void *data,
     void *th = NULL;
     flb_trace("[io] [net_write] trying %zd bytes", len);
 #endif
+    deadline = net_io_deadline_set(u_conn);
+
     if (u->flags & FLB_IO_TCP) {
         if (u->flags & FLB_IO_ASYNC) {
             ret = net_io_write_async(th, u_conn, data, len, out_len);
@@ -427,6 +1148,7 @@ int flb_io_net_write(struct flb_upstream_conn *u_conn, void *data,
         else {
             ret = net_io_write(u_conn, data, len, out_len);
         }
+        u_conn->tfo_pending = FLB_FALSE;
     }
 #ifdef FLB_HAVE_TLS
     else if (u->flags & FLB_IO_TLS) {
@@ -437,6 +1159,9 @@ int flb_io_net_write(struct flb_upstream_conn *u_conn, void *data,
         close(u_conn->fd);
         u_conn->fd = -1;
     }
+    if (deadline == FLB_TRUE) {
+        u_conn->ts_deadline = 0;
+    }
 
 #if defined (FLB_HAVE_FLUSH_UCONTEXT) || defined (FLB_HAVE_FLUSH_LIBCO)
     flb_trace("[io thread=%p] [net_write] ret=%i total=%lu/%lu",
@@ -448,9 +1173,101 @@ int flb_io_net_write(struct flb_upstream_conn *u_conn, void *data,
     return ret;
 }
 
+/*
+ * Write an iovec array to an upstream connection/server: the buffers are
+ * sent with a single writev(2) when possible, so outputs do not need to
+ * concatenate headers and payloads. The caller 'iov' is not modified.
+ */
+int flb_io_net_writev(struct flb_upstream_conn *u_conn,
+                      const struct iovec *iov, int iovcnt, size_t *out_len)
+{
+    int i;
+    int ret = -1;
+    int deadline;
+    int zerocopy;
+    size_t len = 0;
+    struct iovec iov_static[FLB_IO_IOV_STATIC];
+    struct iovec *v = iov_static;
+    struct flb_upstream *u = u_conn->u;
+
+#if defined (FLB_HAVE_FLUSH_UCONTEXT) || defined (FLB_HAVE_FLUSH_LIBCO)
+    struct flb_thread *th = pthread_getspecific(flb_thread_key);
+#else
+    void *th = NULL;
+#endif
+
+    *out_len = 0;
+    if (iovcnt <= 0) {
+        return -1;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    flb_trace("[io] [net_writev] trying %zd bytes in %i buffers", len, iovcnt);
+
+    deadline = net_io_deadline_set(u_conn);
+
+    if (u->flags & FLB_IO_TCP) {
+        /* Local copy: the array is updated on partial writes */
+        if (iovcnt > FLB_IO_IOV_STATIC) {
+            v = flb_malloc(sizeof(struct iovec) * iovcnt);
+            if (!v) {
+                flb_errno();
+                return -1;
+            }
+        }
+        memcpy(v, iov, sizeof(struct iovec) * iovcnt);
+
+        /* The first write of a TCP Fast Open connection is copied */
+        zerocopy = (u_conn->zerocopy == FLB_TRUE &&
+                    u_conn->tfo_pending == FLB_FALSE &&
+                    len >= u->net.zerocopy);
+
+        if (u->flags & FLB_IO_ASYNC) {
+            ret = net_io_writev_async(th, u_conn, v, iovcnt, len, zerocopy,
+                                      out_len);
+        }
+        else {
+            ret = net_io_writev(u_conn, v, iovcnt, len, zerocopy, out_len);
+        }
+
+        if (v != iov_static) {
+            flb_free(v);
+        }
+        u_conn->tfo_pending = FLB_FALSE;
+
+        /* Do not return until the kernel is done with the caller buffers */
+        if (zerocopy == FLB_TRUE && u_conn->fd > 0) {
+            if (ret != -1 && net_io_zerocopy_wait(u_conn, th) == -1) {
+                ret = -1;
+            }
+            if (ret == -1) {
+                net_io_zerocopy_abort(u_conn);
+            }
+        }
+    }
+#ifdef FLB_HAVE_TLS
+    else if (u->flags & FLB_IO_TLS) {
+        ret = net_io_tls_writev(th, u_conn, iov, iovcnt, out_len);
+    }
+#endif
+    if (ret == -1 && u_conn->fd > 0) {
+        close(u_conn->fd);
+        u_conn->fd = -1;
+    }
+    if (deadline == FLB_TRUE) {
+        u_conn->ts_deadline = 0;
+    }
+
+    flb_trace("[io] [net_writev] ret=%i total=%lu/%lu", ret, *out_len, len);
+    return ret;
+}
+
 ssize_t flb_io_net_read(struct flb_upstream_conn *u_conn, void *buf, size_t len)
 {
     int ret = -1;
+    int deadline;
     struct flb_upstream *u = u_conn->u;
 
 #if defined (FLB_HAVE_FLUSH_UCONTEXT) || defined (FLB_HAVE_FLUSH_LIBCO)
@@ -461,9 +1278,14 @@ ssize_t flb_io_net_read(struct flb_upstream_conn *u_conn, void *buf, size_t len)
     void *th = NULL;
     flb_trace("[io] [net_read] try up to %zd bytes", len);
 #endif
+    deadline = net_io_deadline_set(u_conn);
 
     if (u->flags & FLB_IO_TCP) {
-        if (u->flags & FLB_IO_ASYNC) {
+        if (u_conn->tfo_pending == FLB_TRUE &&
+            net_io_tfo_connect(u_conn, th) == -1) {
+            ret = -1;
+        }
+        else if (u->flags & FLB_IO_ASYNC) {
             ret = net_io_read_async(th, u_conn, buf, len);
         }
         else {
@@ -476,6 +1298,114 @@ ssize_t flb_io_net_read(struct flb_upstream_conn *u_conn, void *buf, size_t len)
     }
 #endif
 
+    if (deadline == FLB_TRUE) {
+        u_conn->ts_deadline = 0;
+    }
+
     flb_trace("[io thread=%p] [net_read] ret=%i", th, ret);
     return ret;
 }
+
+#if !defined(__linux__) || defined(FLB_HAVE_TLS)
+/*
+ * Map the file range and write it with the regular write path: TLS, or
+ * plain TCP where sendfile(2) is not available.
+ */
+static int net_io_map_write(void *th, struct flb_upstream_conn *u_conn,
+                            int fd, off_t offset, size_t len, size_t *out_len)
+{
+    int ret = -1;
+    char *map;
+    off_t page;
+    off_t delta;
+    struct flb_upstream *u = u_conn->u;
+
+    /* mmap(2) offsets must be page aligned */
+    page  = sysconf(_SC_PAGESIZE);
+    delta = offset % page;
+    map = mmap(NULL, len + delta, PROT_READ, MAP_PRIVATE,
+               fd, offset - delta);
+    if (map == MAP_FAILED) {
+        flb_errno();
+        return -1;
+    }
+
+    if (u->flags & FLB_IO_TCP) {
+        if (u->flags & FLB_IO_ASYNC) {
+            ret = net_io_write_async(th, u_conn, map + delta, len, out_len);
+        }
+        else {
+            ret = net_io_write(u_conn, map + delta, len, out_len);
+        }
+    }
+#ifdef FLB_HAVE_TLS
+    else if (u->flags & FLB_IO_TLS) {
+        ret = net_io_tls_write(th, u_conn, map + delta, len, out_len);
+    }
+#endif
+
+    munmap(map, len + delta);
+    return ret;
+}
+#endif
+
+/*
+ * Write 'len' bytes of the file 'fd' starting at 'offset' to an upstream
+ * connection. On plain TCP the data is sent with sendfile(2) avoiding the
+ * copies to user space, on TLS the file range is mapped and written
+ * through the TLS layer.
+ */
+int flb_io_net_sendfile(struct flb_upstream_conn *u_conn, int fd, off_t offset,
+                        size_t len, size_t *out_len)
+{
+    int ret = -1;
+    int deadline;
+    struct flb_upstream *u = u_conn->u;
+
+#if defined (FLB_HAVE_FLUSH_UCONTEXT) || defined (FLB_HAVE_FLUSH_LIBCO)
+    struct flb_thread *th = pthread_getspecific(flb_thread_key);
+    flb_trace("[io thread=%p] [net_sendfile] trying %zd bytes",
+              th, len);
+#else
+    void *th = NULL;
+    flb_trace("[io] [net_sendfile] trying %zd bytes", len);
+#endif
+
+    *out_len = 0;
+    deadline = net_io_deadline_set(u_conn);
+
+    if (u->flags & FLB_IO_TCP) {
+        if (u_conn->tfo_pending == FLB_TRUE &&
+            net_io_tfo_connect(u_conn, th) == -1) {
+            ret = -1;
+        }
+#ifdef __linux__
+        else if (u->flags & FLB_IO_ASYNC) {
+            ret = net_io_sendfile_async(th, u_conn, fd, offset, len, out_len);
+        }
+        else {
+            ret = net_io_sendfile(u_conn, fd, offset, len, out_len);
+        }
+#else
+        else {
+            ret = net_io_map_write(th, u_conn, fd, offset, len, out_len);
+        }
+#endif
+    }
+#ifdef FLB_HAVE_TLS
+    else if (u->flags & FLB_IO_TLS) {
+        ret = net_io_map_write(th, u_conn, fd, offset, len, out_len);
+    }
+#endif
+    if (ret == -1 && u_conn->fd > 0) {
+        close(u_conn->fd);
+        u_conn->fd = -1;
+    }
+    if (deadline == FLB_TRUE) {
+        u_conn->ts_deadline = 0;
+    }
+
+    flb_trace("[io] [net_sendfile] ret=%i total=%lu/%lu",
+              ret, *out_len, len);
+    return ret;
+}
@@ -18,6 +18,9 @@
  */
 
 #include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
 #include <mbedtls/net.h>
 #include <mbedtls/ssl.h>
 #include <mbedtls/entropy.h>
@@ -228,11 +231,200 @@ int flb_tls_session_destroy(struct flb_tls_session *session)
     return 0;
 }
 
+void flb_tls_resume_destroy(struct flb_tls_resume *resume)
+{
+    mbedtls_ssl_session_free(&resume->session);
+    flb_free(resume);
+}
+
+/*
+ * BIO callbacks: the socket is the one of the connection, its event may
+ * not be registered yet (e.g: blocking mode or an immediate connect). In
+ * blocking mode they wait for the socket up to the connection deadline,
+ * so the TLS layer never asks to retry.
+ */
+static int io_tls_net_send(void *ctx, const unsigned char *buf, size_t len)
+{
+    int ret;
+    mbedtls_net_context net;
+    struct flb_upstream_conn *u_conn = ctx;
+
+    net.fd = u_conn->fd;
+    while ((ret = mbedtls_net_send(&net, buf, len)) ==
+           MBEDTLS_ERR_SSL_WANT_WRITE &&
+           (u_conn->u->flags & FLB_IO_ASYNC) == 0) {
+        if (flb_io_net_wait(u_conn, POLLOUT) == -1) {
+            return MBEDTLS_ERR_NET_SEND_FAILED;
+        }
+    }
+
+    return ret;
+}
+
+static int io_tls_net_recv(void *ctx, unsigned char *buf, size_t len)
+{
+    int ret;
+    mbedtls_net_context net;
+    struct flb_upstream_conn *u_conn = ctx;
+
+    net.fd = u_conn->fd;
+    while ((ret = mbedtls_net_recv(&net, buf, len)) ==
+           MBEDTLS_ERR_SSL_WANT_READ &&
+           (u_conn->u->flags & FLB_IO_ASYNC) == 0) {
+        if (flb_io_net_wait(u_conn, POLLIN) == -1) {
+            return MBEDTLS_ERR_NET_RECV_FAILED;
+        }
+    }
+
+    return ret;
+}
+
+static inline uint64_t tls_usec_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Offer the last session of the upstream to the server. If the server
+ * accepts it the handshake skips the key exchange and certificate
+ * verification, otherwise it silently falls back to a full handshake.
+ * The master secret of the offered session is copied to 'master', it
+ * returns FLB_TRUE if a session was offered.
+ */
+static int tls_resume_set(struct flb_upstream *u,
+                          struct flb_tls_session *session,
+                          unsigned char *master)
+{
+    int offered = FLB_FALSE;
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&u->mutex_queue);
+#endif
+    if (!u->tls_resume) {
+        u->tls_resume = flb_calloc(1, sizeof(struct flb_tls_resume));
+        if (u->tls_resume) {
+            mbedtls_ssl_session_init(&u->tls_resume->session);
+        }
+    }
+    if (u->tls_resume && u->tls_resume->set == FLB_TRUE &&
+        u->tls->session_resume == FLB_TRUE) {
+        if (mbedtls_ssl_set_session(&session->ssl,
+                                    &u->tls_resume->session) == 0) {
+            memcpy(master, u->tls_resume->session.master,
+                   sizeof(u->tls_resume->session.master));
+            offered = FLB_TRUE;
+        }
+    }
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&u->mutex_queue);
+#endif
+
+    return offered;
+}
+
+/*
+ * Save the negotiated session and account the handshake. A resumed
+ * session keeps the master secret of the offered one, a full handshake
+ * always derives a new one. It returns FLB_TRUE if it was resumed.
+ */
+static int tls_resume_update(struct flb_upstream *u,
+                             struct flb_tls_session *session,
+                             int ok, unsigned char *offered, uint64_t usec)
+{
+    int ret;
+    int resumed = FLB_FALSE;
+    struct flb_tls_resume *r = u->tls_resume;
+
+    if (!r) {
+        return FLB_FALSE;
+    }
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&u->mutex_queue);
+#endif
+    if (ok == FLB_FALSE) {
+        /* do not offer a session that could be the cause */
+        r->stats.failed++;
+        mbedtls_ssl_session_free(&r->session);
+        mbedtls_ssl_session_init(&r->session);
+        r->set = FLB_FALSE;
+    }
+    else {
+        /* keep the newest session, it may carry a new ticket */
+        if (u->tls->session_resume == FLB_TRUE) {
+            mbedtls_ssl_session_free(&r->session);
+            mbedtls_ssl_session_init(&r->session);
+            ret = mbedtls_ssl_get_session(&session->ssl, &r->session);
+            r->set = (ret == 0) ? FLB_TRUE : FLB_FALSE;
+
+            if (r->set == FLB_TRUE && offered &&
+                memcmp(r->session.master, offered,
+                       sizeof(r->session.master)) == 0) {
+                resumed = FLB_TRUE;
+            }
+        }
+
+        if (resumed == FLB_TRUE) {
+            r->stats.resumed++;
+            r->stats.usec_resumed += usec;
+        }
+        else {
+            r->stats.full++;
+            r->stats.usec_full += usec;
+        }
+    }
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&u->mutex_queue);
+#endif
+
+    return resumed;
+}
+
+/* Handshake counters of an upstream, a group adds the ones of its nodes */
+void flb_tls_stats_get(struct flb_upstream *u, struct flb_tls_stats *stats)
+{
+    int i;
+    struct flb_tls_stats node;
+
+    memset(stats, 0, sizeof(struct flb_tls_stats));
+
+    /* a group does not connect by itself */
+    if (u->n_nodes > 0) {
+        for (i = 0; i < u->n_nodes; i++) {
+            flb_tls_stats_get(u->nodes[i], &node);
+            stats->full         += node.full;
+            stats->resumed      += node.resumed;
+            stats->failed       += node.failed;
+            stats->usec_full    += node.usec_full;
+            stats->usec_resumed += node.usec_resumed;
+        }
+        return;
+    }
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&u->mutex_queue);
+#endif
+    if (u->tls_resume) {
+        memcpy(stats, &u->tls_resume->stats, sizeof(struct flb_tls_stats));
+    }
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&u->mutex_queue);
+#endif
+}
+
 /* Perform a TLS handshake */
 int net_io_tls_handshake(void *_u_conn, void *_th)
 {
     int ret;
     int flag;
+    int offered;
+    int resumed;
+    uint64_t ts_start;
+    uint64_t usec;
+    unsigned char master[48];
     struct flb_tls_session *session;
     struct flb_upstream_conn *u_conn = _u_conn;
     struct flb_upstream *u = u_conn->u;
@@ -248,11 +440,12 @@ int net_io_tls_handshake(void *_u_conn, void *_th)
     u_conn->tls_session = session;
     mbedtls_ssl_set_bio(&session->ssl,
                         u_conn,
-                        mbedtls_net_send, mbedtls_net_recv, NULL);
+                        io_tls_net_send, io_tls_net_recv, NULL);
+    offered = tls_resume_set(u, session, master);
+    ts_start = tls_usec_now();
 
  retry_handshake:
     ret = mbedtls_ssl_handshake(&session->ssl);
-
     if (ret != 0) {
         if (ret != MBEDTLS_ERR_SSL_WANT_READ &&
             ret !=  MBEDTLS_ERR_SSL_WANT_WRITE) {
@@ -263,11 +456,8 @@ int net_io_tls_handshake(void *_u_conn, void *_th)
         if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
             flag = MK_EVENT_WRITE;
         }
-        else if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
-            flag = MK_EVENT_READ;
-        }
         else {
-
+            flag = MK_EVENT_READ;
         }
 
         /*
@@ -285,9 +475,13 @@ int net_io_tls_handshake(void *_u_conn, void *_th)
         flb_thread_yield(th, FLB_FALSE);
         goto retry_handshake;
     }
-    else {
-        flb_trace("[io_tls] Handshake OK");
-    }
+
+    usec = tls_usec_now() - ts_start;
+    resumed = tls_resume_update(u, session, FLB_TRUE,
+                                offered == FLB_TRUE ? master : NULL, usec);
+    flb_debug("[io_tls] %s:%i handshake %s in %lu us",
+              u->tcp_host, u->tcp_port,
+              resumed == FLB_TRUE ? "resumed" : "full", usec);
 
     if (u_conn->event.status & MK_EVENT_REGISTERED) {
         mk_event_del(u->evl, &u_conn->event);
@@ -297,6 +491,7 @@ int net_io_tls_handshake(void *_u_conn, void *_th)
     return 0;
 
  error:
+    tls_resume_update(u, session, FLB_FALSE, NULL, 0);
     if (u_conn->event.status & MK_EVENT_REGISTERED) {
         mk_event_del(u->evl, &u_conn->event);
     }
@@ -378,12 +573,93 @@ FLB_INLINE int net_io_tls_write(struct flb_thread *th,
     /* Update counter and check if we need to continue writing */
     total += ret;
     if (total < len) {
-        io_tls_event_switch(u_conn, MK_EVENT_WRITE);
-        flb_thread_yield(th, FLB_FALSE);
+        /* blocking mode: the BIO waits for the socket */
+        if (u->flags & FLB_IO_ASYNC) {
+            io_tls_event_switch(u_conn, MK_EVENT_WRITE);
+            flb_thread_yield(th, FLB_FALSE);
+        }
         goto retry_write;
     }
 
     *out_len = total;
-    mk_event_del(u->evl, &u_conn->event);
+    if (u_conn->event.status & MK_EVENT_REGISTERED) {
+        mk_event_del(u->evl, &u_conn->event);
+    }
+    return 0;
+}
+
+/*
+ * Write an iovec array through the TLS session. Small buffers are
+ * coalesced so each call to the TLS layer fills a complete record,
+ * buffers bigger than a record are written directly.
+ */
+int net_io_tls_writev(struct flb_thread *th, struct flb_upstream_conn *u_conn,
+                      const struct iovec *iov, int iovcnt, size_t *out_len)
+{
+    int i;
+    int ret;
+    char *buf;
+    char *p;
+    size_t len;
+    size_t avail;
+    size_t pending = 0;
+    size_t total = 0;
+    size_t bytes;
+
+    buf = flb_malloc(MBEDTLS_SSL_MAX_CONTENT_LEN);
+    if (!buf) {
+        flb_errno();
+        return -1;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        p   = iov[i].iov_base;
+        len = iov[i].iov_len;
+
+        while (len > 0) {
+            /* Big buffer and nothing pending: skip the copy */
+            if (pending == 0 && len >= MBEDTLS_SSL_MAX_CONTENT_LEN) {
+                ret = net_io_tls_write(th, u_conn, p, len, &bytes);
+                if (ret == -1) {
+                    flb_free(buf);
+                    return -1;
+                }
+                total += bytes;
+                break;
+            }
+
+            avail = MBEDTLS_SSL_MAX_CONTENT_LEN - pending;
+            if (len < avail) {
+                avail = len;
+            }
+            memcpy(buf + pending, p, avail);
+            pending += avail;
+            p   += avail;
+            len -= avail;
+
+            /* Flush a complete record */
+            if (pending == MBEDTLS_SSL_MAX_CONTENT_LEN) {
+                ret = net_io_tls_write(th, u_conn, buf, pending, &bytes);
+                if (ret == -1) {
+                    flb_free(buf);
+                    return -1;
+                }
+                total += bytes;
+                pending = 0;
+            }
+        }
+    }
+
+    if (pending > 0) {
+        ret = net_io_tls_write(th, u_conn, buf, pending, &bytes);
+        if (ret == -1) {
+            flb_free(buf);
+            return -1;
+        }
+        total += bytes;
+    }
+
+    flb_free(buf);
+    *out_len = total;
     return 0;
 }
@@ -159,6 +159,143 @@ int flb_net_socket_tcp_fastopen(int sockfd)
     return setsockopt(sockfd, SOL_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen));
 }
 
+/*
+ * Client side TCP Fast Open (Linux >= 4.11): connect(2) returns right away
+ * and the SYN is sent by the first write(2) carrying its data, saving a
+ * round trip when the server already handed us a cookie.
+ */
+int flb_net_socket_tcp_fastopen_connect(int sockfd)
+{
+    int on = 1;
+
+    return setsockopt(sockfd, SOL_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+}
+
+/* Allow MSG_ZEROCOPY sends on the socket (Linux >= 4.14) */
+int flb_net_socket_zerocopy(int sockfd)
+{
+#ifdef SO_ZEROCOPY
+    int on = 1;
+
+    return setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on));
+#else
+    (void) sockfd;
+    errno = ENOPROTOOPT;
+    return -1;
+#endif
+}
+
+void flb_net_setup_init(struct flb_net_setup *net)
+{
+    memset(net, '\0', sizeof(struct flb_net_setup));
+    net->linger = -1;
+}
+
+/*
+ * Apply the socket tuning options, a failure is not fatal: the connection
+ * keeps the system defaults for that option.
+ */
+int flb_net_socket_setup(int sockfd, struct flb_net_setup *net)
+{
+    int ret = 0;
+    struct linger lin;
+
+    if (net->sndbuf > 0 &&
+        setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF,
+                   &net->sndbuf, sizeof(int)) == -1) {
+        flb_warn("[net] could not set SO_SNDBUF=%i", net->sndbuf);
+        ret = -1;
+    }
+
+    if (net->rcvbuf > 0 &&
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF,
+                   &net->rcvbuf, sizeof(int)) == -1) {
+        flb_warn("[net] could not set SO_RCVBUF=%i", net->rcvbuf);
+        ret = -1;
+    }
+
+    if (net->keepalive == FLB_TRUE) {
+        if (setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE,
+                       &net->keepalive, sizeof(int)) == -1) {
+            flb_warn("[net] could not enable SO_KEEPALIVE");
+            ret = -1;
+        }
+#ifdef TCP_KEEPIDLE
+        if (net->keepalive_time > 0 &&
+            setsockopt(sockfd, SOL_TCP, TCP_KEEPIDLE,
+                       &net->keepalive_time, sizeof(int)) == -1) {
+            flb_warn("[net] could not set TCP_KEEPIDLE=%i",
+                     net->keepalive_time);
+            ret = -1;
+        }
+#endif
+#ifdef TCP_KEEPINTVL
+        if (net->keepalive_interval > 0 &&
+            setsockopt(sockfd, SOL_TCP, TCP_KEEPINTVL,
+                       &net->keepalive_interval, sizeof(int)) == -1) {
+            flb_warn("[net] could not set TCP_KEEPINTVL=%i",
+                     net->keepalive_interval);
+            ret = -1;
+        }
+#endif
+#ifdef TCP_KEEPCNT
+        if (net->keepalive_probes > 0 &&
+            setsockopt(sockfd, SOL_TCP, TCP_KEEPCNT,
+                       &net->keepalive_probes, sizeof(int)) == -1) {
+            flb_warn("[net] could not set TCP_KEEPCNT=%i",
+                     net->keepalive_probes);
+            ret = -1;
+        }
+#endif
+    }
+
+    if (net->linger >= 0) {
+        lin.l_onoff = 1;
+        lin.l_linger = net->linger;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_LINGER,
+                       &lin, sizeof(lin)) == -1) {
+            flb_warn("[net] could not set SO_LINGER=%i", net->linger);
+            ret = -1;
+        }
+    }
+
+#ifdef TCP_CONGESTION
+    if (net->congestion[0] != '\0' &&
+        setsockopt(sockfd, SOL_TCP, TCP_CONGESTION,
+                   net->congestion, strlen(net->congestion)) == -1) {
+        flb_warn("[net] could not set TCP congestion control '%s'",
+                 net->congestion);
+        ret = -1;
+    }
+#endif
+
+    return ret;
+}
+
+/*
+ * Let several listening sockets bind the same address and port, the kernel
+ * balances the incoming connections across them (Linux >= 3.9).
+ */
+int flb_net_socket_reuseport(int sockfd)
+{
+#ifdef SO_REUSEPORT
+    int on = 1;
+    int ret;
+
+    ret = setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    if (ret == -1) {
+        perror("setsockopt");
+        return -1;
+    }
+
+    return 0;
+#else
+    (void) sockfd;
+    errno = ENOPROTOOPT;
+    return -1;
+#endif
+}
+
 int flb_net_socket_create(int family, int nonblock)
 {
     int fd;
@@ -246,7 +383,7 @@ int flb_net_tcp_fd_connect(int fd, char *host, unsigned long port)
     return ret;
 }
 
-int flb_net_server(char *port, char *listen_addr)
+static int net_server(char *port, char *listen_addr, int reuseport)
 {
     int socket_fd = -1;
     int ret;
@@ -274,6 +411,13 @@ int flb_net_server(char *port, char *listen_addr)
         flb_net_socket_tcp_nodelay(socket_fd);
         flb_net_socket_reset(socket_fd);
 
+        if (reuseport && flb_net_socket_reuseport(socket_fd) == -1) {
+            flb_error("Cannot set SO_REUSEPORT on server socket");
+            close(socket_fd);
+            socket_fd = -1;
+            continue;
+        }
+
         ret = flb_net_bind(socket_fd, rp->ai_addr, rp->ai_addrlen, 128);
         if(ret == -1) {
             flb_warn("Cannot listen on %s port %s", listen_addr, port);
@@ -291,6 +435,46 @@ int flb_net_server(char *port, char *listen_addr)
     return socket_fd;
 }
 
+int flb_net_server(char *port, char *listen_addr)
+{
+    return net_server(port, listen_addr, FLB_FALSE);
+}
+
+/*
+ * Create 'n' listening sockets for the same address. When more than one is
+ * requested every socket is bound with SO_REUSEPORT so the kernel spreads
+ * new connections across their accept queues. The descriptors are stored
+ * in 'fds', it returns the number of sockets created or -1 on error.
+ */
+int flb_net_server_listeners(char *port, char *listen_addr, int *fds, int n)
+{
+    int i;
+    int fd;
+
+    if (n <= 1) {
+        fd = net_server(port, listen_addr, FLB_FALSE);
+        if (fd == -1) {
+            return -1;
+        }
+        fds[0] = fd;
+        return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        fd = net_server(port, listen_addr, FLB_TRUE);
+        if (fd == -1) {
+            while (--i >= 0) {
+                close(fds[i]);
+                fds[i] = -1;
+            }
+            return -1;
+        }
+        fds[i] = fd;
+    }
+
+    return n;
+}
+
 int flb_net_bind(int socket_fd, const struct sockaddr *addr,
                  socklen_t addrlen, int backlog)
 {
@@ -332,6 +516,42 @@ int flb_net_accept(int server_fd)
     return remote_fd;
 }
 
+/*
+ * Accept up to 'size' pending connections from a non-blocking server
+ * socket, it stops once the accept queue is empty. The new descriptors are
+ * stored in 'fds' and the number of accepted connections is returned.
+ */
+int flb_net_accept_batch(int server_fd, int *fds, int size)
+{
+    int n = 0;
+    int remote_fd;
+
+    while (n < size) {
+#ifdef FLB_HAVE_ACCEPT4
+        remote_fd = accept4(server_fd, NULL, NULL,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        remote_fd = accept(server_fd, NULL, NULL);
+#endif
+        if (remote_fd == -1) {
+            /* Interrupted, or a queued connection was reset: go on */
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                flb_errno();
+            }
+            break;
+        }
+#ifndef FLB_HAVE_ACCEPT4
+        flb_net_socket_nonblocking(remote_fd);
+#endif
+        fds[n++] = remote_fd;
+    }
+
+    return n;
+}
+
 int flb_net_socket_ip_str(int socket_fd, char **buf, int size, unsigned long *len)
 {
     int ret;
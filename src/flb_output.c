@@ -28,12 +28,17 @@
 #include <fluent-bit/flb_output.h>
 
 #include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_upstream.h>
 #include <fluent-bit/flb_uri.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_macros.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_plugin_proxy.h>
 
+#ifdef FLB_HAVE_BUFFERING
+#include <fluent-bit/flb_buffer_qchunk.h>
+#endif
+
 #define protcmp(a, b)  strncasecmp(a, b, strlen(a))
 
 /* Validate the the output address protocol */
@@ -216,6 +221,7 @@ struct flb_output_instance *flb_output_new(struct flb_config *config,
         instance->use_tls        = FLB_FALSE;
 #ifdef FLB_HAVE_TLS
         instance->tls.context    = NULL;
+        instance->tls.session_resume = FLB_TRUE;
         instance->tls_verify     = FLB_TRUE;
         instance->tls_ca_file    = NULL;
         instance->tls_crt_file   = NULL;
@@ -289,6 +295,14 @@ int flb_output_set_property(struct flb_output_instance *out, char *k, char *v)
             out->tls_verify = FLB_FALSE;
         }
     }
+    else if (prop_key_check("tls.session_resume", k, len) == 0) {
+        if (strcasecmp(v, "true") == 0 || strcasecmp(v, "on") == 0) {
+            out->tls.session_resume = FLB_TRUE;
+        }
+        else {
+            out->tls.session_resume = FLB_FALSE;
+        }
+    }
     else if (prop_key_check("tls.ca_file", k, len) == 0) {
         out->tls_ca_file = flb_strdup(v);
     }
@@ -385,3 +399,169 @@ int flb_output_check(struct flb_config *config)
     }
     return 0;
 }
+
+/*
+ * Check if the data being flushed by the current output thread is backed
+ * by a buffer chunk file (a not compressed chunk replayed from the buffer
+ * path). On success 'fd' and 'offset' can be used to send the content
+ * directly from the file (e.g: flb_io_net_sendfile()). The descriptor
+ * belongs to the buffer interface and must not be closed.
+ */
+int flb_output_chunk_fd(void *data, size_t bytes, int *fd, off_t *offset)
+{
+#ifdef FLB_HAVE_BUFFERING
+    struct flb_thread *th;
+    struct flb_task *task;
+    struct flb_output_thread *out_th;
+
+    th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+    if (!th) {
+        return -1;
+    }
+
+    out_th = (struct flb_output_thread *) FLB_THREAD_DATA(th);
+    task = out_th->task;
+    if (!task->config->buffer_ctx || task->mapped == FLB_FALSE ||
+        task->ref_id == 0) {
+        return -1;
+    }
+
+    /* The data must be a range of the task buffer */
+    if ((char *) data < task->buf ||
+        (char *) data + bytes > task->buf + task->size) {
+        return -1;
+    }
+
+    if (flb_buffer_qchunk_fd(task->config->buffer_ctx,
+                             task->ref_id, fd) == -1) {
+        return -1;
+    }
+
+    *offset = (char *) data - task->buf;
+    return 0;
+#else
+    (void) data;
+    (void) bytes;
+    (void) fd;
+    (void) offset;
+    return -1;
+#endif
+}
+
+/* Tag of the data being flushed by the current output thread, or NULL */
+char *flb_output_thread_tag()
+{
+    struct flb_thread *th;
+    struct flb_output_thread *out_th;
+
+    th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+    if (!th) {
+        return NULL;
+    }
+
+    out_th = (struct flb_output_thread *) FLB_THREAD_DATA(th);
+    if (!out_th->task) {
+        return NULL;
+    }
+
+    return out_th->task->tag;
+}
+
+static int net_property_bool(char *v)
+{
+    if (strcasecmp(v, "true") == 0 || strcasecmp(v, "on") == 0) {
+        return FLB_TRUE;
+    }
+    return FLB_FALSE;
+}
+
+/*
+ * Apply the instance network settings to an upstream created by the
+ * plugin. 'Upstream_Balance' selects how the nodes of an upstream group
+ * ('Host' with a comma separated list) are chosen, the 'net.*' properties
+ * tune the sockets of the new connections.
+ */
+int flb_output_upstream_set(struct flb_upstream *u,
+                            struct flb_output_instance *ins)
+{
+    char *tmp;
+    int64_t size;
+    struct flb_net_setup net;
+
+    flb_net_setup_init(&net);
+
+    tmp = flb_output_get_property("net.tcp_fastopen", ins);
+    if (tmp) {
+        net.tcp_fastopen = net_property_bool(tmp);
+    }
+
+    tmp = flb_output_get_property("net.sndbuf", ins);
+    if (tmp) {
+        net.sndbuf = flb_utils_size_to_bytes(tmp);
+    }
+
+    tmp = flb_output_get_property("net.rcvbuf", ins);
+    if (tmp) {
+        net.rcvbuf = flb_utils_size_to_bytes(tmp);
+    }
+
+    tmp = flb_output_get_property("net.tcp_keepalive", ins);
+    if (tmp) {
+        net.keepalive = net_property_bool(tmp);
+    }
+
+    tmp = flb_output_get_property("net.tcp_keepalive_time", ins);
+    if (tmp) {
+        net.keepalive_time = atoi(tmp);
+    }
+
+    tmp = flb_output_get_property("net.tcp_keepalive_interval", ins);
+    if (tmp) {
+        net.keepalive_interval = atoi(tmp);
+    }
+
+    tmp = flb_output_get_property("net.tcp_keepalive_probes", ins);
+    if (tmp) {
+        net.keepalive_probes = atoi(tmp);
+    }
+
+    tmp = flb_output_get_property("net.linger", ins);
+    if (tmp) {
+        net.linger = atoi(tmp);
+    }
+
+    tmp = flb_output_get_property("net.tcp_congestion", ins);
+    if (tmp) {
+        if (strlen(tmp) >= FLB_NET_CONGESTION_SIZE) {
+            flb_error("[output] invalid net.tcp_congestion '%s'", tmp);
+            return -1;
+        }
+        strcpy(net.congestion, tmp);
+    }
+
+    /* 'on' uses the default threshold, a size sets it */
+    tmp = flb_output_get_property("net.zerocopy", ins);
+    if (tmp) {
+        if (net_property_bool(tmp) == FLB_TRUE) {
+            net.zerocopy = FLB_NET_ZEROCOPY_MIN;
+        }
+        else if (strcasecmp(tmp, "off") != 0 &&
+                 strcasecmp(tmp, "false") != 0) {
+            size = flb_utils_size_to_bytes(tmp);
+            if (size <= 0) {
+                flb_error("[output] invalid net.zerocopy '%s'", tmp);
+                return -1;
+            }
+            net.zerocopy = size;
+        }
+    }
+
+    flb_upstream_net_set(u, &net);
+
+    tmp = flb_output_get_property("upstream_balance", ins);
+    if (tmp) {
+        return flb_upstream_balance_set(u, tmp);
+    }
+
+    return 0;
+}
@@ -17,21 +17,62 @@
  *  limitations under the License.
  */
 
+#include <errno.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_error.h>
+#include <fluent-bit/flb_log.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_pack_json.h>
+#include <fluent-bit/flb_record.h>
+#include <fluent-bit/flb_time.h>
 #include <fluent-bit/flb_info.h>
 
 #include <msgpack.h>
 #include <jsmn/jsmn.h>
 
+#if defined(FLB_HAVE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* JSMN tokens of a message */
+struct jsmn_state {
+    int tokens_count;     /* number of parsed tokens */
+    int tokens_size;      /* array size of tokens    */
+    jsmntok_t *tokens;    /* tokens array            */
+    jsmn_parser parser;   /* parser state            */
+};
+
+static int jsmn_state_init(struct jsmn_state *s)
+{
+    int size = 256;
+
+    jsmn_init(&s->parser);
+    s->tokens = flb_calloc(1, sizeof(jsmntok_t) * size);
+    if (!s->tokens) {
+        perror("calloc");
+        return -1;
+    }
+    s->tokens_size  = size;
+    s->tokens_count = 0;
+
+    return 0;
+}
+
+static void jsmn_state_reset(struct jsmn_state *s)
+{
+    flb_free(s->tokens);
+    s->tokens_size  = 0;
+    s->tokens_count = 0;
+}
+
 static int json_tokenise(char *js, size_t len,
-                         struct flb_pack_state *state)
+                         struct jsmn_state *state)
 {
     int ret;
     int n;
@@ -152,21 +193,21 @@ static char *tokens_to_msgpack(char *js,
 }
 
 /*
- * It parse a JSON string and convert it to MessagePack format, this packer is
- * useful when a complete JSON message exists, otherwise it will fail until
- * the message is complete.
+ * It parse a JSON string and convert it to MessagePack format through the
+ * JSMN tokenizer, it's the fallback of flb_pack_json() for the messages
+ * the structural packer does not handle.
  *
  * This routine do not keep a state in the parser, do not use it for big
  * JSON messages.
  */
-int flb_pack_json(char *js, size_t len, char **buffer, int *size)
+int flb_pack_json_jsmn(char *js, size_t len, char **buffer, int *size)
 {
     int ret;
     int out;
     char *buf;
-    struct flb_pack_state state;
+    struct jsmn_state state;
 
-    ret = flb_pack_state_init(&state);
+    ret = jsmn_state_init(&state);
     if (ret != 0) {
         return -1;
     }
@@ -186,110 +227,695 @@ int flb_pack_json(char *js, size_t len, char **buffer, int *size)
 
     ret = 0;
  flb_pack_json_end:
-    flb_pack_state_reset(&state);
+    jsmn_state_reset(&state);
     return ret;
 }
 
-/* Initialize a JSON packer state */
-int flb_pack_state_init(struct flb_pack_state *s)
+/*
+ * It parse a JSON string and convert it to MessagePack format, this packer is
+ * useful when a complete JSON message exists, otherwise it will fail until
+ * the message is complete.
+ */
+int flb_pack_json(char *js, size_t len, char **buffer, int *size)
 {
-    int size = 256;
+    int ret;
+    int records;
+    size_t i;
+    size_t consumed;
+    msgpack_sbuffer sbuf;
+    struct flb_pack_json pj;
 
-    jsmn_init(&s->parser);
-    s->tokens = flb_calloc(1, sizeof(jsmntok_t) * size);
-    if (!s->tokens) {
-        perror("calloc");
+    ret = flb_pack_json_init(&pj);
+    if (ret != 0) {
         return -1;
     }
-    s->tokens_size  = size;
-    s->tokens_count = 0;
+
+    /* the MessagePack version is usually smaller than the JSON */
+    msgpack_sbuffer_init(&sbuf);
+    sbuf.data = flb_malloc(len + 16);
+    if (!sbuf.data) {
+        flb_errno();
+        flb_pack_json_destroy(&pj);
+        return -1;
+    }
+    sbuf.alloc = len + 16;
+
+    ret = flb_pack_json_buffer(&pj, js, len, &sbuf, &consumed, &records);
+    flb_pack_json_destroy(&pj);
+
+    if (ret == FLB_ERR_JSON_INVAL) {
+        msgpack_sbuffer_destroy(&sbuf);
+        return flb_pack_json_jsmn(js, len, buffer, size);
+    }
+    else if (ret != 0) {
+        msgpack_sbuffer_destroy(&sbuf);
+        return ret;
+    }
+
+    /* every message must be complete */
+    for (i = consumed; i < len; i++) {
+        if (js[i] != ' ' && js[i] != '\t' &&
+            js[i] != '\r' && js[i] != '\n') {
+            msgpack_sbuffer_destroy(&sbuf);
+            return FLB_ERR_JSON_PART;
+        }
+    }
+
+    /* the buffer is handed to the caller as is */
+    *buffer = sbuf.data;
+    *size = sbuf.size;
 
     return 0;
 }
 
-void flb_pack_state_reset(struct flb_pack_state *s)
+/* Initialize a JSON packer state */
+int flb_pack_state_init(struct flb_pack_state *s)
 {
-    flb_free(s->tokens);
-    s->tokens_size  = 0;
-    s->tokens_count = 0;
+    s->last_byte = 0;
+    return flb_pack_json_init(&s->pj);
 }
 
+void flb_pack_state_reset(struct flb_pack_state *s)
+{
+    flb_pack_json_destroy(&s->pj);
+    s->last_byte = 0;
+}
 
 /*
- * It parse a JSON string and convert it to MessagePack format. The main
- * difference of this function and the previous flb_pack_json() is that it
- * keeps a parser and tokens state, allowing to process big messages and
- * resume the parsing process instead of start from zero.
+ * It parse a JSON stream and convert the complete messages to MessagePack.
+ * The main difference with flb_pack_json() is that it keeps the parser
+ * state between calls, every byte is processed once no matter in how many
+ * pieces a big message arrives.
+ *
+ * On success 'state->last_byte' is set to the end of the last complete
+ * message: the caller must remove those bytes from the beginning of its
+ * buffer before calling again with more data appended. On error the state
+ * is reset and the buffered data should be dropped.
  */
 int flb_pack_json_state(char *js, size_t len,
                         char **buffer, int *size,
                         struct flb_pack_state *state)
 {
     int ret;
-    int out;
-    int delim = 0;
-    char *buf;
-    jsmntok_t *t;
+    size_t consumed;
+
+    ret = flb_pack_json_stream(&state->pj, js, len, buffer, size, &consumed);
+    if (ret != 0) {
+        return ret;
+    }
+
+    state->last_byte = consumed;
+    return 0;
+}
+
+void flb_pack_print(char *data, size_t bytes)
+{
+    msgpack_unpacked result;
+    size_t off = 0, cnt = 0;
+
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, data, bytes, &off)) {
+        printf("[%zd] ", cnt++);
+        msgpack_object_print(stdout, result.data);
+        printf("\n");
+    }
+    msgpack_unpacked_destroy(&result);
+}
+
+/*
+ * MessagePack to JSON
+ * -------------------
+ * The encoder below writes JSON text straight from the encoded records
+ * into a caller msgpack_sbuffer, which can be reused across flushes. No
+ * intermediate tree is built: values are decoded in place with
+ * flb_record_unpack() and nested maps and arrays are walked with an
+ * explicit stack, so a deep record does not grow the (small) coroutine
+ * stack of a flush callback.
+ */
+
+/* Make room for 'bytes' more bytes in the output buffer */
+static inline int json_reserve(msgpack_sbuffer *out, size_t bytes)
+{
+    size_t size;
+    char *tmp;
+
+    if (out->alloc - out->size >= bytes) {
+        return 0;
+    }
+
+    size = out->alloc ? out->alloc * 2 : MSGPACK_SBUFFER_INIT_SIZE;
+    while (size - out->size < bytes) {
+        size *= 2;
+    }
+
+    tmp = flb_realloc(out->data, size);
+    if (!tmp) {
+        flb_errno();
+        return -1;
+    }
+    out->data = tmp;
+    out->alloc = size;
+
+    return 0;
+}
+
+static inline int json_write(msgpack_sbuffer *out, const char *buf,
+                             size_t len)
+{
+    if (json_reserve(out, len) != 0) {
+        return -1;
+    }
+    memcpy(out->data + out->size, buf, len);
+    out->size += len;
+    return 0;
+}
+
+static inline int json_put(msgpack_sbuffer *out, char c)
+{
+    if (json_reserve(out, 1) != 0) {
+        return -1;
+    }
+    out->data[out->size++] = c;
+    return 0;
+}
+
+static int json_u64(msgpack_sbuffer *out, uint64_t n, int negative)
+{
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+
+    do {
+        *--p = '0' + (n % 10);
+        n /= 10;
+    } while (n > 0);
+
+    if (negative) {
+        *--p = '-';
+    }
+
+    return json_write(out, p, tmp + sizeof(tmp) - p);
+}
+
+static int json_double(msgpack_sbuffer *out, double d)
+{
+    int len;
+    char tmp[32];
+
+    /* JSON has no representation for them */
+    if (isnan(d) || isinf(d)) {
+        return json_write(out, "null", 4);
+    }
+
+    /* 15 significant digits, 17 if that does not read back the same */
+    len = snprintf(tmp, sizeof(tmp), "%.15g", d);
+    if (strtod(tmp, NULL) != d) {
+        len = snprintf(tmp, sizeof(tmp), "%.17g", d);
+    }
+
+    /* keep it a float for the readers that care */
+    if (strspn(tmp, "-0123456789") == (size_t) len) {
+        tmp[len++] = '.';
+        tmp[len++] = '0';
+    }
+    return json_write(out, tmp, len);
+}
+
+/* Length of the valid UTF-8 sequence at 'p', zero if it's not valid */
+static inline int utf8_len(const unsigned char *p, const unsigned char *end)
+{
+    int i;
+    int n;
+    unsigned char c = p[0];
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xbf;
+
+    if (c >= 0xc2 && c <= 0xdf) {
+        n = 2;
+    }
+    else if (c >= 0xe0 && c <= 0xef) {
+        n = 3;
+        if (c == 0xe0) {
+            lo = 0xa0;                  /* overlong */
+        }
+        else if (c == 0xed) {
+            hi = 0x9f;                  /* surrogates */
+        }
+    }
+    else if (c >= 0xf0 && c <= 0xf4) {
+        n = 4;
+        if (c == 0xf0) {
+            lo = 0x90;                  /* overlong */
+        }
+        else if (c == 0xf4) {
+            hi = 0x8f;                  /* above U+10FFFF */
+        }
+    }
+    else {
+        return 0;
+    }
+
+    if (end - p < n || p[1] < lo || p[1] > hi) {
+        return 0;
+    }
+    for (i = 2; i < n; i++) {
+        if ((p[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+
+    return n;
+}
+
+/* Bytes that are not copied as they are: quote, backslash, control, 8 bit */
+static inline int json_special(unsigned char c)
+{
+    return (c < 0x20 || c == '"' || c == '\\' || c >= 0x80);
+}
 
-    ret = json_tokenise(js, len, state);
-    state->multiple = FLB_TRUE;
-    if (ret == FLB_ERR_JSON_PART && state->multiple == FLB_TRUE) {
-        /*
-         * If the caller enabled 'multiple' flag, it means that the incoming
-         * JSON message may have multiple messages concatenated and likely
-         * the last one is only incomplete.
-         *
-         * The following routine aims to determinate how many JSON messages
-         * are OK in the array of tokens, if any, process them and adjust
-         * the JSMN context/buffers.
-         */
-        int i;
-        int found = 0;
-
-        for (i = 1; i < state->tokens_size; i++) {
-            t = &state->tokens[i];
-            if (t->start < (state->tokens[i - 1]).start) {
+/*
+ * Write a quoted and escaped JSON string. Runs of plain characters are
+ * copied at once, the SSE2 loop looks for the next special byte 16 bytes at
+ * a time. Valid UTF-8 sequences are kept, any other byte is replaced by
+ * U+FFFD so the output is always valid JSON. With FLB_JSON_NODOTS the dots
+ * are replaced by underscores (Elasticsearch field names).
+ */
+int flb_msgpack_to_json_str(msgpack_sbuffer *out, char *str, size_t len,
+                            int flags)
+{
+    int n;
+    int esc_len;
+    char esc[8];
+    size_t i;
+    size_t start;
+    unsigned char c;
+    const unsigned char *p = (unsigned char *) str;
+    const unsigned char *end = p + len;
+    const unsigned char *run = p;
+#if defined(FLB_HAVE_SIMD) && defined(__SSE2__)
+    int mask;
+    __m128i v;
+    __m128i ctl = _mm_set1_epi8(0x20);
+    __m128i quote = _mm_set1_epi8('"');
+    __m128i bslash = _mm_set1_epi8('\\');
+#endif
+
+    /* the common case needs no more room than this */
+    if (json_reserve(out, len + 2) != 0) {
+        return -1;
+    }
+    out->data[out->size++] = '"';
+    start = out->size;
+
+    while (p < end) {
+#if defined(FLB_HAVE_SIMD) && defined(__SSE2__)
+        /* signed compare: bytes >= 0x80 are negative, below 0x20 too */
+        while (end - p >= 16) {
+            v = _mm_loadu_si128((const __m128i *) p);
+            mask = _mm_movemask_epi8(_mm_or_si128(
+                                     _mm_cmplt_epi8(v, ctl),
+                                     _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                                  _mm_cmpeq_epi8(v, bslash))));
+            if (mask != 0) {
+                p += __builtin_ctz(mask);
                 break;
             }
+            p += 16;
+        }
+#endif
+        while (p < end && !json_special(*p)) {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
 
-            if (t->parent == -1 && (t->end != 0)) {
-                found++;
-                delim = i;
+        c = *p;
+        if (c >= 0x80) {
+            n = utf8_len(p, end);
+            if (n > 0) {
+                p += n;
+                continue;
             }
         }
 
-        if (found > 0) {
-            state->tokens_count += delim;
+        switch (c) {
+        case '"':
+        case '\\':
+            esc[0] = '\\';
+            esc[1] = c;
+            esc_len = 2;
+            break;
+        case '\b':
+            memcpy(esc, "\\b", 2);
+            esc_len = 2;
+            break;
+        case '\f':
+            memcpy(esc, "\\f", 2);
+            esc_len = 2;
+            break;
+        case '\n':
+            memcpy(esc, "\\n", 2);
+            esc_len = 2;
+            break;
+        case '\r':
+            memcpy(esc, "\\r", 2);
+            esc_len = 2;
+            break;
+        case '\t':
+            memcpy(esc, "\\t", 2);
+            esc_len = 2;
+            break;
+        default:
+            if (c >= 0x80) {
+                memcpy(esc, "\\ufffd", 6);
+            }
+            else {
+                memcpy(esc, "\\u00", 4);
+                esc[4] = "0123456789abcdef"[c >> 4];
+                esc[5] = "0123456789abcdef"[c & 0x0f];
+            }
+            esc_len = 6;
         }
-        else {
-            return ret;
+
+        if (json_write(out, (char *) run, p - run) != 0 ||
+            json_write(out, esc, esc_len) != 0) {
+            return -1;
         }
+        p++;
+        run = p;
     }
-    else if (ret != 0) {
-        return ret;
+
+    if (json_write(out, (char *) run, p - run) != 0 ||
+        json_put(out, '"') != 0) {
+        return -1;
     }
 
-    buf = tokens_to_msgpack(js, state->tokens, state->tokens_count, &out);
-    if (!buf) {
+    /* escape sequences have no dots, replacing them afterwards is safe */
+    if (flags & FLB_JSON_NODOTS) {
+        for (i = start; i < out->size - 1; i++) {
+            if (out->data[i] == '.') {
+                out->data[i] = '_';
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int json_scalar(msgpack_sbuffer *out, msgpack_object *o, int flags)
+{
+    switch (o->type) {
+    case MSGPACK_OBJECT_NIL:
+        return json_write(out, "null", 4);
+    case MSGPACK_OBJECT_BOOLEAN:
+        if (o->via.boolean) {
+            return json_write(out, "true", 4);
+        }
+        return json_write(out, "false", 5);
+    case MSGPACK_OBJECT_POSITIVE_INTEGER:
+        return json_u64(out, o->via.u64, FLB_FALSE);
+    case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+        return json_u64(out, -(uint64_t) o->via.i64, FLB_TRUE);
+    case MSGPACK_OBJECT_FLOAT:
+        return json_double(out, o->via.f64);
+    case MSGPACK_OBJECT_STR:
+    case MSGPACK_OBJECT_BIN:
+        return flb_msgpack_to_json_str(out, (char *) o->via.str.ptr,
+                                       o->via.str.size, flags);
+    default:
+        /* extension types have no JSON form */
+        return json_write(out, "null", 4);
+    }
+}
+
+/* Map keys must be strings, other scalars are written as quoted text */
+static int json_key(msgpack_sbuffer *out, msgpack_object *o, int flags)
+{
+    if (o->type == MSGPACK_OBJECT_STR || o->type == MSGPACK_OBJECT_BIN) {
+        return json_scalar(out, o, flags);
+    }
+
+    if (json_put(out, '"') != 0 || json_scalar(out, o, 0) != 0) {
         return -1;
     }
+    return json_put(out, '"');
+}
 
-    *size = out;
-    *buffer = buf;
+/* An open map or array while encoding a value */
+struct json_level {
+    uint32_t left;              /* entries (map pairs) not written yet */
+    uint32_t count;             /* entries written                     */
+    int map;
+};
 
+/*
+ * Write the complete value at 'p', nested content included. Map entries
+ * whose key is a map, an array or an extension are skipped. It returns the
+ * position after the value or NULL on error.
+ */
+static char *json_value(msgpack_sbuffer *out, char *p, char *end, int flags)
+{
+    int depth = 0;
+    char *next;
+    msgpack_object o;
+    struct json_level *top = NULL;
+    struct json_level stack[FLB_PACK_JSON_DEPTH];
+
+    for (;;) {
+        if (top) {
+            if (top->left == 0) {
+                if (json_put(out, top->map ? '}' : ']') != 0) {
+                    return NULL;
+                }
+                depth--;
+                if (depth == 0) {
+                    return p;
+                }
+                top = &stack[depth - 1];
+                continue;
+            }
+            top->left--;
+
+            if (top->map) {
+                next = flb_record_unpack(p, end, &o);
+                if (!next) {
+                    return NULL;
+                }
+
+                if (o.type == MSGPACK_OBJECT_MAP ||
+                    o.type == MSGPACK_OBJECT_ARRAY ||
+                    o.type == MSGPACK_OBJECT_EXT) {
+                    p = flb_record_skip(p, end);
+                    if (p) {
+                        p = flb_record_skip(p, end);
+                    }
+                    if (!p) {
+                        return NULL;
+                    }
+                    continue;
+                }
+
+                if ((top->count > 0 && json_put(out, ',') != 0) ||
+                    json_key(out, &o, flags) != 0 ||
+                    json_put(out, ':') != 0) {
+                    return NULL;
+                }
+                p = next;
+            }
+            else if (top->count > 0 && json_put(out, ',') != 0) {
+                return NULL;
+            }
+            top->count++;
+        }
+
+        p = flb_record_unpack(p, end, &o);
+        if (!p) {
+            return NULL;
+        }
+
+        if (o.type == MSGPACK_OBJECT_MAP || o.type == MSGPACK_OBJECT_ARRAY) {
+            if (depth == FLB_PACK_JSON_DEPTH) {
+                return NULL;
+            }
+            top = &stack[depth++];
+            top->map = (o.type == MSGPACK_OBJECT_MAP);
+            top->left = top->map ? o.via.map.size : o.via.array.size;
+            top->count = 0;
+            if (json_put(out, top->map ? '{' : '[') != 0) {
+                return NULL;
+            }
+            continue;
+        }
+
+        if (json_scalar(out, &o, 0) != 0) {
+            return NULL;
+        }
+        if (depth == 0) {
+            return p;
+        }
+    }
+}
+
+/* Write the JSON form of one encoded value, 'flags' apply to map keys */
+int flb_msgpack_to_json_value(msgpack_sbuffer *out, char *data, size_t size,
+                              int flags)
+{
+    size_t off = out->size;
+
+    if (!json_value(out, data, data + size, flags)) {
+        out->size = off;
+        return -1;
+    }
     return 0;
 }
 
-void flb_pack_print(char *data, size_t bytes)
+/*
+ * Write the record map entries as comma separated "key":value pairs, with
+ * a leading comma unless 'first' is set. Entries with a key that is not a
+ * string are skipped.
+ */
+int flb_msgpack_to_json_fields(msgpack_sbuffer *out, struct flb_record *rec,
+                               int first, int flags)
 {
-    msgpack_unpacked result;
-    size_t off = 0, cnt = 0;
+    size_t off = out->size;
+    struct flb_record_kv kv;
 
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        printf("[%zd] ", cnt++);
-        msgpack_object_print(stdout, result.data);
-        printf("\n");
+    while (flb_record_kv_next(rec, &kv)) {
+        if (kv.key.type != MSGPACK_OBJECT_STR &&
+            kv.key.type != MSGPACK_OBJECT_BIN) {
+            continue;
+        }
+
+        if ((!first && json_put(out, ',') != 0) ||
+            json_scalar(out, &kv.key, flags) != 0 ||
+            json_put(out, ':') != 0 ||
+            !json_value(out, kv.val_raw, kv.val_raw + kv.val_size, flags)) {
+            out->size = off;
+            return -1;
+        }
+        first = FLB_FALSE;
     }
-    msgpack_unpacked_destroy(&result);
+
+    return 0;
+}
+
+/*
+ * Write a record time as a number of seconds: integers and floats are
+ * written as they are, an EventTime gets a fraction with nanoseconds.
+ */
+int flb_msgpack_to_json_time(msgpack_sbuffer *out, msgpack_object *o)
+{
+    int len;
+    char tmp[32];
+    struct flb_time tm;
+
+    switch (o->type) {
+    case MSGPACK_OBJECT_POSITIVE_INTEGER:
+    case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+    case MSGPACK_OBJECT_FLOAT:
+        return json_scalar(out, o, 0);
+    default:
+        break;
+    }
+
+    if (flb_time_pop_from_msgpack(&tm, o) != 0) {
+        return json_put(out, '0');
+    }
+
+    len = snprintf(tmp, sizeof(tmp), "%lld.%09ld",
+                   (long long) tm.tm.tv_sec, (long) tm.tm.tv_nsec);
+    return json_write(out, tmp, len);
+}
+
+/* Write one record as a JSON object, its time goes first as 'date_key' */
+int flb_msgpack_to_json_record(msgpack_sbuffer *out, struct flb_record *rec,
+                               char *date_key, int flags)
+{
+    int first = FLB_TRUE;
+    size_t off = out->size;
+
+    if (json_put(out, '{') != 0) {
+        return -1;
+    }
+
+    if (date_key) {
+        if (flb_msgpack_to_json_str(out, date_key, strlen(date_key), 0) ||
+            json_put(out, ':') != 0 ||
+            flb_msgpack_to_json_time(out, &rec->time) != 0) {
+            out->size = off;
+            return -1;
+        }
+        first = FLB_FALSE;
+    }
+
+    if (flb_msgpack_to_json_fields(out, rec, first, flags) != 0 ||
+        json_put(out, '}') != 0) {
+        out->size = off;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Convert the [time, map] records of a chunk to a JSON array of objects
+ * (FLB_JSON_FORMAT_ARRAY) or to one object per line (FLB_JSON_FORMAT_LINES),
+ * appended to 'out'. A record that cannot be converted (malformed or nested
+ * deeper than FLB_PACK_JSON_DEPTH) is skipped so the others are not lost.
+ * It returns the number of records written or -1 on error.
+ */
+int flb_msgpack_to_json(msgpack_sbuffer *out, char *data, size_t bytes,
+                        int format, char *date_key, int flags)
+{
+    int n = 0;
+    int i = 0;
+    size_t off = out->size;
+    size_t rec_off;
+    struct flb_record rec;
+    struct flb_record_iter it;
+
+    /* JSON is usually bigger than its MessagePack form */
+    if (json_reserve(out, bytes + (bytes >> 1) + 2) != 0) {
+        return -1;
+    }
+
+    if (format == FLB_JSON_FORMAT_ARRAY) {
+        out->data[out->size++] = '[';
+    }
+
+    flb_record_iter_init(&it, data, bytes);
+    while (flb_record_iter_next(&it, &rec)) {
+        i++;
+        rec_off = out->size;
+        if (format == FLB_JSON_FORMAT_ARRAY && n > 0 &&
+            json_put(out, ',') != 0) {
+            goto error;
+        }
+
+        errno = 0;
+        if (flb_msgpack_to_json_record(out, &rec, date_key, flags) != 0) {
+            if (errno == ENOMEM) {
+                goto error;
+            }
+            flb_warn("[pack] record #%i cannot be converted to JSON, "
+                     "skipped (malformed or deeper than %i levels)",
+                     i, FLB_PACK_JSON_DEPTH);
+            out->size = rec_off;
+            continue;
+        }
+        if (format == FLB_JSON_FORMAT_LINES && json_put(out, '\n') != 0) {
+            goto error;
+        }
+        n++;
+    }
+
+    if (format == FLB_JSON_FORMAT_ARRAY && json_put(out, ']') != 0) {
+        goto error;
+    }
+
+    return n;
+
+ error:
+    out->size = off;
+    return -1;
 }
@@ -0,0 +1,824 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_error.h>
+#include <fluent-bit/flb_pack_json.h>
+
+#ifdef FLB_HAVE_SIMD
+#include <immintrin.h>
+#endif
+
+/* Bitmaps of a 64 bytes block, bit N is the byte N */
+struct json_block {
+    uint64_t quote;           /* '"'          */
+    uint64_t bslash;          /* '\'          */
+    uint64_t op;              /* { } [ ] : ,  */
+};
+
+/* Grammar states of the index walker */
+#define WALK_VALUE   0        /* a value is expected          */
+#define WALK_KEY     1        /* a map key or '}'             */
+#define WALK_COLON   2        /* ':' after a map key          */
+#define WALK_NEXT    3        /* ',' or the container closing */
+
+/* Where index_walk() stopped */
+struct walk_result {
+    int records;              /* complete records packed          */
+    size_t end;               /* input consumed by those records  */
+    size_t pos;               /* index entries consumed by them   */
+    size_t out;               /* output length of those records   */
+};
+
+static void block_scalar(const char *p, struct json_block *b)
+{
+    int i;
+    uint64_t bit;
+
+    b->quote  = 0;
+    b->bslash = 0;
+    b->op     = 0;
+
+    for (i = 0; i < 64; i++) {
+        bit = 1ULL << i;
+        switch (p[i]) {
+        case '{':
+        case '}':
+        case '[':
+        case ']':
+        case ':':
+        case ',':
+            b->op |= bit;
+            break;
+        case '"':
+            b->quote |= bit;
+            break;
+        case '\\':
+            b->bslash |= bit;
+            break;
+        }
+    }
+}
+
+#ifdef FLB_HAVE_SIMD
+__attribute__((target("avx2")))
+static inline uint64_t avx2_mask(__m256i lo, __m256i hi)
+{
+    return (uint64_t) (uint32_t) _mm256_movemask_epi8(lo) |
+        ((uint64_t) (uint32_t) _mm256_movemask_epi8(hi) << 32);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_op(__m256i v)
+{
+    __m256i t;
+
+    /* '[' and ']' differ from '{' and '}' only in the 0x20 bit */
+    t = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(t, _mm256_set1_epi8('{')),
+                        _mm256_cmpeq_epi8(t, _mm256_set1_epi8('}'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+}
+
+__attribute__((target("avx2")))
+static void block_avx2(const char *p, struct json_block *b)
+{
+    __m256i lo = _mm256_loadu_si256((const __m256i *) p);
+    __m256i hi = _mm256_loadu_si256((const __m256i *) (p + 32));
+    __m256i quote = _mm256_set1_epi8('"');
+    __m256i bslash = _mm256_set1_epi8('\\');
+
+    b->quote  = avx2_mask(_mm256_cmpeq_epi8(lo, quote),
+                          _mm256_cmpeq_epi8(hi, quote));
+    b->bslash = avx2_mask(_mm256_cmpeq_epi8(lo, bslash),
+                          _mm256_cmpeq_epi8(hi, bslash));
+    b->op     = avx2_mask(avx2_op(lo), avx2_op(hi));
+}
+
+__attribute__((target("sse4.2")))
+static void block_sse42(const char *p, struct json_block *b)
+{
+    int i;
+    uint64_t m;
+    __m128i v;
+    __m128i set = _mm_setr_epi8('{', '}', '[', ']', ':', ',',
+                                0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i quote = _mm_set1_epi8('"');
+    __m128i bslash = _mm_set1_epi8('\\');
+
+    b->quote  = 0;
+    b->bslash = 0;
+    b->op     = 0;
+
+    for (i = 0; i < 4; i++) {
+        v = _mm_loadu_si128((const __m128i *) (p + (i * 16)));
+
+        /* explicit lengths, a NUL byte does not end the comparison */
+        m = _mm_cvtsi128_si32(_mm_cmpestrm(set, 6, v, 16,
+                                           _SIDD_UBYTE_OPS |
+                                           _SIDD_CMP_EQUAL_ANY |
+                                           _SIDD_BIT_MASK)) & 0xffff;
+        b->op |= m << (i * 16);
+
+        m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) & 0xffff;
+        b->quote |= m << (i * 16);
+
+        m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, bslash)) & 0xffff;
+        b->bslash |= m << (i * 16);
+    }
+}
+#endif
+
+/*
+ * Bytes escaped by an odd sequence of backslashes, 'carry' tells if the
+ * previous block ended in the middle of such sequence.
+ */
+static inline uint64_t block_escaped(uint64_t bs, uint64_t *carry)
+{
+    uint64_t even = 0x5555555555555555ULL;
+    uint64_t odd = ~even;
+    uint64_t starts;
+    uint64_t even_starts;
+    uint64_t odd_starts;
+    uint64_t even_carries;
+    uint64_t odd_carries;
+    uint64_t even_start_mask;
+    int overflow;
+
+    starts = bs & ~(bs << 1);
+    even_start_mask = even ^ *carry;
+    even_starts = starts & even_start_mask;
+    odd_starts = starts & ~even_start_mask;
+
+    even_carries = bs + even_starts;
+    overflow = __builtin_add_overflow(bs, odd_starts, &odd_carries);
+    odd_carries |= *carry;
+    *carry = overflow ? 1 : 0;
+
+    even_carries &= ~bs;
+    odd_carries &= ~bs;
+
+    return (even_carries & odd) | (odd_carries & even);
+}
+
+/* Bits set from every quote (included) to the next one (excluded) */
+static inline uint64_t prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/*
+ * Find the quotes and the structural characters outside of strings. It
+ * resumes after the last complete block indexed by a previous call.
+ */
+static int index_build(struct flb_pack_json *pj, char *js, size_t len)
+{
+    size_t off;
+    size_t n;
+    size_t size;
+    uint64_t bits;
+    uint64_t quote;
+    uint64_t in_string = pj->in_string;
+    uint64_t carry = pj->escape;
+    uint32_t *tmp;
+    char tail[64];
+    struct json_block b;
+    void (*scan)(const char *, struct json_block *) = block_scalar;
+
+#ifdef FLB_HAVE_SIMD
+    if (pj->simd == FLB_PACK_JSON_AVX2) {
+        scan = block_avx2;
+    }
+    else if (pj->simd == FLB_PACK_JSON_SSE42) {
+        scan = block_sse42;
+    }
+#endif
+
+    n = pj->scan_len;
+    for (off = pj->scan_off; off < len; off += 64) {
+        if (pj->index_size - n < 64) {
+            size = pj->index_size * 2;
+            tmp = flb_realloc(pj->index, size * sizeof(uint32_t));
+            if (!tmp) {
+                flb_errno();
+                return -1;
+            }
+            pj->index = tmp;
+            pj->index_size = size;
+        }
+
+        if (len - off >= 64) {
+            scan(js + off, &b);
+        }
+        else {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, js + off, len - off);
+            scan(tail, &b);
+        }
+
+        quote = b.quote & ~block_escaped(b.bslash, &carry);
+        bits = prefix_xor(quote) ^ in_string;
+        in_string = (uint64_t) ((int64_t) bits >> 63);
+
+        bits = (b.op & ~bits) | quote;
+        while (bits) {
+            pj->index[n++] = off + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+
+        /* a partial block is scanned again when more data arrives */
+        if (len - off >= 64) {
+            pj->scan_off = off + 64;
+            pj->scan_len = n;
+            pj->in_string = in_string;
+            pj->escape = carry;
+        }
+    }
+    pj->index_len = n;
+
+    return 0;
+}
+
+static inline int is_space(char c)
+{
+    return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+}
+
+/*
+ * Look for a primitive (number, true, false or null) in the bytes between
+ * two structural characters. It returns 1 if found, 0 if there is only
+ * white space and -1 otherwise.
+ */
+static int gap_value(char *js, size_t start, size_t end,
+                     size_t *v_start, size_t *v_end)
+{
+    char c;
+    size_t i;
+
+    while (start < end && is_space(js[start])) {
+        start++;
+    }
+    while (end > start && is_space(js[end - 1])) {
+        end--;
+    }
+    if (start == end) {
+        return 0;
+    }
+
+    c = js[start];
+    if (!(c == '-' || (c >= '0' && c <= '9') ||
+          c == 't' || c == 'f' || c == 'n')) {
+        return -1;
+    }
+
+    for (i = start; i < end; i++) {
+        if ((unsigned char) js[i] <= ' ') {
+            return -1;
+        }
+    }
+
+    *v_start = start;
+    *v_end = end;
+    return 1;
+}
+
+static inline int is_blank(char *p, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (!is_space(p[i])) {
+            return FLB_FALSE;
+        }
+    }
+    return FLB_TRUE;
+}
+
+/* Make room for 'bytes' more bytes in the output buffer */
+static inline int out_reserve(msgpack_sbuffer *sbuf, size_t bytes)
+{
+    size_t size;
+    char *tmp;
+
+    if (sbuf->alloc - sbuf->size >= bytes) {
+        return 0;
+    }
+
+    size = sbuf->alloc ? sbuf->alloc * 2 : MSGPACK_SBUFFER_INIT_SIZE;
+    while (size - sbuf->size < bytes) {
+        size *= 2;
+    }
+
+    tmp = flb_realloc(sbuf->data, size);
+    if (!tmp) {
+        flb_errno();
+        return -1;
+    }
+    sbuf->data = tmp;
+    sbuf->alloc = size;
+
+    return 0;
+}
+
+static inline void out_store16(char *p, uint32_t n)
+{
+    p[0] = (n >> 8) & 0xff;
+    p[1] = n & 0xff;
+}
+
+static inline void out_store32(char *p, uint32_t n)
+{
+    p[0] = (n >> 24) & 0xff;
+    p[1] = (n >> 16) & 0xff;
+    p[2] = (n >> 8) & 0xff;
+    p[3] = n & 0xff;
+}
+
+/* Strings are packed as raw binary, as the JSMN tokens packer does */
+static inline int out_bin(msgpack_sbuffer *sbuf, char *buf, size_t len)
+{
+    char *p;
+
+    if (out_reserve(sbuf, len + 5) != 0) {
+        return -1;
+    }
+
+    p = sbuf->data + sbuf->size;
+    if (len < 256) {
+        *p++ = 0xc4;
+        *p++ = len;
+    }
+    else if (len < 65536) {
+        *p++ = 0xc5;
+        out_store16(p, len);
+        p += 2;
+    }
+    else {
+        *p++ = 0xc6;
+        out_store32(p, len);
+        p += 4;
+    }
+    memcpy(p, buf, len);
+    sbuf->size = (p + len) - sbuf->data;
+
+    return 0;
+}
+
+/*
+ * A closed map or array gets its header: one byte was reserved when it was
+ * opened, larger headers move the content already written.
+ */
+static inline int out_header(msgpack_sbuffer *sbuf, struct flb_pack_json_level *l)
+{
+    int size;
+    char *p;
+
+    if (l->count < 16) {
+        sbuf->data[l->offset] = (l->type == '{' ? 0x80 : 0x90) | l->count;
+        return 0;
+    }
+
+    size = (l->count < 65536) ? 3 : 5;
+    if (out_reserve(sbuf, size - 1) != 0) {
+        return -1;
+    }
+
+    p = sbuf->data + l->offset;
+    memmove(p + size, p + 1, sbuf->size - l->offset - 1);
+    sbuf->size += size - 1;
+
+    if (size == 3) {
+        *p = (l->type == '{') ? 0xde : 0xdc;
+        out_store16(p + 1, l->count);
+    }
+    else {
+        *p = (l->type == '{') ? 0xdf : 0xdd;
+        out_store32(p + 1, l->count);
+    }
+
+    return 0;
+}
+
+/* Same conversion rules than the JSMN tokens packer */
+static int pack_primitive(msgpack_packer *pck, char *p, size_t len)
+{
+    if (*p == 'f') {
+        return msgpack_pack_false(pck);
+    }
+    else if (*p == 't') {
+        return msgpack_pack_true(pck);
+    }
+    else if (*p == 'n') {
+        return msgpack_pack_nil(pck);
+    }
+    else if (memchr(p, '.', len)) {
+        return msgpack_pack_double(pck, atof(p));
+    }
+
+    return msgpack_pack_int64(pck, atol(p));
+}
+
+/*
+ * Walk the structural index checking the grammar and writing MessagePack
+ * in the same pass. It starts from the state saved by the previous call
+ * and saves it back when it runs out of index entries.
+ */
+static int index_walk(struct flb_pack_json *pj, char *js, size_t len,
+                      msgpack_sbuffer *sbuf, struct walk_result *r)
+{
+    int ret;
+    int depth = pj->depth;
+    int state = pj->state;
+    char c;
+    size_t i = pj->pos;
+    size_t p;
+    size_t q;
+    size_t v_start;
+    size_t v_end;
+    size_t gap = pj->gap;
+    size_t out_start = sbuf->size;
+    struct flb_pack_json_level *stack = pj->stack;
+    struct flb_pack_json_level *top;
+    msgpack_packer pck;
+
+    r->records = 0;
+    r->end = 0;
+    r->pos = 0;
+    r->out = sbuf->size;
+    top = depth > 0 ? &stack[depth - 1] : NULL;
+
+    msgpack_packer_init(&pck, sbuf, msgpack_sbuffer_write);
+
+    while (i < pj->index_len) {
+        p = pj->index[i];
+        c = js[p];
+
+        if (state == WALK_VALUE) {
+            /* a primitive sits before the next structural character */
+            ret = gap_value(js, gap, p, &v_start, &v_end);
+            if (ret == -1 || (ret == 1 && depth == 0)) {
+                goto invalid;
+            }
+            else if (ret == 1) {
+                if (top->type == '[') {
+                    top->count++;
+                }
+                if (pack_primitive(&pck, js + v_start, v_end - v_start)) {
+                    goto error;
+                }
+                gap = v_end;
+                state = WALK_NEXT;
+                continue;
+            }
+        }
+        else if (p != gap && !is_blank(js + gap, p - gap)) {
+            goto invalid;
+        }
+
+        switch (state) {
+        case WALK_VALUE:
+            if (c == '{' || c == '[') {
+                if (depth == FLB_PACK_JSON_DEPTH) {
+                    goto invalid;
+                }
+                if (top && top->type == '[') {
+                    top->count++;
+                }
+                if (out_reserve(sbuf, 1) != 0) {
+                    goto error;
+                }
+
+                top = &stack[depth++];
+                top->offset = sbuf->size++;
+                top->count = 0;
+                top->type = c;
+
+                state = (c == '{') ? WALK_KEY : WALK_VALUE;
+                gap = p + 1;
+                i++;
+                continue;
+            }
+            else if (c == '"' && depth > 0) {
+                if (i + 1 == pj->index_len) {
+                    goto incomplete;
+                }
+                q = pj->index[i + 1];
+                if (top->type == '[') {
+                    top->count++;
+                }
+                if (out_bin(sbuf, js + p + 1, q - p - 1) != 0) {
+                    goto error;
+                }
+                gap = q + 1;
+                state = WALK_NEXT;
+                i += 2;
+                continue;
+            }
+            else if (c == ']' && depth > 0 && top->type == '[' &&
+                     top->count == 0) {
+                break;
+            }
+            goto invalid;
+        case WALK_KEY:
+            if (c == '"') {
+                if (i + 1 == pj->index_len) {
+                    goto incomplete;
+                }
+                q = pj->index[i + 1];
+                top->count++;
+                if (out_bin(sbuf, js + p + 1, q - p - 1) != 0) {
+                    goto error;
+                }
+                gap = q + 1;
+                state = WALK_COLON;
+                i += 2;
+                continue;
+            }
+            else if (c == '}' && top->count == 0) {
+                break;
+            }
+            goto invalid;
+        case WALK_COLON:
+            if (c != ':') {
+                goto invalid;
+            }
+            gap = p + 1;
+            state = WALK_VALUE;
+            i++;
+            continue;
+        case WALK_NEXT:
+            if (c == ',') {
+                gap = p + 1;
+                state = (top->type == '{') ? WALK_KEY : WALK_VALUE;
+                i++;
+                continue;
+            }
+            else if ((c == '}' && top->type == '{') ||
+                     (c == ']' && top->type == '[')) {
+                break;
+            }
+            goto invalid;
+        }
+
+        /* close the current map or array */
+        if (out_header(sbuf, top) != 0) {
+            goto error;
+        }
+        depth--;
+        top = depth > 0 ? &stack[depth - 1] : NULL;
+        gap = p + 1;
+        i++;
+        if (depth == 0) {
+            r->records++;
+            r->end = p + 1;
+            r->pos = i;
+            r->out = sbuf->size;
+            state = WALK_VALUE;
+        }
+        else {
+            state = WALK_NEXT;
+        }
+    }
+
+    /* anything but white space after the last record must be a record */
+    if (depth == 0) {
+        if (gap_value(js, gap, len, &v_start, &v_end) != 0) {
+            goto invalid;
+        }
+        gap = len;
+        r->end = len;
+        r->pos = i;
+    }
+
+ incomplete:
+    pj->depth = depth;
+    pj->state = state;
+    pj->pos = i;
+    pj->gap = gap;
+    return 0;
+
+ invalid:
+    sbuf->size = out_start;
+    return FLB_ERR_JSON_INVAL;
+
+ error:
+    sbuf->size = out_start;
+    return -1;
+}
+
+/* The best scanner supported by the running CPU */
+int flb_pack_json_simd()
+{
+#ifdef FLB_HAVE_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return FLB_PACK_JSON_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return FLB_PACK_JSON_SSE42;
+    }
+#endif
+    return FLB_PACK_JSON_SCALAR;
+}
+
+/*
+ * Drop the bytes and index entries of the records just packed, the caller
+ * removes 'end' bytes from the beginning of its buffer.
+ */
+static void stream_rebase(struct flb_pack_json *pj, size_t end, size_t pos)
+{
+    size_t i;
+    size_t n = pj->index_len - pos;
+
+    for (i = 0; i < n; i++) {
+        pj->index[i] = pj->index[pos + i] - end;
+    }
+    pj->index_len = n;
+    pj->pos -= pos;
+    pj->gap -= end;
+
+    if (pj->scan_off >= end) {
+        pj->scan_off -= end;
+        pj->scan_len -= pos;
+    }
+    else {
+        /* the last record ends in the partial block, no string is open */
+        pj->scan_off = 0;
+        pj->scan_len = 0;
+        pj->in_string = 0;
+        pj->escape = 0;
+    }
+}
+
+int flb_pack_json_init(struct flb_pack_json *pj)
+{
+    pj->index_size = 1024;
+    pj->index = flb_malloc(sizeof(uint32_t) * pj->index_size);
+    if (!pj->index) {
+        flb_errno();
+        return -1;
+    }
+
+    pj->simd = flb_pack_json_simd();
+    msgpack_sbuffer_init(&pj->out);
+    flb_pack_json_reset(pj);
+
+    return 0;
+}
+
+/* Forget any incomplete record, the next data starts a new stream */
+void flb_pack_json_reset(struct flb_pack_json *pj)
+{
+    pj->index_len = 0;
+    pj->scan_off = 0;
+    pj->scan_len = 0;
+    pj->in_string = 0;
+    pj->escape = 0;
+    pj->state = WALK_VALUE;
+    pj->depth = 0;
+    pj->pos = 0;
+    pj->gap = 0;
+    pj->out.size = 0;
+}
+
+void flb_pack_json_destroy(struct flb_pack_json *pj)
+{
+    flb_free(pj->index);
+    pj->index = NULL;
+    msgpack_sbuffer_destroy(&pj->out);
+    msgpack_sbuffer_init(&pj->out);
+}
+
+/*
+ * Pack the complete JSON maps and arrays found at the beginning of 'js',
+ * MessagePack is appended to 'sbuf'. On success 'consumed' is set to the
+ * end of the last packed record, an incomplete record after it is left for
+ * the next call. It returns FLB_ERR_JSON_PART if no record is complete and
+ * FLB_ERR_JSON_INVAL if the data is not valid or uses something this packer
+ * does not handle (deep nesting, a primitive as record), the caller can try
+ * with JSMN then.
+ */
+int flb_pack_json_buffer(struct flb_pack_json *pj, char *js, size_t len,
+                         msgpack_sbuffer *sbuf, size_t *consumed,
+                         int *records)
+{
+    int ret;
+    struct walk_result r;
+
+    if (len >= UINT32_MAX) {
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    flb_pack_json_reset(pj);
+    ret = index_build(pj, js, len);
+    if (ret != 0) {
+        return -1;
+    }
+
+    ret = index_walk(pj, js, len, sbuf, &r);
+    if (ret != 0) {
+        return ret;
+    }
+
+    /* the output of an incomplete record is discarded */
+    sbuf->size = r.out;
+    if (r.records == 0) {
+        return FLB_ERR_JSON_PART;
+    }
+
+    *consumed = r.end;
+    *records = r.records;
+    return 0;
+}
+
+/*
+ * Resumable version of flb_pack_json_buffer() for data arriving in pieces:
+ * every call indexes and packs only what the previous calls did not see.
+ * On success the packed records are returned in a new buffer and
+ * 'consumed' tells how many bytes the caller must remove from the
+ * beginning of 'js' before calling again with more data appended. An
+ * incomplete record is kept in the packer state and FLB_ERR_JSON_PART is
+ * returned if no record was completed. On errors the state is reset.
+ */
+int flb_pack_json_stream(struct flb_pack_json *pj, char *js, size_t len,
+                         char **buffer, int *size, size_t *consumed)
+{
+    int i;
+    int ret;
+    size_t rest;
+    msgpack_sbuffer sbuf;
+    struct walk_result r;
+
+    if (len >= UINT32_MAX) {
+        flb_pack_json_reset(pj);
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    ret = index_build(pj, js, len);
+    if (ret == 0) {
+        ret = index_walk(pj, js, len, &pj->out, &r);
+    }
+    if (ret != 0) {
+        flb_pack_json_reset(pj);
+        return ret;
+    }
+
+    if (r.records == 0) {
+        return FLB_ERR_JSON_PART;
+    }
+
+    /* the output of the incomplete record moves to a new buffer */
+    msgpack_sbuffer_init(&sbuf);
+    rest = pj->out.size - r.out;
+    if (rest > 0) {
+        if (out_reserve(&sbuf, rest) != 0) {
+            flb_pack_json_reset(pj);
+            return -1;
+        }
+        memcpy(sbuf.data, pj->out.data + r.out, rest);
+        sbuf.size = rest;
+
+        for (i = 0; i < pj->depth; i++) {
+            pj->stack[i].offset -= r.out;
+        }
+    }
+
+    *buffer = pj->out.data;
+    *size = r.out;
+    *consumed = r.end;
+
+    pj->out = sbuf;
+    stream_rebase(pj, r.end, r.pos);
+
+    return 0;
+}
@@ -0,0 +1,457 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_macros.h>
+#include <fluent-bit/flb_record.h>
+#include <fluent-bit/flb_time.h>
+
+static inline uint16_t load16(char *p)
+{
+    unsigned char *u = (unsigned char *) p;
+
+    return ((uint16_t) u[0] << 8) | u[1];
+}
+
+static inline uint32_t load32(char *p)
+{
+    unsigned char *u = (unsigned char *) p;
+
+    return ((uint32_t) u[0] << 24) | ((uint32_t) u[1] << 16) |
+        ((uint32_t) u[2] << 8) | u[3];
+}
+
+static inline uint64_t load64(char *p)
+{
+    return ((uint64_t) load32(p) << 32) | load32(p + 4);
+}
+
+/* Signed integers keep the msgpack-c convention: positives are unsigned */
+static inline void set_int(msgpack_object *o, int64_t n)
+{
+    if (n >= 0) {
+        o->type = MSGPACK_OBJECT_POSITIVE_INTEGER;
+        o->via.u64 = n;
+    }
+    else {
+        o->type = MSGPACK_OBJECT_NEGATIVE_INTEGER;
+        o->via.i64 = n;
+    }
+}
+
+/*
+ * Decode the value at 'p' without allocating: scalars are complete, maps
+ * and arrays only get their size. It returns the position after the
+ * decoded bytes, or NULL if the value is truncated or not valid.
+ */
+static char *mp_header(char *p, char *end, msgpack_object *o)
+{
+    int h;
+    int ext = 0;
+    uint8_t c;
+    uint32_t len;
+    uint32_t u32;
+    uint64_t u64;
+    float f;
+    double d;
+
+    if (p >= end) {
+        return NULL;
+    }
+    c = (uint8_t) *p++;
+
+    if (c <= 0x7f) {
+        o->type = MSGPACK_OBJECT_POSITIVE_INTEGER;
+        o->via.u64 = c;
+        return p;
+    }
+    else if (c >= 0xe0) {
+        o->type = MSGPACK_OBJECT_NEGATIVE_INTEGER;
+        o->via.i64 = (int8_t) c;
+        return p;
+    }
+    else if (c <= 0x8f) {
+        o->type = MSGPACK_OBJECT_MAP;
+        o->via.map.size = c & 0x0f;
+        o->via.map.ptr = NULL;
+        return p;
+    }
+    else if (c <= 0x9f) {
+        o->type = MSGPACK_OBJECT_ARRAY;
+        o->via.array.size = c & 0x0f;
+        o->via.array.ptr = NULL;
+        return p;
+    }
+    else if (c <= 0xbf) {
+        o->type = MSGPACK_OBJECT_STR;
+        len = c & 0x1f;
+        goto payload;
+    }
+
+    /* bytes of the fixed size header after the type */
+    switch (c) {
+    case 0xc4: case 0xc7: case 0xcc: case 0xd0: case 0xd9:
+        h = 1;
+        break;
+    case 0xc5: case 0xc8: case 0xcd: case 0xd1: case 0xda: case 0xdc:
+    case 0xde:
+        h = 2;
+        break;
+    case 0xc6: case 0xc9: case 0xca: case 0xce: case 0xd2: case 0xdb:
+    case 0xdd: case 0xdf:
+        h = 4;
+        break;
+    case 0xcb: case 0xcf: case 0xd3:
+        h = 8;
+        break;
+    default:
+        h = 0;
+    }
+    if (end - p < h) {
+        return NULL;
+    }
+
+    switch (c) {
+    case 0xc0:
+        o->type = MSGPACK_OBJECT_NIL;
+        return p;
+    case 0xc2:
+    case 0xc3:
+        o->type = MSGPACK_OBJECT_BOOLEAN;
+        o->via.boolean = (c == 0xc3);
+        return p;
+    case 0xc4:
+    case 0xc5:
+    case 0xc6:
+        o->type = MSGPACK_OBJECT_BIN;
+        len = (h == 1) ? (uint8_t) *p : (h == 2) ? load16(p) : load32(p);
+        p += h;
+        goto payload;
+    case 0xc7:
+    case 0xc8:
+    case 0xc9:
+        len = (h == 1) ? (uint8_t) *p : (h == 2) ? load16(p) : load32(p);
+        p += h;
+        ext = 1;
+        goto payload;
+    case 0xca:
+        u32 = load32(p);
+        memcpy(&f, &u32, sizeof(f));
+        o->type = MSGPACK_OBJECT_FLOAT;
+        o->via.f64 = f;
+        return p + 4;
+    case 0xcb:
+        u64 = load64(p);
+        memcpy(&d, &u64, sizeof(d));
+        o->type = MSGPACK_OBJECT_FLOAT;
+        o->via.f64 = d;
+        return p + 8;
+    case 0xcc:
+    case 0xcd:
+    case 0xce:
+    case 0xcf:
+        o->type = MSGPACK_OBJECT_POSITIVE_INTEGER;
+        o->via.u64 = (h == 1) ? (uint8_t) *p : (h == 2) ? load16(p) :
+            (h == 4) ? load32(p) : load64(p);
+        return p + h;
+    case 0xd0:
+        set_int(o, (int8_t) *p);
+        return p + 1;
+    case 0xd1:
+        set_int(o, (int16_t) load16(p));
+        return p + 2;
+    case 0xd2:
+        set_int(o, (int32_t) load32(p));
+        return p + 4;
+    case 0xd3:
+        set_int(o, (int64_t) load64(p));
+        return p + 8;
+    case 0xd4:
+    case 0xd5:
+    case 0xd6:
+    case 0xd7:
+    case 0xd8:
+        len = 1 << (c - 0xd4);
+        ext = 1;
+        goto payload;
+    case 0xd9:
+    case 0xda:
+    case 0xdb:
+        o->type = MSGPACK_OBJECT_STR;
+        len = (h == 1) ? (uint8_t) *p : (h == 2) ? load16(p) : load32(p);
+        p += h;
+        goto payload;
+    case 0xdc:
+    case 0xdd:
+        o->type = MSGPACK_OBJECT_ARRAY;
+        o->via.array.size = (h == 2) ? load16(p) : load32(p);
+        o->via.array.ptr = NULL;
+        return p + h;
+    case 0xde:
+    case 0xdf:
+        o->type = MSGPACK_OBJECT_MAP;
+        o->via.map.size = (h == 2) ? load16(p) : load32(p);
+        o->via.map.ptr = NULL;
+        return p + h;
+    default:
+        return NULL;
+    }
+
+ payload:
+    if (ext) {
+        /* the extension type byte comes before the data */
+        if (p >= end) {
+            return NULL;
+        }
+        o->type = MSGPACK_OBJECT_EXT;
+        o->via.ext.type = (int8_t) *p++;
+        o->via.ext.size = len;
+        o->via.ext.ptr = p;
+    }
+    else {
+        /* str and bin share the same layout */
+        o->via.str.size = len;
+        o->via.str.ptr = p;
+    }
+
+    if ((size_t) (end - p) < len) {
+        return NULL;
+    }
+    return p + len;
+}
+
+/* Position after the complete value at 'p', nested content included */
+static char *mp_skip(char *p, char *end)
+{
+    uint64_t pending = 1;
+    msgpack_object o;
+
+    while (pending > 0) {
+        p = mp_header(p, end, &o);
+        if (!p) {
+            return NULL;
+        }
+        pending--;
+
+        if (o.type == MSGPACK_OBJECT_MAP) {
+            pending += (uint64_t) o.via.map.size * 2;
+        }
+        else if (o.type == MSGPACK_OBJECT_ARRAY) {
+            pending += o.via.array.size;
+        }
+    }
+
+    return p;
+}
+
+/* Decode a scalar or the size of a container, the whole value is passed */
+static inline char *mp_value(char *p, char *end, msgpack_object *o)
+{
+    char *next;
+
+    next = mp_header(p, end, o);
+    if (next && (o->type == MSGPACK_OBJECT_MAP ||
+                 o->type == MSGPACK_OBJECT_ARRAY)) {
+        next = mp_skip(p, end);
+    }
+
+    return next;
+}
+
+void flb_record_iter_init(struct flb_record_iter *it, void *data,
+                          size_t size)
+{
+    it->data = data;
+    it->size = size;
+    it->offset = 0;
+}
+
+/*
+ * Move to the next [time, map] record, other entries are skipped. It
+ * returns FLB_FALSE once the buffer is over or the rest is truncated.
+ */
+int flb_record_iter_next(struct flb_record_iter *it, struct flb_record *rec)
+{
+    char *p;
+    char *start;
+    char *next;
+    char *end = it->data + it->size;
+    msgpack_object o;
+
+    while (it->offset < it->size) {
+        start = it->data + it->offset;
+        next = mp_skip(start, end);
+        if (!next) {
+            it->offset = it->size;
+            return FLB_FALSE;
+        }
+        it->offset = next - it->data;
+
+        /* mp_skip() checked the bounds of the whole entry */
+        p = mp_header(start, next, &o);
+        if (o.type != MSGPACK_OBJECT_ARRAY || o.via.array.size != 2) {
+            continue;
+        }
+
+        p = mp_header(p, next, &rec->time);
+        if (rec->time.type == MSGPACK_OBJECT_MAP ||
+            rec->time.type == MSGPACK_OBJECT_ARRAY) {
+            continue;
+        }
+
+        p = mp_header(p, next, &o);
+        if (o.type != MSGPACK_OBJECT_MAP) {
+            continue;
+        }
+
+        rec->size = o.via.map.size;
+        rec->raw = start;
+        rec->raw_size = next - start;
+        rec->kv = p;
+        rec->end = next;
+        rec->kv_left = rec->size;
+        return FLB_TRUE;
+    }
+
+    return FLB_FALSE;
+}
+
+/* Get the next entry of the record map, FLB_FALSE after the last one */
+int flb_record_kv_next(struct flb_record *rec, struct flb_record_kv *kv)
+{
+    char *p;
+
+    if (rec->kv_left == 0) {
+        return FLB_FALSE;
+    }
+
+    kv->key_raw = rec->kv;
+    p = mp_value(rec->kv, rec->end, &kv->key);
+    kv->key_size = p - kv->key_raw;
+
+    kv->val_raw = p;
+    p = mp_value(p, rec->end, &kv->val);
+    kv->val_size = p - kv->val_raw;
+
+    rec->kv = p;
+    rec->kv_left--;
+
+    return FLB_TRUE;
+}
+
+/* Get the time in seconds of a record time object, -1 if it's not one */
+int flb_record_time_get(msgpack_object *o, time_t *t)
+{
+    struct flb_time tm;
+
+    if (flb_time_pop_from_msgpack(&tm, o) != 0) {
+        return -1;
+    }
+    *t = tm.tm.tv_sec;
+    return 0;
+}
+
+/* Record time in seconds */
+time_t flb_record_time(struct flb_record *rec)
+{
+    time_t t = 0;
+
+    flb_record_time_get(&rec->time, &t);
+    return t;
+}
+
+/* Number of complete MessagePack objects in the buffer */
+int flb_record_count(void *data, size_t size)
+{
+    int n = 0;
+    char *p = data;
+    char *end = p + size;
+
+    while (p < end) {
+        p = mp_skip(p, end);
+        if (!p) {
+            break;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+/*
+ * Decode the value at 'p' for callers walking nested content themselves:
+ * a map or array only gets its size and the return value points to its
+ * first entry. NULL if the value is truncated or not valid.
+ */
+char *flb_record_unpack(char *p, char *end, msgpack_object *o)
+{
+    return mp_header(p, end, o);
+}
+
+/* Position after the complete value at 'p', NULL if truncated */
+char *flb_record_skip(char *p, char *end)
+{
+    return mp_skip(p, end);
+}
+
+/*
+ * Build the metadata of a buffer whose writer did not keep it: every
+ * complete object is an entry, the time range comes from the [time, map]
+ * records.
+ */
+void flb_chunk_meta_scan(struct flb_chunk_meta *m, void *data, size_t size)
+{
+    char *p = data;
+    char *next;
+    char *end = p + size;
+    time_t t;
+    msgpack_object o;
+    msgpack_object map;
+
+    flb_chunk_meta_init(m);
+
+    while (p < end) {
+        next = mp_skip(p, end);
+        if (!next) {
+            break;
+        }
+
+        /*
+         * mp_skip() checked the bounds of the whole entry, a time (number
+         * or EventTime) is fully decoded by its header so the map header
+         * follows it.
+         */
+        p = mp_header(p, next, &o);
+        if (o.type == MSGPACK_OBJECT_ARRAY && o.via.array.size == 2 &&
+            (p = mp_header(p, next, &o)) &&
+            flb_record_time_get(&o, &t) == 0 &&
+            mp_header(p, next, &map) && map.type == MSGPACK_OBJECT_MAP) {
+            flb_chunk_meta_add(m, t, 0);
+        }
+        else {
+            m->records++;
+        }
+        p = next;
+    }
+
+    m->bytes = size;
+}
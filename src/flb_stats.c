@@ -39,6 +39,11 @@
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_worker.h>
+
+#ifdef FLB_HAVE_BUFFERING
+#include <fluent-bit/flb_buffer.h>
+#endif
 
 #define SDP(s)       &s->data[s->n_data]
 #define SDP_TIME(s)  *SDP(s).time
@@ -75,7 +80,7 @@ static int stats_userver_timer(struct flb_stats *stats)
     event = &timer->event;
     event->mask   = MK_EVENT_EMPTY;
     event->status = MK_EVENT_NONE;
-    fd = mk_event_timeout_create(stats->evl, 5, event);
+    fd = mk_event_timeout_create(stats->evl, 5, 0, event);
     if (fd == -1) {
         flb_error("[stats_usrv] could not create timeout handler");
         flb_free(timer);
@@ -317,6 +322,26 @@ static int flb_stats_userver_deliver(struct flb_stats *stats)
     }
 
     json_add_to_object(j_root, "output_plugins", j_outp);
+
+#ifdef FLB_HAVE_BUFFERING
+    /* Buffer usage */
+    if (stats->config->buffer_ctx) {
+        struct flb_buffer *buf = stats->config->buffer_ctx;
+        json_t *j_buf = json_create_object();
+
+        json_add_to_object(j_buf, "usage", json_create_number(buf->usage));
+        json_add_to_object(j_buf, "max_size",
+                           json_create_number(buf->max_size));
+        json_add_to_object(j_buf, "evictions",
+                           json_create_number(buf->evictions));
+        json_add_to_object(j_buf, "paused", json_create_number(buf->paused));
+        json_add_to_object(j_buf, "mem_usage",
+                           json_create_number(buf->mem_usage));
+        json_add_to_object(j_buf, "spills", json_create_number(buf->spills));
+        json_add_to_object(j_root, "buffer", j_buf);
+    }
+#endif
+
     raw = json_print_unformatted(j_root);
     flb_debug("[stats] dump\n%s", raw);
 
@@ -429,7 +454,7 @@ static void stats_worker_init(void *data)
                 stats_userver_remove((struct flb_stats_userver_c *) event,
                                      stats);
             }
-            else if (event->fd == stats->ch_manager[1]) {
+            else if (event->fd == stats->ch_manager[0]) {
                 /*
                  * Once we get a signal on the manager channel, we start
                  * our shutdown procedure and return (pthread exit).
@@ -451,7 +476,7 @@ static void stats_worker_init(void *data)
     }
 }
 
-static int register_input_plugin(struct flb_input_plugin *plugin,
+static int register_input_plugin(struct flb_input_instance *plugin,
                                  struct flb_stats *stats)
 {
     int ret;
@@ -497,7 +522,7 @@ static int register_input_plugin(struct flb_input_plugin *plugin,
     return 0;
 }
 
-static int register_output_plugin(struct flb_output_plugin *plugin,
+static int register_output_plugin(struct flb_output_instance *plugin,
                                   struct flb_stats *stats)
 {
     int ret;
@@ -551,8 +576,8 @@ static int register_output_plugin(struct flb_output_plugin *plugin,
 static int flb_stats_components_init(struct flb_stats *stats)
 {
     struct mk_list *head;
-    struct flb_input_plugin *in;
-    struct flb_output_plugin *out;
+    struct flb_input_instance *in;
+    struct flb_output_instance *out;
 
     /* Initialize list headers */
     mk_list_init(&stats->in_plugins);
@@ -560,13 +585,13 @@ static int flb_stats_components_init(struct flb_stats *stats)
 
     /* Register input plugins */
     mk_list_foreach(head, &stats->config->inputs) {
-        in = mk_list_entry(head, struct flb_input_plugin, _head);
+        in = mk_list_entry(head, struct flb_input_instance, _head);
         register_input_plugin(in, stats);
     }
 
     /* Register output plugins */
     mk_list_foreach(head, &stats->config->outputs) {
-        out = mk_list_entry(head, struct flb_output_plugin, _head);
+        out = mk_list_entry(head, struct flb_output_instance, _head);
         register_output_plugin(out, stats);
     }
 
@@ -613,7 +638,15 @@ int flb_stats_init(struct flb_config *config)
     }
 
     /* Spawn a worker thread*/
-    stats->worker_tid = mk_utils_worker_spawn(stats_worker_init, stats);
+    ret = flb_worker_create(stats_worker_init, stats, &stats->worker_tid,
+                            config);
+    if (ret == -1) {
+        flb_error("[stats] could not spawn worker");
+        mk_event_loop_destroy(stats->evl);
+        config->stats_ctx = NULL;
+        flb_free(stats);
+        return -1;
+    }
 
     return 0;
 }
@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_config.h>
@@ -28,6 +29,12 @@
 #include <fluent-bit/flb_task.h>
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_str.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_dict.h>
+
+#ifdef FLB_HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #ifdef FLB_HAVE_BUFFERING
 #include <fluent-bit/flb_sha1.h>
@@ -149,6 +156,355 @@ int flb_task_retry_clean(struct flb_task *task, void *data)
     return -1;
 }
 
+#ifdef FLB_HAVE_ZLIB
+/* Compress 'in' as a gzip stream */
+static int enc_gzip(char *in, size_t in_size, char **out_buf, size_t *out_size)
+{
+    int ret;
+    char *buf;
+    size_t size;
+    z_stream strm;
+
+    memset(&strm, 0, sizeof(strm));
+
+    /* 15 bits window plus 16: gzip header and trailer instead of zlib */
+    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                       Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        return -1;
+    }
+
+    /* the bound leaves no room for the gzip wrapper, add it */
+    size = deflateBound(&strm, in_size) + 18;
+    buf = flb_malloc(size);
+    if (!buf) {
+        flb_errno();
+        deflateEnd(&strm);
+        return -1;
+    }
+
+    strm.next_in = (Bytef *) in;
+    strm.avail_in = in_size;
+    strm.next_out = (Bytef *) buf;
+    strm.avail_out = size;
+
+    ret = deflate(&strm, Z_FINISH);
+    deflateEnd(&strm);
+    if (ret != Z_STREAM_END) {
+        flb_free(buf);
+        return -1;
+    }
+
+    *out_buf = buf;
+    *out_size = strm.total_out;
+    return 0;
+}
+#endif
+
+static int task_encoding_get(struct flb_task *task, int format,
+                             char **out_buf, size_t *out_size);
+
+/*
+ * Contiguous copy of a chained task, a compacted task gets its records
+ * expanded back. 'readers' is the number of output threads of the task
+ * the caller accounts for (itself): if no other one may be reading the
+ * blocks they are released, the records are not held twice.
+ */
+static char *task_buf_get(struct flb_task *task, int readers)
+{
+    size_t size;
+
+    if (task->buf) {
+        return task->buf;
+    }
+
+    if (task->chain.count > 0) {
+        task->buf = flb_chain_flatten(&task->chain);
+        if (task->buf && task->users <= readers) {
+            flb_chain_reset(&task->chain);
+        }
+    }
+    else if (task->dict_buf) {
+        if (flb_dict_decode(task->dict_buf, task->dict_size,
+                            &task->buf, &size) == 0) {
+            task->size = size;
+            flb_free(task->dict_buf);
+            task->dict_buf = NULL;
+            task->dict_size = 0;
+        }
+    }
+    return task->buf;
+}
+
+/* Convert the task records to 'format', the result is owned by the caller */
+static int task_encode(struct flb_task *task, int format,
+                       char **out_buf, size_t *out_size)
+{
+    int ret;
+    char *buf;
+    size_t size;
+    msgpack_sbuffer sbuf;
+
+    /* a gzip encoding is made from the plain one, cached too */
+    if (format & FLB_TASK_ENC_GZIP) {
+#ifdef FLB_HAVE_ZLIB
+        ret = task_encoding_get(task, format & ~FLB_TASK_ENC_GZIP,
+                                &buf, &size);
+        if (ret != 0) {
+            return -1;
+        }
+        return enc_gzip(buf, size, out_buf, out_size);
+#else
+        flb_error("[task] gzip encoding is not available, built without zlib");
+        return -1;
+#endif
+    }
+
+    if (!task_buf_get(task, 1)) {
+        return -1;
+    }
+
+    msgpack_sbuffer_init(&sbuf);
+    switch (format) {
+    case FLB_TASK_ENC_JSON:
+        ret = flb_msgpack_to_json(&sbuf, task->buf, task->size,
+                                  FLB_JSON_FORMAT_ARRAY, "date", 0);
+        break;
+    case FLB_TASK_ENC_JSON_LINES:
+        ret = flb_msgpack_to_json(&sbuf, task->buf, task->size,
+                                  FLB_JSON_FORMAT_LINES, "date", 0);
+        break;
+    default:
+        flb_error("[task] unknown encoding %i", format);
+        ret = -1;
+    }
+
+    if (ret == -1) {
+        msgpack_sbuffer_destroy(&sbuf);
+        return -1;
+    }
+
+    *out_buf = sbuf.data;
+    *out_size = sbuf.size;
+    return 0;
+}
+
+/* Lookup a cached encoding, create it if missing */
+static int task_encoding_get(struct flb_task *task, int format,
+                             char **out_buf, size_t *out_size)
+{
+    int ret;
+    char *buf;
+    size_t size;
+    struct mk_list *head;
+    struct flb_task_enc *enc;
+
+    if (format == FLB_TASK_ENC_MSGPACK) {
+        if (!task_buf_get(task, 1)) {
+            return -1;
+        }
+        *out_buf = task->buf;
+        *out_size = task->size;
+        return 0;
+    }
+
+    mk_list_foreach(head, &task->encodings) {
+        enc = mk_list_entry(head, struct flb_task_enc, _head);
+        if (enc->format == format) {
+            *out_buf = enc->buf;
+            *out_size = enc->size;
+            return 0;
+        }
+    }
+
+    ret = task_encode(task, format, &buf, &size);
+    if (ret != 0) {
+        return -1;
+    }
+
+    enc = flb_malloc(sizeof(struct flb_task_enc));
+    if (!enc) {
+        flb_errno();
+        flb_free(buf);
+        return -1;
+    }
+    enc->format = format;
+    enc->buf = buf;
+    enc->size = size;
+    mk_list_add(&enc->_head, &task->encodings);
+
+    flb_trace("[task] task_id=%i encoding=%#x %zu -> %zu bytes",
+              task->id, format, task->size, size);
+
+    *out_buf = buf;
+    *out_size = size;
+    return 0;
+}
+
+/*
+ * Get the task records converted to 'format' (FLB_TASK_ENC_ value). The
+ * conversion happens once per task whatever the number of routes asking
+ * for it, the buffer belongs to the task: it must not be modified or
+ * released and it's valid until flb_task_destroy().
+ */
+int flb_task_encoding(struct flb_task *task, int format,
+                      char **out_buf, size_t *out_size)
+{
+    int ret;
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&task->mutex_threads);
+#endif
+
+    ret = task_encoding_get(task, format, out_buf, out_size);
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&task->mutex_threads);
+#endif
+    return ret;
+}
+
+/*
+ * Get the task records as a single buffer, from an output thread of the
+ * task. A task created from a chain gets a copy made on first use, the
+ * blocks are kept until flb_task_destroy() only if other routes may be
+ * reading them.
+ */
+char *flb_task_buf(struct flb_task *task)
+{
+    char *buf;
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&task->mutex_threads);
+#endif
+
+    buf = task_buf_get(task, 1);
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&task->mutex_threads);
+#endif
+    return buf;
+}
+
+/*
+ * Get the task records as a columnar batch (see flb_batch.h), built on
+ * first use and shared by the routes. It's owned by the task, valid
+ * until flb_task_destroy().
+ */
+struct flb_batch *flb_task_batch(struct flb_task *task)
+{
+    struct flb_batch *batch;
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&task->mutex_threads);
+#endif
+
+    if (!task->batch && task_buf_get(task, 1)) {
+        task->batch = flb_batch_create(task->buf, task->size);
+    }
+    batch = task->batch;
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&task->mutex_threads);
+#endif
+    return batch;
+}
+
+/*
+ * Copy a chained task to a single buffer out of the output threads. The
+ * blocks are released unless an output thread of the task is running.
+ */
+void flb_task_flatten(struct flb_task *task)
+{
+    if (task->chain.count == 0) {
+        return;
+    }
+
+    task_buf_get(task, 0);
+}
+
+#ifdef FLB_HAVE_BUFFERING
+/*
+ * The buffer interface stores and hashes contiguous data: flatten the
+ * records and generate their SHA1 and its hexa representation.
+ */
+int flb_task_buffer_prepare(struct flb_task *task)
+{
+    int i;
+
+    flb_task_flatten(task);
+    if (!task->buf) {
+        return -1;
+    }
+
+    flb_sha1_encode(task->buf, task->size, task->hash_sha1);
+    for (i = 0; i < 20; ++i) {
+        sprintf(&task->hash_hex[i*2], "%02x", task->hash_sha1[i]);
+    }
+    task->hash_hex[40] = '\0';
+
+    return 0;
+}
+#endif
+
+/*
+ * A task waiting for a retry with no output thread running keeps its
+ * records dictionary encoded if the input instance asked for it (the
+ * 'intern_keys' property). They are expanded again on the next use
+ * through flb_task_buf(). Tasks handled by the buffer interface are
+ * not compacted: its workers reference the task buffer.
+ */
+int flb_task_compact(struct flb_task *task)
+{
+    int ret;
+    char *buf;
+    size_t size;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_task_enc *enc;
+
+    if (task->i_ins->intern_keys == FLB_FALSE || task->users > 0 ||
+        task->mapped == FLB_TRUE || task->dict_buf) {
+        return -1;
+    }
+
+#ifdef FLB_HAVE_BUFFERING
+    if (task->config->buffer_ctx) {
+        return -1;
+    }
+#endif
+
+    if (!task_buf_get(task, 0)) {
+        return -1;
+    }
+
+    ret = flb_dict_encode(task->buf, task->size, &buf, &size);
+    if (ret == -1) {
+        return -1;
+    }
+
+    flb_trace("[task] task_id=%i compacted %zu -> %zu bytes",
+              task->id, task->size, size);
+
+    flb_free(task->buf);
+    task->buf = NULL;
+    flb_chain_reset(&task->chain);
+    task->dict_buf = buf;
+    task->dict_size = size;
+
+    /* cached encodings and batch are built again if required */
+    flb_batch_destroy(task->batch);
+    task->batch = NULL;
+    mk_list_foreach_safe(head, tmp, &task->encodings) {
+        enc = mk_list_entry(head, struct flb_task_enc, _head);
+        mk_list_del(&enc->_head);
+        flb_free(enc->buf);
+        flb_free(enc);
+    }
+
+    return 0;
+}
+
 /* Allocate an initialize a basic Task structure */
 static struct flb_task *task_alloc(struct flb_config *config)
 {
@@ -183,17 +539,37 @@ static struct flb_task *task_alloc(struct flb_config *config)
     mk_list_init(&task->threads);
     mk_list_init(&task->routes);
     mk_list_init(&task->retries);
+    mk_list_init(&task->encodings);
+    flb_chain_init(&task->chain);
 
     return task;
 }
 
+/*
+ * Set the task records summary: the one kept by the writer if any, a scan
+ * of the buffer otherwise. Outputs rely on it, they don't scan themselves.
+ */
+static void task_meta_set(struct flb_task *task, struct flb_chunk_meta *meta)
+{
+    if (meta && (meta->records > 0 || task->size == 0)) {
+        task->meta = *meta;
+    }
+    else {
+        flb_task_flatten(task);
+        flb_chunk_meta_scan(&task->meta, task->buf, task->size);
+    }
+    task->meta.bytes = task->size;
+}
+
 /* Create an engine task to handle the output plugin flushing work */
 struct flb_task *flb_task_create(uint64_t ref_id,
                                  char *buf,
                                  size_t size,
+                                 struct flb_chain *chain,
                                  struct flb_input_instance *i_ins,
                                  struct flb_input_dyntag *dt,
                                  char *tag,
+                                 struct flb_chunk_meta *meta,
                                  struct flb_config *config)
 {
     int count = 0;
@@ -218,6 +594,13 @@ struct flb_task *flb_task_create(uint64_t ref_id,
     task->i_ins  = i_ins;
     task->dt     = dt;
     task->destinations = 0;
+
+    /* A chain is taken over, the records stay in its blocks */
+    if (chain) {
+        flb_chain_move(&task->chain, chain);
+        task->size = task->chain.size;
+    }
+    task_meta_set(task, meta);
     mk_list_add(&task->_head, &i_ins->tasks);
 
     /* Routes */
@@ -267,31 +650,52 @@ struct flb_task *flb_task_create(uint64_t ref_id,
     if (count == 0) {
         flb_debug("[task] created task=%p id=%i without routes, dropping.",
                   task, task->id);
-        task->buf = NULL;
+        if (!chain) {
+            /* the caller still owns the buffer */
+            task->buf = NULL;
+        }
         flb_task_destroy(task);
         return NULL;
     }
 
 #ifdef FLB_HAVE_BUFFERING
-    int i;
     int worker_id;
 
-    /* Generate content SHA1 and it Hexa representation */
-    flb_sha1_encode(buf, size, task->hash_sha1);
-    for (i = 0; i < 20; ++i) {
-        sprintf(&task->hash_hex[i*2], "%02x", task->hash_sha1[i]);
-    }
-    task->hash_hex[40] = '\0';
+    task->created     = time(NULL);
+    task->routes_mask = routes_mask;
+    task->routes_done = 0;
 
     /*
-     * Generate a buffer chunk push request, note that suggested routes
-     * are passed through the 'routes_mask' bit mask variable.
+     * In hybrid mode the task is kept in memory as it is (chained records
+     * stay in their blocks), the buffer interface will store it later if
+     * required (retry, age or memory pressure).
      */
-    worker_id = flb_buffer_chunk_push(config->buffer_ctx, buf, size, tag,
-                                      routes_mask, task->hash_hex);
+    if (config->buffer_ctx &&
+        config->buffer_ctx->mode == FLB_BUFFER_MODE_HYBRID) {
+        task->worker_id = FLB_TASK_WORKER_MEM;
+        flb_buffer_chunk_hold(config->buffer_ctx, task);
+    }
+    else {
+        if (config->buffer_ctx && flb_task_buffer_prepare(task) == -1) {
+            flb_task_destroy(task);
+            return NULL;
+        }
 
-    task->worker_id = worker_id;
-    flb_debug("[task->buffer] worker_id=%i", worker_id);
+        /*
+         * Generate a buffer chunk push request, note that suggested routes
+         * are passed through the 'routes_mask' bit mask variable.
+         */
+        worker_id = flb_buffer_chunk_push(config->buffer_ctx,
+                                          task->buf, task->size, tag,
+                                          routes_mask, task->hash_hex,
+                                          &task->meta);
+
+        if (worker_id == -1) {
+            worker_id = FLB_TASK_WORKER_NONE;
+        }
+        task->worker_id = worker_id;
+        flb_debug("[task->buffer] worker_id=%i", worker_id);
+    }
 #endif
 
 #ifdef FLB_HAVE_FLUSH_PTHREADS
@@ -314,6 +718,7 @@ struct flb_task *flb_task_create_direct(uint64_t ref_id,
                                         char *tag,
                                         char *hash,
                                         uint64_t routes,
+                                        struct flb_chunk_meta *meta,
                                         struct flb_config *config)
 {
     int count = 0;
@@ -336,6 +741,7 @@ struct flb_task *flb_task_create_direct(uint64_t ref_id,
     task->i_ins     = i_ins;
     task->dt        = NULL;
     task->mapped    = FLB_TRUE;
+    task_meta_set(task, meta);
 #ifdef FLB_HAVE_BUFFERING
     memcpy(&task->hash_hex, hash, 41);
 #endif
@@ -367,6 +773,7 @@ void flb_task_destroy(struct flb_task *task)
     struct mk_list *head;
     struct flb_task_route *route;
     struct flb_task_retry *retry;
+    struct flb_task_enc *enc;
 
     flb_debug("[task] destroy task=%p (task_id=%i)", task, task->id);
 
@@ -387,8 +794,18 @@ void flb_task_destroy(struct flb_task *task)
     /* Unlink and release */
     mk_list_del(&task->_head);
 
+#ifdef FLB_HAVE_BUFFERING
+    /* Task never stored in the buffer path (hybrid mode) */
+    if (task->worker_id == FLB_TASK_WORKER_MEM &&
+        task->config->buffer_ctx) {
+        flb_buffer_chunk_release(task->config->buffer_ctx, task);
+    }
+#endif
+
     if (task->mapped == FLB_FALSE) {
         flb_free(task->buf);
+        flb_free(task->dict_buf);
+        flb_chain_reset(&task->chain);
     }
 #ifdef FLB_HAVE_BUFFERING
     else {
@@ -406,6 +823,15 @@ void flb_task_destroy(struct flb_task *task)
         flb_task_retry_destroy(retry);
     }
 
+    /* Remove cached encodings */
+    mk_list_foreach_safe(head, tmp, &task->encodings) {
+        enc = mk_list_entry(head, struct flb_task_enc, _head);
+        mk_list_del(&enc->_head);
+        flb_free(enc->buf);
+        flb_free(enc);
+    }
+    flb_batch_destroy(task->batch);
+
     flb_free(task->tag);
     flb_free(task);
 }
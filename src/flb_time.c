@@ -0,0 +1,154 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <time.h>
+#include <stdint.h>
+#include <msgpack.h>
+
+#include <fluent-bit/flb_time.h>
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#define FLB_TIME_MONO_CLOCK  CLOCK_MONOTONIC_COARSE
+#else
+#define FLB_TIME_MONO_CLOCK  CLOCK_MONOTONIC
+#endif
+
+#define NSEC_PER_SEC  1000000000ULL
+
+/*
+ * Cached clocks in nanoseconds, written by the engine thread and read by
+ * any other. A single 64 bits value can't be seen half updated.
+ */
+static uint64_t time_real;
+static uint64_t time_mono;
+
+static inline uint64_t ts_to_ns(struct timespec *ts)
+{
+    return (uint64_t) ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static inline void ns_to_time(uint64_t ns, struct flb_time *t)
+{
+    t->tm.tv_sec  = ns / NSEC_PER_SEC;
+    t->tm.tv_nsec = ns % NSEC_PER_SEC;
+}
+
+/* Refresh the cached clocks, the engine calls it once per loop iteration */
+void flb_time_update()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    __atomic_store_n(&time_real, ts_to_ns(&ts), __ATOMIC_RELAXED);
+
+    clock_gettime(FLB_TIME_MONO_CLOCK, &ts);
+    __atomic_store_n(&time_mono, ts_to_ns(&ts), __ATOMIC_RELAXED);
+}
+
+/* Wall clock time, the real one if the engine is not running yet */
+void flb_time_now(struct flb_time *t)
+{
+    uint64_t ns;
+
+    ns = __atomic_load_n(&time_real, __ATOMIC_RELAXED);
+    if (ns == 0) {
+        clock_gettime(CLOCK_REALTIME, &t->tm);
+        return;
+    }
+    ns_to_time(ns, t);
+}
+
+/* Wall clock time, not cached */
+void flb_time_get(struct flb_time *t)
+{
+    clock_gettime(CLOCK_REALTIME, &t->tm);
+}
+
+/* Coarse monotonic time, for intervals */
+void flb_time_mono(struct flb_time *t)
+{
+    uint64_t ns;
+
+    ns = __atomic_load_n(&time_mono, __ATOMIC_RELAXED);
+    if (ns == 0) {
+        clock_gettime(FLB_TIME_MONO_CLOCK, &t->tm);
+        return;
+    }
+    ns_to_time(ns, t);
+}
+
+/* Pack 't' as an EventTime */
+int flb_time_append_to_msgpack(struct flb_time *t, msgpack_packer *pck)
+{
+    int ret;
+    char buf[8];
+    uint32_t sec = (uint32_t) t->tm.tv_sec;
+    uint32_t nsec = (uint32_t) t->tm.tv_nsec;
+
+    buf[0] = (sec >> 24) & 0xff;
+    buf[1] = (sec >> 16) & 0xff;
+    buf[2] = (sec >> 8) & 0xff;
+    buf[3] = sec & 0xff;
+    buf[4] = (nsec >> 24) & 0xff;
+    buf[5] = (nsec >> 16) & 0xff;
+    buf[6] = (nsec >> 8) & 0xff;
+    buf[7] = nsec & 0xff;
+
+    ret = msgpack_pack_ext(pck, sizeof(buf), FLB_TIME_EVENT_EXT);
+    if (ret != 0) {
+        return ret;
+    }
+    return msgpack_pack_ext_body(pck, buf, sizeof(buf));
+}
+
+/*
+ * Read a record time: an integer (seconds), a float (seconds with a
+ * fraction) or an EventTime. It returns -1 for any other object.
+ */
+int flb_time_pop_from_msgpack(struct flb_time *t, msgpack_object *o)
+{
+    double d;
+    const unsigned char *p;
+
+    switch (o->type) {
+    case MSGPACK_OBJECT_POSITIVE_INTEGER:
+        flb_time_set(t, o->via.u64, 0);
+        return 0;
+    case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+        flb_time_set(t, o->via.i64, 0);
+        return 0;
+    case MSGPACK_OBJECT_FLOAT:
+        d = o->via.f64;
+        t->tm.tv_sec  = (time_t) d;
+        t->tm.tv_nsec = (long) ((d - (double) t->tm.tv_sec) * NSEC_PER_SEC);
+        return 0;
+    case MSGPACK_OBJECT_EXT:
+        if (o->via.ext.type != FLB_TIME_EVENT_EXT || o->via.ext.size != 8) {
+            return -1;
+        }
+        p = (const unsigned char *) o->via.ext.ptr;
+        t->tm.tv_sec  = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+            ((uint32_t) p[2] << 8) | p[3];
+        t->tm.tv_nsec = ((uint32_t) p[4] << 24) | ((uint32_t) p[5] << 16) |
+            ((uint32_t) p[6] << 8) | p[7];
+        return 0;
+    default:
+        return -1;
+    }
+}
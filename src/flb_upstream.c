@@ -17,7 +17,14 @@
  *  limitations under the License.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
 #include <mk_core.h>
 #include <fluent-bit/flb_info.h>
@@ -27,6 +34,12 @@
 #include <fluent-bit/flb_io.h>
 #include <fluent-bit/flb_io_tls.h>
 #include <fluent-bit/flb_tls.h>
+#include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_http_client.h>
+
+static int group_nodes_create(struct flb_upstream *u,
+                              struct flb_config *config,
+                              int port, void *tls);
 
 /* Creates a new upstream context */
 struct flb_upstream *flb_upstream_create(struct flb_config *config,
@@ -49,6 +62,19 @@ struct flb_upstream *flb_upstream_create(struct flb_config *config,
     mk_list_init(&u->av_queue);
     mk_list_init(&u->busy_queue);
 
+    /* Keepalive */
+    u->ka_enabled      = config->net_keepalive;
+    u->ka_idle_timeout = config->net_keepalive_idle_timeout;
+    u->ka_max_requests = config->net_keepalive_max_requests;
+    u->ka_pool_size    = config->net_keepalive_pool_size;
+    u->av_connections  = 0;
+    u->ka_created      = 0;
+    u->ka_reused       = 0;
+    u->net_io_timeout  = config->net_io_timeout;
+    u->dns             = config->dns;
+    flb_net_setup_init(&u->net);
+    mk_list_add(&u->_head, &config->upstreams);
+
     /*
      * If Fluent Bit was built with FLUSH_PTHREADS, means each operation inside
      * the thread will not have access to the main event loop and it's quite
@@ -71,25 +97,465 @@ struct flb_upstream *flb_upstream_create(struct flb_config *config,
     pthread_mutex_init(&u->mutex_queue, NULL);
 #endif
 
+    /* A list of hosts creates an upstream group */
+    if (strchr(host, ',')) {
+        if (group_nodes_create(u, config, port, tls) == -1) {
+            flb_upstream_destroy(u);
+            return NULL;
+        }
+    }
+
     return u;
 }
 
+/* 32 bits FNV-1a with a final mix, used to place nodes and tags in the ring */
+static uint32_t group_hash(char *str, int len)
+{
+    int i;
+    uint32_t h = 2166136261u;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) str[i];
+        h *= 16777619u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static int group_point_cmp(const void *a, const void *b)
+{
+    const struct flb_upstream_point *p1 = a;
+    const struct flb_upstream_point *p2 = b;
+
+    if (p1->hash < p2->hash) {
+        return -1;
+    }
+    return p1->hash > p2->hash;
+}
+
+/* Build the consistent hash ring, each node gets 'weight' * VNODES points */
+static int group_ring_create(struct flb_upstream *u)
+{
+    int i;
+    int v;
+    int len;
+    int n = 0;
+    char key[256];
+    struct flb_upstream *node;
+
+    for (i = 0; i < u->n_nodes; i++) {
+        n += u->nodes[i]->weight * FLB_UPSTREAM_VNODES;
+    }
+
+    u->ring = flb_malloc(sizeof(struct flb_upstream_point) * n);
+    if (!u->ring) {
+        flb_errno();
+        return -1;
+    }
+
+    n = 0;
+    for (i = 0; i < u->n_nodes; i++) {
+        node = u->nodes[i];
+        for (v = 0; v < node->weight * FLB_UPSTREAM_VNODES; v++) {
+            len = snprintf(key, sizeof(key) - 1, "%s:%i-%i",
+                           node->tcp_host, node->tcp_port, v);
+            u->ring[n].hash = group_hash(key, len);
+            u->ring[n].node = node;
+            n++;
+        }
+    }
+    u->ring_size = n;
+    qsort(u->ring, n, sizeof(struct flb_upstream_point), group_point_cmp);
+
+    return 0;
+}
+
+/*
+ * Create the nodes of a group from the 'host[:port[:weight]]' comma
+ * separated list, 'port' is the default port.
+ */
+static int group_nodes_create(struct flb_upstream *u,
+                              struct flb_config *config,
+                              int port, void *tls)
+{
+    int n_port;
+    int weight;
+    char *p;
+    char *tok;
+    char *save;
+    char *list;
+    struct flb_upstream *node;
+
+    list = flb_strdup(u->tcp_host);
+    if (!list) {
+        return -1;
+    }
+
+    u->nodes = flb_calloc(FLB_UPSTREAM_MAX_NODES,
+                          sizeof(struct flb_upstream *));
+    if (!u->nodes) {
+        flb_errno();
+        flb_free(list);
+        return -1;
+    }
+
+    for (tok = strtok_r(list, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        while (*tok == ' ' || *tok == '\t') {
+            tok++;
+        }
+        p = tok + strlen(tok);
+        while (p > tok && (*(p - 1) == ' ' || *(p - 1) == '\t')) {
+            *--p = '\0';
+        }
+        if (*tok == '\0') {
+            continue;
+        }
+
+        if (u->n_nodes == FLB_UPSTREAM_MAX_NODES) {
+            flb_error("[upstream] too many nodes, max is %i",
+                      FLB_UPSTREAM_MAX_NODES);
+            flb_free(list);
+            return -1;
+        }
+
+        n_port = port;
+        weight = 1;
+        p = strchr(tok, ':');
+        if (p) {
+            *p++ = '\0';
+            n_port = atoi(p);
+            p = strchr(p, ':');
+            if (p) {
+                weight = atoi(p + 1);
+            }
+        }
+        if (n_port <= 0 || weight <= 0) {
+            flb_error("[upstream] invalid node '%s'", tok);
+            flb_free(list);
+            return -1;
+        }
+
+        node = flb_upstream_create(config, tok, n_port, u->flags, tls);
+        if (!node) {
+            flb_free(list);
+            return -1;
+        }
+        node->parent = u;
+        node->weight = weight;
+        node->index  = u->n_nodes;
+        u->nodes[u->n_nodes++] = node;
+
+        flb_debug("[upstream] group node %s:%i weight=%i",
+                  node->tcp_host, node->tcp_port, weight);
+    }
+    flb_free(list);
+
+    if (u->n_nodes == 0) {
+        flb_error("[upstream] no nodes in '%s'", u->tcp_host);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Set how a group selects its nodes: 'least_outstanding' or 'hash_tag' */
+int flb_upstream_balance_set(struct flb_upstream *u, char *mode)
+{
+    if (strcasecmp(mode, "least_outstanding") == 0) {
+        u->balance = FLB_UPSTREAM_LEAST_OUTSTANDING;
+        return 0;
+    }
+    else if (strcasecmp(mode, "hash_tag") == 0) {
+        u->balance = FLB_UPSTREAM_HASH_TAG;
+        if (u->n_nodes > 0 && !u->ring) {
+            return group_ring_create(u);
+        }
+        return 0;
+    }
+
+    flb_error("[upstream] unknown balance mode '%s'", mode);
+    return -1;
+}
+
+/* Socket options for new connections, a group passes them to its nodes */
+void flb_upstream_net_set(struct flb_upstream *u, struct flb_net_setup *net)
+{
+    int i;
+
+    memcpy(&u->net, net, sizeof(struct flb_net_setup));
+    for (i = 0; i < u->n_nodes; i++) {
+        memcpy(&u->nodes[i]->net, net, sizeof(struct flb_net_setup));
+    }
+}
+
+/* Is the node usable ? ejected nodes come back after FLB_UPSTREAM_EJECT_TIME */
+static inline int group_node_available(struct flb_upstream *node,
+                                       uint64_t tried, time_t now)
+{
+    if (tried & (1ULL << node->index)) {
+        return FLB_FALSE;
+    }
+    return node->ejected_until <= now;
+}
+
+/*
+ * Select a node not present in the 'tried' mask. If every remaining node is
+ * ejected, the one closest to the end of its ejection is used.
+ */
+static struct flb_upstream *group_node_select(struct flb_upstream *u,
+                                              uint64_t tried)
+{
+    int i;
+    int a;
+    int b;
+    int len;
+    int total = 0;
+    int lo;
+    int hi;
+    int mid;
+    char *tag;
+    uint32_t hash;
+    time_t now;
+    struct flb_upstream *node;
+    struct flb_upstream *best = NULL;
+    struct flb_upstream *fallback = NULL;
+
+    now = time(NULL);
+
+    /* Consistent hash: first available node clockwise from the tag */
+    tag = (u->balance == FLB_UPSTREAM_HASH_TAG) ? flb_output_thread_tag() : NULL;
+    if (tag && u->ring_size > 0) {
+        len = strlen(tag);
+        hash = group_hash(tag, len);
+
+        lo = 0;
+        hi = u->ring_size;
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            if (u->ring[mid].hash < hash) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+
+        for (i = 0; i < u->ring_size; i++) {
+            node = u->ring[(lo + i) % u->ring_size].node;
+            if (group_node_available(node, tried, now)) {
+                return node;
+            }
+        }
+    }
+
+    /*
+     * Least outstanding requests relative to the node weight. Ties (e.g:
+     * all nodes idle) are broken with a smooth weighted round-robin, so
+     * the load follows the weights.
+     */
+    for (i = 0; i < u->n_nodes; i++) {
+        node = u->nodes[i];
+        if (tried & (1ULL << node->index)) {
+            continue;
+        }
+
+        if (node->ejected_until > now) {
+            if (!fallback || node->ejected_until < fallback->ejected_until) {
+                fallback = node;
+            }
+            continue;
+        }
+
+        node->credit += node->weight;
+        total += node->weight;
+        if (!best) {
+            best = node;
+            continue;
+        }
+
+        a = node->outstanding * best->weight;
+        b = best->outstanding * node->weight;
+        if (a < b || (a == b && node->credit > best->credit)) {
+            best = node;
+        }
+    }
+
+    if (best) {
+        best->credit -= total;
+        return best;
+    }
+    return fallback;
+}
+
+/* Account the result of a request on a group node */
+static void group_node_done(struct flb_upstream *node, int ok)
+{
+    time_t now;
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&node->parent->mutex_queue);
+#endif
+
+    node->outstanding--;
+    if (ok == FLB_TRUE) {
+        if (node->ejected_until > 0) {
+            flb_info("[upstream] node %s:%i is healthy again",
+                     node->tcp_host, node->tcp_port);
+        }
+        node->fails = 0;
+        node->ejected_until = 0;
+    }
+    else {
+        node->fails++;
+        now = time(NULL);
+        if (node->fails >= FLB_UPSTREAM_MAX_FAILS &&
+            node->ejected_until <= now) {
+            node->ejected_until = now + FLB_UPSTREAM_EJECT_TIME;
+            flb_warn("[upstream] node %s:%i ejected for %i seconds "
+                     "after %i failures",
+                     node->tcp_host, node->tcp_port,
+                     FLB_UPSTREAM_EJECT_TIME, node->fails);
+        }
+    }
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&node->parent->mutex_queue);
+#endif
+}
+
+/* Get a connection from one of the nodes of a group */
+static struct flb_upstream_conn *group_conn_get(struct flb_upstream *u)
+{
+    int i;
+    uint64_t tried = 0;
+    struct flb_upstream *node;
+    struct flb_upstream_conn *u_conn;
+
+    for (i = 0; i < u->n_nodes; i++) {
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+        pthread_mutex_lock(&u->mutex_queue);
+#endif
+        node = group_node_select(u, tried);
+        if (node) {
+            node->outstanding++;
+        }
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+        pthread_mutex_unlock(&u->mutex_queue);
+#endif
+        if (!node) {
+            break;
+        }
+
+        u_conn = flb_upstream_conn_get(node);
+        if (u_conn) {
+            return u_conn;
+        }
+
+        /* Could not connect, try another node */
+        group_node_done(node, FLB_FALSE);
+        tried |= (1ULL << node->index);
+    }
+
+    return NULL;
+}
+
+/* Close and release a connection */
+static int conn_destroy(struct flb_upstream_conn *u_conn)
+{
+    struct flb_upstream *u = u_conn->u;
+
+    flb_trace("[upstream] [fd=%i] destroy connection %p",
+              u_conn->fd, u_conn);
+
+    if (u->flags & FLB_IO_ASYNC) {
+        mk_event_del(u->evl, &u_conn->event);
+    }
+
+    if (u_conn->fd > 0) {
+        close(u_conn->fd);
+    }
+
+#ifdef FLB_HAVE_TLS
+    if (u_conn->tls_session) {
+        flb_tls_session_destroy(u_conn->tls_session);
+        u_conn->tls_session = NULL;
+    }
+#endif
+
+    if (u_conn->http) {
+        flb_http_client_free(u_conn->http);
+    }
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&u->mutex_queue);
+#endif
+
+    /* remove connection from the queue */
+    mk_list_del(&u_conn->_head);
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&u->mutex_queue);
+#endif
+
+    u->n_connections--;
+    flb_free(u_conn);
+
+    return 0;
+}
+
 int flb_upstream_destroy(struct flb_upstream *u)
 {
+    int i;
     struct mk_list *tmp;
     struct mk_list *head;
     struct flb_upstream_conn *u_conn;
+#ifdef FLB_HAVE_TLS
+    struct flb_tls_stats *st;
+#endif
+
+    for (i = 0; i < u->n_nodes; i++) {
+        flb_upstream_destroy(u->nodes[i]);
+    }
+    flb_free(u->nodes);
+    flb_free(u->ring);
+
+    if (u->n_nodes == 0) {
+        flb_debug("[upstream] %s:%i connections created=%lu reused=%lu",
+                  u->tcp_host, u->tcp_port, u->ka_created, u->ka_reused);
+    }
+
+#ifdef FLB_HAVE_TLS
+    if (u->tls_resume) {
+        st = &u->tls_resume->stats;
+        flb_debug("[upstream] %s:%i tls handshakes full=%lu (avg %lu us) "
+                  "resumed=%lu (avg %lu us) failed=%lu",
+                  u->tcp_host, u->tcp_port,
+                  st->full, st->full ? st->usec_full / st->full : 0,
+                  st->resumed,
+                  st->resumed ? st->usec_resumed / st->resumed : 0,
+                  st->failed);
+        flb_tls_resume_destroy(u->tls_resume);
+    }
+#endif
 
     mk_list_foreach_safe(head, tmp, &u->av_queue) {
         u_conn = mk_list_entry(head, struct flb_upstream_conn, _head);
-        flb_upstream_conn_release(u_conn);
+        conn_destroy(u_conn);
     }
 
     mk_list_foreach_safe(head, tmp, &u->busy_queue) {
         u_conn = mk_list_entry(head, struct flb_upstream_conn, _head);
-        flb_upstream_conn_release(u_conn);
+        conn_destroy(u_conn);
     }
 
+    mk_list_del(&u->_head);
     flb_free(u->tcp_host);
     flb_free(u);
 
@@ -114,55 +580,128 @@ static struct flb_upstream_conn *create_conn(struct flb_upstream *u)
     conn->u             = u;
     conn->fd            = -1;
     conn->connect_count = 0;
+    conn->requests      = 1;
+    conn->ka_close      = FLB_FALSE;
+    conn->ts_available  = 0;
+    conn->ts_deadline   = 0;
+    conn->write_size    = 0;
+    conn->tfo_pending   = FLB_FALSE;
+    conn->zerocopy      = FLB_FALSE;
+    conn->zc_sent       = 0;
+    conn->zc_done       = 0;
+    conn->http          = NULL;
 #ifdef FLB_HAVE_TLS
     conn->tls_session   = NULL;
 #endif
 
     MK_EVENT_NEW(&conn->event);
 
-    /* Start connection */
-    ret = flb_io_net_connect(conn, th);
-    if (ret == -1) {
-        flb_free(conn);
-        return NULL;
-    }
-
 #ifdef FLB_HAVE_FLUSH_PTHREADS
     pthread_mutex_lock(&u->mutex_queue);
 #endif
 
-    /* Link new connection to the busy queue */
+    /*
+     * Link new connection to the busy queue, it's done before connecting
+     * so the connect deadline is also checked.
+     */
     mk_list_add(&conn->_head, &u->busy_queue);
 
 #ifdef FLB_HAVE_FLUSH_PTHREADS
     pthread_mutex_unlock(&u->mutex_queue);
 #endif
 
+    /* Start connection */
+    ret = flb_io_net_connect(conn, th);
+    if (ret == -1) {
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+        pthread_mutex_lock(&u->mutex_queue);
+#endif
+        mk_list_del(&conn->_head);
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+        pthread_mutex_unlock(&u->mutex_queue);
+#endif
+        flb_free(conn);
+        return NULL;
+    }
+
     u->n_connections++;
+    u->ka_created++;
 
     return conn;
 }
 
+/*
+ * Check that an idle connection can be used: it must not be idle for more
+ * than the allowed time and the remote end must not have closed it. A
+ * connection with pending data is not usable either, we cannot know to
+ * which request that data belongs to.
+ */
+static int conn_is_alive(struct flb_upstream_conn *u_conn, time_t now)
+{
+    int ret;
+    char tmp;
+    struct flb_upstream *u = u_conn->u;
+
+    if (u->ka_idle_timeout > 0 &&
+        now - u_conn->ts_available > u->ka_idle_timeout) {
+        return FLB_FALSE;
+    }
+
+    ret = recv(u_conn->fd, &tmp, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return FLB_TRUE;
+    }
+
+    return FLB_FALSE;
+}
+
+/* Get an alive connection from the available queue */
 static struct flb_upstream_conn *get_conn(struct flb_upstream *u)
 {
+    time_t now;
     struct flb_upstream_conn *conn;
 
+    now = time(NULL);
+
+    while (1) {
 #ifdef FLB_HAVE_FLUSH_PTHREADS
-    pthread_mutex_lock(&u->mutex_queue);
+        pthread_mutex_lock(&u->mutex_queue);
 #endif
-    /* Get the first available connection and increase the counter */
-    conn = mk_list_entry_first(&u->av_queue,
-                               struct flb_upstream_conn, _head);
-    u->n_connections++;
+        if (mk_list_is_empty(&u->av_queue) == 0) {
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+            pthread_mutex_unlock(&u->mutex_queue);
+#endif
+            return NULL;
+        }
 
-    /* Move it to the busy queue */
-    mk_list_del(&conn->_head);
-    mk_list_add(&conn->_head, &u->busy_queue);
+        /* Take the most recent one, it's the most likely to be alive */
+        conn = mk_list_entry_last(&u->av_queue,
+                                  struct flb_upstream_conn, _head);
+        u->av_connections--;
+
+        /* Move it to the busy queue */
+        mk_list_del(&conn->_head);
+        mk_list_add(&conn->_head, &u->busy_queue);
 
 #ifdef FLB_HAVE_FLUSH_PTHREADS
-    pthread_mutex_unlock(&u->mutex_queue);
+        pthread_mutex_unlock(&u->mutex_queue);
 #endif
 
+        if (conn_is_alive(conn, now) == FLB_TRUE) {
+            break;
+        }
+
+        flb_debug("[upstream] [fd=%i] discarding idle connection", conn->fd);
+        conn_destroy(conn);
+    }
+
+    conn->requests++;
+    conn->ka_close = FLB_FALSE;
+    u->ka_reused++;
+
+    flb_trace("[upstream] [fd=%i] reusing connection %p (requests=%i)",
+              conn->fd, conn, conn->requests);
+
     return conn;
 }
 
@@ -170,25 +709,26 @@ struct flb_upstream_conn *flb_upstream_conn_get(struct flb_upstream *u)
 {
     struct flb_upstream_conn *u_conn = NULL;
 
-    /*
-     * FIXME: for 0.9 series the keep alive mode will be enabled, useless
-     * check now as the available queue is always empty.
-     */
-    if (mk_list_is_empty(&u->av_queue) == 0) {
+    if (u->n_nodes > 0) {
+        return group_conn_get(u);
+    }
 
-        if (u->max_connections <= 0) {
-            u_conn = create_conn(u);
-        }
-        else if (u->n_connections < u->max_connections) {
-            u_conn = create_conn(u);
-        }
-        else {
-            return NULL;
+    /* Try to reuse an available connection */
+    if (u->ka_enabled == FLB_TRUE) {
+        u_conn = get_conn(u);
+        if (u_conn) {
+            return u_conn;
         }
     }
+
+    if (u->max_connections <= 0) {
+        u_conn = create_conn(u);
+    }
+    else if (u->n_connections < u->max_connections) {
+        u_conn = create_conn(u);
+    }
     else {
-        /* Get an available connection */
-        u_conn = get_conn(u);
+        return NULL;
     }
 
     if (!u_conn) {
@@ -205,34 +745,80 @@ int flb_upstream_conn_release(struct flb_upstream_conn *u_conn)
     flb_trace("[upstream] [fd=%i] releasing connection %p",
               u_conn->fd, u_conn);
 
-    if (u->flags & FLB_IO_ASYNC) {
-        mk_event_del(u->evl, &u_conn->event);
+    /* Network errors close the connection: passive health check */
+    if (u->parent) {
+        group_node_done(u, u_conn->fd > 0);
     }
 
-    if (u_conn->fd > 0) {
-        close(u_conn->fd);
+    /* Connections that cannot be reused are destroyed */
+    if (u->ka_enabled == FLB_FALSE || u_conn->fd <= 0 ||
+        u_conn->ka_close == FLB_TRUE ||
+        (u->ka_max_requests > 0 && u_conn->requests >= u->ka_max_requests) ||
+        u->av_connections >= u->ka_pool_size) {
+        return conn_destroy(u_conn);
     }
 
-#ifdef FLB_HAVE_TLS
-    if (u_conn->tls_session) {
-        flb_tls_session_destroy(u_conn->tls_session);
-        u_conn->tls_session = NULL;
+    if (u->flags & FLB_IO_ASYNC) {
+        mk_event_del(u->evl, &u_conn->event);
     }
-#endif
+    MK_EVENT_NEW(&u_conn->event);
+    u_conn->thread = NULL;
+    u_conn->ts_available = time(NULL);
 
 #ifdef FLB_HAVE_FLUSH_PTHREADS
     pthread_mutex_lock(&u->mutex_queue);
 #endif
 
-    /* remove connection from the queue */
+    /* Move the connection to the available queue */
     mk_list_del(&u_conn->_head);
+    mk_list_add(&u_conn->_head, &u->av_queue);
+    u->av_connections++;
 
 #ifdef FLB_HAVE_FLUSH_PTHREADS
     pthread_mutex_unlock(&u->mutex_queue);
 #endif
 
-    u->n_connections--;
-    flb_free(u_conn);
-
     return 0;
 }
+
+/*
+ * Check the deadline of the network operations in progress: connections
+ * with an expired deadline are shutdown(2), the co-routine waiting on it
+ * gets resumed by the event loop and the operation fails. This function
+ * is invoked by the engine every second.
+ */
+int flb_upstream_conn_timeouts(struct flb_config *config)
+{
+    int c = 0;
+    time_t now;
+    struct mk_list *head;
+    struct mk_list *c_head;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+
+    now = time(NULL);
+    mk_list_foreach(head, &config->upstreams) {
+        u = mk_list_entry(head, struct flb_upstream, _head);
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+        pthread_mutex_lock(&u->mutex_queue);
+#endif
+        mk_list_foreach(c_head, &u->busy_queue) {
+            u_conn = mk_list_entry(c_head, struct flb_upstream_conn, _head);
+            if (u_conn->ts_deadline == 0 || u_conn->ts_deadline > now ||
+                u_conn->fd <= 0) {
+                continue;
+            }
+
+            flb_debug("[upstream] fd=%i %s:%i deadline expired",
+                      u_conn->fd, u->tcp_host, u->tcp_port);
+            shutdown(u_conn->fd, SHUT_RDWR);
+            c++;
+        }
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+        pthread_mutex_unlock(&u->mutex_queue);
+#endif
+    }
+
+    return c;
+}
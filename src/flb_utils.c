@@ -20,6 +20,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
 #include <time.h>
 #include <sys/time.h>
@@ -183,3 +185,50 @@ void flb_utils_print_setup(struct flb_config *config)
 
     }
 }
+
+/*
+ * Convert a human readable size like '512K', '64M' or '1G' into a number
+ * of bytes. A plain number is taken as bytes. Returns -1 on invalid input.
+ */
+int64_t flb_utils_size_to_bytes(char *size)
+{
+    int64_t val;
+    char *end;
+
+    if (!size) {
+        return -1;
+    }
+
+    errno = 0;
+    val = strtoll(size, &end, 10);
+    if (errno != 0 || end == size || val < 0) {
+        return -1;
+    }
+
+    /* Optional unit, 'B' suffix is accepted (e.g: 64M or 64MB) */
+    switch (toupper(*end)) {
+    case '\0':
+        return val;
+    case 'K':
+        val *= 1024;
+        break;
+    case 'M':
+        val *= 1024 * 1024;
+        break;
+    case 'G':
+        val *= 1024 * 1024 * 1024;
+        break;
+    default:
+        return -1;
+    }
+
+    end++;
+    if (toupper(*end) == 'B') {
+        end++;
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+
+    return val;
+}
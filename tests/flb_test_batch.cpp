@@ -0,0 +1,141 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+extern "C" {
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_batch.h>
+}
+
+/* Columnar view of the records, types, validity and aggregation */
+TEST(Batch, columns)
+{
+    int i;
+    int n;
+    uint8_t sel[2];
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    msgpack_unpacked result;
+    size_t off = 0;
+    struct flb_time tm;
+    struct flb_time from;
+    struct flb_batch *batch;
+    struct flb_batch_col *col;
+    struct flb_batch_stats st;
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    /*
+     * 10 records: 'n' is an integer but a float in the last one, 's' is
+     * missing on odd rows, 'm' mixes a map and a string, 'z' is nil.
+     */
+    for (i = 0; i < 10; i++) {
+        flb_time_set(&tm, 1500000000 + i, 0);
+        msgpack_pack_array(&pck, 2);
+        flb_time_append_to_msgpack(&tm, &pck);
+        msgpack_pack_map(&pck, (i % 2) ? 3 : 4);
+
+        msgpack_pack_str(&pck, 1);
+        msgpack_pack_str_body(&pck, "n", 1);
+        if (i == 9) {
+            msgpack_pack_double(&pck, 9.5);
+        }
+        else {
+            msgpack_pack_int(&pck, i - 2);
+        }
+
+        if (i % 2 == 0) {
+            msgpack_pack_str(&pck, 1);
+            msgpack_pack_str_body(&pck, "s", 1);
+            msgpack_pack_str(&pck, 3);
+            msgpack_pack_str_body(&pck, "abc", 3);
+        }
+
+        msgpack_pack_str(&pck, 1);
+        msgpack_pack_str_body(&pck, "m", 1);
+        if (i == 0) {
+            msgpack_pack_map(&pck, 1);
+            msgpack_pack_str(&pck, 1);
+            msgpack_pack_str_body(&pck, "k", 1);
+            msgpack_pack_true(&pck);
+        }
+        else {
+            msgpack_pack_str(&pck, 1);
+            msgpack_pack_str_body(&pck, "v", 1);
+        }
+
+        msgpack_pack_str(&pck, 1);
+        msgpack_pack_str_body(&pck, "z", 1);
+        msgpack_pack_nil(&pck);
+    }
+
+    batch = flb_batch_create(sbuf.data, sbuf.size);
+    ASSERT_TRUE(batch != NULL);
+    ASSERT_EQ(batch->rows, 10);
+    ASSERT_EQ(batch->n_cols, 4);
+    EXPECT_EQ(batch->time[3].tm.tv_sec, 1500000003);
+
+    col = flb_batch_col_get(batch, "n", 1);
+    ASSERT_TRUE(col != NULL);
+    EXPECT_EQ(col->type, FLB_BATCH_DOUBLE);
+    EXPECT_EQ(col->promoted, FLB_TRUE);
+    EXPECT_EQ(col->v.f64[0], -2.0);
+
+    col = flb_batch_col_get(batch, "s", 1);
+    ASSERT_TRUE(col != NULL);
+    EXPECT_EQ(col->type, FLB_BATCH_STR);
+    EXPECT_TRUE(flb_batch_valid(col, 4));
+    EXPECT_FALSE(flb_batch_valid(col, 5));
+    EXPECT_EQ(col->v.view[4].len, 3U);
+    EXPECT_EQ(memcmp(col->v.view[4].ptr, "abc", 3), 0);
+    EXPECT_EQ(flb_batch_col_stats(batch, col, NULL, &st), -1);
+
+    /* mixed types keep the encoded value */
+    col = flb_batch_col_get(batch, "m", 1);
+    ASSERT_TRUE(col != NULL);
+    EXPECT_EQ(col->type, FLB_BATCH_RAW);
+    msgpack_unpacked_init(&result);
+    ASSERT_EQ(msgpack_unpack_next(&result, col->v.view[0].ptr,
+                                  col->v.view[0].len, &off),
+              MSGPACK_UNPACK_SUCCESS);
+    EXPECT_EQ(result.data.type, MSGPACK_OBJECT_MAP);
+    msgpack_unpacked_destroy(&result);
+
+    col = flb_batch_col_get(batch, "z", 1);
+    ASSERT_TRUE(col != NULL);
+    EXPECT_EQ(col->type, FLB_BATCH_NULL);
+    EXPECT_FALSE(flb_batch_valid(col, 0));
+    EXPECT_TRUE(flb_batch_col_get(batch, "none", 4) == NULL);
+
+    /* aggregation over all the rows and over a time range */
+    col = flb_batch_col_get(batch, "n", 1);
+    ASSERT_EQ(flb_batch_col_stats(batch, col, NULL, &st), 0);
+    EXPECT_EQ(st.count, 10);
+    EXPECT_EQ(st.min, -2.0);
+    EXPECT_EQ(st.max, 9.5);
+    EXPECT_EQ(st.sum, 18.0 + 9.5);
+
+    flb_time_set(&from, 1500000005, 0);
+    n = flb_batch_time_select(batch, &from, NULL, sel);
+    EXPECT_EQ(n, 5);
+    ASSERT_EQ(flb_batch_col_stats(batch, col, sel, &st), 0);
+    EXPECT_EQ(st.count, 5);
+    EXPECT_EQ(st.min, 3.0);
+    EXPECT_EQ(st.sum, 3.0 + 4 + 5 + 6 + 9.5);
+
+    flb_batch_destroy(batch);
+
+    /* no records, no columns */
+    batch = flb_batch_create(sbuf.data, 0);
+    ASSERT_TRUE(batch != NULL);
+    EXPECT_EQ(batch->rows, 0);
+    EXPECT_EQ(batch->n_cols, 0);
+    flb_batch_destroy(batch);
+
+    msgpack_sbuffer_destroy(&sbuf);
+}
@@ -0,0 +1,111 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+extern "C" {
+#include <fluent-bit/flb_chain.h>
+}
+
+/* Records packed into a chain, read as an iovec list and flattened */
+TEST(Chain, blocks)
+{
+    int i;
+    int n;
+    int blocks = 0;
+    char *flat;
+    char *p;
+    size_t size = 0;
+    size_t mem = 0;
+    size_t bsize;
+    size_t off = 0;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    msgpack_packer cpck;
+    msgpack_unpacked result;
+    struct flb_chain chain;
+    struct flb_chain dst;
+    struct iovec iov[8];
+    char str[1000];
+
+    memset(str, 'x', sizeof(str));
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+    flb_chain_init(&chain);
+    flb_chain_packer_init(&cpck, &chain);
+
+    /* the same records on both, crossing the block boundaries */
+    for (i = 0; i < 200; i++) {
+        msgpack_pack_array(&pck, 2);
+        msgpack_pack_int(&pck, i);
+        msgpack_pack_str(&pck, sizeof(str));
+        msgpack_pack_str_body(&pck, str, sizeof(str));
+
+        msgpack_pack_array(&cpck, 2);
+        msgpack_pack_int(&cpck, i);
+        msgpack_pack_str(&cpck, sizeof(str));
+        msgpack_pack_str_body(&cpck, str, sizeof(str));
+    }
+    ASSERT_EQ(chain.size, sbuf.size);
+
+    /* blocks double from the small first one up to the maximum size */
+    for (bsize = FLB_CHAIN_BLOCK_MIN; mem < sbuf.size; blocks++) {
+        mem += bsize;
+        bsize = bsize * 2 > FLB_CHAIN_BLOCK_MAX ? FLB_CHAIN_BLOCK_MAX :
+            bsize * 2;
+    }
+    EXPECT_EQ(chain.count, blocks);
+    EXPECT_EQ(chain.mem, mem);
+
+    /* moved blocks keep their order, the source ends empty */
+    flb_chain_init(&dst);
+    flb_chain_move(&dst, &chain);
+    EXPECT_EQ(chain.size, 0U);
+    EXPECT_EQ(chain.count, 0);
+    ASSERT_EQ(dst.size, sbuf.size);
+
+    n = flb_chain_iov(&dst, iov, 8);
+    ASSERT_EQ(n, dst.count);
+    EXPECT_EQ(dst.mem, mem);
+    EXPECT_EQ(iov[0].iov_len, (size_t) FLB_CHAIN_BLOCK_MIN);
+    EXPECT_EQ(iov[1].iov_len, (size_t) FLB_CHAIN_BLOCK_MIN * 2);
+    EXPECT_EQ(iov[n - 2].iov_len, (size_t) FLB_CHAIN_BLOCK_MAX);
+    p = sbuf.data;
+    for (i = 0; i < n; i++) {
+        EXPECT_EQ(memcmp(iov[i].iov_base, p, iov[i].iov_len), 0);
+        p += iov[i].iov_len;
+        size += iov[i].iov_len;
+    }
+    EXPECT_EQ(size, sbuf.size);
+    EXPECT_EQ(flb_chain_iov(&dst, iov, 1), 1);
+
+    flat = flb_chain_flatten(&dst);
+    ASSERT_TRUE(flat != NULL);
+    EXPECT_EQ(memcmp(flat, sbuf.data, sbuf.size), 0);
+
+    msgpack_unpacked_init(&result);
+    i = 0;
+    while (msgpack_unpack_next(&result, flat, dst.size, &off)) {
+        EXPECT_EQ(result.data.via.array.ptr[0].via.i64, i);
+        i++;
+    }
+    EXPECT_EQ(i, 200);
+    msgpack_unpacked_destroy(&result);
+    flb_free(flat);
+
+    /* a reset chain can be written again, from a small block */
+    flb_chain_reset(&dst);
+    EXPECT_EQ(dst.size, 0U);
+    EXPECT_EQ(dst.mem, 0U);
+    msgpack_pack_int(&cpck, 1);
+    EXPECT_EQ(chain.size, 1U);
+    EXPECT_EQ(chain.count, 1);
+    EXPECT_EQ(chain.mem, (size_t) FLB_CHAIN_BLOCK_MIN);
+
+    flb_chain_reset(&chain);
+    flb_chain_pool_exit();
+    msgpack_sbuffer_destroy(&sbuf);
+}
@@ -0,0 +1,97 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+extern "C" {
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_dict.h>
+}
+
+/* Interned map keys, the decoded chunk gives the original bytes */
+TEST(Dict, encode_decode)
+{
+    int i;
+    int c;
+    int ret;
+    char key[32];
+    char *enc;
+    char *dec;
+    size_t enc_size;
+    size_t dec_size;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    struct flb_time tm;
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    /* in_cpu like samples: the same keys on every record */
+    flb_time_set(&tm, 1500000000, 0);
+    for (i = 0; i < 100; i++) {
+        msgpack_pack_array(&pck, 2);
+        flb_time_append_to_msgpack(&tm, &pck);
+        msgpack_pack_map(&pck, 301);
+        for (c = 0; c < 300; c++) {
+            snprintf(key, sizeof(key), "cpu%i.p_cpu", c);
+            msgpack_pack_str(&pck, strlen(key));
+            msgpack_pack_str_body(&pck, key, strlen(key));
+            msgpack_pack_double(&pck, c * 0.5);
+        }
+        /* short keys are kept as they are */
+        msgpack_pack_str(&pck, 1);
+        msgpack_pack_str_body(&pck, "x", 1);
+        msgpack_pack_map(&pck, 1);
+        msgpack_pack_bin(&pck, 6);
+        msgpack_pack_bin_body(&pck, "nested", 6);
+        msgpack_pack_int(&pck, i);
+    }
+
+    ret = flb_dict_encode(sbuf.data, sbuf.size, &enc, &enc_size);
+    ASSERT_EQ(ret, 0);
+    EXPECT_LT(enc_size, sbuf.size * 6 / 10);
+
+    /* more than 256 keys: two bytes references are used too */
+    ret = flb_dict_decode(enc, enc_size, &dec, &dec_size);
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(dec_size, sbuf.size);
+    EXPECT_EQ(memcmp(dec, sbuf.data, sbuf.size), 0);
+    flb_free(dec);
+
+    /* a truncated chunk is rejected */
+    ret = flb_dict_decode(enc, enc_size - 1, &dec, &dec_size);
+    EXPECT_EQ(ret, -1);
+    flb_free(enc);
+
+    /* plain records are not an encoded chunk */
+    ret = flb_dict_decode(sbuf.data, sbuf.size, &dec, &dec_size);
+    EXPECT_EQ(ret, -1);
+    msgpack_sbuffer_clear(&sbuf);
+
+    /* nothing repeated, nothing to do */
+    msgpack_pack_map(&pck, 1);
+    msgpack_pack_str(&pck, 8);
+    msgpack_pack_str_body(&pck, "only_one", 8);
+    msgpack_pack_int(&pck, 1);
+    ret = flb_dict_encode(sbuf.data, sbuf.size, &enc, &enc_size);
+    EXPECT_EQ(ret, -1);
+    msgpack_sbuffer_clear(&sbuf);
+
+    /* a key using the reference extension type can't be encoded */
+    for (i = 0; i < 2; i++) {
+        msgpack_pack_map(&pck, 2);
+        msgpack_pack_str(&pck, 8);
+        msgpack_pack_str_body(&pck, "repeated", 8);
+        msgpack_pack_int(&pck, 1);
+        msgpack_pack_ext(&pck, 1, FLB_DICT_EXT_KEY);
+        msgpack_pack_ext_body(&pck, "\x00", 1);
+        msgpack_pack_int(&pck, 2);
+    }
+    ret = flb_dict_encode(sbuf.data, sbuf.size, &enc, &enc_size);
+    EXPECT_EQ(ret, -1);
+
+    msgpack_sbuffer_destroy(&sbuf);
+}
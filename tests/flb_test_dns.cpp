@@ -0,0 +1,313 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <map>
+#include <string>
+
+extern "C" {
+#include <fluent-bit/flb_dns.h>
+}
+
+#include "flb_test_helper.h"
+
+/*
+ * Stub name server on a loopback UDP port, set as DNS_Server. The answer
+ * depends on the first label of the name:
+ *
+ *   ok    A record 10.0.0.1 with a TTL of one second
+ *   nx    NXDOMAIN
+ *   slow  the first query is dropped, the retransmission gets 'ok'
+ *   tc    truncated answer (TC bit)
+ *   dead  never answered
+ *   spoof forged answers (other port, other ID, other question), then 'ok'
+ */
+struct stub {
+    int fd;
+    int fd_spoof;             /* another port on the same address */
+    int port;
+    int stop;
+    pthread_mutex_t mutex;
+    std::map<std::string, int> queries;
+};
+
+static std::string qname(unsigned char *buf, int size)
+{
+    int off = 12;
+    std::string name;
+
+    /* fully qualified, with the trailing dot */
+    while (off < size && buf[off] != 0) {
+        name.append((char *) buf + off + 1, buf[off]);
+        name += ".";
+        off += buf[off] + 1;
+    }
+
+    return name;
+}
+
+/* Append an A record 10.0.0.'n' to the answer in 'buf' */
+static int stub_answer(unsigned char *buf, int len, int n)
+{
+    unsigned char rr[] = {
+        0xc0, 0x0c,              /* name: the question */
+        0x00, 0x01, 0x00, 0x01,  /* A, IN              */
+        0x00, 0x00, 0x00, 0x01,  /* TTL                */
+        0x00, 0x04, 10, 0, 0, 0
+    };
+
+    rr[15] = n;
+    buf[7] = 1;                  /* ANCOUNT */
+    memcpy(buf + len, rr, sizeof(rr));
+    return len + sizeof(rr);
+}
+
+static void *stub_worker(void *data)
+{
+    int n;
+    int len;
+    ssize_t bytes;
+    unsigned char buf[512];
+    std::string name;
+    std::string label;
+    struct sockaddr_in peer;
+    socklen_t peer_len;
+    struct stub *s = (struct stub *) data;
+
+    while (!s->stop) {
+        peer_len = sizeof(peer);
+        bytes = recvfrom(s->fd, buf, sizeof(buf), 0,
+                         (struct sockaddr *) &peer, &peer_len);
+        if (bytes < 12) {
+            continue;
+        }
+
+        name = qname(buf, bytes);
+        label = name.substr(0, name.find('.'));
+
+        pthread_mutex_lock(&s->mutex);
+        n = ++s->queries[name];
+        pthread_mutex_unlock(&s->mutex);
+
+        if (label == "dead" || (label == "slow" && n == 1)) {
+            continue;
+        }
+
+        len = bytes;
+        buf[2] |= 0x80;                  /* QR: response */
+        buf[3] = 0x80;                   /* RA, rcode 0  */
+
+        if (label == "nx") {
+            buf[3] |= 3;
+        }
+        else if (label == "tc") {
+            buf[2] |= 0x02;
+        }
+        else if (label == "spoof") {
+            int bad_len;
+            unsigned char bad[512];
+
+            memcpy(bad, buf, len);
+            bad_len = stub_answer(bad, len, 6);
+
+            /* right answer from the wrong port */
+            sendto(s->fd_spoof, bad, bad_len, 0,
+                   (struct sockaddr *) &peer, peer_len);
+
+            /* wrong ID */
+            bad[1] ^= 0x01;
+            sendto(s->fd, bad, bad_len, 0, (struct sockaddr *) &peer,
+                   peer_len);
+            bad[1] ^= 0x01;
+
+            /* wrong question */
+            bad[13] = 'x';
+            sendto(s->fd, bad, bad_len, 0, (struct sockaddr *) &peer,
+                   peer_len);
+
+            len = stub_answer(buf, len, 1);
+        }
+        else {
+            len = stub_answer(buf, len, 1);
+        }
+
+        sendto(s->fd, buf, len, 0, (struct sockaddr *) &peer, peer_len);
+    }
+
+    return NULL;
+}
+
+static int stub_start(struct stub *s, pthread_t *tid)
+{
+    struct timeval tv = {0, 100000};
+
+    s->fd = flb_test_listen(SOCK_DGRAM, 0, 0, &s->port);
+    if (s->fd == -1) {
+        return -1;
+    }
+    s->fd_spoof = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s->fd_spoof == -1) {
+        close(s->fd);
+        return -1;
+    }
+    setsockopt(s->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    s->stop = 0;
+    pthread_mutex_init(&s->mutex, NULL);
+    return pthread_create(tid, NULL, stub_worker, s);
+}
+
+static int stub_queries(struct stub *s, const char *name)
+{
+    int n;
+
+    pthread_mutex_lock(&s->mutex);
+    n = s->queries[name];
+    pthread_mutex_unlock(&s->mutex);
+
+    return n;
+}
+
+/* Results of the lookups, they run on a worker */
+struct dns_run {
+    struct flb_config *config;
+    struct stub *s;
+    int ret[11];
+    int queries[11];
+    struct in_addr addr[11];
+};
+
+static void dns_resolve(struct dns_run *r, struct flb_dns *dns,
+                        int i, const char *host)
+{
+    r->ret[i] = flb_dns_resolve(dns, NULL, NULL, (char *) host, &r->addr[i]);
+    r->queries[i] = stub_queries(r->s, host);
+}
+
+static void dns_worker(void *data)
+{
+    struct flb_dns *dns;
+    struct dns_run *r = (struct dns_run *) data;
+
+    dns = flb_dns_create(r->config);
+    if (dns) {
+        /* positive answer, then a cache hit */
+        dns_resolve(r, dns, 0, "ok.test.");
+        dns_resolve(r, dns, 1, "ok.test.");
+
+        /* NXDOMAIN, then the cached negative answer */
+        dns_resolve(r, dns, 2, "nx.test.");
+        dns_resolve(r, dns, 3, "nx.test.");
+
+        /* both entries expire after one second */
+        sleep(2);
+        dns_resolve(r, dns, 4, "ok.test.");
+        dns_resolve(r, dns, 5, "nx.test.");
+
+        /* the retransmitted query gets the answer */
+        dns_resolve(r, dns, 6, "slow.test.");
+
+        /* truncated answers fail and are not cached */
+        dns_resolve(r, dns, 7, "tc.test.");
+        dns_resolve(r, dns, 8, "tc.test.");
+
+        /* retransmitted until DNS_Timeout */
+        dns_resolve(r, dns, 9, "dead.test.");
+
+        /* forged answers are ignored */
+        dns_resolve(r, dns, 10, "spoof.test.");
+
+        flb_dns_destroy(dns);
+    }
+}
+
+TEST(DNS, stub_server)
+{
+    int ret;
+    char server[32];
+    pthread_t stub_tid;
+    flb_ctx_t *ctx;
+    struct stub s;
+    struct dns_run r;
+
+    ASSERT_EQ(stub_start(&s, &stub_tid), 0);
+
+    ctx = flb_create();
+    ASSERT_TRUE(ctx != NULL);
+
+    snprintf(server, sizeof(server), "127.0.0.1:%i", s.port);
+    ret = flb_service_set(ctx,
+                          "DNS_Server", server,
+                          "DNS_Timeout", "2",
+                          "DNS_Negative_TTL", "1",
+                          NULL);
+    ASSERT_EQ(ret, 0);
+
+    memset(&r, 0, sizeof(r));
+    r.config = ctx->config;
+    r.s = &s;
+    ret = flb_test_worker_run(ctx->config, dns_worker, &r);
+    ASSERT_EQ(ret, 0);
+
+    s.stop = 1;
+    pthread_join(stub_tid, NULL);
+    close(s.fd);
+    close(s.fd_spoof);
+
+    EXPECT_EQ(r.ret[0], 0);
+    EXPECT_STREQ(inet_ntoa(r.addr[0]), "10.0.0.1");
+    EXPECT_EQ(r.queries[0], 1);
+    EXPECT_EQ(r.ret[1], 0);
+    EXPECT_EQ(r.addr[1].s_addr, r.addr[0].s_addr);
+    EXPECT_EQ(r.queries[1], 1);
+
+    /* negative answers fail the same way, the cached one is not asked */
+    EXPECT_EQ(r.ret[2], -1);
+    EXPECT_EQ(r.queries[2], 1);
+    EXPECT_EQ(r.ret[3], -1);
+    EXPECT_EQ(r.queries[3], 1);
+
+    EXPECT_EQ(r.ret[4], 0);
+    EXPECT_EQ(r.queries[4], 2);
+    EXPECT_EQ(r.ret[5], -1);
+    EXPECT_EQ(r.queries[5], 2);
+
+    EXPECT_EQ(r.ret[6], 0);
+    EXPECT_EQ(r.queries[6], 2);
+
+    EXPECT_EQ(r.ret[7], -1);
+    EXPECT_EQ(r.ret[8], -1);
+    EXPECT_EQ(r.queries[8], 2);
+
+    EXPECT_EQ(r.ret[9], -1);
+    EXPECT_GE(r.queries[9], 2);
+
+    EXPECT_EQ(r.ret[10], 0);
+    EXPECT_STREQ(inet_ntoa(r.addr[10]), "10.0.0.1");
+
+    flb_destroy(ctx);
+}
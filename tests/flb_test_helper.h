@@ -0,0 +1,127 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * Helpers shared by the tests: a runner for the code that must run on a
+ * Fluent Bit worker and loopback listeners for the stub servers.
+ */
+
+#ifndef FLB_TEST_HELPER_H
+#define FLB_TEST_HELPER_H
+
+#include <fluent-bit.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+extern "C" {
+#include <fluent-bit/flb_worker.h>
+}
+
+struct flb_test_worker {
+    void (*fn)(void *);
+    void *data;
+    int done;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static inline void flb_test_worker_cb(void *data)
+{
+    struct flb_test_worker *r = (struct flb_test_worker *) data;
+
+    r->fn(r->data);
+
+    pthread_mutex_lock(&r->mutex);
+    r->done = 1;
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+}
+
+/*
+ * Fluent Bit logging requires a worker context: run 'fn' on a worker of
+ * 'config' and wait until it returns. It returns -1 if the worker could
+ * not be created.
+ */
+static inline int flb_test_worker_run(struct flb_config *config,
+                                      void (*fn)(void *), void *data)
+{
+    int ret;
+    pthread_t tid;
+    struct flb_test_worker r;
+
+    r.fn = fn;
+    r.data = data;
+    r.done = 0;
+    pthread_mutex_init(&r.mutex, NULL);
+    pthread_cond_init(&r.cond, NULL);
+
+    ret = flb_worker_create(flb_test_worker_cb, &r, &tid, config);
+    if (ret == 0) {
+        pthread_mutex_lock(&r.mutex);
+        while (!r.done) {
+            pthread_cond_wait(&r.cond, &r.mutex);
+        }
+        pthread_mutex_unlock(&r.mutex);
+    }
+
+    pthread_cond_destroy(&r.cond);
+    pthread_mutex_destroy(&r.mutex);
+
+    return ret == 0 ? 0 : -1;
+}
+
+/*
+ * Socket of 'type' (SOCK_STREAM or SOCK_DGRAM) bound to a loopback 'port',
+ * zero picks a free one. Stream sockets listen with 'backlog'. It returns
+ * the descriptor and sets the bound port, or -1 on error.
+ */
+static inline int flb_test_listen(int type, int port, int backlog,
+                                  int *bound_port)
+{
+    int fd;
+    int on = 1;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    fd = socket(AF_INET, type, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        (type == SOCK_STREAM && listen(fd, backlog) != 0) ||
+        getsockname(fd, (struct sockaddr *) &addr, &len) != 0) {
+        close(fd);
+        return -1;
+    }
+    *bound_port = ntohs(addr.sin_port);
+
+    return fd;
+}
+
+#endif
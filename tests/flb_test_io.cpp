@@ -0,0 +1,615 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <string>
+
+extern "C" {
+#include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_http_client.h>
+}
+
+#include "flb_test_helper.h"
+
+/*
+ * Blocking upstream writes over loopback, with and without MSG_ZEROCOPY.
+ * Each round sends the buffer filled with a different byte, the receiver
+ * checks the content so a buffer modified while the kernel still holds
+ * its pages is detected.
+ */
+#define IO_BUF_SIZE   (1024 * 1024)
+#define IO_ROUNDS     4
+
+/* Opt-in benchmark, run with --gtest_also_run_disabled_tests */
+#define IO_BENCH_BUF_SIZE   (16 * 1024 * 1024)
+#define IO_BENCH_ROUNDS     32
+
+struct sink {
+    int fd;
+    int port;
+    size_t bytes;
+    size_t round_size;          /* if set, check the round pattern */
+    size_t bad;                 /* unexpected bytes                */
+};
+
+static inline char io_pattern(int round)
+{
+    return 'a' + (round % 26);
+}
+
+static void *sink_worker(void *data)
+{
+    int fd;
+    ssize_t i;
+    ssize_t ret;
+    char *buf;
+    struct sink *s = (struct sink *) data;
+
+    buf = (char *) malloc(1024 * 1024);
+    fd = accept(s->fd, NULL, NULL);
+    while (fd >= 0 && (ret = read(fd, buf, 1024 * 1024)) > 0) {
+        for (i = 0; s->round_size > 0 && i < ret; i++) {
+            if (buf[i] != io_pattern((s->bytes + i) / s->round_size)) {
+                s->bad++;
+            }
+        }
+        s->bytes += ret;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(buf);
+    return NULL;
+}
+
+static int sink_create(struct sink *s)
+{
+    memset(s, 0, sizeof(struct sink));
+    s->fd = flb_test_listen(SOCK_STREAM, 0, 4, &s->port);
+
+    return s->fd == -1 ? -1 : 0;
+}
+
+struct io_result {
+    double secs;
+    size_t received;
+    size_t bad;
+    int zerocopy;               /* MSG_ZEROCOPY enabled on the socket */
+    uint32_t zc_sent;
+    uint32_t zc_pending;        /* completions not reaped on return   */
+};
+
+static int io_send(struct flb_config *config, size_t zerocopy,
+                   char *buf, size_t size, int rounds, int check,
+                   struct io_result *r)
+{
+    int i;
+    int ret;
+    size_t sent;
+    pthread_t tid;
+    struct timespec t0;
+    struct timespec t1;
+    struct sink s;
+    struct flb_net_setup net;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+
+    memset(r, 0, sizeof(struct io_result));
+    if (sink_create(&s) != 0) {
+        return -1;
+    }
+    if (check) {
+        s.round_size = size;
+    }
+    pthread_create(&tid, NULL, sink_worker, &s);
+
+    u = flb_upstream_create(config, (char *) "127.0.0.1", s.port,
+                            FLB_IO_TCP, NULL);
+    u->flags &= ~(FLB_IO_ASYNC);    /* no engine loop, blocking mode */
+    flb_net_setup_init(&net);
+    net.zerocopy = zerocopy;
+    flb_upstream_net_set(u, &net);
+
+    u_conn = flb_upstream_conn_get(u);
+    if (!u_conn) {
+        flb_upstream_destroy(u);
+        shutdown(s.fd, SHUT_RDWR);
+        close(s.fd);
+        pthread_join(tid, NULL);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < rounds; i++) {
+        if (check) {
+            memset(buf, io_pattern(i), size);
+        }
+        ret = flb_io_net_write(u_conn, buf, size, &sent);
+        if (ret == -1 || sent != size) {
+            break;
+        }
+        /* the next round overwrites the buffer right away */
+        r->zc_pending += u_conn->zc_sent - u_conn->zc_done;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    r->zerocopy = u_conn->zerocopy;
+    r->zc_sent = u_conn->zc_sent;
+
+    flb_upstream_conn_release(u_conn);
+    flb_upstream_destroy(u);
+    pthread_join(tid, NULL);
+    close(s.fd);
+
+    r->received = s.bytes;
+    r->bad = s.bad;
+    r->secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    return 0;
+}
+
+/* Sends without and with MSG_ZEROCOPY, they run on a worker */
+struct io_run {
+    struct flb_config *config;
+    char *buf;
+    size_t size;
+    int rounds;
+    int check;
+    struct io_result res[2];
+};
+
+static void io_run_worker(void *data)
+{
+    struct io_run *run = (struct io_run *) data;
+
+    io_send(run->config, 0, run->buf, run->size, run->rounds, run->check,
+            &run->res[0]);
+    io_send(run->config, FLB_NET_ZEROCOPY_MIN, run->buf, run->size,
+            run->rounds, run->check, &run->res[1]);
+}
+
+static void io_run(flb_ctx_t *ctx, struct io_run *run,
+                   size_t size, int rounds, int check)
+{
+    memset(run, 0, sizeof(struct io_run));
+    run->config = ctx->config;
+    run->size = size;
+    run->rounds = rounds;
+    run->check = check;
+    run->buf = (char *) malloc(size);
+    memset(run->buf, 'x', size);
+
+    EXPECT_EQ(flb_test_worker_run(ctx->config, io_run_worker, run), 0);
+
+    free(run->buf);
+}
+
+TEST(IO, zerocopy_loopback)
+{
+    int i;
+    size_t total = (size_t) IO_BUF_SIZE * IO_ROUNDS;
+    flb_ctx_t *ctx;
+    struct io_run run;
+
+    ctx = flb_create();
+    ASSERT_TRUE(ctx != NULL);
+
+    io_run(ctx, &run, IO_BUF_SIZE, IO_ROUNDS, FLB_TRUE);
+
+    for (i = 0; i < 2; i++) {
+        EXPECT_EQ(run.res[i].received, total) << "zerocopy=" << i;
+        EXPECT_EQ(run.res[i].bad, 0u) << "zerocopy=" << i;
+    }
+    EXPECT_EQ(run.res[0].zerocopy, FLB_FALSE);
+
+    /*
+     * A kernel without MSG_ZEROCOPY falls back to copies. Otherwise every
+     * send was completed and reaped before the write returned.
+     */
+    if (run.res[1].zerocopy == FLB_TRUE) {
+        EXPECT_TRUE(run.res[1].zc_sent > 0);
+        EXPECT_EQ(run.res[1].zc_pending, 0u);
+    }
+    else {
+        printf("[io] MSG_ZEROCOPY is not available, copies were checked\n");
+    }
+
+    flb_destroy(ctx);
+}
+
+/*
+ * Throughput with and without MSG_ZEROCOPY, the numbers are printed only:
+ * on loopback the kernel copies zero-copy pages when the data is
+ * delivered, a real NIC is needed to see the gain.
+ */
+TEST(IO, DISABLED_zerocopy_benchmark)
+{
+    size_t total = (size_t) IO_BENCH_BUF_SIZE * IO_BENCH_ROUNDS;
+    flb_ctx_t *ctx;
+    struct io_run run;
+
+    ctx = flb_create();
+    ASSERT_TRUE(ctx != NULL);
+
+    io_run(ctx, &run, IO_BENCH_BUF_SIZE, IO_BENCH_ROUNDS, FLB_FALSE);
+
+    EXPECT_EQ(run.res[0].received, total);
+    printf("[io] copy     : %zu MB in %.3fs, %.0f MB/s\n",
+           total >> 20, run.res[0].secs, (total >> 20) / run.res[0].secs);
+
+    EXPECT_EQ(run.res[1].received, total);
+    printf("[io] zerocopy : %zu MB in %.3fs, %.0f MB/s\n",
+           total >> 20, run.res[1].secs, (total >> 20) / run.res[1].secs);
+
+    flb_destroy(ctx);
+}
+
+/*
+ * HTTP client: five pipelined requests on one connection, the server
+ * answers all of them at once with interim, chunked, HEAD, oversized and
+ * empty responses.
+ */
+#define HTTP_REQUESTS    5
+#define HTTP_BIG_CHUNKS  25
+
+struct http_srv {
+    struct sink s;
+    int requests;               /* requests to read before answering */
+    char *resp;
+    size_t resp_len;
+};
+
+static void *http_srv_worker(void *data)
+{
+    int fd;
+    int n = 0;
+    ssize_t ret;
+    char buf[4096];
+    char *p;
+    struct http_srv *h = (struct http_srv *) data;
+
+    fd = accept(h->s.fd, NULL, NULL);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    /* GET and HEAD requests have no body: count the header ends */
+    while (n < h->requests && (ret = read(fd, buf, sizeof(buf) - 1)) > 0) {
+        buf[ret] = '\0';
+        p = buf;
+        while ((p = strstr(p, "\r\n\r\n")) != NULL) {
+            n++;
+            p += 4;
+        }
+    }
+    write(fd, h->resp, h->resp_len);
+    while (read(fd, buf, sizeof(buf)) > 0);
+    close(fd);
+
+    return NULL;
+}
+
+struct http_result {
+    struct flb_config *config;
+    int ret[HTTP_REQUESTS];
+    int status[HTTP_REQUESTS];
+    int truncated[HTTP_REQUESTS];
+    std::string payload[HTTP_REQUESTS];
+    int ka_close;
+};
+
+static void http_worker(void *data)
+{
+    int i;
+    int methods[HTTP_REQUESTS] = {
+        FLB_HTTP_GET, FLB_HTTP_GET, FLB_HTTP_HEAD, FLB_HTTP_GET, FLB_HTTP_GET
+    };
+    size_t b_sent;
+    pthread_t tid;
+    std::string resp;
+    struct http_srv h;
+    struct http_result *r = (struct http_result *) data;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+    struct flb_http_client *c = NULL;
+
+    resp  = "HTTP/1.1 100 Continue\r\n\r\n";
+    resp += "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+    resp += "HTTP/1.1 201 Created\r\ntransfer-encoding: chunked\r\n\r\n"
+            "3\r\nabc\r\n4;ext=1\r\ndefg\r\n0\r\nX-Trailer: 1\r\n\r\n";
+    resp += "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n";
+    resp += "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+    for (i = 0; i < HTTP_BIG_CHUNKS; i++) {
+        resp += "1000\r\n" + std::string(4096, 'a' + (i % 26)) + "\r\n";
+    }
+    resp += "0\r\n\r\n";
+    resp += "HTTP/1.1 204 No Content\r\n\r\n";
+
+    h.requests = HTTP_REQUESTS;
+    h.resp = (char *) resp.c_str();
+    h.resp_len = resp.size();
+    r->ka_close = -1;
+
+    if (sink_create(&h.s) == 0) {
+        pthread_create(&tid, NULL, http_srv_worker, &h);
+
+        u = flb_upstream_create(r->config, (char *) "127.0.0.1", h.s.port,
+                                FLB_IO_TCP, NULL);
+        u->flags &= ~(FLB_IO_ASYNC);
+        u_conn = flb_upstream_conn_get(u);
+
+        for (i = 0; u_conn && i < HTTP_REQUESTS; i++) {
+            if (i == 0) {
+                c = flb_http_client(u_conn, methods[i], (char *) "/",
+                                    NULL, 0, NULL, 0, NULL);
+            }
+            else {
+                flb_http_request(c, methods[i], (char *) "/", NULL, 0);
+            }
+            flb_http_send(c, &b_sent);
+        }
+
+        for (i = 0; c && i < HTTP_REQUESTS; i++) {
+            r->ret[i] = flb_http_response(c);
+            r->status[i] = c->resp.status;
+            r->truncated[i] = c->resp.truncated;
+            r->payload[i].assign(c->resp.payload, c->resp.payload_size);
+        }
+
+        if (u_conn) {
+            r->ka_close = u_conn->ka_close;
+            flb_http_client_destroy(c);
+            flb_upstream_conn_release(u_conn);
+        }
+        flb_upstream_destroy(u);
+        pthread_join(tid, NULL);
+        close(h.s.fd);
+    }
+}
+
+TEST(IO, http_client_pipeline)
+{
+    int ret;
+    flb_ctx_t *ctx;
+    struct http_result r;
+
+    ctx = flb_create();
+    ASSERT_TRUE(ctx != NULL);
+
+    r.config = ctx->config;
+    ret = flb_test_worker_run(ctx->config, http_worker, &r);
+    ASSERT_EQ(ret, 0);
+
+    EXPECT_EQ(r.ret[0], 0);
+    EXPECT_EQ(r.status[0], 200);
+    EXPECT_EQ(r.payload[0], "hello");
+
+    EXPECT_EQ(r.ret[1], 0);
+    EXPECT_EQ(r.status[1], 201);
+    EXPECT_EQ(r.payload[1], "abcdefg");
+
+    EXPECT_EQ(r.ret[2], 0);
+    EXPECT_EQ(r.status[2], 200);
+    EXPECT_EQ(r.payload[2].size(), 0u);
+
+    /* the body is larger than the response buffer */
+    EXPECT_EQ(r.ret[3], 0);
+    EXPECT_EQ(r.status[3], 200);
+    EXPECT_EQ(r.truncated[3], 1);
+    EXPECT_TRUE(r.payload[3].size() > 0);
+    EXPECT_TRUE(r.payload[3].size() < FLB_HTTP_DATA_SIZE_MAX);
+    EXPECT_EQ(r.payload[3].substr(0, 4096), std::string(4096, 'a'));
+
+    EXPECT_EQ(r.ret[4], 0);
+    EXPECT_EQ(r.status[4], 204);
+
+    /* every response was consumed, the connection can be reused */
+    EXPECT_EQ(r.ka_close, FLB_FALSE);
+
+    flb_destroy(ctx);
+}
+
+/*
+ * Invalid Content-Length values: negative, out of range, trailing garbage
+ * and conflicting duplicates. The response is rejected and the connection
+ * is not reused.
+ */
+#define HTTP_BAD_LENGTHS  5
+
+static const char *http_bad_lengths[HTTP_BAD_LENGTHS] = {
+    "Content-Length: -1\r\n",
+    "Content-Length: 18446744073709551617\r\n",
+    "Content-Length: 9223372036854775808\r\n",
+    "Content-Length: 12abc\r\n",
+    "Content-Length: 2\r\nContent-Length: 3\r\n"
+};
+
+struct http_bad_result {
+    struct flb_config *config;
+    int ret[HTTP_BAD_LENGTHS];
+    int ka_close[HTTP_BAD_LENGTHS];
+};
+
+static void http_bad_worker(void *data)
+{
+    int i;
+    size_t b_sent;
+    pthread_t tid;
+    std::string resp;
+    struct http_srv h;
+    struct http_bad_result *r = (struct http_bad_result *) data;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+    struct flb_http_client *c;
+
+    for (i = 0; i < HTTP_BAD_LENGTHS; i++) {
+        r->ret[i] = 0;
+        r->ka_close[i] = -1;
+
+        resp  = "HTTP/1.1 200 OK\r\n";
+        resp += http_bad_lengths[i];
+        resp += "\r\nabc";
+        h.requests = 1;
+        h.resp = (char *) resp.c_str();
+        h.resp_len = resp.size();
+
+        if (sink_create(&h.s) != 0) {
+            continue;
+        }
+        pthread_create(&tid, NULL, http_srv_worker, &h);
+
+        u = flb_upstream_create(r->config, (char *) "127.0.0.1", h.s.port,
+                                FLB_IO_TCP, NULL);
+        u->flags &= ~(FLB_IO_ASYNC);
+        u_conn = flb_upstream_conn_get(u);
+        if (u_conn) {
+            c = flb_http_client(u_conn, FLB_HTTP_GET, (char *) "/",
+                                NULL, 0, NULL, 0, NULL);
+            flb_http_send(c, &b_sent);
+            r->ret[i] = flb_http_response(c);
+            r->ka_close[i] = u_conn->ka_close;
+            flb_http_client_destroy(c);
+            flb_upstream_conn_release(u_conn);
+        }
+        flb_upstream_destroy(u);
+        pthread_join(tid, NULL);
+        close(h.s.fd);
+    }
+}
+
+TEST(IO, http_client_bad_length)
+{
+    int i;
+    int ret;
+    flb_ctx_t *ctx;
+    struct http_bad_result r;
+
+    ctx = flb_create();
+    ASSERT_TRUE(ctx != NULL);
+
+    r.config = ctx->config;
+    ret = flb_test_worker_run(ctx->config, http_bad_worker, &r);
+    ASSERT_EQ(ret, 0);
+
+    for (i = 0; i < HTTP_BAD_LENGTHS; i++) {
+        EXPECT_EQ(r.ret[i], -1) << http_bad_lengths[i];
+        EXPECT_EQ(r.ka_close[i], FLB_TRUE) << http_bad_lengths[i];
+    }
+
+    flb_destroy(ctx);
+}
+
+/*
+ * Net_IO_Timeout in blocking mode: the server never accepts nor reads,
+ * a read and a large write must give up once the deadline expires.
+ */
+#define TIMEOUT_WRITE_SIZE  (64 * 1024 * 1024)
+
+struct timeout_result {
+    struct flb_config *config;
+    int connected;
+    ssize_t read_ret;
+    int write_ret;
+    size_t write_sent;
+    double read_secs;
+    double write_secs;
+};
+
+static double elapsed(struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static void timeout_worker(void *data)
+{
+    char buf[64];
+    char *big;
+    struct timespec t0;
+    struct sink s;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+    struct timeout_result *r = (struct timeout_result *) data;
+
+    if (sink_create(&s) != 0) {
+        return;
+    }
+
+    u = flb_upstream_create(r->config, (char *) "127.0.0.1", s.port,
+                            FLB_IO_TCP, NULL);
+    u->flags &= ~(FLB_IO_ASYNC);
+    u->net_io_timeout = 1;
+
+    u_conn = flb_upstream_conn_get(u);
+    if (u_conn) {
+        r->connected = FLB_TRUE;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        r->read_ret = flb_io_net_read(u_conn, buf, sizeof(buf));
+        r->read_secs = elapsed(&t0);
+
+        big = (char *) malloc(TIMEOUT_WRITE_SIZE);
+        memset(big, 'x', TIMEOUT_WRITE_SIZE);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        r->write_ret = flb_io_net_write(u_conn, big, TIMEOUT_WRITE_SIZE,
+                                        &r->write_sent);
+        r->write_secs = elapsed(&t0);
+        free(big);
+
+        flb_upstream_conn_release(u_conn);
+    }
+    flb_upstream_destroy(u);
+    close(s.fd);
+}
+
+TEST(IO, blocking_timeout)
+{
+    int ret;
+    flb_ctx_t *ctx;
+    struct timeout_result r;
+
+    ctx = flb_create();
+    ASSERT_TRUE(ctx != NULL);
+
+    memset(&r, 0, sizeof(r));
+    r.config = ctx->config;
+    ret = flb_test_worker_run(ctx->config, timeout_worker, &r);
+    ASSERT_EQ(ret, 0);
+
+    ASSERT_EQ(r.connected, FLB_TRUE);
+
+    EXPECT_EQ(r.read_ret, -1);
+    EXPECT_LT(r.read_secs, 3.0);
+
+    EXPECT_EQ(r.write_ret, -1);
+    EXPECT_LT(r.write_sent, (size_t) TIMEOUT_WRITE_SIZE);
+    EXPECT_LT(r.write_secs, 3.0);
+
+    flb_destroy(ctx);
+}
@@ -0,0 +1,724 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+extern "C" {
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_pack_json.h>
+#include <fluent-bit/flb_record.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_error.h>
+}
+
+#include "data/json_es.h"
+#include "data/json_invalid.h"
+#include "data/json_long.h"
+#include "data/json_rsmall.h"
+#include "data/json_small.h"
+#include "data/json_td.h"
+
+#include "flb_test_helper.h"
+
+struct corpus {
+    const char *name;
+    const char *json;
+    size_t len;
+};
+
+static struct corpus corpora[] = {
+    { "json_es",     JSON_ES,     sizeof(JSON_ES) - 1     },
+    { "json_long",   JSON_LONG,   sizeof(JSON_LONG) - 1   },
+    { "json_rsmall", JSON_RSMALL, sizeof(JSON_RSMALL) - 1 },
+    { "json_small",  JSON_SMALL,  sizeof(JSON_SMALL) - 1  },
+    { "json_td",     JSON_TD,     sizeof(JSON_TD) - 1     },
+};
+
+#define N_CORPORA  (sizeof(corpora) / sizeof(struct corpus))
+
+/* Pack with the JSMN tokens path, the reference output */
+static std::string pack_jsmn(const char *js, size_t len, int *ret)
+{
+    int size;
+    char *buf;
+    std::string out;
+
+    *ret = flb_pack_json_jsmn((char *) js, len, &buf, &size);
+    if (*ret == 0) {
+        out.assign(buf, size);
+        free(buf);
+    }
+    return out;
+}
+
+static std::string pack_fast(const char *js, size_t len, int *ret)
+{
+    int size;
+    char *buf;
+    std::string out;
+
+    *ret = flb_pack_json((char *) js, len, &buf, &size);
+    if (*ret == 0) {
+        out.assign(buf, size);
+        free(buf);
+    }
+    return out;
+}
+
+/* Pack with a given structural scanner */
+static std::string pack_scanner(int simd, const char *js, size_t len,
+                                int *ret)
+{
+    int records;
+    size_t consumed;
+    std::string out;
+    msgpack_sbuffer sbuf;
+    struct flb_pack_json pj;
+
+    flb_pack_json_init(&pj);
+    pj.simd = simd;
+    msgpack_sbuffer_init(&sbuf);
+
+    *ret = flb_pack_json_buffer(&pj, (char *) js, len, &sbuf,
+                                &consumed, &records);
+    if (*ret == 0) {
+        out.assign(sbuf.data, sbuf.size);
+    }
+    msgpack_sbuffer_destroy(&sbuf);
+    flb_pack_json_destroy(&pj);
+
+    return out;
+}
+
+TEST(Pack, json_corpora)
+{
+    int i;
+    int simd;
+    int ret_a;
+    int ret_b;
+    std::string a;
+    std::string b;
+
+    for (i = 0; i < (int) N_CORPORA; i++) {
+        a = pack_jsmn(corpora[i].json, corpora[i].len, &ret_a);
+        b = pack_fast(corpora[i].json, corpora[i].len, &ret_b);
+        EXPECT_EQ(ret_a, 0) << corpora[i].name;
+        EXPECT_EQ(ret_b, 0) << corpora[i].name;
+        EXPECT_TRUE(a == b) << corpora[i].name;
+
+        for (simd = FLB_PACK_JSON_SCALAR; simd <= flb_pack_json_simd();
+             simd++) {
+            b = pack_scanner(simd, corpora[i].json, corpora[i].len, &ret_b);
+            EXPECT_EQ(ret_b, 0) << corpora[i].name << " simd=" << simd;
+            EXPECT_TRUE(a == b) << corpora[i].name << " simd=" << simd;
+        }
+    }
+
+    /* invalid data goes through the JSMN fallback */
+    a = pack_jsmn(JSON_INVALID, sizeof(JSON_INVALID) - 1, &ret_a);
+    b = pack_fast(JSON_INVALID, sizeof(JSON_INVALID) - 1, &ret_b);
+    EXPECT_EQ(ret_a, ret_b);
+    EXPECT_NE(ret_b, 0);
+}
+
+TEST(Pack, json_escapes_and_parts)
+{
+    int i;
+    int simd;
+    int ret_a;
+    int ret_b;
+    std::string js;
+    std::string a;
+    std::string b;
+
+    /* escaped quotes and backslashes crossing the 64 bytes blocks */
+    for (i = 0; i < 130; i++) {
+        js = "[" + std::string(i, ' ') +
+            "{\"k\\\"ey\": \"v\\\\\", \"x\": \"a\\\\\\\"{[,:b\","
+            " \"n\": [1, -2.5, true, false, null, {}, []],"
+            " \"e\": \"\\\\\\\\\"}, 10]   {\"second\": \"rec\"}\n";
+
+        a = pack_jsmn(js.c_str(), js.size(), &ret_a);
+        b = pack_fast(js.c_str(), js.size(), &ret_b);
+        ASSERT_EQ(ret_a, 0) << i;
+        ASSERT_EQ(ret_b, 0) << i;
+        ASSERT_TRUE(a == b) << i;
+
+        for (simd = FLB_PACK_JSON_SCALAR; simd <= flb_pack_json_simd();
+             simd++) {
+            b = pack_scanner(simd, js.c_str(), js.size(), &ret_b);
+            ASSERT_EQ(ret_b, 0) << i << " simd=" << simd;
+            ASSERT_TRUE(a == b) << i << " simd=" << simd;
+        }
+    }
+
+    /* every prefix of a record is incomplete */
+    js = "{\"key\": \"va\\\"lue\", \"arr\": [1, 2, {\"a\": null}]}";
+    for (i = 1; i < (int) js.size(); i++) {
+        pack_fast(js.c_str(), i, &ret_b);
+        EXPECT_EQ(ret_b, FLB_ERR_JSON_PART) << js.substr(0, i);
+    }
+}
+
+/*
+ * Feed 'js' to the stream packer in pieces of 'step' bytes, removing the
+ * consumed bytes as the input plugins do.
+ */
+static std::string pack_stream(const char *js, size_t len, size_t step,
+                               int *ret)
+{
+    int size;
+    char *pack;
+    size_t off = 0;
+    size_t consumed;
+    std::string buf;
+    std::string out;
+    struct flb_pack_json pj;
+
+    flb_pack_json_init(&pj);
+    *ret = FLB_ERR_JSON_PART;
+
+    while (off < len) {
+        buf.append(js + off, std::min(step, len - off));
+        off += std::min(step, len - off);
+
+        *ret = flb_pack_json_stream(&pj, (char *) buf.data(), buf.size(),
+                                    &pack, &size, &consumed);
+        if (*ret == FLB_ERR_JSON_PART) {
+            continue;
+        }
+        else if (*ret != 0) {
+            break;
+        }
+        out.append(pack, size);
+        free(pack);
+        buf.erase(0, consumed);
+    }
+    flb_pack_json_destroy(&pj);
+
+    if (*ret == FLB_ERR_JSON_PART && out.size() > 0) {
+        *ret = 0;
+    }
+    return out;
+}
+
+TEST(Pack, json_stream)
+{
+    int i;
+    int ret_a;
+    int ret_b;
+    size_t step;
+    size_t steps[] = { 1, 3, 7, 63, 64, 65, 500, 4096 };
+    std::string js;
+    std::string a;
+    std::string b;
+
+    for (i = 0; i < (int) N_CORPORA; i++) {
+        a = pack_jsmn(corpora[i].json, corpora[i].len, &ret_a);
+        ASSERT_EQ(ret_a, 0);
+
+        for (step = 0; step < sizeof(steps) / sizeof(size_t); step++) {
+            b = pack_stream(corpora[i].json, corpora[i].len, steps[step],
+                            &ret_b);
+            EXPECT_EQ(ret_b, 0) << corpora[i].name << " step=" << steps[step];
+            EXPECT_TRUE(a == b) << corpora[i].name << " step=" << steps[step];
+        }
+    }
+
+    /* many records with escapes, separated by white space */
+    js = "";
+    a = "";
+    for (i = 0; i < 50; i++) {
+        b = "{\"k\\\"" + std::to_string(i) + "\": [\"a\\\\\", " +
+            std::to_string(i * 3) + ", {\"x\": -1.5}], \"s\": \"" +
+            std::string(i * 7, 'z') + "\"}";
+        a += pack_jsmn(b.c_str(), b.size(), &ret_a);
+        js += b + std::string(i % 5, '\n');
+    }
+    for (step = 1; step < 150; step += 13) {
+        b = pack_stream(js.c_str(), js.size(), step, &ret_b);
+        EXPECT_EQ(ret_b, 0) << "step=" << step;
+        EXPECT_TRUE(a == b) << "step=" << step;
+    }
+
+    /* invalid data after a valid record */
+    js = "{\"a\": 1} {\"b\": 2} x {\"c\": 3}";
+    pack_stream(js.c_str(), js.size(), 1, &ret_b);
+    EXPECT_EQ(ret_b, FLB_ERR_JSON_INVAL);
+}
+
+/* A key or value view against the msgpack-c object */
+static void check_view(msgpack_object *view, char *raw, size_t size,
+                       msgpack_object *ref)
+{
+    size_t off = 0;
+    msgpack_unpacked value;
+
+    msgpack_unpacked_init(&value);
+    ASSERT_TRUE(msgpack_unpack_next(&value, raw, size, &off));
+    EXPECT_EQ(off, size);
+    EXPECT_TRUE(msgpack_object_equal(value.data, *ref));
+    msgpack_unpacked_destroy(&value);
+
+    if (view->type == MSGPACK_OBJECT_MAP) {
+        EXPECT_EQ(view->via.map.size, ref->via.map.size);
+    }
+    else if (view->type == MSGPACK_OBJECT_ARRAY) {
+        EXPECT_EQ(view->via.array.size, ref->via.array.size);
+    }
+    else {
+        EXPECT_TRUE(msgpack_object_equal(*view, *ref));
+    }
+}
+
+/* Records with every MessagePack type, the iterator must agree with msgpack-c */
+TEST(Pack, record_iter)
+{
+    int i;
+    int n;
+    int count;
+    size_t off = 0;
+    std::string big(70000, 'b');
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    msgpack_unpacked result;
+    msgpack_object map;
+    struct flb_record rec;
+    struct flb_record_kv kv;
+    struct flb_record_iter it;
+    struct flb_chunk_meta meta;
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    for (i = 0; i < 3; i++) {
+        msgpack_pack_array(&pck, 2);
+        if (i == 2) {
+            msgpack_pack_double(&pck, 1500000002.5);
+        }
+        else {
+            msgpack_pack_uint64(&pck, 1500000000 + i);
+        }
+
+        msgpack_pack_map(&pck, 19);
+        msgpack_pack_str(&pck, 1);
+        msgpack_pack_str_body(&pck, "a", 1);
+        msgpack_pack_int8(&pck, -5);
+        msgpack_pack_bin(&pck, 2);
+        msgpack_pack_bin_body(&pck, "bb", 2);
+        msgpack_pack_int16(&pck, -3000);
+        msgpack_pack_int(&pck, 1);
+        msgpack_pack_int32(&pck, -70000);
+        msgpack_pack_int(&pck, 2);
+        msgpack_pack_int64(&pck, -5000000000LL);
+        msgpack_pack_int(&pck, 3);
+        msgpack_pack_uint64(&pck, 18446744073709551615ULL);
+        msgpack_pack_int(&pck, 4);
+        msgpack_pack_int32(&pck, 70000);
+        msgpack_pack_int(&pck, 5);
+        msgpack_pack_float(&pck, 1.5);
+        msgpack_pack_int(&pck, 6);
+        msgpack_pack_double(&pck, -2.25);
+        msgpack_pack_int(&pck, 7);
+        msgpack_pack_nil(&pck);
+        msgpack_pack_true(&pck);
+        msgpack_pack_false(&pck);
+        msgpack_pack_str(&pck, 40);
+        msgpack_pack_str_body(&pck, big.data(), 40);
+        msgpack_pack_str(&pck, 300);
+        msgpack_pack_str_body(&pck, big.data(), 300);
+        msgpack_pack_bin(&pck, big.size());
+        msgpack_pack_bin_body(&pck, big.data(), big.size());
+        msgpack_pack_int(&pck, 8);
+        msgpack_pack_ext(&pck, 8, 0);
+        msgpack_pack_ext_body(&pck, "12345678", 8);
+        msgpack_pack_int(&pck, 9);
+        msgpack_pack_ext(&pck, 5, 3);
+        msgpack_pack_ext_body(&pck, "12345", 5);
+
+        /* nested containers, the value is only sized */
+        msgpack_pack_int(&pck, 10);
+        msgpack_pack_map(&pck, 1);
+        msgpack_pack_int(&pck, 1);
+        msgpack_pack_array(&pck, 20);
+        for (n = 0; n < 20; n++) {
+            msgpack_pack_int(&pck, n * 1000);
+        }
+        msgpack_pack_array(&pck, 0);
+        msgpack_pack_map(&pck, 0);
+        msgpack_pack_int(&pck, 11);
+        msgpack_pack_uint8(&pck, 200);
+        msgpack_pack_int(&pck, 12);
+        msgpack_pack_uint16(&pck, 60000);
+        msgpack_pack_int(&pck, 13);
+        msgpack_pack_int(&pck, -1);
+        msgpack_pack_int(&pck, 14);
+
+        /* entries that are not records */
+        msgpack_pack_str(&pck, 3);
+        msgpack_pack_str_body(&pck, "abc", 3);
+        msgpack_pack_array(&pck, 2);
+        msgpack_pack_int(&pck, 1);
+        msgpack_pack_int(&pck, 2);
+    }
+
+    count = 0;
+    msgpack_unpacked_init(&result);
+    flb_record_iter_init(&it, sbuf.data, sbuf.size);
+    while (msgpack_unpack_next(&result, sbuf.data, sbuf.size, &off)) {
+        count++;
+        if (result.data.type != MSGPACK_OBJECT_ARRAY ||
+            result.data.via.array.size != 2 ||
+            result.data.via.array.ptr[1].type != MSGPACK_OBJECT_MAP) {
+            continue;
+        }
+
+        ASSERT_TRUE(flb_record_iter_next(&it, &rec));
+        EXPECT_EQ(it.offset, off);
+        EXPECT_TRUE(msgpack_object_equal(rec.time,
+                                         result.data.via.array.ptr[0]));
+        EXPECT_EQ(flb_record_time(&rec), 1500000000 + (count - 1) / 3);
+
+        map = result.data.via.array.ptr[1];
+        ASSERT_EQ(rec.size, map.via.map.size);
+        for (n = 0; n < (int) map.via.map.size; n++) {
+            ASSERT_TRUE(flb_record_kv_next(&rec, &kv));
+            check_view(&kv.key, kv.key_raw, kv.key_size,
+                       &map.via.map.ptr[n].key);
+            check_view(&kv.val, kv.val_raw, kv.val_size,
+                       &map.via.map.ptr[n].val);
+        }
+        EXPECT_FALSE(flb_record_kv_next(&rec, &kv));
+    }
+    EXPECT_FALSE(flb_record_iter_next(&it, &rec));
+    EXPECT_EQ(count, flb_record_count(sbuf.data, sbuf.size));
+    EXPECT_EQ(count, 9);
+
+    /* chunk metadata matches the count, times come from the records */
+    flb_chunk_meta_scan(&meta, sbuf.data, sbuf.size);
+    EXPECT_EQ((int) meta.records, count);
+    EXPECT_EQ(meta.bytes, sbuf.size);
+    EXPECT_EQ(meta.t_first, 1500000000);
+    EXPECT_EQ(meta.t_last, 1500000002);
+    EXPECT_EQ(meta.t_min, 1500000000);
+    EXPECT_EQ(meta.t_max, 1500000002);
+
+    flb_chunk_meta_init(&meta);
+    flb_chunk_meta_add(&meta, 20, 10);
+    flb_chunk_meta_add(&meta, 10, 10);
+    flb_chunk_meta_add(&meta, 30, 10);
+    flb_chunk_meta_add(&meta, 15, 10);
+    EXPECT_EQ(meta.records, 4U);
+    EXPECT_EQ(meta.bytes, 40U);
+    EXPECT_EQ(meta.t_first, 20);
+    EXPECT_EQ(meta.t_last, 15);
+    EXPECT_EQ(meta.t_min, 10);
+    EXPECT_EQ(meta.t_max, 30);
+
+    /* a truncated record is not returned */
+    flb_record_iter_init(&it, sbuf.data, sbuf.size - 100);
+    for (n = 0; flb_record_iter_next(&it, &rec); n++);
+    EXPECT_EQ(n, 2);
+
+    msgpack_unpacked_destroy(&result);
+    msgpack_sbuffer_destroy(&sbuf);
+}
+
+static std::string json_str(const char *str, size_t len, int flags)
+{
+    int ret;
+    std::string js;
+    msgpack_sbuffer out;
+
+    msgpack_sbuffer_init(&out);
+    ret = flb_msgpack_to_json_str(&out, (char *) str, len, flags);
+    EXPECT_EQ(ret, 0);
+    js.assign(out.data, out.size);
+    msgpack_sbuffer_destroy(&out);
+
+    return js;
+}
+
+/* Escaping, UTF-8 validation, the SIMD loop must find specials at any offset */
+TEST(Pack, json_escape_str)
+{
+    int i;
+    std::string in;
+    std::string expect;
+    const char utf8[] = "\xc3\xb1 \xe2\x82\xac \xf0\x9f\x98\x80";
+    const char bad[] = "\xff|\xc0\xaf|\xed\xa0\x80|\xf4\x90\x80\x80|\xe2\x82";
+
+    EXPECT_EQ(json_str("", 0, 0), "\"\"");
+    EXPECT_EQ(json_str("a\"b\\c/", 6, 0), "\"a\\\"b\\\\c/\"");
+    EXPECT_EQ(json_str("\b\f\n\r\t\x01\x1f", 7, 0),
+              "\"\\b\\f\\n\\r\\t\\u0001\\u001f\"");
+    EXPECT_EQ(json_str("a\0b", 3, 0), "\"a\\u0000b\"");
+    EXPECT_EQ(json_str(utf8, sizeof(utf8) - 1, 0),
+              std::string("\"") + utf8 + "\"");
+    EXPECT_EQ(json_str(bad, sizeof(bad) - 1, 0),
+              "\"\\ufffd|\\ufffd\\ufffd|\\ufffd\\ufffd\\ufffd|"
+              "\\ufffd\\ufffd\\ufffd\\ufffd|\\ufffd\\ufffd\"");
+    EXPECT_EQ(json_str("a.b.\"c", 6, FLB_JSON_NODOTS), "\"a_b_\\\"c\"");
+
+    for (i = 0; i < 40; i++) {
+        in.assign(40, 'x');
+        in[i] = '\n';
+        expect = "\"" + in.substr(0, i) + "\\n" + in.substr(i + 1) + "\"";
+        EXPECT_EQ(json_str(in.c_str(), in.size(), 0), expect);
+
+        in[i] = '\xe9';
+        expect = "\"" + in.substr(0, i) + "\\ufffd" + in.substr(i + 1) + "\"";
+        EXPECT_EQ(json_str(in.c_str(), in.size(), 0), expect);
+    }
+}
+
+/* Records with nested values to JSON, as an array and as lines */
+TEST(Pack, json_from_records)
+{
+    int ret;
+    msgpack_sbuffer sbuf;
+    msgpack_sbuffer out;
+    msgpack_packer pck;
+    std::string js;
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    msgpack_pack_array(&pck, 2);
+    msgpack_pack_uint64(&pck, 1500000000);
+    msgpack_pack_map(&pck, 6);
+    msgpack_pack_str(&pck, 5);
+    msgpack_pack_str_body(&pck, "a.key", 5);
+    msgpack_pack_str(&pck, 3);
+    msgpack_pack_str_body(&pck, "x\ty", 3);
+    msgpack_pack_int(&pck, 7);                   /* skipped, not a string */
+    msgpack_pack_true(&pck);
+    msgpack_pack_str(&pck, 1);
+    msgpack_pack_str_body(&pck, "n", 1);
+    msgpack_pack_int64(&pck, -12345678901LL);
+    msgpack_pack_str(&pck, 1);
+    msgpack_pack_str_body(&pck, "f", 1);
+    msgpack_pack_double(&pck, 0.5);
+    msgpack_pack_str(&pck, 1);
+    msgpack_pack_str_body(&pck, "m", 1);
+    msgpack_pack_map(&pck, 4);
+    msgpack_pack_str(&pck, 3);
+    msgpack_pack_str_body(&pck, "b.c", 3);
+    msgpack_pack_array(&pck, 3);
+    msgpack_pack_nil(&pck);
+    msgpack_pack_array(&pck, 0);
+    msgpack_pack_map(&pck, 0);
+    msgpack_pack_uint8(&pck, 1);                 /* scalar key, quoted */
+    msgpack_pack_double(&pck, 2.0);
+    msgpack_pack_array(&pck, 1);                 /* skipped, container key */
+    msgpack_pack_nil(&pck);
+    msgpack_pack_false(&pck);
+    msgpack_pack_bin(&pck, 1);
+    msgpack_pack_bin_body(&pck, "z", 1);
+    msgpack_pack_ext(&pck, 1, 1);
+    msgpack_pack_ext_body(&pck, "e", 1);
+    msgpack_pack_str(&pck, 1);
+    msgpack_pack_str_body(&pck, "i", 1);
+    msgpack_pack_uint64(&pck, 18446744073709551615ULL);
+
+    /* not a record, skipped */
+    msgpack_pack_uint8(&pck, 3);
+
+    msgpack_pack_array(&pck, 2);
+    msgpack_pack_double(&pck, 1500000001.9);
+    msgpack_pack_map(&pck, 0);
+
+    msgpack_sbuffer_init(&out);
+    ret = flb_msgpack_to_json(&out, sbuf.data, sbuf.size,
+                              FLB_JSON_FORMAT_ARRAY, (char *) "date", 0);
+    EXPECT_EQ(ret, 2);
+    js.assign(out.data, out.size);
+    EXPECT_EQ(js,
+              "[{\"date\":1500000000,\"a.key\":\"x\\ty\",\"n\":-12345678901,"
+              "\"f\":0.5,\"m\":{\"b.c\":[null,[],{}],\"1\":2.0,\"z\":null},"
+              "\"i\":18446744073709551615},{\"date\":1500000001.9}]");
+    msgpack_sbuffer_destroy(&out);
+
+    msgpack_sbuffer_init(&out);
+    ret = flb_msgpack_to_json(&out, sbuf.data, sbuf.size,
+                              FLB_JSON_FORMAT_LINES, NULL, FLB_JSON_NODOTS);
+    EXPECT_EQ(ret, 2);
+    js.assign(out.data, out.size);
+    EXPECT_EQ(js,
+              "{\"a_key\":\"x\\ty\",\"n\":-12345678901,"
+              "\"f\":0.5,\"m\":{\"b_c\":[null,[],{}],\"1\":2.0,\"z\":null},"
+              "\"i\":18446744073709551615}\n{}\n");
+    msgpack_sbuffer_destroy(&out);
+
+    /* truncated input leaves the output as it was */
+    msgpack_sbuffer_init(&out);
+    msgpack_sbuffer_write(&out, "x", 1);
+    ret = flb_msgpack_to_json_value(&out, sbuf.data + 6, 20, 0);
+    EXPECT_EQ(ret, -1);
+    EXPECT_EQ(out.size, 1);
+    msgpack_sbuffer_destroy(&out);
+
+    msgpack_sbuffer_destroy(&sbuf);
+}
+
+/*
+ * Records nested deeper than FLB_PACK_JSON_DEPTH are skipped with a
+ * warning, the other records of the chunk are converted. The warning
+ * needs a worker context.
+ */
+struct json_skip_run {
+    int ret[2];
+    std::string js[2];
+};
+
+static void json_skip_pack(msgpack_packer *pck, int t, const char *key)
+{
+    msgpack_pack_array(pck, 2);
+    msgpack_pack_uint64(pck, t);
+    msgpack_pack_map(pck, 1);
+    msgpack_pack_str(pck, 1);
+    msgpack_pack_str_body(pck, key, 1);
+    msgpack_pack_uint8(pck, t);
+}
+
+static void json_skip_worker(void *data)
+{
+    int i;
+    int f;
+    int formats[2] = {FLB_JSON_FORMAT_ARRAY, FLB_JSON_FORMAT_LINES};
+    msgpack_sbuffer sbuf;
+    msgpack_sbuffer out;
+    msgpack_packer pck;
+    struct json_skip_run *r = (struct json_skip_run *) data;
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    /* too deep, valid, too deep, valid */
+    for (i = 0; i < 4; i++) {
+        if (i % 2 == 1) {
+            json_skip_pack(&pck, i, i == 1 ? "a" : "b");
+            continue;
+        }
+        msgpack_pack_array(&pck, 2);
+        msgpack_pack_uint64(&pck, i);
+        msgpack_pack_map(&pck, 1);
+        msgpack_pack_str(&pck, 1);
+        msgpack_pack_str_body(&pck, "d", 1);
+        for (f = 0; f < FLB_PACK_JSON_DEPTH + 1; f++) {
+            msgpack_pack_array(&pck, 1);
+        }
+        msgpack_pack_nil(&pck);
+    }
+
+    for (i = 0; i < 2; i++) {
+        msgpack_sbuffer_init(&out);
+        r->ret[i] = flb_msgpack_to_json(&out, sbuf.data, sbuf.size,
+                                        formats[i], (char *) "date", 0);
+        r->js[i].assign(out.data, out.size);
+        msgpack_sbuffer_destroy(&out);
+    }
+
+    msgpack_sbuffer_destroy(&sbuf);
+}
+
+TEST(Pack, json_skip_deep_record)
+{
+    int ret;
+    flb_ctx_t *ctx;
+    struct json_skip_run r;
+
+    ctx = flb_create();
+    ASSERT_TRUE(ctx != NULL);
+
+    ret = flb_test_worker_run(ctx->config, json_skip_worker, &r);
+    ASSERT_EQ(ret, 0);
+
+    EXPECT_EQ(r.ret[0], 2);
+    EXPECT_EQ(r.js[0], "[{\"date\":1,\"a\":1},{\"date\":3,\"b\":3}]");
+    EXPECT_EQ(r.ret[1], 2);
+    EXPECT_EQ(r.js[1], "{\"date\":1,\"a\":1}\n{\"date\":3,\"b\":3}\n");
+
+    flb_destroy(ctx);
+}
+
+/* JSON -> MessagePack -> JSON -> MessagePack gives the same bytes */
+TEST(Pack, json_roundtrip)
+{
+    int i;
+    int ret;
+    std::string mp1;
+    std::string mp2;
+    msgpack_sbuffer out;
+
+    for (i = 0; i < (int) N_CORPORA; i++) {
+        mp1 = pack_fast(corpora[i].json, corpora[i].len, &ret);
+        ASSERT_EQ(ret, 0) << corpora[i].name;
+
+        msgpack_sbuffer_init(&out);
+        ret = flb_msgpack_to_json_value(&out, (char *) mp1.data(),
+                                        mp1.size(), 0);
+        ASSERT_EQ(ret, 0) << corpora[i].name;
+
+        mp2 = pack_fast(out.data, out.size, &ret);
+        EXPECT_EQ(ret, 0) << corpora[i].name;
+        EXPECT_TRUE(mp1 == mp2) << corpora[i].name;
+        msgpack_sbuffer_destroy(&out);
+    }
+}
+
+static double bench(std::string (*fn)(const char *, size_t, int *),
+                    struct corpus *c, int rounds)
+{
+    int i;
+    int ret;
+    struct timespec t0;
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < rounds; i++) {
+        fn(c->json, c->len, &ret);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+/* Throughput of both packers, the numbers are printed only */
+TEST(Pack, json_benchmark)
+{
+    int i;
+    int rounds;
+    double mb;
+    double t_jsmn;
+    double t_fast;
+
+    printf("[pack] scanner=%s\n",
+           flb_pack_json_simd() == FLB_PACK_JSON_AVX2 ? "avx2" :
+           flb_pack_json_simd() == FLB_PACK_JSON_SSE42 ? "sse4.2" :
+           "scalar");
+
+    for (i = 0; i < (int) N_CORPORA; i++) {
+        rounds = (64 * 1024 * 1024) / corpora[i].len;
+        if (rounds > 20000) {
+            rounds = 20000;
+        }
+        if (rounds < 20) {
+            rounds = 20;
+        }
+        mb = (double) corpora[i].len * rounds / (1024 * 1024);
+
+        t_jsmn = bench(pack_jsmn, &corpora[i], rounds);
+        t_fast = bench(pack_fast, &corpora[i], rounds);
+
+        printf("[pack] %-12s %8zu bytes: jsmn %7.1f MB/s, "
+               "structural %7.1f MB/s (x%.2f)\n",
+               corpora[i].name, corpora[i].len,
+               mb / t_jsmn, mb / t_fast, t_jsmn / t_fast);
+        EXPECT_TRUE(t_fast > 0);
+    }
+}
@@ -0,0 +1,88 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+extern "C" {
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_record.h>
+#include <fluent-bit/flb_time.h>
+}
+
+/* EventTime records, the time keeps its nanoseconds */
+TEST(Time, event_time)
+{
+    int ret;
+    size_t off = 0;
+    time_t t;
+    msgpack_sbuffer sbuf;
+    msgpack_sbuffer out;
+    msgpack_packer pck;
+    msgpack_unpacked result;
+    struct flb_time tm;
+    struct flb_time now;
+    struct flb_chunk_meta meta;
+    std::string js;
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    flb_time_set(&tm, 1500000000, 5);
+    msgpack_pack_array(&pck, 2);
+    flb_time_append_to_msgpack(&tm, &pck);
+    msgpack_pack_map(&pck, 1);
+    msgpack_pack_str(&pck, 1);
+    msgpack_pack_str_body(&pck, "a", 1);
+    msgpack_pack_int(&pck, 1);
+
+    flb_time_set(&tm, 1500000001, 999999999);
+    msgpack_pack_array(&pck, 2);
+    flb_time_append_to_msgpack(&tm, &pck);
+    msgpack_pack_map(&pck, 0);
+
+    /* Fluentd layout: ext 8 type 0, seconds and nanoseconds big endian */
+    EXPECT_EQ(memcmp(sbuf.data + 1, "\xd7\x00\x59\x68\x2f\x00"
+                     "\x00\x00\x00\x05", 10), 0);
+
+    msgpack_unpacked_init(&result);
+    ASSERT_TRUE(msgpack_unpack_next(&result, sbuf.data, sbuf.size, &off));
+    ASSERT_EQ(flb_time_pop_from_msgpack(&tm,
+                                        &result.data.via.array.ptr[0]), 0);
+    EXPECT_EQ(tm.tm.tv_sec, 1500000000);
+    EXPECT_EQ(tm.tm.tv_nsec, 5);
+    ASSERT_EQ(flb_record_time_get(&result.data.via.array.ptr[0], &t), 0);
+    EXPECT_EQ(t, 1500000000);
+
+    /* other extension types are not a time */
+    off = 0;
+    ASSERT_TRUE(msgpack_unpack_next(&result, "\xd7\x01" "12345678", 10,
+                                    &off));
+    EXPECT_EQ(flb_time_pop_from_msgpack(&tm, &result.data), -1);
+    msgpack_unpacked_destroy(&result);
+
+    flb_chunk_meta_scan(&meta, sbuf.data, sbuf.size);
+    EXPECT_EQ(meta.records, 2U);
+    EXPECT_EQ(meta.t_first, 1500000000);
+    EXPECT_EQ(meta.t_last, 1500000001);
+
+    msgpack_sbuffer_init(&out);
+    ret = flb_msgpack_to_json(&out, sbuf.data, sbuf.size,
+                              FLB_JSON_FORMAT_LINES, (char *) "date", 0);
+    EXPECT_EQ(ret, 2);
+    js.assign(out.data, out.size);
+    EXPECT_EQ(js, "{\"date\":1500000000.000000005,\"a\":1}\n"
+              "{\"date\":1500000001.999999999}\n");
+    msgpack_sbuffer_destroy(&out);
+    msgpack_sbuffer_destroy(&sbuf);
+
+    /* the cached clock follows the real one */
+    flb_time_update();
+    flb_time_now(&tm);
+    flb_time_get(&now);
+    EXPECT_LE(tm.tm.tv_sec, now.tm.tv_sec);
+    EXPECT_GE(tm.tm.tv_sec + 1, now.tm.tv_sec);
+}
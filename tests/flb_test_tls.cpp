@@ -0,0 +1,281 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+extern "C" {
+#include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_io_tls.h>
+#include <fluent-bit/flb_upstream.h>
+#include <mbedtls/certs.h>
+#include <mbedtls/ssl_cache.h>
+#include <mbedtls/ssl_ticket.h>
+}
+
+#include "flb_test_helper.h"
+
+/*
+ * Local TLS server with the mbedTLS test certificate. It resumes sessions
+ * from its cache (session ID) or from session tickets, one connection at
+ * a time: the handshake, then it waits for the client to close.
+ */
+#define TLS_CONNS  4
+
+struct tls_srv {
+    int fd;
+    int port;
+    int handshakes;
+    pthread_t tid;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    mbedtls_x509_crt crt;
+    mbedtls_pk_context key;
+    mbedtls_ssl_cache_context cache;
+    mbedtls_ssl_ticket_context ticket;
+    mbedtls_ssl_config conf;
+};
+
+static void *tls_srv_worker(void *data)
+{
+    int ret;
+    char buf[256];
+    mbedtls_net_context client;
+    mbedtls_ssl_context ssl;
+    struct tls_srv *s = (struct tls_srv *) data;
+
+    while ((client.fd = accept(s->fd, NULL, NULL)) >= 0) {
+        mbedtls_ssl_init(&ssl);
+        mbedtls_ssl_setup(&ssl, &s->conf);
+        mbedtls_ssl_set_bio(&ssl, &client,
+                            mbedtls_net_send, mbedtls_net_recv, NULL);
+
+        do {
+            ret = mbedtls_ssl_handshake(&ssl);
+        } while (ret == MBEDTLS_ERR_SSL_WANT_READ ||
+                 ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+
+        if (ret == 0) {
+            s->handshakes++;
+            while (mbedtls_ssl_read(&ssl, (unsigned char *) buf,
+                                    sizeof(buf)) > 0);
+        }
+
+        mbedtls_ssl_free(&ssl);
+        close(client.fd);
+    }
+
+    return NULL;
+}
+
+static int tls_srv_start(struct tls_srv *s, int tickets)
+{
+    memset(s, 0, sizeof(struct tls_srv));
+    mbedtls_entropy_init(&s->entropy);
+    mbedtls_ctr_drbg_init(&s->ctr_drbg);
+    mbedtls_x509_crt_init(&s->crt);
+    mbedtls_pk_init(&s->key);
+    mbedtls_ssl_cache_init(&s->cache);
+    mbedtls_ssl_ticket_init(&s->ticket);
+    mbedtls_ssl_config_init(&s->conf);
+
+    if (mbedtls_ctr_drbg_seed(&s->ctr_drbg, mbedtls_entropy_func,
+                              &s->entropy, NULL, 0) != 0 ||
+        mbedtls_x509_crt_parse(&s->crt,
+                               (const unsigned char *) mbedtls_test_srv_crt,
+                               mbedtls_test_srv_crt_len) != 0 ||
+        mbedtls_pk_parse_key(&s->key,
+                             (const unsigned char *) mbedtls_test_srv_key,
+                             mbedtls_test_srv_key_len, NULL, 0) != 0 ||
+        mbedtls_ssl_config_defaults(&s->conf, MBEDTLS_SSL_IS_SERVER,
+                                    MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        return -1;
+    }
+
+    mbedtls_ssl_conf_rng(&s->conf, mbedtls_ctr_drbg_random, &s->ctr_drbg);
+    if (mbedtls_ssl_conf_own_cert(&s->conf, &s->crt, &s->key) != 0) {
+        return -1;
+    }
+
+    if (tickets) {
+        if (mbedtls_ssl_ticket_setup(&s->ticket, mbedtls_ctr_drbg_random,
+                                     &s->ctr_drbg, MBEDTLS_CIPHER_AES_256_GCM,
+                                     86400) != 0) {
+            return -1;
+        }
+        mbedtls_ssl_conf_session_tickets_cb(&s->conf,
+                                            mbedtls_ssl_ticket_write,
+                                            mbedtls_ssl_ticket_parse,
+                                            &s->ticket);
+    }
+    else {
+        mbedtls_ssl_conf_session_cache(&s->conf, &s->cache,
+                                       mbedtls_ssl_cache_get,
+                                       mbedtls_ssl_cache_set);
+    }
+
+    s->fd = flb_test_listen(SOCK_STREAM, 0, TLS_CONNS, &s->port);
+    if (s->fd == -1) {
+        return -1;
+    }
+
+    return pthread_create(&s->tid, NULL, tls_srv_worker, s);
+}
+
+static void tls_srv_stop(struct tls_srv *s)
+{
+    shutdown(s->fd, SHUT_RDWR);
+    pthread_join(s->tid, NULL);
+    close(s->fd);
+
+    mbedtls_ssl_config_free(&s->conf);
+    mbedtls_ssl_ticket_free(&s->ticket);
+    mbedtls_ssl_cache_free(&s->cache);
+    mbedtls_pk_free(&s->key);
+    mbedtls_x509_crt_free(&s->crt);
+    mbedtls_ctr_drbg_free(&s->ctr_drbg);
+    mbedtls_entropy_free(&s->entropy);
+}
+
+/* Results of the connections, they run on a worker */
+struct tls_run {
+    struct flb_config *config;
+    char *ca_file;
+    int tickets;
+    int session_resume;
+    int connected;
+    int handshakes;             /* seen by the server */
+    struct flb_tls_stats stats;
+};
+
+static void tls_worker(void *data)
+{
+    int i;
+    struct tls_srv s;
+    struct flb_tls tls;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+    struct tls_run *r = (struct tls_run *) data;
+
+    /* the test certificates expire, the handshake cost is the same */
+    tls.context = flb_tls_context_new(FLB_FALSE, r->ca_file, NULL, NULL, NULL);
+    tls.session_resume = r->session_resume;
+
+    if (tls.context && tls_srv_start(&s, r->tickets) == 0) {
+        u = flb_upstream_create(r->config, (char *) "127.0.0.1", s.port,
+                                FLB_IO_TCP | FLB_IO_TLS, &tls);
+        u->flags &= ~(FLB_IO_ASYNC);    /* no engine loop, blocking mode */
+        u->ka_enabled = FLB_FALSE;      /* one handshake per connection  */
+
+        for (i = 0; i < TLS_CONNS; i++) {
+            /*
+             * mbedTLS 2.2 rotates the ticket keys when used within the
+             * second they were created, the ticket would be dropped.
+             */
+            if (r->tickets) {
+                sleep(1);
+            }
+            u_conn = flb_upstream_conn_get(u);
+            if (u_conn) {
+                r->connected++;
+                flb_upstream_conn_release(u_conn);
+            }
+        }
+
+        flb_tls_stats_get(u, &r->stats);
+        flb_upstream_destroy(u);
+        tls_srv_stop(&s);
+        r->handshakes = s.handshakes;
+    }
+
+    if (tls.context) {
+        flb_tls_context_destroy(tls.context);
+    }
+}
+
+static void tls_run(struct tls_run *r, int tickets, int session_resume)
+{
+    int fd;
+    flb_ctx_t *ctx;
+    char ca_file[] = "/tmp/flb_test_tls_XXXXXX";
+
+    memset(r, 0, sizeof(struct tls_run));
+
+    fd = mkstemp(ca_file);
+    ASSERT_TRUE(fd >= 0);
+    ASSERT_EQ(write(fd, mbedtls_test_cas_pem, strlen(mbedtls_test_cas_pem)),
+              (ssize_t) strlen(mbedtls_test_cas_pem));
+    close(fd);
+
+    ctx = flb_create();
+    ASSERT_TRUE(ctx != NULL);
+
+    r->config = ctx->config;
+    r->ca_file = ca_file;
+    r->tickets = tickets;
+    r->session_resume = session_resume;
+    EXPECT_EQ(flb_test_worker_run(ctx->config, tls_worker, r), 0);
+
+    unlink(ca_file);
+    flb_destroy(ctx);
+}
+
+TEST(TLS, resume_session_id)
+{
+    struct tls_run r;
+
+    tls_run(&r, FLB_FALSE, FLB_TRUE);
+
+    EXPECT_EQ(r.connected, TLS_CONNS);
+    EXPECT_EQ(r.handshakes, TLS_CONNS);
+    EXPECT_EQ(r.stats.full, 1u);
+    EXPECT_EQ(r.stats.resumed, (uint64_t) TLS_CONNS - 1);
+    EXPECT_EQ(r.stats.failed, 0u);
+    EXPECT_GT(r.stats.usec_full, 0u);
+    EXPECT_GT(r.stats.usec_resumed, 0u);
+}
+
+TEST(TLS, resume_ticket)
+{
+    struct tls_run r;
+
+    tls_run(&r, FLB_TRUE, FLB_TRUE);
+
+    EXPECT_EQ(r.connected, TLS_CONNS);
+    EXPECT_EQ(r.stats.full, 1u);
+    EXPECT_EQ(r.stats.resumed, (uint64_t) TLS_CONNS - 1);
+    EXPECT_EQ(r.stats.failed, 0u);
+}
+
+TEST(TLS, resume_disabled)
+{
+    struct tls_run r;
+
+    tls_run(&r, FLB_FALSE, FLB_FALSE);
+
+    EXPECT_EQ(r.connected, TLS_CONNS);
+    EXPECT_EQ(r.stats.full, (uint64_t) TLS_CONNS);
+    EXPECT_EQ(r.stats.resumed, 0u);
+}
@@ -0,0 +1,450 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+
+extern "C" {
+#include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_upstream.h>
+}
+
+#include "flb_test_helper.h"
+
+/*
+ * Upstream connections to loopback servers in blocking mode. The servers
+ * accept and keep the connections open, the number of accepted ones tells
+ * if a connection was reused or created.
+ */
+#define SRV_MAX_CONNS  64
+
+struct srv {
+    int fd;
+    int port;
+    int accepted;
+    int conns[SRV_MAX_CONNS];
+    pthread_t tid;
+    pthread_mutex_t mutex;
+};
+
+static void *srv_worker(void *data)
+{
+    int fd;
+    struct srv *s = (struct srv *) data;
+
+    while ((fd = accept(s->fd, NULL, NULL)) >= 0) {
+        pthread_mutex_lock(&s->mutex);
+        if (s->accepted < SRV_MAX_CONNS) {
+            s->conns[s->accepted] = fd;
+        }
+        else {
+            close(fd);
+        }
+        s->accepted++;
+        pthread_mutex_unlock(&s->mutex);
+    }
+
+    return NULL;
+}
+
+/* Listen on 'port', zero picks a free one */
+static int srv_start(struct srv *s, int port)
+{
+    memset(s, 0, sizeof(struct srv));
+    s->fd = flb_test_listen(SOCK_STREAM, port, SRV_MAX_CONNS, &s->port);
+    if (s->fd == -1) {
+        return -1;
+    }
+
+    pthread_mutex_init(&s->mutex, NULL);
+    return pthread_create(&s->tid, NULL, srv_worker, s);
+}
+
+/* Wait up to a second for 'n' accepted connections, returns the count */
+static int srv_accepted(struct srv *s, int n)
+{
+    int i;
+    int ret = 0;
+
+    for (i = 0; i < 100; i++) {
+        pthread_mutex_lock(&s->mutex);
+        ret = s->accepted;
+        pthread_mutex_unlock(&s->mutex);
+        if (ret >= n) {
+            break;
+        }
+        usleep(10000);
+    }
+
+    return ret;
+}
+
+/* Close the server side of the accepted connections */
+static void srv_close_conns(struct srv *s)
+{
+    int i;
+
+    pthread_mutex_lock(&s->mutex);
+    for (i = 0; i < s->accepted && i < SRV_MAX_CONNS; i++) {
+        if (s->conns[i] >= 0) {
+            close(s->conns[i]);
+            s->conns[i] = -1;
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+}
+
+static void srv_stop(struct srv *s)
+{
+    shutdown(s->fd, SHUT_RDWR);
+    pthread_join(s->tid, NULL);
+    close(s->fd);
+    srv_close_conns(s);
+}
+
+/* Blocking connections, there is no engine loop */
+static struct flb_upstream *up_create(struct flb_config *config,
+                                      const char *host, int port)
+{
+    int i;
+    struct flb_upstream *u;
+
+    u = flb_upstream_create(config, (char *) host, port, FLB_IO_TCP, NULL);
+    if (!u) {
+        return NULL;
+    }
+
+    u->flags &= ~(FLB_IO_ASYNC);
+    for (i = 0; i < u->n_nodes; i++) {
+        u->nodes[i]->flags &= ~(FLB_IO_ASYNC);
+    }
+
+    return u;
+}
+
+/* Results of the tests, they run on a worker */
+struct up_run {
+    struct flb_config *config;
+
+    /* keepalive pool */
+    int reuse_same;             /* second get returned the pooled one   */
+    int reuse_pooled;           /* av_connections after a release       */
+    int reuse_created;
+    int reuse_reused;
+    int reuse_accepted;
+    int max_created;
+    int max_reused;
+    int max_accepted;
+    int idle_created;
+    int idle_reused;
+    int pool_av;                /* av_connections with a pool size of 1 */
+    int pool_n;
+
+    /* groups */
+    int eject_node[2];          /* connections per node                 */
+    int eject_fails;            /* failures of the refusing node        */
+    int eject_ejected;
+    int eject_held;             /* still ejected after more requests    */
+    int eject_recovered;        /* requests until the node is used      */
+    int eject_healthy;
+    int weight_idle[2];
+    int weight_busy[2];
+};
+
+static void up_run(struct up_run *r, void (*fn)(void *))
+{
+    flb_ctx_t *ctx;
+
+    ctx = flb_create();
+    ASSERT_TRUE(ctx != NULL);
+
+    memset(r, 0, sizeof(struct up_run));
+    r->config = ctx->config;
+    EXPECT_EQ(flb_test_worker_run(ctx->config, fn, r), 0);
+
+    flb_destroy(ctx);
+}
+
+static void pool_test(void *data)
+{
+    int i;
+    struct srv s;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *c1;
+    struct flb_upstream_conn *c2;
+    struct up_run *r = (struct up_run *) data;
+
+    /* Released connections are reused, closed ones are discarded */
+    if (srv_start(&s, 0) != 0) {
+        return;
+    }
+    u = up_create(r->config, "127.0.0.1", s.port);
+    u->ka_pool_size = 4;
+
+    c1 = flb_upstream_conn_get(u);
+    if (!c1) {
+        flb_upstream_destroy(u);
+        srv_stop(&s);
+        return;
+    }
+    flb_upstream_conn_release(c1);
+    r->reuse_pooled = u->av_connections;
+
+    c2 = flb_upstream_conn_get(u);
+    r->reuse_same = (c2 == c1);
+    flb_upstream_conn_release(c2);
+
+    srv_accepted(&s, 1);
+    srv_close_conns(&s);
+    usleep(100000);
+
+    c1 = flb_upstream_conn_get(u);
+    if (c1) {
+        flb_upstream_conn_release(c1);
+    }
+    r->reuse_created = u->ka_created;
+    r->reuse_reused = u->ka_reused;
+    r->reuse_accepted = srv_accepted(&s, 2);
+    flb_upstream_destroy(u);
+    srv_stop(&s);
+
+    /* A connection is closed after 'ka_max_requests' uses */
+    if (srv_start(&s, 0) != 0) {
+        return;
+    }
+    u = up_create(r->config, "127.0.0.1", s.port);
+    u->ka_pool_size = 4;
+    u->ka_max_requests = 2;
+    for (i = 0; i < 4; i++) {
+        c1 = flb_upstream_conn_get(u);
+        if (c1) {
+            flb_upstream_conn_release(c1);
+        }
+    }
+    r->max_created = u->ka_created;
+    r->max_reused = u->ka_reused;
+    r->max_accepted = srv_accepted(&s, 2);
+    flb_upstream_destroy(u);
+    srv_stop(&s);
+
+    /* Idle connections expire, the pool keeps up to 'ka_pool_size' */
+    if (srv_start(&s, 0) != 0) {
+        return;
+    }
+    u = up_create(r->config, "127.0.0.1", s.port);
+    u->ka_pool_size = 1;
+    u->ka_idle_timeout = 1;
+
+    c1 = flb_upstream_conn_get(u);
+    c2 = flb_upstream_conn_get(u);
+    if (c1) {
+        flb_upstream_conn_release(c1);
+    }
+    if (c2) {
+        flb_upstream_conn_release(c2);
+    }
+    r->pool_av = u->av_connections;
+    r->pool_n = u->n_connections;
+
+    sleep(2);
+    c1 = flb_upstream_conn_get(u);
+    if (c1) {
+        flb_upstream_conn_release(c1);
+    }
+    r->idle_created = u->ka_created;
+    r->idle_reused = u->ka_reused;
+    flb_upstream_destroy(u);
+    srv_stop(&s);
+}
+
+TEST(Upstream, keepalive_pool)
+{
+    struct up_run r;
+
+    up_run(&r, pool_test);
+
+    EXPECT_EQ(r.reuse_pooled, 1);
+    EXPECT_EQ(r.reuse_same, 1);
+    EXPECT_EQ(r.reuse_created, 2);
+    EXPECT_EQ(r.reuse_reused, 1);
+    EXPECT_EQ(r.reuse_accepted, 2);
+
+    EXPECT_EQ(r.max_created, 2);
+    EXPECT_EQ(r.max_reused, 2);
+    EXPECT_EQ(r.max_accepted, 2);
+
+    EXPECT_EQ(r.pool_av, 1);
+    EXPECT_EQ(r.pool_n, 1);
+    EXPECT_EQ(r.idle_created, 3);
+    EXPECT_EQ(r.idle_reused, 0);
+}
+
+/* Index of the group node owning the connection */
+static int up_node(struct flb_upstream *u, struct flb_upstream_conn *c)
+{
+    int i;
+
+    for (i = 0; i < u->n_nodes; i++) {
+        if (c->u == u->nodes[i]) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* A loopback port where nobody listens */
+static int free_port()
+{
+    int fd;
+    int port = 0;
+
+    fd = flb_test_listen(SOCK_STREAM, 0, 1, &port);
+    if (fd != -1) {
+        close(fd);
+    }
+
+    return port;
+}
+
+static void group_test(void *data)
+{
+    int i;
+    int n;
+    int port;
+    char hosts[128];
+    struct srv s1;
+    struct srv s2;
+    struct flb_upstream *u;
+    struct flb_upstream *node;
+    struct flb_upstream_conn *c;
+    struct flb_upstream_conn *held[8];
+    struct up_run *r = (struct up_run *) data;
+
+    /*
+     * The second node refuses connections: after FLB_UPSTREAM_MAX_FAILS
+     * failures it is ejected and the requests go to the first one.
+     */
+    if (srv_start(&s1, 0) != 0) {
+        return;
+    }
+    port = free_port();
+    snprintf(hosts, sizeof(hosts), "127.0.0.1:%i,127.0.0.1:%i",
+             s1.port, port);
+    u = up_create(r->config, hosts, 0);
+    node = u->nodes[1];
+
+    for (i = 0; i < 8; i++) {
+        c = flb_upstream_conn_get(u);
+        if (c) {
+            r->eject_node[up_node(u, c)]++;
+            flb_upstream_conn_release(c);
+        }
+    }
+    r->eject_fails = node->fails;
+    r->eject_ejected = node->ejected_until > time(NULL);
+
+    for (i = 0; i < 8; i++) {
+        c = flb_upstream_conn_get(u);
+        if (c) {
+            flb_upstream_conn_release(c);
+        }
+    }
+    r->eject_held = (node->fails == r->eject_fails);
+
+    /*
+     * The node comes back, end its ejection instead of waiting
+     * FLB_UPSTREAM_EJECT_TIME seconds: the next requests use it again.
+     */
+    if (srv_start(&s2, port) != 0) {
+        flb_upstream_destroy(u);
+        srv_stop(&s1);
+        return;
+    }
+    node->ejected_until = time(NULL);
+    for (n = 1; n <= 4; n++) {
+        c = flb_upstream_conn_get(u);
+        if (!c) {
+            continue;
+        }
+        i = up_node(u, c);
+        flb_upstream_conn_release(c);
+        if (i == 1) {
+            r->eject_recovered = n;
+            break;
+        }
+    }
+    r->eject_healthy = (node->fails == 0 && node->ejected_until == 0);
+    flb_upstream_destroy(u);
+
+    /* Weights 1:3, idle nodes and nodes with requests in progress */
+    snprintf(hosts, sizeof(hosts), "127.0.0.1:%i:1,127.0.0.1:%i:3",
+             s1.port, s2.port);
+    u = up_create(r->config, hosts, 0);
+
+    for (i = 0; i < 400; i++) {
+        c = flb_upstream_conn_get(u);
+        if (c) {
+            r->weight_idle[up_node(u, c)]++;
+            flb_upstream_conn_release(c);
+        }
+    }
+
+    for (i = 0; i < 8; i++) {
+        held[i] = flb_upstream_conn_get(u);
+        if (held[i]) {
+            r->weight_busy[up_node(u, held[i])]++;
+        }
+    }
+    for (i = 0; i < 8; i++) {
+        if (held[i]) {
+            flb_upstream_conn_release(held[i]);
+        }
+    }
+    flb_upstream_destroy(u);
+
+    srv_stop(&s1);
+    srv_stop(&s2);
+}
+
+TEST(Upstream, group_nodes)
+{
+    struct up_run r;
+
+    up_run(&r, group_test);
+
+    EXPECT_EQ(r.eject_node[0], 8);
+    EXPECT_EQ(r.eject_node[1], 0);
+    EXPECT_EQ(r.eject_fails, FLB_UPSTREAM_MAX_FAILS);
+    EXPECT_EQ(r.eject_ejected, 1);
+    EXPECT_EQ(r.eject_held, 1);
+
+    EXPECT_GT(r.eject_recovered, 0);
+    EXPECT_EQ(r.eject_healthy, 1);
+
+    EXPECT_EQ(r.weight_idle[0], 100);
+    EXPECT_EQ(r.weight_idle[1], 300);
+    EXPECT_EQ(r.weight_busy[0], 2);
+    EXPECT_EQ(r.weight_busy[1], 6);
+}